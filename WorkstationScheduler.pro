@@ -53,7 +53,21 @@ SOURCES += \
     descriptiondialog.cpp \
     threadeddb.cpp \
     dbcommand.cpp \
-    wsrecentmenuaction.cpp
+    dbstats.cpp \
+    wsrecentmenuaction.cpp \
+    wstablemodel.cpp \
+    namescache.cpp \
+    utilizationdialog.cpp \
+    heatmapview.cpp \
+    wsdbtransfer.cpp \
+    wscommandline.cpp \
+    wsbatch.cpp \
+    brokerlink.cpp \
+    wssnapshot.cpp \
+    wsviewcache.cpp \
+    diagnosticsdialog.cpp \
+    wssocket.cpp \
+    wswire.cpp
 
 HEADERS += \
     workstationscheduler.h \
@@ -62,13 +76,31 @@ HEADERS += \
     commandqueue.h \
     threadeddb.h \
     dbcommand.h \
-    wsrecentmenuaction.h
+    dbstats.h \
+    wsrecentmenuaction.h \
+    wstablemodel.h \
+    namescache.h \
+    utilizationdialog.h \
+    heatmapview.h \
+    wsdbtransfer.h \
+    wscommandline.h \
+    wsbatch.h \
+    brokerlink.h \
+    wssnapshot.h \
+    wsviewcache.h \
+    diagnosticsdialog.h \
+    wssocket.h \
+    wswire.h
 
 FORMS += \
     workstationscheduler.ui \
-    descriptiondialog.ui
+    descriptiondialog.ui \
+    utilizationdialog.ui \
+    diagnosticsdialog.ui
 
 LIBS += \
     -lsqlite3
 
+win32:LIBS += -lws2_32
+
 win32:RC_ICONS += Icon/icon.ico
@@ -0,0 +1,206 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+// Command queue microbenchmark.  Compares the lock-free CommandQueue against
+// the previous mutex based queue and reports throughput, the time the
+// producer spends in add and the enqueue to dequeue latency as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "commandqueue.h"
+#include "mutexqueue.h"
+
+typedef std::chrono::steady_clock Clock;
+
+class Item {
+public:
+    Item() : queued(Clock::now()) {}
+
+    Clock::time_point queued;
+};
+
+class Options {
+public:
+    Options() :
+        items(1000000),
+        burst(500),
+        idleUs(1000) {}
+
+    int64_t items;
+    int64_t burst;
+    int64_t idleUs;
+    std::string outFile;
+};
+
+class Stats {
+public:
+    void add(double value) {samples.push_back(value);}
+
+    double percentile(double p) {
+        if (samples.empty())
+            return 0;
+
+        if (!sorted) {
+            std::sort(samples.begin(), samples.end());
+            sorted = true;
+        }
+        size_t idx = static_cast<size_t>(p / 100.0 * static_cast<double>(samples.size() - 1) + 0.5);
+
+        return samples[std::min(idx, samples.size() - 1)];
+    }
+
+    std::vector<double> samples;
+    bool sorted = false;
+};
+
+class Result {
+public:
+    double itemsPerSec;
+    Stats addNs;
+    Stats latencyUs;
+};
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --items N          items per run (default 1000000)\n"
+              << "  --burst N          items added back to back before the producer idles (default 500)\n"
+              << "  --idle US          producer idle time between bursts in the burst run (default 1000)\n"
+              << "  --out FILE         write JSON results to FILE instead of stdout\n";
+}
+
+static bool parseArgs(int argc, char *argv[], Options &opt) {
+    for (int count = 1; count + 1 < argc; count += 2) {
+        std::string arg(argv[count]);
+        const char *val = argv[count + 1];
+
+        if (arg == "--items")
+            opt.items = atoll(val);
+        else if (arg == "--burst")
+            opt.burst = atoll(val);
+        else if (arg == "--idle")
+            opt.idleUs = atoll(val);
+        else if (arg == "--out")
+            opt.outFile = val;
+        else
+            return false;
+    }
+
+    return argc % 2 == 1 && opt.items > 0 && opt.burst > 0 && opt.idleUs >= 0;
+}
+
+// The producer adds bursts like a large booking does, the consumer blocks in pop like the worker thread
+template <class Queue>
+static Result run(const Options &opt, int64_t idleUs) {
+    Queue queue;
+    Result result;
+    std::vector<double> latency;
+
+    latency.reserve(static_cast<size_t>(opt.items));
+    result.addNs.samples.reserve(static_cast<size_t>(opt.items));
+
+    std::thread consumer([&]() {
+        Item *item;
+
+        while ((item = queue.pop(true)) != nullptr) {
+            latency.push_back(std::chrono::duration<double, std::micro>(Clock::now() - item->queued).count());
+            delete item;
+        }
+    });
+
+    auto start = Clock::now();
+    for (int64_t count = 0; count < opt.items; count++) {
+        Item *item = new Item();
+
+        queue.add(item);
+        result.addNs.add(std::chrono::duration<double, std::nano>(Clock::now() - item->queued).count());
+
+        if (idleUs > 0 && (count + 1) % opt.burst == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(idleUs));
+    }
+    queue.add(nullptr);
+    consumer.join();
+
+    double sec = std::chrono::duration<double>(Clock::now() - start).count();
+    result.itemsPerSec = static_cast<double>(opt.items) / sec;
+    result.latencyUs.samples.swap(latency);
+
+    return result;
+}
+
+static void writeResult(std::ostream &out, const std::string &name, Result &result, bool last) {
+    out << "    \"" << name << "\": {\"items_per_s\": " << result.itemsPerSec
+        << ", \"add_p50_ns\": " << result.addNs.percentile(50)
+        << ", \"add_p99_ns\": " << result.addNs.percentile(99)
+        << ", \"add_max_ns\": " << result.addNs.percentile(100)
+        << ", \"latency_p50_us\": " << result.latencyUs.percentile(50)
+        << ", \"latency_p99_us\": " << result.latencyUs.percentile(99)
+        << ", \"latency_max_us\": " << result.latencyUs.percentile(100) << "}"
+        << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+
+    if (!parseArgs(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Bursts idle between them so the consumer parks, the stream run never idles
+    int64_t bursts = std::min<int64_t>(opt.items, 200 * opt.burst);
+    Options burstOpt(opt);
+    burstOpt.items = bursts;
+
+    std::map<std::string, Result> results;
+    results["mutex_stream"] = run<MutexQueue<Item> >(opt, 0);
+    results["lockfree_stream"] = run<CommandQueue<Item> >(opt, 0);
+    results["mutex_burst"] = run<MutexQueue<Item> >(burstOpt, opt.idleUs);
+    results["lockfree_burst"] = run<CommandQueue<Item> >(burstOpt, opt.idleUs);
+
+    std::ofstream file;
+    std::ostream &out = opt.outFile.empty() ? std::cout : file;
+    if (!opt.outFile.empty())
+        file.open(opt.outFile);
+
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\n";
+    out << "  \"config\": {\"items\": " << opt.items << ", \"burst\": " << opt.burst << ", \"idle_us\": " << opt.idleUs << "},\n";
+    out << "  \"results\": {\n";
+
+    size_t count = 0;
+    for (auto &item : results)
+        writeResult(out, item.first, item.second, ++count == results.size());
+
+    out << "  }\n";
+    out << "}\n";
+
+    return 0;
+}
@@ -0,0 +1,462 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+// Headless Wsdb benchmark.  Generates a synthetic database and reports
+// per-operation latency percentiles as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "wsdb.h"
+
+static const int64_t slotsPerDay = 48;
+static const int64_t daysPerYear = 365;
+
+class Options {
+public:
+    Options() :
+        dbFile("wsdbbench.db"),
+        stations(50),
+        years(1),
+        occupancy(0.5),
+        seed(1),
+        iterations(200),
+        users(200),
+        engine(Wsdb::EngineSlots),
+        reuse(false),
+        firstSlot(0),
+        freeSlot(0) {}
+
+    std::string dbFile;
+    int64_t stations;
+    int64_t years;
+    double occupancy;
+    uint64_t seed;
+    int64_t iterations;
+    int64_t users;
+    int64_t engine;
+    bool reuse;
+    std::string outFile;
+    std::string baselineFile;
+    int64_t firstSlot; // Start of the booked span, 0 for a generated database
+    int64_t freeSlot; // Past every booking of a reused database
+};
+
+class Stats {
+public:
+    void add(double us) {samples.push_back(us);}
+
+    double percentile(double p) const {
+        if (samples.empty())
+            return 0;
+
+        std::vector<double> sorted(samples);
+        std::sort(sorted.begin(), sorted.end());
+        size_t idx = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+
+        return sorted[std::min(idx, sorted.size() - 1)];
+    }
+
+    double mean() const {
+        double sum = 0;
+
+        for (auto s : samples)
+            sum += s;
+
+        return samples.empty() ? 0 : sum / static_cast<double>(samples.size());
+    }
+
+    std::vector<double> samples;
+};
+
+class CountCallback : public WsdbCallback {
+public:
+    CountCallback() : rows(0) {}
+
+    virtual void callback(int64_t, int64_t, const char *, int64_t) {rows++;}
+
+    int64_t rows;
+};
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --db FILE          database file (default wsdbbench.db)\n"
+              << "  --stations N       number of stations (default 50)\n"
+              << "  --years Y          years of bookings (default 1)\n"
+              << "  --occupancy P      fraction of slots booked, 0 to 1 (default 0.5)\n"
+              << "  --seed S           random seed (default 1)\n"
+              << "  --iterations N     samples per operation (default 200)\n"
+              << "  --users N          distinct user names (default 200)\n"
+              << "  --engine E         storage engine for a generated database, slots or intervals (default slots)\n"
+              << "  --reuse            use an existing database instead of generating one, its stations,\n"
+              << "                     span of years and engine replace the options above\n"
+              << "  --out FILE         write JSON results to FILE instead of stdout\n"
+              << "  --baseline FILE    compare against JSON results saved earlier\n";
+}
+
+static bool parseArgs(int argc, char *argv[], Options &opt) {
+    for (int count = 1; count < argc; count++) {
+        std::string arg(argv[count]);
+        const char *val = count + 1 < argc ? argv[count + 1] : nullptr;
+
+        if (arg == "--reuse") {
+            opt.reuse = true;
+            continue;
+        }
+
+        if (val == nullptr)
+            return false;
+        count++;
+
+        if (arg == "--db")
+            opt.dbFile = val;
+        else if (arg == "--stations")
+            opt.stations = atoll(val);
+        else if (arg == "--years")
+            opt.years = atoll(val);
+        else if (arg == "--occupancy")
+            opt.occupancy = atof(val);
+        else if (arg == "--seed")
+            opt.seed = strtoull(val, nullptr, 10);
+        else if (arg == "--iterations")
+            opt.iterations = atoll(val);
+        else if (arg == "--users")
+            opt.users = atoll(val);
+        else if (arg == "--engine" && strcmp(val, "slots") == 0)
+            opt.engine = Wsdb::EngineSlots;
+        else if (arg == "--engine" && strcmp(val, "intervals") == 0)
+            opt.engine = Wsdb::EngineIntervals;
+        else if (arg == "--out")
+            opt.outFile = val;
+        else if (arg == "--baseline")
+            opt.baselineFile = val;
+        else
+            return false;
+    }
+
+    return opt.stations > 0 && opt.years > 0 && opt.iterations > 0 && opt.users > 0 &&
+           opt.occupancy >= 0 && opt.occupancy <= 1;
+}
+
+static std::string userName(int64_t user) {
+    std::stringstream str;
+
+    str << "user" << user;
+
+    return str.str();
+}
+
+static int64_t totalSlots(const Options &opt) {
+    return opt.years * daysPerYear * slotsPerDay;
+}
+
+// Books contiguous blocks of 1 to 16 slots with gaps sized to hit the occupancy
+static void generate(Wsdb &wsdb, const Options &opt) {
+    std::mt19937_64 rng(opt.seed);
+    std::uniform_int_distribution<int64_t> blockLen(1, 16);
+    std::uniform_int_distribution<int64_t> user(0, opt.users - 1);
+    std::uniform_int_distribution<int64_t> color(0, 0xFFFFFF);
+    double meanBlock = 8.5;
+    double meanGap = opt.occupancy > 0 ? meanBlock * (1 - opt.occupancy) / opt.occupancy : 0;
+    std::exponential_distribution<double> gap(meanGap > 0 ? 1 / meanGap : 1);
+    int64_t slots = totalSlots(opt);
+    int64_t rows = 0;
+
+    std::vector<Wsdb::StationInfo> info;
+    for (int64_t station = 0; station < opt.stations; station++)
+        info.push_back(Wsdb::StationInfo(Wsdb::defaultWorkstationName(station), "", 0));
+
+    wsdb.begin();
+    wsdb.setStationInfo(info);
+
+    for (int64_t station = 0; station < opt.stations; station++) {
+        if (opt.occupancy <= 0)
+            break;
+
+        int64_t slot = static_cast<int64_t>(gap(rng));
+        while (slot < slots) {
+            int64_t len = blockLen(rng);
+            std::string name = userName(user(rng));
+            int64_t attr = color(rng) << 24;
+
+            len = std::min(len, slots - slot);
+            wsdb.insertNames(slot, slot + len - 1, station, name.c_str(), attr);
+            slot += len;
+
+            if (rows / 200000 != (rows + len) / 200000) {
+                wsdb.commit();
+                wsdb.begin();
+            }
+            rows += len;
+
+            if (meanGap > 0)
+                slot += static_cast<int64_t>(gap(rng) + 0.5);
+        }
+    }
+
+    wsdb.commit();
+}
+
+// Takes the configuration of a reused database from the file instead of the command line
+static void readConfig(Wsdb &wsdb, Options &opt) {
+    opt.stations = wsdb.getNumStations();
+    if (opt.stations <= 0)
+        throw std::runtime_error("The database has no stations");
+
+    opt.engine = wsdb.getStorageEngine();
+
+    int64_t first, last;
+    if (!wsdb.getSlotRange(&first, &last))
+        return;
+
+    // last may be a few slots past the newest booking, so the span is rounded to whole years
+    int64_t slotsPerYear = daysPerYear * slotsPerDay;
+    opt.firstSlot = first / slotsPerDay * slotsPerDay;
+    opt.freeSlot = (last / slotsPerDay + 1) * slotsPerDay;
+    opt.years = std::max<int64_t>(1, (opt.freeSlot - opt.firstSlot + slotsPerYear / 2) / slotsPerYear);
+}
+
+static double elapsedUs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void timeOp(std::map<std::string, Stats> &results, const std::string &name, int64_t iterations, std::function<void(int64_t)> op) {
+    Stats &stats = results[name];
+
+    for (int64_t count = 0; count < iterations; count++) {
+        auto start = std::chrono::steady_clock::now();
+        op(count);
+        stats.add(elapsedUs(start));
+    }
+}
+
+static void runBenchmarks(Wsdb &wsdb, const Options &opt, std::map<std::string, Stats> &results) {
+    std::mt19937_64 rng(opt.seed + 1);
+    int64_t days = opt.years * daysPerYear;
+    std::uniform_int_distribution<int64_t> day(0, days - 1);
+    std::uniform_int_distribution<int64_t> station(0, opt.stations - 1);
+    std::vector<int64_t> inserted;
+
+    // Writes go past the booked range so they never collide with existing bookings
+    int64_t freeBase = std::max(opt.firstSlot + totalSlots(opt), opt.freeSlot);
+
+    timeOp(results, "insertName", opt.iterations, [&](int64_t count) {
+        inserted.push_back(station(rng));
+        wsdb.insertName(freeBase + count, inserted.back(), "benchmark", 0);
+    });
+
+    timeOp(results, "removeNames", opt.iterations, [&](int64_t count) {
+        wsdb.removeNames(freeBase + count, freeBase + count, inserted[static_cast<size_t>(count)]);
+    });
+
+    timeOp(results, "selectNamesDaily", opt.iterations, [&](int64_t) {
+        CountCallback cb;
+        int64_t start = opt.firstSlot + day(rng) * slotsPerDay;
+        wsdb.selectNames(start, start + slotsPerDay - 1, 0, 0x7FFFFFFF, cb);
+    });
+
+    timeOp(results, "selectNamesWeekly", opt.iterations, [&](int64_t) {
+        CountCallback cb;
+        int64_t start = opt.firstSlot + std::max<int64_t>(0, day(rng) - 6) * slotsPerDay;
+        int64_t st = station(rng);
+        wsdb.selectNames(start, start + slotsPerDay * 7 - 1, st, st, cb);
+    });
+
+    std::vector<int64_t> counts;
+    timeOp(results, "getSlotCountsDaily", opt.iterations, [&](int64_t) {
+        int64_t start = opt.firstSlot + day(rng) * slotsPerDay;
+        wsdb.getSlotCounts(start, start + slotsPerDay - 1, &counts);
+    });
+
+    std::vector<Wsdb::StationInfo> info;
+    timeOp(results, "getStationInfo", opt.iterations, [&](int64_t) {
+        wsdb.getStationInfo(&info);
+    });
+
+    timeOp(results, "setStationInfo", opt.iterations, [&](int64_t) {
+        wsdb.setStationInfo(info);
+    });
+}
+
+// Reads the per-operation numbers back from JSON written by writeJson
+static std::map<std::string, std::map<std::string, double> > readBaseline(const std::string &filename) {
+    std::map<std::string, std::map<std::string, double> > baseline;
+    std::ifstream in(filename);
+
+    if (!in)
+        throw std::runtime_error("Could not open baseline " + filename);
+
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string text = buf.str();
+
+    size_t pos = text.find("\"results\"");
+    if (pos == std::string::npos)
+        throw std::runtime_error("No results in baseline " + filename);
+
+    std::string op;
+    int depth = 0;
+    for (pos = text.find('{', pos); pos < text.size(); pos++) {
+        char c = text[pos];
+
+        if (c == '{') {
+            depth++;
+        } else if (c == '}') {
+            if (--depth == 0)
+                break;
+        } else if (c == '"') {
+            size_t end = text.find('"', pos + 1);
+            if (end == std::string::npos)
+                break;
+            std::string key = text.substr(pos + 1, end - pos - 1);
+            pos = end;
+
+            if (depth == 1) {
+                op = key;
+            } else if (depth == 2) {
+                size_t colon = text.find(':', pos);
+                if (colon == std::string::npos)
+                    break;
+                baseline[op][key] = strtod(text.c_str() + colon + 1, nullptr);
+                pos = colon;
+            }
+        }
+    }
+
+    return baseline;
+}
+
+static void writeJson(std::ostream &out, const Options &opt, const std::map<std::string, Stats> &results, double generateSec,
+                      const std::map<std::string, std::map<std::string, double> > *baseline) {
+    out.setf(std::ios::fixed);
+    out.precision(3);
+
+    out << "{\n";
+    out << "  \"config\": {\"stations\": " << opt.stations << ", \"years\": " << opt.years
+        << ", \"occupancy\": " << opt.occupancy << ", \"seed\": " << opt.seed
+        << ", \"iterations\": " << opt.iterations << ", \"users\": " << opt.users
+        << ", \"engine\": " << opt.engine << ", \"reuse\": " << (opt.reuse ? "true" : "false")
+        << ", \"first_slot\": " << opt.firstSlot
+        << ", \"generate_s\": " << generateSec << "},\n";
+
+    out << "  \"results\": {";
+    bool first = true;
+    for (auto &item : results) {
+        const Stats &stats = item.second;
+
+        out << (first ? "\n" : ",\n");
+        out << "    \"" << item.first << "\": {\"count\": " << stats.samples.size()
+            << ", \"mean_us\": " << stats.mean()
+            << ", \"p50_us\": " << stats.percentile(50)
+            << ", \"p90_us\": " << stats.percentile(90)
+            << ", \"p99_us\": " << stats.percentile(99)
+            << ", \"max_us\": " << stats.percentile(100) << "}";
+        first = false;
+    }
+    out << "\n  }";
+
+    if (baseline) {
+        // Ratios above 1 are slower than the baseline
+        out << ",\n  \"baseline\": {";
+        first = true;
+        for (auto &item : results) {
+            auto base = baseline->find(item.first);
+            if (base == baseline->end())
+                continue;
+
+            out << (first ? "\n" : ",\n");
+            out << "    \"" << item.first << "\": {";
+            const char *keys[] = {"p50_us", "p90_us", "p99_us"};
+            const double pct[] = {50, 90, 99};
+            for (int count = 0; count < 3; count++) {
+                auto val = base->second.find(keys[count]);
+                double ratio = val == base->second.end() || val->second <= 0 ? 0 : item.second.percentile(pct[count]) / val->second;
+                out << (count ? ", " : "") << "\"" << std::string(keys[count], 3) << "_ratio\": " << ratio;
+            }
+            out << "}";
+            first = false;
+        }
+        out << "\n  }";
+    }
+
+    out << "\n}\n";
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+
+    if (!parseArgs(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    try {
+        std::map<std::string, std::map<std::string, double> > baseline;
+        if (!opt.baselineFile.empty())
+            baseline = readBaseline(opt.baselineFile);
+
+        if (!opt.reuse)
+            ::remove(opt.dbFile.c_str());
+
+        Wsdb wsdb;
+        wsdb.open(opt.dbFile.c_str());
+
+        double generateSec = 0;
+        if (opt.reuse) {
+            readConfig(wsdb, opt);
+        } else {
+            wsdb.convertStorage(opt.engine);
+
+            auto start = std::chrono::steady_clock::now();
+            generate(wsdb, opt);
+            generateSec = elapsedUs(start) / 1e6;
+        }
+
+        std::map<std::string, Stats> results;
+        runBenchmarks(wsdb, opt, results);
+
+        const std::map<std::string, std::map<std::string, double> > *base = opt.baselineFile.empty() ? nullptr : &baseline;
+        if (opt.outFile.empty()) {
+            writeJson(std::cout, opt, results, generateSec, base);
+        } else {
+            std::ofstream out(opt.outFile);
+            writeJson(out, opt, results, generateSec, base);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "wsdbbench: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,553 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+// Serves one database file to WorkstationScheduler clients on this machine, see BrokerLink.
+//
+// The broker owns the only connection to the file. A thread per client reads its commands into
+// one inbox, the main thread takes everything waiting as a round: the writes of all clients
+// commit in one transaction, then the other commands run in the order they arrived. Changes,
+// by the broker or anyone else using the file directly, are pushed to every client before the
+// replies of the round go out. While idle the broker does the upkeep clients do for local files.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "dbcommand.h"
+#include "namescache.h"
+#include "threadeddb.h"
+#include "wsdb.h"
+#include "wssnapshot.h"
+#include "wssocket.h"
+#include "wswire.h"
+
+// Refresh stamps are kept per id, so a session cannot make the broker keep more than this many
+static const int64_t maxRefreshId = 1024;
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+    stopRequested = 1;
+}
+
+static int64_t steadyMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class BrokerChanges : public WsdbChangeCallback {
+public:
+    BrokerChanges() : lastSeq(-1) {}
+
+    virtual void change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr);
+
+    std::vector<int64_t> fields; // seq, slotStart, slotStop and station of each change
+    int64_t lastSeq;
+};
+
+void BrokerChanges::change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *, int64_t) {
+    fields.insert(fields.end(), {seq, slotStart, slotStop, station});
+    lastSeq = std::max(lastSeq, seq);
+}
+
+class WsBroker {
+public:
+    WsBroker(const std::string &filename, const std::string &host, int port);
+
+    void run(); // Until a stop is requested
+
+private:
+    // Last query run for a refresh id of a client
+    class RefreshStamp {
+    public:
+        RefreshStamp() : version(-1) {}
+
+        int64_t version;
+        std::string key;
+    };
+
+    class Session {
+    public:
+        Session(std::unique_ptr<WsSocket> socket, int64_t id) : socket(std::move(socket)), id(id) {}
+
+        void send(const std::string &payload); // Drops the connection on errors
+
+        std::unique_ptr<WsSocket> socket;
+        int64_t id;
+        std::mutex sendMutex;
+        std::vector<RefreshStamp> stamps; // Main thread only
+    };
+
+    class Frame {
+    public:
+        Frame(std::shared_ptr<Session> session, std::string payload) :
+            session(session), payload(payload) {}
+
+        std::shared_ptr<Session> session;
+        std::string payload;
+    };
+
+    class Request {
+    public:
+        Request(const Frame &frame) :
+            session(frame.session), payload(frame.payload), id(-1), refreshId(0), tag(0) {}
+
+        std::shared_ptr<Session> session;
+        std::string payload;
+        int64_t id;
+        size_t refreshId;
+        int64_t tag;
+        std::unique_ptr<DbCommand> cmd; // nullptr for open and close
+        std::unique_ptr<DbCallback> result;
+    };
+
+    void runAccept();
+    void runSession(std::shared_ptr<Session> session);
+    void runRound(std::vector<Frame> &frames);
+    void runWrites(std::vector<Request *> batch);
+    void runCommand(Request &req);
+    void decodeCommand(Request &req);
+    void fail(Request &req, const std::string &errorMsg, bool isCause);
+    void pushChanges();
+    int64_t runMaintenance(); // Returns the ms to wait before the next step
+    static DbCallback *takeCallback(CommandQueue<DbCallback> &cbQueue);
+
+private:
+    std::string filename;
+    Wsdb wsdb;
+    NamesCache namesCache;   // Main thread, shared by all clients, see DbSelectNamesCommand::encode
+    std::unique_ptr<WsSocket> listener;
+    std::mutex inboxMutex;   // Guards the members below
+    std::condition_variable inboxReady;
+    std::vector<Frame> inbox;
+    std::vector<std::shared_ptr<Session> > sessions;
+    int64_t nextSession;
+    int64_t pushedSeq;       // Changes up to this one were pushed
+    int64_t lastCommand;     // steady_clock ms of the last round
+    int64_t maintenanceOwner;
+    bool isMaintaining;      // The lease is held, a round of upkeep is under way
+    WsSnapshotPublisher snapshot;
+};
+
+void WsBroker::Session::send(const std::string &payload) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+
+    try {
+        socket->sendFrame(payload);
+    } catch (std::exception &) {
+        // Its session thread ends and removes it
+        socket->shutdown();
+    }
+}
+
+WsBroker::WsBroker(const std::string &filename, const std::string &host, int port) :
+    filename(filename), namesCache(256), nextSession(1), pushedSeq(-1), lastCommand(steadyMs()), isMaintaining(false) {
+    std::random_device seed;
+    maintenanceOwner = (static_cast<int64_t>(seed()) << 31) ^ static_cast<int64_t>(seed()) ^ static_cast<int64_t>(time(nullptr));
+
+    wsdb.open(filename.c_str());
+    pushedSeq = wsdb.getLastChange();
+    listener = WsSocket::listenOn(host, port);
+}
+
+void WsBroker::run() {
+    std::thread(&WsBroker::runAccept, this).detach();
+
+    int64_t delay = ThreadedDb::maintenanceIdle;
+    while (!stopRequested) {
+        std::vector<Frame> frames;
+        {
+            std::unique_lock<std::mutex> lock(inboxMutex);
+
+            // Woken at least every second for a stop and changes made outside the broker
+            inboxReady.wait_for(lock, std::chrono::milliseconds(std::min<int64_t>(delay, 1000)), [this] {return !inbox.empty();});
+            frames.swap(inbox);
+        }
+
+        if (frames.empty()) {
+            pushChanges();
+            delay = runMaintenance();
+            continue;
+        }
+
+        lastCommand = steadyMs();
+        delay = ThreadedDb::maintenanceIdle;
+        runRound(frames);
+    }
+
+    listener->shutdown();
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+
+        for (auto &session : sessions)
+            session->socket->shutdown();
+    }
+
+    if (isMaintaining)
+        wsdb.endMaintenance(maintenanceOwner, time(nullptr));
+    wsdb.close();
+}
+
+void WsBroker::runAccept() {
+    std::unique_ptr<WsSocket> socket;
+
+    while ((socket = listener->accept())) {
+        std::shared_ptr<Session> session;
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+
+            session = std::make_shared<Session>(std::move(socket), nextSession++);
+        }
+
+        std::thread(&WsBroker::runSession, this, session).detach();
+    }
+}
+
+void WsBroker::runSession(std::shared_ptr<Session> session) {
+    std::string payload;
+
+    try {
+        if (!session->socket->recvFrame(&payload))
+            throw std::runtime_error("closed before saying hello");
+
+        WireReader in(payload);
+        if (in.getInt() != WsWire::MsgHello)
+            throw std::runtime_error("did not say hello");
+        int64_t version = in.getInt();
+
+        // The client checks the version, so it can tell its user
+        WireWriter hello;
+        hello.putInt(WsWire::MsgHello);
+        hello.putInt(WsWire::version);
+        hello.putString(filename);
+        session->send(hello.data());
+        if (version != WsWire::version)
+            throw std::runtime_error("runs version " + std::to_string(version));
+
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+
+            sessions.push_back(session);
+            std::cerr << "Client " << session->id << " connected, " << sessions.size() << " in all" << std::endl;
+        }
+
+        while (session->socket->recvFrame(&payload)) {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+
+            inbox.push_back(Frame(session, payload));
+            inboxReady.notify_one();
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Client " << session->id << ": " << e.what() << std::endl;
+    }
+
+    session->socket->shutdown();
+
+    // Frames still in the inbox run, their replies go nowhere
+    std::lock_guard<std::mutex> lock(inboxMutex);
+
+    auto found = std::find(sessions.begin(), sessions.end(), session);
+    if (found != sessions.end()) {
+        sessions.erase(found);
+        std::cerr << "Client " << session->id << " disconnected, " << sessions.size() << " left" << std::endl;
+    }
+}
+
+void WsBroker::runRound(std::vector<Frame> &frames) {
+    std::vector<std::unique_ptr<Request> > requests;
+    std::vector<Request *> writes;
+
+    for (auto &frame : frames) {
+        std::unique_ptr<Request> req(new Request(frame));
+
+        try {
+            decodeCommand(*req);
+        } catch (std::exception &e) {
+            // Without a request id there is no one to answer, the client is broken
+            if (req->id < 0) {
+                std::cerr << "Client " << req->session->id << ": " << e.what() << std::endl;
+                req->session->socket->shutdown();
+                continue;
+            }
+
+            DbErrorCallback *cb = new DbErrorCallback();
+            cb->prepare(e.what());
+            req->result.reset(cb);
+        }
+
+        if (req->cmd && req->cmd->isWrite())
+            writes.push_back(req.get());
+        requests.push_back(std::move(req));
+    }
+
+    runWrites(writes);
+
+    // Picks up changes made outside the broker before any cached names are trusted
+    namesCache.sync(wsdb, wsdb.getGeneration());
+    for (auto &req : requests) {
+        if (!req->result)
+            runCommand(*req);
+    }
+
+    // Caches are current before a client sees its own write done
+    pushChanges();
+
+    for (auto &req : requests) {
+        WireWriter out;
+
+        out.putInt(WsWire::MsgReply);
+        out.putInt(req->id);
+        req->result->encode(out);
+        req->session->send(out.data());
+    }
+}
+
+void WsBroker::runWrites(std::vector<Request *> batch) {
+    while (!batch.empty()) {
+        CommandQueue<DbCallback> pending;
+        size_t failed = 0;
+
+        try {
+            wsdb.begin();
+            for (size_t count = 0; count < batch.size(); count++) {
+                failed = count;
+                batch[count]->cmd->execute(wsdb, pending);
+                batch[count]->result.reset(takeCallback(pending));
+            }
+
+            failed = batch.size();
+            wsdb.pruneChanges();
+            wsdb.commit();
+        } catch (std::exception &e) {
+            wsdb.rollback();
+
+            for (auto req : batch)
+                req->result.reset();
+
+            // Nothing to blame but the file, every write of the round is lost
+            if (failed == batch.size()) {
+                for (size_t count = 0; count < batch.size(); count++)
+                    fail(*batch[count], e.what(), count == 0);
+                return;
+            }
+
+            // One client's bad write must not fail the others, they run again without it
+            fail(*batch[failed], e.what(), true);
+            batch.erase(batch.begin() + static_cast<std::ptrdiff_t>(failed));
+            for (auto req : batch)
+                decodeCommand(*req);
+            continue;
+        }
+
+        namesCache.sync(wsdb, wsdb.getGeneration());
+        return;
+    }
+}
+
+void WsBroker::runCommand(Request &req) {
+    CommandQueue<DbCallback> cbQueue;
+
+    // Open and close leave the file alone, there is only the one
+    if (!req.cmd) {
+        if (req.tag == WsWire::CmdOpen) {
+            DbOpenCallback *cb = new DbOpenCallback();
+            cb->prepare(wsdb.getActiveProfile());
+            req.result.reset(cb);
+        } else {
+            req.result.reset(new DbCallback());
+        }
+        return;
+    }
+
+    std::string key = req.refreshId == 0 ? std::string() : req.cmd->queryKey();
+    int64_t version = key.empty() ? -1 : wsdb.getChangeVersion();
+    std::vector<RefreshStamp> &stamps = req.session->stamps;
+
+    if (stamps.size() < req.refreshId)
+        stamps.resize(req.refreshId);
+
+    try {
+        // A no-op refresh costs only the version check, as with ThreadedDb
+        if (version >= 0 && stamps[req.refreshId - 1].version == version && stamps[req.refreshId - 1].key == key) {
+            req.cmd->unchanged(cbQueue);
+            req.result.reset(takeCallback(cbQueue));
+            return;
+        }
+
+        req.cmd->execute(wsdb, cbQueue);
+        req.result.reset(takeCallback(cbQueue));
+    } catch (std::exception &e) {
+        fail(req, e.what(), true);
+        return;
+    }
+
+    if (version >= 0) {
+        stamps[req.refreshId - 1].version = version;
+        stamps[req.refreshId - 1].key = key;
+    }
+}
+
+void WsBroker::decodeCommand(Request &req) {
+    WireReader in(req.payload);
+
+    if (in.getInt() != WsWire::MsgCommand)
+        throw std::runtime_error("Expected a command");
+
+    int64_t id = in.getInt();
+    int64_t refreshId = in.getInt();
+    if (id < 0 || refreshId < 0 || refreshId > maxRefreshId)
+        throw std::runtime_error("Bad request id");
+
+    req.id = id;
+    req.refreshId = static_cast<size_t>(refreshId);
+    req.tag = in.getInt();
+    req.cmd.reset(DbCommand::decode(req.tag, in, &namesCache));
+}
+
+void WsBroker::fail(Request &req, const std::string &errorMsg, bool isCause) {
+    CommandQueue<DbCallback> cbQueue;
+
+    req.cmd->fail(errorMsg, isCause, cbQueue);
+    req.result.reset(takeCallback(cbQueue));
+}
+
+void WsBroker::pushChanges() {
+    int64_t last = wsdb.getLastChange();
+    if (last == pushedSeq)
+        return;
+
+    BrokerChanges changes;
+    bool complete = pushedSeq >= 0 && wsdb.selectChanges(pushedSeq, changes);
+
+    WireWriter out;
+    out.putInt(WsWire::MsgChanges);
+    out.putBool(complete);
+    out.putInt(static_cast<int64_t>(changes.fields.size() / 4));
+    for (auto field : changes.fields)
+        out.putInt(field);
+
+    pushedSeq = std::max(last, changes.lastSeq);
+
+    std::vector<std::shared_ptr<Session> > clients;
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+
+        clients = sessions;
+    }
+
+    for (auto &session : clients)
+        session->send(out.data());
+}
+
+int64_t WsBroker::runMaintenance() {
+    int64_t idle = steadyMs() - lastCommand;
+    if (idle < ThreadedDb::maintenanceIdle)
+        return ThreadedDb::maintenanceIdle - idle;
+
+    snapshot.update(wsdb);
+
+    if (!isMaintaining) {
+        if (!wsdb.beginMaintenance(maintenanceOwner, time(nullptr), ThreadedDb::maintenanceInterval, ThreadedDb::maintenanceLease))
+            return ThreadedDb::maintenanceIdle;
+        isMaintaining = true;
+    }
+
+    // Steps stay within the budget, a command waits at most that long
+    if (wsdb.maintenanceStep(ThreadedDb::maintenanceBudget))
+        return 0;
+
+    wsdb.endMaintenance(maintenanceOwner, time(nullptr));
+    isMaintaining = false;
+
+    return ThreadedDb::maintenanceIdle;
+}
+
+DbCallback *WsBroker::takeCallback(CommandQueue<DbCallback> &cbQueue) {
+    DbCallback *cb = cbQueue.pop(false);
+    DbCallback *extra;
+
+    // Commands deliver exactly one, anything else would leave the client waiting or confused
+    while ((extra = cbQueue.pop(false)))
+        delete extra;
+
+    return cb ? cb : new DbCallback();
+}
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [--listen [HOST:]PORT] FILE\n"
+                 "Serves the database FILE to clients set to use a broker, on "
+                 "127.0.0.1:" << WsWire::defaultPort << " unless given\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::string address;
+    std::string filename;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::string word = argv[arg];
+
+        if (word == "--listen" && arg + 1 < argc) {
+            address = argv[++arg];
+        } else if (word.empty() || word[0] == '-' || !filename.empty()) {
+            usage(argv[0]);
+            return 2;
+        } else {
+            filename = word;
+        }
+    }
+
+    if (filename.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    try {
+        std::string host;
+        int port;
+        WsSocket::parseAddress(address, &host, &port);
+
+        if (!std::ifstream(filename.c_str()))
+            throw std::runtime_error(filename + " does not exist");
+
+        // Session threads are detached and may outlive run, the broker is never destroyed
+        WsBroker *broker = new WsBroker(filename, host, port);
+        std::cerr << "Serving " << filename << " on " << host << ":" << port << std::endl;
+        broker->run();
+    } catch (std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+##############################################################################
+# Copyright 2020 Paul Maurer
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+##############################################################################
+
+
+# Broker that owns a database file and serves it to clients on this machine
+
+TEMPLATE = app
+TARGET = wsbroker
+
+CONFIG += console c++11 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    wsbroker.cpp \
+    ../brokerlink.cpp \
+    ../dbcommand.cpp \
+    ../dbstats.cpp \
+    ../namescache.cpp \
+    ../threadeddb.cpp \
+    ../wsdb.cpp \
+    ../wsdbtransfer.cpp \
+    ../wssnapshot.cpp \
+    ../wssocket.cpp \
+    ../wswire.cpp
+
+HEADERS += \
+    ../brokerlink.h \
+    ../commandqueue.h \
+    ../dbcommand.h \
+    ../dbstats.h \
+    ../namescache.h \
+    ../threadeddb.h \
+    ../wsdb.h \
+    ../wsdbtransfer.h \
+    ../wssnapshot.h \
+    ../wssocket.h \
+    ../wswire.h
+
+LIBS += \
+    -lsqlite3
+
+win32:LIBS += -lws2_32
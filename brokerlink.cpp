@@ -0,0 +1,308 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include "brokerlink.h"
+
+const size_t BrokerLink::maxInFlight = 4; // Enough to hide the round trip, few enough that refreshes still coalesce
+const int64_t BrokerLink::reconnectDelay = 2000;
+
+static int64_t steadyMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BrokerLink::BrokerLink(const std::string &address, NamesCache *namesCache, std::function<void()> wake) :
+    port(0), namesCache(namesCache), wake(wake), nextRequest(0), lastAttempt(INT64_MIN / 2), changesPushed(false), isClosing(false) {
+    try {
+        WsSocket::parseAddress(address, &host, &port);
+    } catch (std::exception &e) {
+        addressError = e.what();
+    }
+
+    sender = std::thread([this] {runSender();});
+}
+
+BrokerLink::~BrokerLink() {
+    // Writes are interactive and still go out first, refreshes left behind are dropped
+    cmdQueue.add(nullptr, 0, PriorityInteractive);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        isClosing = true;
+    }
+    windowOpen.notify_all();
+    sender.join();
+
+    std::shared_ptr<WsSocket> conn;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        conn = socket;
+    }
+    if (conn)
+        conn->shutdown();
+    if (receiver.joinable())
+        receiver.join();
+}
+
+int BrokerLink::queueCommand(DbCommand *cmd, size_t refreshId, QueuePriority priority) {
+    if (refreshId != 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (serials.size() < refreshId)
+            serials.resize(refreshId, 0);
+        serials[refreshId - 1]++;
+    }
+
+    return cmdQueue.add(cmd, refreshId, priority);
+}
+
+DbCallback *BrokerLink::popCallback() {
+    DbCallback *cb = cbQueue.pop(false);
+
+    return cb ? cb : failQueue.pop(false);
+}
+
+bool BrokerLink::takeChanges() {
+    return changesPushed.exchange(false);
+}
+
+size_t BrokerLink::getQueueDepth(QueuePriority priority) {
+    return cmdQueue.getDepth(priority);
+}
+
+void BrokerLink::runSender() {
+    DbCommand *cmd;
+    size_t refreshId;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            windowOpen.wait(lock, [this] {return pending.size() < maxInFlight || isClosing;});
+        }
+
+        if ((cmd = cmdQueue.pop(true, &refreshId)) == nullptr)
+            break;
+        cmd->getTiming().started = DbTiming::now();
+
+        WireWriter out;
+        int64_t request = ++nextRequest;
+        std::string error;
+
+        out.putInt(WsWire::MsgCommand);
+        out.putInt(request);
+        out.putInt(static_cast<int64_t>(refreshId));
+
+        std::shared_ptr<WsSocket> conn;
+        if (!cmd->encode(out))
+            error = "This command does not run on a broker";
+        else
+            conn = connection(&error);
+
+        if (conn) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                // Registered under the lock the receiver fails leftovers with, so none is missed
+                if (socket == conn)
+                    pending.insert(std::make_pair(request, Pending(cmd, refreshId, refreshId == 0 ? 0 : serials[refreshId - 1])));
+                else
+                    conn.reset();
+            }
+
+            if (conn) {
+                try {
+                    conn->sendFrame(out.data());
+                } catch (std::exception &) {
+                    // The receiver notices too and fails the command with the others
+                    conn->shutdown();
+                }
+                continue;
+            }
+            error = "Lost the connection to the broker";
+        }
+
+        CommandQueue<DbCallback> failed;
+        cmd->fail(error, true, failed);
+        cmd->finish(failed, failQueue);
+        delete cmd;
+        wake();
+    }
+}
+
+std::shared_ptr<WsSocket> BrokerLink::connection(std::string *error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (socket)
+            return socket;
+    }
+
+    if (!addressError.empty()) {
+        *error = addressError;
+        return nullptr;
+    }
+
+    // A broker that is down is not asked again for every command
+    int64_t now = steadyMs();
+    if (now - lastAttempt < reconnectDelay) {
+        *error = lastError;
+        return nullptr;
+    }
+    lastAttempt = now;
+
+    // The receiver of the lost connection has failed its commands by the time it ends
+    if (receiver.joinable())
+        receiver.join();
+
+    try {
+        std::shared_ptr<WsSocket> conn(WsSocket::connectTo(host, port));
+
+        WireWriter hello;
+        hello.putInt(WsWire::MsgHello);
+        hello.putInt(WsWire::version);
+        conn->sendFrame(hello.data());
+
+        std::string payload;
+        if (!conn->recvFrame(&payload))
+            throw std::runtime_error("Broker closed the connection");
+
+        WireReader in(payload);
+        if (in.getInt() != WsWire::MsgHello || in.getInt() != WsWire::version)
+            throw std::runtime_error("Broker runs another version");
+
+        // Whatever changed while we were not connected was never pushed
+        namesCache->apply(std::vector<DbSelectChangesCallback::Change>(), false);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        socket = conn;
+        receiver = std::thread([this, conn] {runReceiver(conn);});
+
+        return conn;
+    } catch (std::exception &e) {
+        lastError = "Could not reach the broker at " + host + ":" + std::to_string(port) + ":\n\n" + e.what();
+        *error = lastError;
+
+        return nullptr;
+    }
+}
+
+void BrokerLink::runReceiver(std::shared_ptr<WsSocket> conn) {
+    std::string payload;
+    std::string error = "The broker closed the connection";
+
+    try {
+        while (conn->recvFrame(&payload)) {
+            WireReader in(payload);
+            int64_t type = in.getInt();
+
+            if (type == WsWire::MsgReply)
+                receiveReply(in);
+            else if (type == WsWire::MsgChanges)
+                receiveChanges(in);
+            else
+                throw std::runtime_error("Unexpected broker message");
+        }
+    } catch (std::exception &e) {
+        error = std::string("Lost the connection to the broker:\n\n") + e.what();
+    }
+
+    conn->shutdown();
+
+    std::map<int64_t, Pending> lost;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        socket.reset();
+        lost.swap(pending);
+    }
+    windowOpen.notify_all();
+
+    for (auto &entry : lost) {
+        entry.second.cmd->fail(error, true, results);
+        entry.second.cmd->finish(results, cbQueue);
+        delete entry.second.cmd;
+    }
+
+    namesCache->apply(std::vector<DbSelectChangesCallback::Change>(), false);
+    wake();
+}
+
+void BrokerLink::receiveReply(WireReader &in) {
+    int64_t request = in.getInt();
+    bool isCurrent;
+    DbCommand *cmd;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = pending.find(request);
+        if (entry == pending.end())
+            throw std::runtime_error("Reply to an unknown request");
+
+        cmd = entry->second.cmd;
+        isCurrent = entry->second.refreshId == 0 || serials[entry->second.refreshId - 1] == entry->second.serial;
+        pending.erase(entry);
+    }
+    windowOpen.notify_one();
+
+    std::unique_ptr<DbCommand> cmdPtr(cmd);
+    if (!isCurrent) {
+        results.add(new DbCallback());
+    } else {
+        try {
+            cmd->reply(in, results);
+        } catch (std::exception &e) {
+            // Still exactly one callback, then the connection is dropped
+            DbCallback *cb;
+            while ((cb = results.pop(false)))
+                delete cb;
+            cmd->fail(e.what(), true, results);
+            cmd->finish(results, cbQueue);
+            throw;
+        }
+    }
+    cmd->finish(results, cbQueue);
+
+    wake();
+}
+
+void BrokerLink::receiveChanges(WireReader &in) {
+    std::vector<DbSelectChangesCallback::Change> changes;
+
+    bool complete = in.getBool();
+    for (size_t count = in.getCount(); count > 0; count--) {
+        int64_t seq = in.getInt();
+        int64_t slotStart = in.getInt();
+        int64_t slotStop = in.getInt();
+        changes.push_back(DbSelectChangesCallback::Change(seq, slotStart, slotStop, in.getInt(), "", 0));
+    }
+
+    namesCache->apply(changes, complete);
+    changesPushed.store(true);
+    wake();
+}
@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef BROKERLINK_H
+#define BROKERLINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dbcommand.h"
+#include "namescache.h"
+#include "wssocket.h"
+
+// Runs ThreadedDb's commands on a broker, which owns the file, see broker/wsbroker.cpp.
+//
+// A sender thread keeps at most maxInFlight commands at the broker. The rest wait in the queue,
+// where priorities apply and a refresh still supersedes the queued one of its id. A receiver
+// thread turns replies into the commands' callbacks; the reply to a refresh that was queued again
+// meanwhile becomes a plain DbCallback, as a cancelled refresh does locally. Changes the broker
+// pushes are applied to the names cache.
+//
+// The connection is made for the first command and again for the first one after it was lost,
+// at most every reconnectDelay. Commands that cannot reach the broker fail with the reason.
+//
+// A command counts as started once the sender took it, the round trip is its execution.
+class BrokerLink {
+public:
+    static const size_t maxInFlight;
+    static const int64_t reconnectDelay; // ms
+
+    // wake is called from the link's threads whenever callbacks are ready
+    BrokerLink(const std::string &address, NamesCache *namesCache, std::function<void()> wake);
+    ~BrokerLink();
+
+    int queueCommand(DbCommand *cmd, size_t refreshId, QueuePriority priority); // Commands added, see CommandQueue::add
+    DbCallback *popCallback(); // nullptr if none is ready
+    bool takeChanges();        // True once after the broker pushed changes
+    size_t getQueueDepth(QueuePriority priority);
+
+private:
+    class Pending {
+    public:
+        Pending(DbCommand *cmd, size_t refreshId, int64_t serial) :
+            cmd(cmd), refreshId(refreshId), serial(serial) {}
+
+        DbCommand *cmd;
+        size_t refreshId;
+        int64_t serial;
+    };
+
+    void runSender();
+    void runReceiver(std::shared_ptr<WsSocket> conn);
+    std::shared_ptr<WsSocket> connection(std::string *error); // Sender thread, connects if needed
+    void receiveReply(WireReader &in);
+    void receiveChanges(WireReader &in);
+
+private:
+    std::string host;
+    int port;
+    std::string addressError; // The address could not be parsed
+    NamesCache *namesCache;
+    std::function<void()> wake;
+    CommandQueue<DbCommand> cmdQueue;   // GUI thread to sender
+    CommandQueue<DbCallback> cbQueue;   // Receiver to GUI thread
+    CommandQueue<DbCallback> results;   // Receiver thread only, see DbCommand::finish
+    CommandQueue<DbCallback> failQueue; // Sender to GUI thread
+    std::thread sender;
+    std::thread receiver;   // Of the current or the last connection, sender thread only
+    int64_t nextRequest;    // Sender thread only
+    int64_t lastAttempt;    // steady_clock ms, sender thread only
+    std::string lastError;  // Sender thread only
+    std::atomic<bool> changesPushed;
+    std::mutex mutex;       // Guards the members below
+    std::condition_variable windowOpen;
+    std::shared_ptr<WsSocket> socket; // nullptr while not connected
+    std::map<int64_t, Pending> pending;
+    std::vector<int64_t> serials; // Times each refresh id was queued
+    bool isClosing;
+};
+
+#endif // BROKERLINK_H
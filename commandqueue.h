@@ -23,118 +23,327 @@
 #ifndef COMMANDQUEUE_H
 #define COMMANDQUEUE_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
-#include <vector>
+#include <stddef.h>
+#include <stdint.h>
 
+// Lanes of a CommandQueue, lower values are served first
+enum QueuePriority {
+    PriorityInteractive = 0, // User actions, always get the next turn
+    PriorityVisible     = 1, // Refreshes of what is on screen
+    PriorityBackground  = 2, // Timed refreshes, prefetch and maintenance
+    numPriorities       = 3
+};
+
+// Unbounded single producer, single consumer queue.  Each priority lane is a
+// chain of fixed size ring segments, so add and pop never take a lock; the
+// mutex is only used to park the consumer when it blocks on an empty queue.
+//
+// Items are FIFO within a lane.  Interactive items always come out first, of
+// the other lanes the higher priority wins unless a lower lane with work has
+// been passed over starvationLimit times in a row.
+//
+// Adding an item with a non-zero refresh id supersedes the item with the same
+// id that is still queued, the superseded item is deleted when the consumer
+// reaches it.
 template <class T>
 class CommandQueue {
+public:
+    static const size_t maxRefreshIds = 16; // Larger ids are queued without coalescing
+    static const unsigned starvationLimit = 4;
+
 private:
-    class QueuedItem {
+    static const size_t segmentSize = 256;
+    static const unsigned laneBits = 2; // Tickets carry the lane of their item in the low bits
+
+    class Slot {
     public:
-        QueuedItem *prev;
-        QueuedItem *next;
-        std::unique_ptr<T> data;
+        T *data;
         size_t id;
+        uint64_t ticket;
     };
-  
+
+    class Segment {
+    public:
+        Segment() : written(0), next(nullptr) {}
+
+        Slot items[segmentSize];
+        std::atomic<size_t> written;
+        std::atomic<Segment *> next;
+    };
+
+    // Ticket of the newest unclaimed item for each refresh id, 0 if none
+    std::atomic<uint64_t> pending[maxRefreshIds];
+    std::atomic<size_t> depth[numPriorities]; // Unclaimed items per lane
+    std::atomic<Segment *> spare;
+    std::atomic<bool> readerWaiting;
     std::mutex mutex;
     std::condition_variable cond;
 
-    QueuedItem *first;
-    QueuedItem *last;
-    std::vector<QueuedItem *> refresh;
-    bool readerWaiting;
-  
-    void append(T *data, size_t id) {
-        QueuedItem *qi = new QueuedItem();
-        qi->prev = last;
-        qi->next = nullptr;
-        qi->data.reset(data);
-        qi->id   = id;
-
-        if (last != nullptr)
-            last->next = qi;
-
-        last = qi;
-        if (first == nullptr)
-            first = qi;
+    // Producer side
+    char producerPad[64];
+    Segment *tail[numPriorities];
+    uint64_t nextTicket;
+
+    // Consumer side
+    char consumerPad[64];
+    Segment *head[numPriorities];
+    size_t headPos[numPriorities];
+    unsigned passed[numPriorities]; // Turns a lane with work was skipped
+
+    Segment *newSegment() {
+        Segment *seg = spare.exchange(nullptr, std::memory_order_acquire);
+
+        return seg ? seg : new Segment();
+    }
+
+    void retire(Segment *seg) {
+        seg->written.store(0, std::memory_order_relaxed);
+        seg->next.store(nullptr, std::memory_order_relaxed);
+        delete spare.exchange(seg, std::memory_order_release);
+    }
+
+    // First queued slot of a lane, or null if the lane is empty
+    Slot *front(size_t lane) {
+        for (;;) {
+            if (headPos[lane] < head[lane]->written.load(std::memory_order_acquire))
+                return &head[lane]->items[headPos[lane]];
+
+            if (headPos[lane] < segmentSize)
+                return nullptr;
+
+            Segment *next = head[lane]->next.load(std::memory_order_acquire);
+            if (next == nullptr)
+                return nullptr;
+
+            retire(head[lane]);
+            head[lane] = next;
+            headPos[lane] = 0;
+        }
     }
 
-    void remove(QueuedItem *qi) {
-        if (qi->prev)
-            qi->prev->next = qi->next;
-        else
-            first = qi->next;
+    // Front slot of a lane after deleting superseded items, null if the lane is empty.
+    // It is only looked at, a later add can still supersede it until it is claimed.
+    Slot *live(size_t lane) {
+        Slot *slot;
 
-        if (qi->next)
-            qi->next->prev = qi->prev;
-        else
-            last = qi->prev;
+        while ((slot = front(lane)) != nullptr) {
+            // Ticket 0 means no coalescing or already claimed
+            uint64_t ticket = slot->ticket;
+            if (ticket == 0 || pending[slot->id - 1].load() == ticket)
+                return slot;
 
-        if (qi->id != 0 && qi->id <= refresh.size() && refresh[qi->id-1] == qi)
-            refresh[qi->id-1] = nullptr;
+            delete slot->data;
+            headPos[lane]++;
+        }
 
-        delete qi;
+        return nullptr;
     }
 
-    int purgeRefresh(size_t id) {
-        QueuedItem *qi;
+    // Slot pop would return next, null if every lane is empty. Nothing is claimed.
+    Slot *next(size_t *laneOut) {
+        Slot *fronts[numPriorities];
+        size_t chosen = numPriorities;
+
+        for (size_t lane = 0; lane < numPriorities; lane++)
+            fronts[lane] = live(lane);
 
-        if (id == 0 || id > refresh.size() || (qi = refresh[id - 1]) == nullptr)
-            return 0;
+        for (size_t lane = 0; lane < numPriorities; lane++) {
+            if (fronts[lane] == nullptr)
+                continue;
 
-        remove(qi);
+            if (chosen == numPriorities) {
+                chosen = lane;
+                if (lane == PriorityInteractive)
+                    break;
+            } else if (passed[lane] >= starvationLimit) {
+                chosen = lane;
+                break;
+            }
+        }
+
+        if (chosen == numPriorities)
+            return nullptr;
 
-        return 1;
+        *laneOut = chosen;
+        return fronts[chosen];
     }
 
-    void refreshAddLast() {
-        size_t id = last->id;
+    // Claims the slot next returned, false if it was superseded since and has been dropped
+    bool claim(size_t lane, Slot *slot) {
+        uint64_t ticket = slot->ticket;
 
-        if (id == 0)
-            return;
+        if (ticket == 0 || pending[slot->id - 1].compare_exchange_strong(ticket, 0)) {
+            slot->ticket = 0;
+            return true;
+        }
 
-        if (refresh.size() < id)
-            refresh.resize(id, nullptr);
+        delete slot->data;
+        headPos[lane]++;
+        return false;
+    }
+
+    bool isEmpty() {
+        for (size_t lane = 0; lane < numPriorities; lane++) {
+            if (front(lane) != nullptr)
+                return false;
+        }
 
-        refresh[id - 1] = last;
+        return true;
+    }
+
+    T *take(size_t lane, Slot *slot, size_t *refreshId) {
+        if (refreshId)
+            *refreshId = slot->id;
+
+        T *data = slot->data;
+        headPos[lane]++;
+        depth[lane].fetch_sub(1, std::memory_order_relaxed);
+
+        for (size_t other = 0; other < numPriorities; other++) {
+            if (other == lane)
+                passed[other] = 0;
+            else if (other > lane && front(other) != nullptr)
+                passed[other]++;
+        }
+
+        return data;
     }
 
 public:
-    CommandQueue() : first(nullptr), last(nullptr), readerWaiting(false) {}
+    CommandQueue() : spare(nullptr), readerWaiting(false), nextTicket(0) {
+        for (size_t count = 0; count < maxRefreshIds; count++)
+            pending[count].store(0, std::memory_order_relaxed);
+
+        for (size_t lane = 0; lane < numPriorities; lane++) {
+            depth[lane].store(0, std::memory_order_relaxed);
+            tail[lane] = head[lane] = new Segment();
+            headPos[lane] = 0;
+            passed[lane] = 0;
+        }
+    }
 
     ~CommandQueue() {
+        Slot *slot;
+
+        for (size_t lane = 0; lane < numPriorities; lane++) {
+            while ((slot = front(lane)) != nullptr) {
+                delete slot->data;
+                headPos[lane]++;
+            }
+
+            delete head[lane];
+        }
+
+        delete spare.load();
     }
 
-    int add(T *data, size_t refreshId = 0) {
-        std::unique_lock<std::mutex> lock(mutex);
+    // Returns 0 if the item superseded a queued one with the same refresh id
+    int add(T *data, size_t refreshId = 0, QueuePriority priority = PriorityVisible) {
+        size_t lane = std::min<size_t>(priority, PriorityBackground);
+        int num = 0;
+        uint64_t ticket = 0;
+
+        depth[lane].fetch_add(1, std::memory_order_relaxed);
+        if (refreshId != 0 && refreshId <= maxRefreshIds) {
+            ticket = (++nextTicket << laneBits) | lane;
+            uint64_t old = pending[refreshId - 1].exchange(ticket);
+            if (old != 0) {
+                depth[old & ((1 << laneBits) - 1)].fetch_sub(1, std::memory_order_relaxed);
+                num = 1;
+            }
+        }
 
-        int num = purgeRefresh(refreshId);
-        append(data, refreshId);
-        refreshAddLast();
+        Segment *seg = tail[lane];
+        size_t pos = seg->written.load(std::memory_order_relaxed);
+        if (pos == segmentSize) {
+            Segment *fresh = newSegment();
+            seg->next.store(fresh, std::memory_order_release);
+            tail[lane] = seg = fresh;
+            pos = 0;
+        }
 
-        if (readerWaiting)
+        Slot &slot = seg->items[pos];
+        slot.data = data;
+        slot.id = refreshId;
+        slot.ticket = ticket;
+        seg->written.store(pos + 1, std::memory_order_release);
+
+        // Pairs with the fence in pop, either the reader sees the item or we see it waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (readerWaiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex);
             cond.notify_one();
+        }
 
         return 1 - num;
     }
-  
-    T *pop(bool block = true) {
-        std::unique_lock<std::mutex> lock(mutex);
-    
-        if (!block && first == nullptr)
-            return nullptr;
 
-        readerWaiting = true;
-        while (first == nullptr)
-            cond.wait(lock);
-        readerWaiting = false;
+    T *pop(bool block = true, size_t *refreshId = nullptr) {
+        Slot *slot;
+        size_t lane;
 
-        T *data = first->data.release();
-        remove(first);
-    
-        return data;
+        for (;;) {
+            if ((slot = next(&lane)) != nullptr) {
+                if (claim(lane, slot))
+                    return take(lane, slot, refreshId);
+                continue;
+            }
+
+            if (!block)
+                return nullptr;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            readerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (isEmpty())
+                cond.wait(lock);
+            readerWaiting.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Waits until an item is queued or the timeout passes, true if pop would not block
+    bool waitFor(std::chrono::milliseconds timeout) {
+        size_t lane;
+
+        if (next(&lane) != nullptr)
+            return true;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            readerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (isEmpty())
+                cond.wait_for(lock, timeout);
+            readerWaiting.store(false, std::memory_order_relaxed);
+        }
+
+        return next(&lane) != nullptr;
+    }
+
+    // Non-blocking, only pops if pred accepts the item pop would return.
+    // A rejected item stays queued as it was, a later add can still supersede it.
+    template <class Pred>
+    T *popIf(Pred pred) {
+        size_t lane;
+        Slot *slot;
+
+        do {
+            slot = next(&lane);
+            if (slot == nullptr || !pred(slot->data))
+                return nullptr;
+        } while (!claim(lane, slot));
+
+        return take(lane, slot, nullptr);
+    }
+
+    // Items waiting in a lane, superseded ones excluded.  Safe from any thread, for diagnostics.
+    size_t getDepth(QueuePriority priority) {
+        return depth[std::min<size_t>(priority, PriorityBackground)].load(std::memory_order_relaxed);
     }
 };
 
@@ -20,12 +20,25 @@
 // DEALINGS IN THE SOFTWARE.
 //////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <exception>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 
 #include "dbcommand.h"
+#include "namescache.h"
 
 // Abstract classes //////////////////////////////////////////////////////////
 
+int64_t DbTiming::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 DbCallback::DbCallback() {
 }
 
@@ -35,7 +48,29 @@ DbCallback::~DbCallback() {
 void DbCallback::execute() {
 }
 
-DbCommand::DbCommand() {
+void DbCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyPlain);
+}
+
+DbTiming &DbCallback::getTiming() {
+    return timing;
+}
+
+DbErrorCallback::DbErrorCallback() : isCause(true) {
+}
+
+void DbErrorCallback::prepare(std::string preErrorMsg, bool preIsCause) {
+    errorMsg = preErrorMsg;
+    isCause = preIsCause;
+}
+
+void DbErrorCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyError);
+    out.putString(errorMsg);
+    out.putBool(isCause);
+}
+
+DbCommand::DbCommand(DbErrorCallback *errCb) : errorCallback(errCb), barrier(0) {
 }
 
 DbCommand::~DbCommand() {
@@ -45,6 +80,175 @@ void DbCommand::execute(Wsdb &, CommandQueue<DbCallback> &cbQueue) {
     cbQueue.add(new DbCallback());
 }
 
+const char *DbCommand::getName() {
+    return "Command";
+}
+
+bool DbCommand::isWrite() {
+    return false;
+}
+
+bool DbCommand::isRead() {
+    return false;
+}
+
+void DbCommand::fail(const std::string &errorMsg, bool isCause, CommandQueue<DbCallback> &cbQueue) {
+    if (!errorCallback) {
+        cbQueue.add(new DbCallback());
+        return;
+    }
+
+    errorCallback->prepare(errorMsg, isCause);
+    cbQueue.add(errorCallback.release());
+}
+
+std::string DbCommand::queryKey() {
+    return std::string();
+}
+
+void DbCommand::unchanged(CommandQueue<DbCallback> &cbQueue) {
+    cbQueue.add(new DbCallback());
+}
+
+void DbCommand::setBarrier(int64_t count) {
+    barrier = count;
+}
+
+int64_t DbCommand::getBarrier() {
+    return barrier;
+}
+
+DbTiming &DbCommand::getTiming() {
+    return timing;
+}
+
+void DbCommand::finish(CommandQueue<DbCallback> &results, CommandQueue<DbCallback> &cbQueue, bool discard) {
+    DbCallback *cb;
+
+    timing.name = getName();
+    timing.finished = DbTiming::now();
+    while ((cb = results.pop(false))) {
+        if (discard) {
+            delete cb;
+            cb = new DbCallback();
+        }
+        cb->getTiming() = timing;
+        cbQueue.add(cb);
+    }
+}
+
+bool DbCommand::encode(WireWriter &) {
+    return false;
+}
+
+void DbCommand::reply(WireReader &in, CommandQueue<DbCallback> &cbQueue) {
+    int64_t kind = in.getInt();
+
+    if (kind == WsWire::ReplyResult) {
+        cbQueue.add(decodeResult(in));
+    } else if (kind == WsWire::ReplyError) {
+        std::string errorMsg = in.getString();
+        fail(errorMsg, in.getBool(), cbQueue);
+    } else {
+        cbQueue.add(new DbCallback());
+    }
+}
+
+DbCallback *DbCommand::decodeResult(WireReader &) {
+    return new DbCallback();
+}
+
+static WsdbTransfer::Format decodeFormat(WireReader &in) {
+    int64_t format = in.getInt();
+    if (format != WsdbTransfer::FormatCsv && format != WsdbTransfer::FormatJson)
+        throw std::runtime_error("Unknown transfer format");
+
+    return static_cast<WsdbTransfer::Format>(format);
+}
+
+// Leaves room for the rest of the message around a file's contents
+static bool fitsFrame(size_t size) {
+    return size + 4096 <= WsWire::maxFrame;
+}
+
+static std::vector<Wsdb::StationInfo> decodeStationInfo(WireReader &in) {
+    std::vector<Wsdb::StationInfo> info;
+
+    for (size_t count = in.getCount(); count > 0; count--) {
+        std::string name = in.getString();
+        std::string desc = in.getString();
+        info.push_back(Wsdb::StationInfo(name, desc, in.getInt()));
+    }
+
+    return info;
+}
+
+DbCommand *DbCommand::decode(int64_t tag, WireReader &in, NamesCache *cache) {
+    int64_t slotStart, slotStop, station, stationStart, stationStop;
+
+    switch (tag) {
+    case WsWire::CmdNop:
+        return new DbNopCommand(new DbCallback());
+    case WsWire::CmdOpen:
+    case WsWire::CmdClose:
+        return nullptr;
+    case WsWire::CmdGetStationInfo:
+        return new DbGetStationInfoCommand(new DbGetStationInfoCallback());
+    case WsWire::CmdSetStationInfo: {
+        std::vector<Wsdb::StationInfo> info = decodeStationInfo(in);
+        int64_t yellow = in.getInt();
+        return new DbSetStationInfoCommand(info, Wsdb::Limits(yellow, in.getInt()), new DbErrorCallback());
+    }
+    case WsWire::CmdInsertName: {
+        slotStart = in.getInt();
+        slotStop = in.getInt();
+        station = in.getInt();
+        std::string name = in.getString();
+        return new DbInsertNameCommand(slotStart, slotStop, station, name, in.getInt(), new DbInsertNameCallback(nullptr), new DbErrorCallback());
+    }
+    case WsWire::CmdSelectNames: {
+        slotStart = in.getInt();
+        slotStop = in.getInt();
+        stationStart = in.getInt();
+        stationStop = in.getInt();
+        bool isCached = in.getBool();
+        return new DbSelectNamesCommand(slotStart, slotStop, stationStart, stationStop, new DbSelectNamesCallback(),
+                                        isCached ? cache : nullptr, in.getInt());
+    }
+    case WsWire::CmdPrefetchNames:
+        slotStart = in.getInt();
+        slotStop = in.getInt();
+        stationStart = in.getInt();
+        stationStop = in.getInt();
+        return new DbPrefetchNamesCommand(slotStart, slotStop, stationStart, stationStop, in.getInt(), cache);
+    case WsWire::CmdSelectSlotCounts:
+        slotStart = in.getInt();
+        return new DbSelectSlotCountsCommand(slotStart, in.getInt(), new DbSelectSlotCountsCallback());
+    case WsWire::CmdSelectUsage: {
+        slotStart = in.getInt();
+        slotStop = in.getInt();
+        int64_t origin = in.getInt();
+        int64_t slotsPerBucket = in.getInt();
+        return new DbSelectUsageCommand(slotStart, slotStop, origin, slotsPerBucket, in.getInt(), new DbSelectUsageCallback());
+    }
+    case WsWire::CmdRemoveNames:
+        slotStart = in.getInt();
+        slotStop = in.getInt();
+        return new DbRemoveNamesCommand(slotStart, slotStop, in.getInt(), new DbErrorCallback());
+    case WsWire::CmdSelectChanges:
+        return new DbSelectChangesCommand(in.getInt(), new DbSelectChangesCallback());
+    case WsWire::CmdImport: {
+        std::string readError = in.getString();
+        WsdbTransfer::Format format = decodeFormat(in);
+        return new DbImportCommand(format, in.getString(), readError, new DbImportCallback());
+    }
+    case WsWire::CmdExport:
+        return new DbExportCommand(decodeFormat(in), new DbExportCallback());
+    }
+
+    throw std::runtime_error("Unknown broker command");
+}
+
 // DbNopCommand ///////////////////////////////////////////////////////////////
 
 DbNopCommand::DbNopCommand(DbCallback *cb) : callback(cb) {
@@ -53,32 +257,89 @@ DbNopCommand::DbNopCommand(DbCallback *cb) : callback(cb) {
 DbNopCommand::~DbNopCommand() {
 }
 
+const char *DbNopCommand::getName() {
+    return "Nop";
+}
+
 void DbNopCommand::execute(Wsdb &, CommandQueue<DbCallback> &cbQueue) {
     cbQueue.add(callback.release());
 }
 
+bool DbNopCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdNop);
+
+    return true;
+}
+
+void DbNopCommand::reply(WireReader &, CommandQueue<DbCallback> &cbQueue) {
+    cbQueue.add(callback.release());
+}
+
 // DbOpenCommand //////////////////////////////////////////////////////////////
 
-void DbOpenCallback::prepare(std::string preErrorMsg) {
-    errorMsg = preErrorMsg;
+void DbOpenCallback::prepare(const Wsdb::StorageProfile &preProfile) {
+    profile = preProfile;
 }
 
-DbOpenCommand::DbOpenCommand(std::string filename, DbOpenCallback *cb) : filename(filename), callback(cb) {
+void DbOpenCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putString(errorMsg);
+    out.putInt(profile.journalMode);
+    out.putInt(profile.synchronous);
+    out.putInt(profile.busyTimeout);
+    out.putInt(profile.mmapSize);
+    out.putInt(profile.cacheSize);
+}
+
+void DbOpenCallback::decode(WireReader &in) {
+    errorMsg = in.getString();
+    profile.journalMode = in.getInt();
+    profile.synchronous = in.getInt();
+    profile.busyTimeout = in.getInt();
+    profile.mmapSize = in.getInt();
+    profile.cacheSize = in.getInt();
+}
+
+DbOpenCommand::DbOpenCommand(std::string filename, const Wsdb::StorageProfile &clientProfile, DbOpenCallback *cb) :
+    filename(filename), clientProfile(clientProfile), callback(cb) {
 }
 
 DbOpenCommand::~DbOpenCommand() {
 }
 
+const char *DbOpenCommand::getName() {
+    return "Open";
+}
+
 void DbOpenCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
     try {
-        wsdb.open(filename.c_str());
+        wsdb.open(filename.c_str(), clientProfile);
     } catch (std::exception &e) {
         callback->prepare(e.what());
         cbQueue.add(callback.release());
         return;
     }
 
-    cbQueue.add(new DbCallback());
+    callback->prepare(wsdb.getActiveProfile());
+    cbQueue.add(callback.release());
+}
+
+void DbOpenCommand::fail(const std::string &errorMsg, bool, CommandQueue<DbCallback> &cbQueue) {
+    callback->prepare(errorMsg);
+    cbQueue.add(callback.release());
+}
+
+bool DbOpenCommand::encode(WireWriter &out) {
+    // The broker serves the file it was started with, the name is only shown locally
+    out.putInt(WsWire::CmdOpen);
+
+    return true;
+}
+
+DbCallback *DbOpenCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    return callback.release();
 }
 
 // DbCloseCommand ////////////////////////////////////////////////////////////
@@ -86,34 +347,108 @@ void DbOpenCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
 DbCloseCommand::DbCloseCommand() {
 }
 
+const char *DbCloseCommand::getName() {
+    return "Close";
+}
+
 void DbCloseCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
     wsdb.close();
     cbQueue.add(new DbCallback());
 }
 
+bool DbCloseCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdClose);
+
+    return true;
+}
+
 // DbGetStationsNamesCommand/////////////////////////////////////////////////
 
+DbGetStationInfoCallback::DbGetStationInfoCallback() : unchanged(false) {
+}
+
 std::vector<Wsdb::StationInfo> *DbGetStationInfoCallback::prepare(const Wsdb::Limits &preLimits) {
     limits = preLimits;
 
     return &info;
 }
 
+void DbGetStationInfoCallback::prepareUnchanged() {
+    unchanged = true;
+}
+
+static void encodeStationInfo(const std::vector<Wsdb::StationInfo> &info, WireWriter &out) {
+    out.putInt(static_cast<int64_t>(info.size()));
+    for (auto &station : info) {
+        out.putString(station.name);
+        out.putString(station.desc);
+        out.putInt(station.flags);
+    }
+}
+
+void DbGetStationInfoCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putBool(unchanged);
+    out.putInt(limits.yellow);
+    out.putInt(limits.red);
+    encodeStationInfo(info, out);
+}
+
+void DbGetStationInfoCallback::decode(WireReader &in) {
+    unchanged = in.getBool();
+    limits.yellow = in.getInt();
+    limits.red = in.getInt();
+    info = decodeStationInfo(in);
+}
+
 DbGetStationInfoCommand::DbGetStationInfoCommand(DbGetStationInfoCallback *cb) : callback(cb) {
 }
 
 DbGetStationInfoCommand::~DbGetStationInfoCommand() {
 }
 
+const char *DbGetStationInfoCommand::getName() {
+    return "GetStationInfo";
+}
+
 void DbGetStationInfoCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
     wsdb.getStationInfo(callback->prepare(wsdb.getLimits()));
     cbQueue.add(callback.release());
 }
 
+bool DbGetStationInfoCommand::isRead() {
+    return true;
+}
+
+std::string DbGetStationInfoCommand::queryKey() {
+    return "info";
+}
+
+void DbGetStationInfoCommand::unchanged(CommandQueue<DbCallback> &cbQueue) {
+    callback->prepareUnchanged();
+    cbQueue.add(callback.release());
+}
+
+bool DbGetStationInfoCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdGetStationInfo);
+
+    return true;
+}
+
+DbCallback *DbGetStationInfoCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    return callback.release();
+}
+
 // DbSetStationInfoCommand //////////////////////////////////////////
 
-DbSetStationInfoCommand::DbSetStationInfoCommand(const std::vector<Wsdb::StationInfo> &info, const Wsdb::Limits &limits)
-    : info(info), limits(limits) {
+DbSetStationInfoCommand::DbSetStationInfoCommand(const std::vector<Wsdb::StationInfo> &info, const Wsdb::Limits &limits, DbErrorCallback *errCb)
+    : DbCommand(errCb), info(info), limits(limits) {
+}
+
+const char *DbSetStationInfoCommand::getName() {
+    return "SetStationInfo";
 }
 
 void DbSetStationInfoCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
@@ -122,45 +457,185 @@ void DbSetStationInfoCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQu
     cbQueue.add(new DbCallback());
 }
 
+bool DbSetStationInfoCommand::isWrite() {
+    return true;
+}
+
+bool DbSetStationInfoCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdSetStationInfo);
+    encodeStationInfo(info, out);
+    out.putInt(limits.yellow);
+    out.putInt(limits.red);
+
+    return true;
+}
+
 // DbInsertNameCommand ////////////////////////////////////////////////////
 
-DbInsertNameCallback::DbInsertNameCallback(int64_t *bookCount) : bookCount(bookCount) {
+DbInsertNameCallback::DbInsertNameCallback(int64_t *bookCount) : bookCount(bookCount), booked(0) {
+}
+
+void DbInsertNameCallback::execute() {
+    *bookCount += booked;
 }
 
 void DbInsertNameCallback::prepare(int64_t num) {
-    *bookCount += num;
+    booked += num;
+}
+
+void DbInsertNameCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putInt(booked);
+}
+
+void DbInsertNameCallback::decode(WireReader &in) {
+    booked = in.getInt();
 }
 
-DbInsertNameCommand::DbInsertNameCommand(int64_t slotStart, int64_t slotStop, int64_t station, std::string name, int64_t attr, DbInsertNameCallback *cb) :
-   slotStart(slotStart), slotStop(slotStop), station(station), name(name), attr(attr), callback(cb) {
+DbInsertNameCommand::DbInsertNameCommand(int64_t slotStart, int64_t slotStop, int64_t station, std::string name, int64_t attr, DbInsertNameCallback *cb, DbErrorCallback *errCb) :
+   DbCommand(errCb), slotStart(slotStart), slotStop(slotStop), station(station), name(name), attr(attr), callback(cb) {
 }
 
 DbInsertNameCommand::~DbInsertNameCommand() {
 }
 
+const char *DbInsertNameCommand::getName() {
+    return "InsertName";
+}
+
 void DbInsertNameCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
-    for (int64_t slot = slotStart; slot <= slotStop; slot++)
-        callback->prepare(wsdb.insertName(slot, station, name.c_str(), attr));
+    callback->prepare(wsdb.insertNames(slotStart, slotStop, station, name.c_str(), attr));
     cbQueue.add(callback.release());
 }
 
+bool DbInsertNameCommand::isWrite() {
+    return true;
+}
+
+bool DbInsertNameCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdInsertName);
+    out.putInt(slotStart);
+    out.putInt(slotStop);
+    out.putInt(station);
+    out.putString(name);
+    out.putInt(attr);
+
+    return true;
+}
+
+DbCallback *DbInsertNameCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    return callback.release();
+}
+
 // DbSelectNamesCommand //////////////////////////////////////////////////
 
-DbSelectNamesCallback::Datum::Datum(int64_t slot, int64_t station, const std::string &name, int64_t attr) :
-   slot(slot), station(station), name(name), attr(attr) {
+void DbSelectNamesCallback::Names::reserve(size_t rows) {
+    slot.reserve(rows);
+    station.reserve(rows);
+    attr.reserve(rows);
+    nameOffset.reserve(rows);
+    arena.reserve(rows * 8);
+}
+
+void DbSelectNamesCallback::Names::append(int64_t slotA, int64_t stationA, const char *name, int64_t attrA) {
+    if (name == nullptr)
+        name = "";
+
+    // Consecutive slots are usually booked by the same name, share its copy
+    size_t last = nameOffset.size();
+    if (last > 0 && strcmp(arena.c_str() + nameOffset[last - 1], name) == 0) {
+        nameOffset.push_back(nameOffset[last - 1]);
+    } else {
+        nameOffset.push_back(arena.size());
+        arena.append(name);
+        arena.push_back('\0');
+    }
+
+    slot.push_back(slotA);
+    station.push_back(stationA);
+    attr.push_back(attrA);
+}
+
+DbSelectNamesCallback::DbSelectNamesCallback() : unchanged(false), changeSeq(-1) {
 }
 
 DbSelectNamesCallback::~DbSelectNamesCallback() {
-    for (auto datum : data)
-        delete datum;
 }
 
-void DbSelectNamesCallback::prepare(int64_t slot, int64_t station, const std::string &name, int64_t attr) {
-    data.push_back(new Datum(slot, station, name, attr));
+void DbSelectNamesCallback::prepare(int64_t slot, int64_t station, const char *name, int64_t attr) {
+    data.append(slot, station, name, attr);
+}
+
+void DbSelectNamesCallback::prepareSize(size_t rows) {
+    data.reserve(rows);
+}
+
+void DbSelectNamesCallback::prepareUnchanged() {
+    unchanged = true;
+}
+
+void DbSelectNamesCallback::prepareChangeSeq(int64_t seq) {
+    changeSeq = seq;
+}
+
+void DbSelectNamesCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putBool(unchanged);
+    out.putInt(changeSeq);
+    encodeNames(data, out);
+}
+
+void DbSelectNamesCallback::decode(WireReader &in) {
+    unchanged = in.getBool();
+    changeSeq = in.getInt();
+    decodeNames(in, &data);
+}
+
+void DbSelectNamesCallback::encodeNames(const Names &names, WireWriter &out) {
+    int64_t lastSlot = 0;
+    int64_t lastAttr = 0;
+
+    // Rows come sorted and in runs of one booking, deltas and a flag for a repeated name keep them short
+    out.putInt(static_cast<int64_t>(names.size()));
+    for (size_t row = 0; row < names.size(); row++) {
+        bool isSameName = row > 0 && names.nameOffset[row] == names.nameOffset[row - 1];
+
+        out.putInt(names.slot[row] - lastSlot);
+        out.putInt(names.station[row]);
+        out.putInt(names.attr[row] - lastAttr);
+        out.putBool(isSameName);
+        if (!isSameName)
+            out.putString(names.name(row));
+
+        lastSlot = names.slot[row];
+        lastAttr = names.attr[row];
+    }
+}
+
+void DbSelectNamesCallback::decodeNames(WireReader &in, Names *names) {
+    int64_t slot = 0;
+    int64_t attr = 0;
+    std::string name;
+
+    size_t rows = in.getCount();
+    names->reserve(rows);
+    for (size_t row = 0; row < rows; row++) {
+        slot += in.getInt();
+        int64_t station = in.getInt();
+        attr += in.getInt();
+        if (!in.getBool())
+            name = in.getString();
+
+        names->append(slot, station, name.c_str(), attr);
+    }
 }
 
-DbSelectNamesCommand::DbSelectNamesCommand(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, DbSelectNamesCallback *cb) :
-    slotStart(slotStart), slotStop(slotStop), stationStart(stationStart), stationStop(stationStop), callback(cb) {
+DbSelectNamesCommand::DbSelectNamesCommand(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, DbSelectNamesCallback *cb,
+                                           NamesCache *cache, int64_t knownSeq) :
+    slotStart(slotStart), slotStop(slotStop), stationStart(stationStart), stationStop(stationStop), callback(cb),
+    cache(cache), cacheEpoch(cache ? cache->getEpoch() : 0), knownSeq(knownSeq) {
 }
 
 DbSelectNamesCommand::~DbSelectNamesCommand() {
@@ -177,23 +652,653 @@ private:
 };
 
 void DbWsdbCallback::callback(int64_t slot, int64_t station, const char *name, int64_t attr) {
-    cb->prepare(slot, station, std::string(name), attr);
+    cb->prepare(slot, station, name, attr);
 }
 
-void DbSelectNamesCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
-    DbWsdbCallback cb(callback.get());
+static int64_t selectNamesInto(Wsdb &wsdb, int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, DbSelectNamesCallback *callback) {
+    DbWsdbCallback cb(callback);
+
+    // Size the columns for a fully booked range up front
+    int64_t stations = std::min(stationStop - stationStart + 1, wsdb.getNumStations());
+    int64_t rows = (slotStop - slotStart + 1) * std::max<int64_t>(stations, 0);
+    callback->prepareSize(static_cast<size_t>(std::min<int64_t>(std::max<int64_t>(rows, 0), 1 << 20)));
 
+    // Read first, replaying a change that is already in data is harmless
+    int64_t changeSeq = wsdb.getLastChange();
+    callback->prepareChangeSeq(changeSeq);
     wsdb.selectNames(slotStart, slotStop, stationStart, stationStop, cb);
+
+    return changeSeq;
+}
+
+const char *DbSelectNamesCommand::getName() {
+    return "SelectNames";
+}
+
+void DbSelectNamesCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
+    NamesCache::Range range(slotStart, slotStop, stationStart, stationStop);
+
+    // ThreadedDb syncs the cache before each refresh, a surviving entry is still current
+    if (cache && knownSeq >= 0 && cache->contains(range, knownSeq)) {
+        unchanged(cbQueue);
+        return;
+    }
+
+    int64_t changeSeq = selectNamesInto(wsdb, slotStart, slotStop, stationStart, stationStop, callback.get());
+    // A cancelled select may have stopped part way, it is dropped by ThreadedDb
+    if (cache && !wsdb.isCancelled())
+        cache->store(cacheEpoch, range, changeSeq, std::make_shared<const DbSelectNamesCallback::Names>(callback->names()));
+    cbQueue.add(callback.release());
+}
+
+bool DbSelectNamesCommand::isRead() {
+    return true;
+}
+
+std::string DbSelectNamesCommand::queryKey() {
+    // The last query may not be what is shown after a cached view, knownSeq decides instead
+    if (cache)
+        return std::string();
+
+    std::stringstream str;
+    str << "select " << slotStart << " " << slotStop << " " << stationStart << " " << stationStop;
+
+    return str.str();
+}
+
+void DbSelectNamesCommand::unchanged(CommandQueue<DbCallback> &cbQueue) {
+    callback->prepareUnchanged();
     cbQueue.add(callback.release());
 }
 
+bool DbSelectNamesCommand::encode(WireWriter &out) {
+    // With a cache the broker checks knownSeq against its own, which holds what it sent us
+    out.putInt(WsWire::CmdSelectNames);
+    out.putInt(slotStart);
+    out.putInt(slotStop);
+    out.putInt(stationStart);
+    out.putInt(stationStop);
+    out.putBool(cache != nullptr);
+    out.putInt(knownSeq);
+
+    return true;
+}
+
+DbCallback *DbSelectNamesCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    if (cache && !callback->isUnchanged())
+        cache->store(cacheEpoch, NamesCache::Range(slotStart, slotStop, stationStart, stationStop), callback->getChangeSeq(),
+                     std::make_shared<const DbSelectNamesCallback::Names>(callback->names()));
+
+    return callback.release();
+}
+
+// DbPrefetchNamesCommand /////////////////////////////////////////////////
+
+void DbPrefetchNamesCallback::prepare(const Range &range) {
+    ranges.push_back(range);
+}
+
+void DbPrefetchNamesCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putInt(static_cast<int64_t>(ranges.size()));
+    for (auto &range : ranges) {
+        out.putInt(range.slotStart);
+        out.putInt(range.slotStop);
+        out.putInt(range.changeSeq);
+        DbSelectNamesCallback::encodeNames(*range.data, out);
+    }
+}
+
+void DbPrefetchNamesCallback::decode(WireReader &in) {
+    for (size_t count = in.getCount(); count > 0; count--) {
+        int64_t slotStart = in.getInt();
+        int64_t slotStop = in.getInt();
+        int64_t changeSeq = in.getInt();
+        std::shared_ptr<DbSelectNamesCallback::Names> data = std::make_shared<DbSelectNamesCallback::Names>();
+        DbSelectNamesCallback::decodeNames(in, data.get());
+
+        ranges.push_back(Range(slotStart, slotStop, changeSeq, data));
+    }
+}
+
+DbPrefetchNamesCommand::DbPrefetchNamesCommand(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, int64_t shift, NamesCache *cache) :
+    slotStart(slotStart), slotStop(slotStop), stationStart(stationStart), stationStop(stationStop), shift(shift),
+    cache(cache), cacheEpoch(cache->getEpoch()), callback(new DbPrefetchNamesCallback()) {
+}
+
+DbPrefetchNamesCommand::~DbPrefetchNamesCommand() {
+}
+
+const char *DbPrefetchNamesCommand::getName() {
+    return "PrefetchNames";
+}
+
+void DbPrefetchNamesCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
+    for (int64_t offset : {shift, -shift}) {
+        NamesCache::Range range(slotStart + offset, slotStop + offset, stationStart, stationStop);
+        std::shared_ptr<const DbSelectNamesCallback::Names> data;
+        int64_t changeSeq;
+
+        // Cached ranges are still reported, on a broker the cache is not the client's
+        if (cache->lookup(range, &data, &changeSeq)) {
+            callback->prepare(DbPrefetchNamesCallback::Range(range.slotStart, range.slotStop, changeSeq, data));
+            continue;
+        }
+
+        DbSelectNamesCallback result;
+        changeSeq = selectNamesInto(wsdb, range.slotStart, range.slotStop, stationStart, stationStop, &result);
+        if (wsdb.isCancelled())
+            break;
+
+        data = std::make_shared<const DbSelectNamesCallback::Names>(result.names());
+        cache->store(cacheEpoch, range, changeSeq, data);
+        callback->prepare(DbPrefetchNamesCallback::Range(range.slotStart, range.slotStop, changeSeq, data));
+    }
+
+    cbQueue.add(callback.release());
+}
+
+bool DbPrefetchNamesCommand::isRead() {
+    return true;
+}
+
+bool DbPrefetchNamesCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdPrefetchNames);
+    out.putInt(slotStart);
+    out.putInt(slotStop);
+    out.putInt(stationStart);
+    out.putInt(stationStop);
+    out.putInt(shift);
+
+    return true;
+}
+
+DbCallback *DbPrefetchNamesCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    for (auto &range : callback->fetched())
+        cache->store(cacheEpoch, NamesCache::Range(range.slotStart, range.slotStop, stationStart, stationStop), range.changeSeq, range.data);
+
+    return callback.release();
+}
+
+// DbSelectSlotCountsCommand //////////////////////////////////////////////
+
+DbSelectSlotCountsCallback::DbSelectSlotCountsCallback() : unchanged(false) {
+}
+
+std::vector<int64_t> *DbSelectSlotCountsCallback::prepare() {
+    return &counts;
+}
+
+void DbSelectSlotCountsCallback::prepareUnchanged() {
+    unchanged = true;
+}
+
+void DbSelectSlotCountsCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putBool(unchanged);
+    out.putInt(static_cast<int64_t>(counts.size()));
+    for (auto count : counts)
+        out.putInt(count);
+}
+
+void DbSelectSlotCountsCallback::decode(WireReader &in) {
+    unchanged = in.getBool();
+    counts.resize(in.getCount());
+    for (auto &count : counts)
+        count = in.getInt();
+}
+
+DbSelectSlotCountsCommand::DbSelectSlotCountsCommand(int64_t slotStart, int64_t slotStop, DbSelectSlotCountsCallback *cb) :
+    slotStart(slotStart), slotStop(slotStop), callback(cb) {
+}
+
+DbSelectSlotCountsCommand::~DbSelectSlotCountsCommand() {
+}
+
+const char *DbSelectSlotCountsCommand::getName() {
+    return "SelectSlotCounts";
+}
+
+void DbSelectSlotCountsCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
+    wsdb.getSlotCounts(slotStart, slotStop, callback->prepare());
+    cbQueue.add(callback.release());
+}
+
+bool DbSelectSlotCountsCommand::isRead() {
+    return true;
+}
+
+std::string DbSelectSlotCountsCommand::queryKey() {
+    std::stringstream str;
+    str << "counts " << slotStart << " " << slotStop;
+
+    return str.str();
+}
+
+void DbSelectSlotCountsCommand::unchanged(CommandQueue<DbCallback> &cbQueue) {
+    callback->prepareUnchanged();
+    cbQueue.add(callback.release());
+}
+
+bool DbSelectSlotCountsCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdSelectSlotCounts);
+    out.putInt(slotStart);
+    out.putInt(slotStop);
+
+    return true;
+}
+
+DbCallback *DbSelectSlotCountsCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    return callback.release();
+}
+
+// DbSelectUsageCommand ///////////////////////////////////////////////////
+
+void DbSelectUsageCallback::prepare(int64_t station, int64_t bucket, int64_t booked) {
+    usage.push_back(Usage(station, bucket, booked));
+}
+
+void DbSelectUsageCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putInt(static_cast<int64_t>(usage.size()));
+    for (auto &use : usage) {
+        out.putInt(use.station);
+        out.putInt(use.bucket);
+        out.putInt(use.booked);
+    }
+}
+
+void DbSelectUsageCallback::decode(WireReader &in) {
+    for (size_t count = in.getCount(); count > 0; count--) {
+        int64_t station = in.getInt();
+        int64_t bucket = in.getInt();
+        usage.push_back(Usage(station, bucket, in.getInt()));
+    }
+}
+
+class DbWsdbUsageCallback : public WsdbUsageCallback {
+public:
+    DbWsdbUsageCallback(DbSelectUsageCallback *cb) : cb(cb) {}
+
+    virtual void usage(int64_t station, int64_t bucket, int64_t booked);
+
+private:
+    DbSelectUsageCallback *cb;
+};
+
+void DbWsdbUsageCallback::usage(int64_t station, int64_t bucket, int64_t booked) {
+    cb->prepare(station, bucket, booked);
+}
+
+DbSelectUsageCommand::DbSelectUsageCommand(int64_t slotStart, int64_t slotStop, int64_t origin, int64_t slotsPerBucket, int64_t bucketsPerCycle, DbSelectUsageCallback *cb) :
+    slotStart(slotStart), slotStop(slotStop), origin(origin), slotsPerBucket(slotsPerBucket), bucketsPerCycle(bucketsPerCycle), callback(cb) {
+}
+
+DbSelectUsageCommand::~DbSelectUsageCommand() {
+}
+
+const char *DbSelectUsageCommand::getName() {
+    return "SelectUsage";
+}
+
+void DbSelectUsageCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
+    DbWsdbUsageCallback cb(callback.get());
+
+    wsdb.selectUsage(slotStart, slotStop, origin, slotsPerBucket, bucketsPerCycle, cb);
+    cbQueue.add(callback.release());
+}
+
+bool DbSelectUsageCommand::isRead() {
+    return true;
+}
+
+bool DbSelectUsageCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdSelectUsage);
+    out.putInt(slotStart);
+    out.putInt(slotStop);
+    out.putInt(origin);
+    out.putInt(slotsPerBucket);
+    out.putInt(bucketsPerCycle);
+
+    return true;
+}
+
+DbCallback *DbSelectUsageCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    return callback.release();
+}
+
 // DbRemoveNamesCommand ///////////////////////////////////////////////////
 
-DbRemoveNamesCommand::DbRemoveNamesCommand(int64_t slotStart, int64_t slotStop, int64_t station) :
-    slotStart(slotStart), slotStop(slotStop), station(station) {
+DbRemoveNamesCommand::DbRemoveNamesCommand(int64_t slotStart, int64_t slotStop, int64_t station, DbErrorCallback *errCb) :
+    DbCommand(errCb), slotStart(slotStart), slotStop(slotStop), station(station) {
+}
+
+const char *DbRemoveNamesCommand::getName() {
+    return "RemoveNames";
 }
 
 void DbRemoveNamesCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
     wsdb.removeNames(slotStart, slotStop, station);
     cbQueue.add(new DbCallback());
 }
+
+bool DbRemoveNamesCommand::isWrite() {
+    return true;
+}
+
+bool DbRemoveNamesCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdRemoveNames);
+    out.putInt(slotStart);
+    out.putInt(slotStop);
+    out.putInt(station);
+
+    return true;
+}
+
+// DbSelectChangesCommand ////////////////////////////////////////////////
+
+DbSelectChangesCallback::Change::Change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr) :
+    seq(seq), slotStart(slotStart), slotStop(slotStop), station(station), name(name ? name : ""), attr(attr), isRemoval(name == nullptr) {
+}
+
+DbSelectChangesCallback::DbSelectChangesCallback() : truncated(false) {
+}
+
+void DbSelectChangesCallback::prepare(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr) {
+    changes.push_back(Change(seq, slotStart, slotStop, station, name, attr));
+}
+
+void DbSelectChangesCallback::prepareTruncated() {
+    truncated = true;
+}
+
+void DbSelectChangesCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putBool(truncated);
+    out.putInt(static_cast<int64_t>(changes.size()));
+    for (auto &change : changes) {
+        out.putInt(change.seq);
+        out.putInt(change.slotStart);
+        out.putInt(change.slotStop);
+        out.putInt(change.station);
+        out.putBool(change.isRemoval);
+        out.putString(change.name);
+        out.putInt(change.attr);
+    }
+}
+
+void DbSelectChangesCallback::decode(WireReader &in) {
+    truncated = in.getBool();
+    for (size_t count = in.getCount(); count > 0; count--) {
+        int64_t seq = in.getInt();
+        int64_t slotStart = in.getInt();
+        int64_t slotStop = in.getInt();
+        int64_t station = in.getInt();
+        bool isRemoval = in.getBool();
+        std::string name = in.getString();
+        changes.push_back(Change(seq, slotStart, slotStop, station, isRemoval ? nullptr : name.c_str(), in.getInt()));
+    }
+}
+
+DbSelectChangesCommand::DbSelectChangesCommand(int64_t sinceSeq, DbSelectChangesCallback *cb) :
+    sinceSeq(sinceSeq), callback(cb) {
+}
+
+DbSelectChangesCommand::~DbSelectChangesCommand() {
+}
+
+class DbWsdbChangeCallback : public WsdbChangeCallback {
+public:
+    DbWsdbChangeCallback(DbSelectChangesCallback *cb) : cb(cb) {}
+
+    virtual void change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr);
+
+private:
+    DbSelectChangesCallback *cb;
+};
+
+void DbWsdbChangeCallback::change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr) {
+    cb->prepare(seq, slotStart, slotStop, station, name, attr);
+}
+
+const char *DbSelectChangesCommand::getName() {
+    return "SelectChanges";
+}
+
+void DbSelectChangesCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
+    DbWsdbChangeCallback cb(callback.get());
+
+    if (!wsdb.selectChanges(sinceSeq, cb))
+        callback->prepareTruncated();
+    cbQueue.add(callback.release());
+}
+
+bool DbSelectChangesCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdSelectChanges);
+    out.putInt(sinceSeq);
+
+    return true;
+}
+
+DbCallback *DbSelectChangesCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    return callback.release();
+}
+
+// DbImportCommand ///////////////////////////////////////////////////////
+
+void DbImportCallback::prepare(const WsdbTransfer::ImportResult &preResult) {
+    result = preResult;
+}
+
+void DbImportCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putString(errorMsg);
+    out.putInt(result.records);
+    out.putInt(result.booked);
+    out.putInt(result.conflicts);
+    out.putInt(result.rejected);
+    out.putInt(static_cast<int64_t>(result.problems.size()));
+    for (auto &problem : result.problems) {
+        out.putInt(problem.line);
+        out.putString(problem.message);
+    }
+}
+
+void DbImportCallback::decode(WireReader &in) {
+    errorMsg = in.getString();
+    result.records = in.getInt();
+    result.booked = in.getInt();
+    result.conflicts = in.getInt();
+    result.rejected = in.getInt();
+    for (size_t count = in.getCount(); count > 0; count--) {
+        int64_t line = in.getInt();
+        result.problems.push_back(WsdbTransfer::Problem(line, in.getString()));
+    }
+}
+
+DbImportCommand::DbImportCommand(std::string filename, DbImportCallback *cb) :
+    filename(filename), format(WsdbTransfer::formatOf(filename)), callback(cb) {
+}
+
+DbImportCommand::DbImportCommand(WsdbTransfer::Format format, std::string contents, std::string readError, DbImportCallback *cb) :
+    format(format), contents(contents), readError(readError), callback(cb) {
+}
+
+DbImportCommand::~DbImportCommand() {
+}
+
+const char *DbImportCommand::getName() {
+    return "Import";
+}
+
+void DbImportCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
+    try {
+        if (!readError.empty())
+            throw std::runtime_error(readError);
+
+        if (filename.empty()) {
+            std::istringstream in(contents);
+            contents.clear();
+            callback->prepare(WsdbTransfer::importReservations(in, format, wsdb));
+        } else {
+            std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+            if (!in)
+                throw std::runtime_error("Could not open " + filename);
+
+            callback->prepare(WsdbTransfer::importReservations(in, format, wsdb));
+        }
+    } catch (std::exception &e) {
+        callback->prepare(e.what());
+    }
+
+    cbQueue.add(callback.release());
+}
+
+void DbImportCommand::fail(const std::string &errorMsg, bool, CommandQueue<DbCallback> &cbQueue) {
+    callback->prepare(errorMsg);
+    cbQueue.add(callback.release());
+}
+
+bool DbImportCommand::encode(WireWriter &out) {
+    // The file is read here, the broker may run as another user and must not open client paths
+    std::string error;
+    std::string data;
+    std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!in) {
+        error = "Could not open " + filename;
+    } else {
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (in.bad())
+            error = "Could not read " + filename;
+        else if (!fitsFrame(data.size()))
+            error = filename + " is too large to send to the broker";
+    }
+
+    out.putInt(WsWire::CmdImport);
+    out.putString(error);
+    out.putInt(format);
+    out.putString(error.empty() ? data : std::string());
+
+    return true;
+}
+
+DbCallback *DbImportCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+
+    return callback.release();
+}
+
+// DbExportCommand ///////////////////////////////////////////////////////
+
+DbExportCallback::DbExportCallback() :
+    records(0) {
+}
+
+void DbExportCallback::prepare(int64_t preRecords) {
+    records = preRecords;
+}
+
+void DbExportCallback::prepare(int64_t preRecords, std::string preContents) {
+    records = preRecords;
+    contents = preContents;
+}
+
+void DbExportCallback::encode(WireWriter &out) {
+    out.putInt(WsWire::ReplyResult);
+    out.putString(errorMsg);
+    out.putInt(records);
+    out.putString(contents);
+}
+
+void DbExportCallback::decode(WireReader &in) {
+    errorMsg = in.getString();
+    records = in.getInt();
+    contents = in.getString();
+}
+
+void DbExportCallback::save(const std::string &filename) {
+    if (!errorMsg.empty())
+        return;
+
+    std::ofstream out(filename.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (out)
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    if (out)
+        out.close();
+    if (!out)
+        errorMsg = "Could not write " + filename;
+    contents.clear();
+}
+
+DbExportCommand::DbExportCommand(std::string filename, DbExportCallback *cb) :
+    filename(filename), format(WsdbTransfer::formatOf(filename)), callback(cb) {
+}
+
+DbExportCommand::DbExportCommand(WsdbTransfer::Format format, DbExportCallback *cb) :
+    format(format), callback(cb) {
+}
+
+DbExportCommand::~DbExportCommand() {
+}
+
+const char *DbExportCommand::getName() {
+    return "Export";
+}
+
+void DbExportCommand::execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue) {
+    try {
+        if (filename.empty()) {
+            // The broker's copy, the client writes the file
+            std::ostringstream out;
+            int64_t records = WsdbTransfer::exportReservations(out, format, wsdb);
+            std::string data = out.str();
+            if (!fitsFrame(data.size()))
+                throw std::runtime_error("The export is too large to send from the broker");
+
+            callback->prepare(records, data);
+        } else {
+            std::ofstream out(filename.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+            if (!out)
+                throw std::runtime_error("Could not create " + filename);
+
+            callback->prepare(WsdbTransfer::exportReservations(out, format, wsdb));
+        }
+    } catch (std::exception &e) {
+        callback->prepare(e.what());
+    }
+
+    cbQueue.add(callback.release());
+}
+
+bool DbExportCommand::isRead() {
+    return true;
+}
+
+void DbExportCommand::fail(const std::string &errorMsg, bool, CommandQueue<DbCallback> &cbQueue) {
+    callback->prepare(errorMsg);
+    cbQueue.add(callback.release());
+}
+
+bool DbExportCommand::encode(WireWriter &out) {
+    out.putInt(WsWire::CmdExport);
+    out.putInt(format);
+
+    return true;
+}
+
+DbCallback *DbExportCommand::decodeResult(WireReader &in) {
+    callback->decode(in);
+    callback->save(filename);
+
+    return callback.release();
+}
@@ -23,27 +23,111 @@
 #ifndef DBCOMMAND_H
 #define DBCOMMAND_H
 
-#include <list>
+#include <vector>
 
 #include "commandqueue.h"
 #include "wsdb.h"
+#include "wsdbtransfer.h"
+#include "wswire.h"
+
+class NamesCache;
 
 // Abstract classes //////////////////////////////////////////////////////////
 
+// When a command reached each stage on its way through ThreadedDb or BrokerLink, in steady_clock
+// us, 0 if it did not. The callback gets a copy once the command finished, see DbStats.
+class DbTiming {
+public:
+    DbTiming() : name(nullptr), queued(0), started(0), finished(0), busy(0) {}
+
+    static int64_t now();
+
+    const char *name; // DbCommand::getName
+    int64_t queued;   // Added to the queue
+    int64_t started;  // Taken from the queue to run
+    int64_t finished; // Its callback was ready for the GUI thread
+    int64_t busy;     // Part of started to finished spent waiting for locks on the file, us
+};
+
 class DbCallback {
 public:
     DbCallback();
     virtual ~DbCallback();
 
     virtual void execute();
+    // Written by the broker for the client's copy of the callback, see DbCommand::reply
+    virtual void encode(WireWriter &out);
+
+    DbTiming &getTiming();
+
+protected:
+    DbTiming timing;
+};
+
+class DbErrorCallback : public DbCallback {
+public:
+    DbErrorCallback();
+
+    // isCause is false when the command was only rolled back because another
+    // command in the same transaction failed
+    void prepare(std::string preErrorMsg, bool preIsCause = true);
+
+    virtual void encode(WireWriter &out);
+
+protected:
+    std::string errorMsg;
+    bool isCause;
 };
 
 class DbCommand {
 public:
-    DbCommand();
+    DbCommand(DbErrorCallback *errCb = nullptr);
     virtual ~DbCommand();
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    // The command type in diagnostics
+    virtual const char *getName();
+
+    // Write commands are grouped into a single transaction by ThreadedDb
+    virtual bool isWrite();
+    // Called instead of execute's callback when the transaction is rolled back
+    virtual void fail(const std::string &errorMsg, bool isCause, CommandQueue<DbCallback> &cbQueue);
+    // Reads may run on one of ThreadedDb's read-only connections instead of the writer
+    virtual bool isRead();
+
+    // Refreshes that return a non-empty key are skipped by ThreadedDb when the same
+    // query already ran against the current change version, unchanged() is called instead
+    virtual std::string queryKey();
+    virtual void unchanged(CommandQueue<DbCallback> &cbQueue);
+
+    // Set by ThreadedDb, the number of writer commands that finish before a reader runs this one
+    void setBarrier(int64_t count);
+    int64_t getBarrier();
+
+    // Stamped by ThreadedDb and BrokerLink as the command moves along
+    DbTiming &getTiming();
+    // Moves the callbacks execute, fail or unchanged left in results to cbQueue, each with a copy of
+    // the timing finished now. A discarded callback is replaced by a plain DbCallback.
+    void finish(CommandQueue<DbCallback> &results, CommandQueue<DbCallback> &cbQueue, bool discard = false);
+
+    // Broker transport, see WsWire. encode writes the command, false if it cannot run on a broker.
+    // reply delivers the callback the broker's copy of the command encoded, exactly one.
+    virtual bool encode(WireWriter &out);
+    virtual void reply(WireReader &in, CommandQueue<DbCallback> &cbQueue);
+
+    // The broker's copy of a client's command. Its callbacks only encode, writes always get an
+    // error callback so a failure reaches the client. nullptr for open and close, which the
+    // broker answers itself as it serves only its own file.
+    static DbCommand *decode(int64_t tag, WireReader &in, NamesCache *cache);
+
+protected:
+    // This command's callback prepared from a ReplyResult
+    virtual DbCallback *decodeResult(WireReader &in);
+
+protected:
+    std::unique_ptr<DbErrorCallback> errorCallback;
+    int64_t barrier;
+    DbTiming timing;
 };
 
 // DbNopCommand /////////////////////////////////////////////////////////////
@@ -54,6 +138,9 @@ public:
     virtual ~DbNopCommand();
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool encode(WireWriter &out);
+    virtual void reply(WireReader &in, CommandQueue<DbCallback> &cbQueue);
 
 protected:
     std::unique_ptr<DbCallback> callback;
@@ -61,23 +148,35 @@ protected:
 
 // DbOpenCommand ////////////////////////////////////////////////////////////
 
-class DbOpenCallback : public DbCallback {
+// Delivered on success too, with an empty error message and the profile that took effect
+class DbOpenCallback : public DbErrorCallback {
 public:
-    void prepare(std::string preErrorMsg);
+    using DbErrorCallback::prepare;
+    void prepare(const Wsdb::StorageProfile &preProfile);
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
 
 protected:
-    std::string errorMsg;
+    Wsdb::StorageProfile profile;
 };
 
 class DbOpenCommand : public DbCommand {
 public:
-    DbOpenCommand(std::string filename, DbOpenCallback *cb);
+    DbOpenCommand(std::string filename, const Wsdb::StorageProfile &clientProfile, DbOpenCallback *cb);
     virtual ~DbOpenCommand();
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual void fail(const std::string &errorMsg, bool isCause, CommandQueue<DbCallback> &cbQueue);
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
 
 protected:
     std::string filename;
+    Wsdb::StorageProfile clientProfile;
     std::unique_ptr<DbOpenCallback> callback;
 };
 
@@ -88,17 +187,26 @@ public:
     DbCloseCommand();
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool encode(WireWriter &out);
 };
 
 // DbGetStationsInfoCommand/////////////////////////////////////////////////
 
 class DbGetStationInfoCallback : public DbCallback {
 public:
+    DbGetStationInfoCallback();
+
     std::vector<Wsdb::StationInfo> *prepare(const Wsdb::Limits &preLimits);
+    void prepareUnchanged();
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
 
 protected:
     std::vector<Wsdb::StationInfo> info;
     Wsdb::Limits limits;
+    bool unchanged; // info is empty, the previous result is still current
 };
 
 class DbGetStationInfoCommand : public DbCommand {
@@ -107,6 +215,14 @@ public:
     virtual ~DbGetStationInfoCommand();
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isRead();
+    virtual std::string queryKey();
+    virtual void unchanged(CommandQueue<DbCallback> &cbQueue);
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
 
 protected:
     std::unique_ptr<DbGetStationInfoCallback> callback;
@@ -116,9 +232,12 @@ protected:
 
 class DbSetStationInfoCommand : public DbCommand {
 public:
-    DbSetStationInfoCommand(const std::vector<Wsdb::StationInfo> &info, const Wsdb::Limits &limits);
+    DbSetStationInfoCommand(const std::vector<Wsdb::StationInfo> &info, const Wsdb::Limits &limits, DbErrorCallback *errCb = nullptr);
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isWrite();
+    virtual bool encode(WireWriter &out);
 
 protected:
     std::vector<Wsdb::StationInfo> info;
@@ -131,18 +250,30 @@ class DbInsertNameCallback : public DbCallback {
 public:
     DbInsertNameCallback(int64_t *bookCount);
 
+    virtual void execute();
+
     void prepare(int64_t num);
 
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+
 protected:
     int64_t *bookCount;
+    int64_t booked;
 };
 
 class DbInsertNameCommand : public DbCommand {
 public:
-    DbInsertNameCommand(int64_t slotStart, int64_t slotStop, int64_t station, std::string name, int64_t attr, DbInsertNameCallback *cb);
+    DbInsertNameCommand(int64_t slotStart, int64_t slotStop, int64_t station, std::string name, int64_t attr, DbInsertNameCallback *cb, DbErrorCallback *errCb = nullptr);
     virtual ~DbInsertNameCommand();
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isWrite();
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
 
 protected:
     int64_t slotStart;
@@ -157,29 +288,61 @@ protected:
 
 class DbSelectNamesCallback : public DbCallback {
 public:
+    DbSelectNamesCallback();
     virtual ~DbSelectNamesCallback();
 
-    void prepare(int64_t slot, int64_t station, const std::string &name, int64_t attr);
+    void prepare(int64_t slot, int64_t station, const char *name, int64_t attr);
+    void prepareUnchanged();
+    void prepareChangeSeq(int64_t seq);
+    void prepareSize(size_t rows);
 
-    class Datum {
+    // Columnar result, all names share one arena so rows need no allocations of their own
+    class Names {
     public:
-        Datum(int64_t slot, int64_t station, const std::string &name, int64_t attr);
-        int64_t slot;
-        int64_t station;
-        std::string name;
-        int64_t attr;
+        void reserve(size_t rows);
+        void append(int64_t slot, int64_t station, const char *name, int64_t attr);
+        size_t size() const {return slot.size();}
+        const char *name(size_t row) const {return arena.c_str() + nameOffset[row];}
+
+        std::vector<int64_t> slot;
+        std::vector<int64_t> station;
+        std::vector<int64_t> attr;
+        std::vector<size_t> nameOffset;
+        std::string arena;
     };
 
+    const Names &names() const {return data;}
+    bool isUnchanged() const {return unchanged;}
+    int64_t getChangeSeq() const {return changeSeq;}
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+    static void encodeNames(const Names &names, WireWriter &out);
+    static void decodeNames(WireReader &in, Names *names);
+
 protected:
-    std::list<Datum *> data;
+    Names data;
+    bool unchanged; // data is empty, the previous result is still current
+    int64_t changeSeq; // data includes all changes up to this sequence number
 };
 
+// With a cache the result is stored there as well. knownSeq is the changeSeq of the cache
+// entry the caller already shows, unchanged() is delivered while that entry is still valid.
 class DbSelectNamesCommand : public DbCommand {
 public:
-    DbSelectNamesCommand(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, DbSelectNamesCallback *cb);
+    DbSelectNamesCommand(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, DbSelectNamesCallback *cb,
+                         NamesCache *cache = nullptr, int64_t knownSeq = -1);
     virtual ~DbSelectNamesCommand();
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isRead();
+    virtual std::string queryKey();
+    virtual void unchanged(CommandQueue<DbCallback> &cbQueue);
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
 
 protected:
     int64_t slotStart;
@@ -187,15 +350,157 @@ protected:
     int64_t stationStart;
     int64_t stationStop;
     std::unique_ptr<DbSelectNamesCallback> callback;
+    NamesCache *cache;
+    int64_t cacheEpoch;
+    int64_t knownSeq;
+};
+
+// DbPrefetchNamesCommand ////////////////////////////////////////////////
+
+// The ranges a prefetch read or found cached, so a client behind a broker can fill its own cache
+class DbPrefetchNamesCallback : public DbCallback {
+public:
+    class Range {
+    public:
+        Range(int64_t slotStart, int64_t slotStop, int64_t changeSeq, std::shared_ptr<const DbSelectNamesCallback::Names> data) :
+            slotStart(slotStart), slotStop(slotStop), changeSeq(changeSeq), data(data) {}
+
+        int64_t slotStart;
+        int64_t slotStop;
+        int64_t changeSeq;
+        std::shared_ptr<const DbSelectNamesCallback::Names> data;
+    };
+
+    void prepare(const Range &range);
+    const std::vector<Range> &fetched() const {return ranges;}
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+
+protected:
+    std::vector<Range> ranges;
+};
+
+// Fills the cache with the ranges shift slots after and before the given one, skipping cached ones
+class DbPrefetchNamesCommand : public DbCommand {
+public:
+    DbPrefetchNamesCommand(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, int64_t shift, NamesCache *cache);
+    virtual ~DbPrefetchNamesCommand();
+
+    virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isRead();
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
+
+protected:
+    int64_t slotStart;
+    int64_t slotStop;
+    int64_t stationStart;
+    int64_t stationStop;
+    int64_t shift;
+    NamesCache *cache;
+    int64_t cacheEpoch;
+    std::unique_ptr<DbPrefetchNamesCallback> callback;
+};
+
+// DbSelectSlotCountsCommand /////////////////////////////////////////////
+
+class DbSelectSlotCountsCallback : public DbCallback {
+public:
+    DbSelectSlotCountsCallback();
+
+    std::vector<int64_t> *prepare();
+    void prepareUnchanged();
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+
+protected:
+    std::vector<int64_t> counts; // Booked stations per slot, from slotStart on
+    bool unchanged; // counts is empty, the previous result is still current
+};
+
+// Reads slot_counts only, reservations are not touched
+class DbSelectSlotCountsCommand : public DbCommand {
+public:
+    DbSelectSlotCountsCommand(int64_t slotStart, int64_t slotStop, DbSelectSlotCountsCallback *cb);
+    virtual ~DbSelectSlotCountsCommand();
+
+    virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isRead();
+    virtual std::string queryKey();
+    virtual void unchanged(CommandQueue<DbCallback> &cbQueue);
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
+
+protected:
+    int64_t slotStart;
+    int64_t slotStop;
+    std::unique_ptr<DbSelectSlotCountsCallback> callback;
+};
+
+// DbSelectUsageCommand //////////////////////////////////////////////////
+
+class DbSelectUsageCallback : public DbCallback {
+public:
+    void prepare(int64_t station, int64_t bucket, int64_t booked);
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+
+    class Usage {
+    public:
+        Usage(int64_t station, int64_t bucket, int64_t booked) :
+            station(station), bucket(bucket), booked(booked) {}
+
+        int64_t station;
+        int64_t bucket;
+        int64_t booked; // Booked slots of the station in the bucket
+    };
+
+protected:
+    std::vector<Usage> usage; // Only buckets with bookings
+};
+
+// Aggregates in SQL, see Wsdb::selectUsage. Long ranges are best queried in pieces.
+class DbSelectUsageCommand : public DbCommand {
+public:
+    DbSelectUsageCommand(int64_t slotStart, int64_t slotStop, int64_t origin, int64_t slotsPerBucket, int64_t bucketsPerCycle, DbSelectUsageCallback *cb);
+    virtual ~DbSelectUsageCommand();
+
+    virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isRead();
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
+
+protected:
+    int64_t slotStart;
+    int64_t slotStop;
+    int64_t origin;
+    int64_t slotsPerBucket;
+    int64_t bucketsPerCycle;
+    std::unique_ptr<DbSelectUsageCallback> callback;
 };
 
 // DbRemoveNamesCommand //////////////////////////////////////////////////
 
 class DbRemoveNamesCommand : public DbCommand {
 public:
-    DbRemoveNamesCommand(int64_t slotStart, int64_t slotStop, int64_t station);
+    DbRemoveNamesCommand(int64_t slotStart, int64_t slotStop, int64_t station, DbErrorCallback *errCb = nullptr);
 
     virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isWrite();
+    virtual bool encode(WireWriter &out);
 
 protected:
     int64_t slotStart;
@@ -203,4 +508,134 @@ protected:
     int64_t station;
 };
 
+// DbSelectChangesCommand ////////////////////////////////////////////////
+
+class DbSelectChangesCallback : public DbCallback {
+public:
+    DbSelectChangesCallback();
+
+    void prepare(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr);
+    void prepareTruncated();
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+
+    class Change {
+    public:
+        Change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr);
+        int64_t seq;
+        int64_t slotStart;
+        int64_t slotStop;
+        int64_t station;
+        std::string name;
+        int64_t attr;
+        bool isRemoval;
+    };
+
+protected:
+    std::vector<Change> changes;
+    bool truncated; // Changes were pruned from the log, reselect everything
+};
+
+class DbSelectChangesCommand : public DbCommand {
+public:
+    DbSelectChangesCommand(int64_t sinceSeq, DbSelectChangesCallback *cb);
+    virtual ~DbSelectChangesCommand();
+
+    virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
+
+protected:
+    int64_t sinceSeq;
+    std::unique_ptr<DbSelectChangesCallback> callback;
+};
+
+// DbImportCommand ///////////////////////////////////////////////////////
+
+// Delivered on success too, with an empty error message
+class DbImportCallback : public DbErrorCallback {
+public:
+    using DbErrorCallback::prepare;
+    void prepare(const WsdbTransfer::ImportResult &preResult);
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+
+protected:
+    WsdbTransfer::ImportResult result;
+};
+
+// Runs on the writer outside ThreadedDb's write transactions, the import commits in batches itself.
+// The client reads the file, a broker only gets its contents and never opens a path it was sent.
+class DbImportCommand : public DbCommand {
+public:
+    DbImportCommand(std::string filename, DbImportCallback *cb);
+    // The broker's copy, readError is set if the client could not read the file
+    DbImportCommand(WsdbTransfer::Format format, std::string contents, std::string readError, DbImportCallback *cb);
+    virtual ~DbImportCommand();
+
+    virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual void fail(const std::string &errorMsg, bool isCause, CommandQueue<DbCallback> &cbQueue);
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
+
+protected:
+    std::string filename;
+    WsdbTransfer::Format format;
+    std::string contents;
+    std::string readError;
+    std::unique_ptr<DbImportCallback> callback;
+};
+
+// DbExportCommand ///////////////////////////////////////////////////////
+
+// Delivered on success too, with an empty error message
+class DbExportCallback : public DbErrorCallback {
+public:
+    DbExportCallback();
+
+    using DbErrorCallback::prepare;
+    void prepare(int64_t preRecords);
+    void prepare(int64_t preRecords, std::string preContents);
+
+    virtual void encode(WireWriter &out);
+    void decode(WireReader &in);
+    // Writes the contents a broker sent, sets the error message if that fails
+    void save(const std::string &filename);
+
+protected:
+    int64_t records;
+    std::string contents; // Only from a broker
+};
+
+// A broker sends back the exported contents and the client writes the file
+class DbExportCommand : public DbCommand {
+public:
+    DbExportCommand(std::string filename, DbExportCallback *cb);
+    // The broker's copy
+    DbExportCommand(WsdbTransfer::Format format, DbExportCallback *cb);
+    virtual ~DbExportCommand();
+
+    virtual void execute(Wsdb &wsdb, CommandQueue<DbCallback> &cbQueue);
+    virtual const char *getName();
+    virtual bool isRead();
+    virtual void fail(const std::string &errorMsg, bool isCause, CommandQueue<DbCallback> &cbQueue);
+    virtual bool encode(WireWriter &out);
+
+protected:
+    virtual DbCallback *decodeResult(WireReader &in);
+
+protected:
+    std::string filename; // Empty in the broker's copy
+    WsdbTransfer::Format format;
+    std::unique_ptr<DbExportCallback> callback;
+};
+
 #endif // DBCOMMAND_H
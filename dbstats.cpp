@@ -0,0 +1,218 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "dbstats.h"
+
+const int64_t DbHistogram::subBuckets = 16;
+const int64_t DbHistogram::maxValue = static_cast<int64_t>(1) << 36; // About 19 h
+
+const char *const DbStats::stageNames[numStages] = {"queue", "busy", "execute", "delivery", "callback", "total"};
+const char *const DbStats::priorityNames[numPriorities] = {"interactive", "visible", "background"};
+
+// DbHistogram ///////////////////////////////////////////////////////////////
+
+DbHistogram::DbHistogram() : count(0), sum(0), max(0) {
+}
+
+void DbHistogram::record(int64_t value) {
+    value = std::min(std::max<int64_t>(value, 0), maxValue);
+
+    size_t bucket = bucketFor(value);
+    if (buckets.size() <= bucket)
+        buckets.resize(bucket + 1, 0);
+
+    buckets[bucket]++;
+    count++;
+    sum += value;
+    max = std::max(max, value);
+}
+
+int64_t DbHistogram::getCount() const {
+    return count;
+}
+
+int64_t DbHistogram::getMax() const {
+    return max;
+}
+
+double DbHistogram::getMean() const {
+    return count > 0 ? static_cast<double>(sum) / static_cast<double>(count) : 0.0;
+}
+
+int64_t DbHistogram::getPercentile(double percent) const {
+    if (count == 0)
+        return 0;
+
+    int64_t rank = static_cast<int64_t>(std::ceil(percent / 100.0 * static_cast<double>(count)));
+    rank = std::min(std::max<int64_t>(rank, 1), count);
+
+    int64_t seen = 0;
+    for (size_t bucket = 0; bucket < buckets.size(); bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank)
+            return std::min(highestIn(bucket), max);
+    }
+
+    return max;
+}
+
+size_t DbHistogram::bucketFor(int64_t value) {
+    if (value < 2 * subBuckets)
+        return static_cast<size_t>(value);
+
+    // Shift until the value fits in the upper half of the sub buckets
+    int64_t shift = 0;
+    while ((value >> shift) >= 2 * subBuckets)
+        shift++;
+
+    return static_cast<size_t>(shift * subBuckets + (value >> shift));
+}
+
+int64_t DbHistogram::highestIn(size_t bucket) {
+    int64_t index = static_cast<int64_t>(bucket);
+
+    if (index < 2 * subBuckets)
+        return index;
+
+    int64_t shift = index / subBuckets - 1;
+    int64_t mantissa = index % subBuckets + subBuckets;
+
+    return ((mantissa + 1) << shift) - 1;
+}
+
+// DbStats ///////////////////////////////////////////////////////////////////
+
+DbStats::DbStats() {
+    reset();
+}
+
+void DbStats::record(const DbTiming &timing, int64_t delivered, int64_t done) {
+    // Callbacks made outside a queue, such as those of a closing connection, carry no timing
+    if (timing.name == nullptr || timing.queued == 0 || timing.finished == 0)
+        return;
+
+    std::vector<DbHistogram> &stages = commands[timing.name];
+    if (stages.empty())
+        stages.resize(numStages);
+
+    // A command that failed before it was taken from the queue spent all of it waiting
+    int64_t started = timing.started != 0 ? timing.started : timing.finished;
+
+    stages[StageQueue].record(started - timing.queued);
+    stages[StageBusy].record(timing.busy);
+    stages[StageExecute].record(std::max<int64_t>(0, timing.finished - started - timing.busy));
+    stages[StageDelivery].record(delivered - timing.finished);
+    stages[StageCallback].record(done - delivered);
+    stages[StageTotal].record(done - timing.queued);
+}
+
+void DbStats::setDepth(QueuePriority priority, size_t newDepth) {
+    size_t lane = std::min<size_t>(priority, PriorityBackground);
+
+    depth[lane] = newDepth;
+    peakDepth[lane] = std::max(peakDepth[lane], newDepth);
+}
+
+void DbStats::reset() {
+    commands.clear();
+    for (size_t lane = 0; lane < numPriorities; lane++) {
+        depth[lane] = 0;
+        peakDepth[lane] = 0;
+    }
+    since = DbTiming::now();
+}
+
+std::vector<std::string> DbStats::getCommands() const {
+    std::vector<std::string> names;
+
+    for (auto &entry : commands)
+        names.push_back(entry.first);
+
+    return names;
+}
+
+const DbHistogram &DbStats::getHistogram(const std::string &command, Stage stage) const {
+    static const DbHistogram empty;
+
+    auto entry = commands.find(command);
+    if (entry == commands.end() || stage >= numStages)
+        return empty;
+
+    return entry->second[stage];
+}
+
+size_t DbStats::getDepth(QueuePriority priority) const {
+    return depth[std::min<size_t>(priority, PriorityBackground)];
+}
+
+size_t DbStats::getPeakDepth(QueuePriority priority) const {
+    return peakDepth[std::min<size_t>(priority, PriorityBackground)];
+}
+
+int64_t DbStats::getSince() const {
+    return since;
+}
+
+std::string DbStats::toJson() const {
+    std::ostringstream out;
+
+    // Command and stage names are plain identifiers, nothing needs escaping
+    out << std::fixed << std::setprecision(1);
+    out << "{\n  \"unit\": \"us\",\n  \"seconds\": " << static_cast<double>(DbTiming::now() - since) / 1e6 << ",\n";
+
+    out << "  \"queues\": {";
+    for (size_t lane = 0; lane < numPriorities; lane++) {
+        out << (lane == 0 ? "\n" : ",\n");
+        out << "    \"" << priorityNames[lane] << "\": {\"depth\": " << depth[lane] << ", \"peak\": " << peakDepth[lane] << "}";
+    }
+    out << "\n  },\n";
+
+    out << "  \"commands\": {";
+    bool isFirst = true;
+    for (auto &entry : commands) {
+        out << (isFirst ? "\n" : ",\n");
+        isFirst = false;
+
+        out << "    \"" << entry.first << "\": {";
+        for (size_t stage = 0; stage < numStages; stage++) {
+            const DbHistogram &hist = entry.second[stage];
+
+            out << (stage == 0 ? "\n" : ",\n");
+            out << "      \"" << stageNames[stage] << "\": {\"count\": " << hist.getCount()
+                << ", \"mean\": " << hist.getMean()
+                << ", \"p50\": " << hist.getPercentile(50)
+                << ", \"p90\": " << hist.getPercentile(90)
+                << ", \"p99\": " << hist.getPercentile(99)
+                << ", \"max\": " << hist.getMax() << "}";
+        }
+        out << "\n    }";
+    }
+    out << (commands.empty() ? "}\n" : "\n  }\n");
+    out << "}\n";
+
+    return out.str();
+}
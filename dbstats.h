@@ -0,0 +1,100 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef DBSTATS_H
+#define DBSTATS_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "commandqueue.h"
+#include "dbcommand.h"
+
+// Durations in us, counted in buckets as HdrHistogram does: exact below 2 * subBuckets,
+// above that each power of two is split into subBuckets, so a value is off by at most 1/16.
+class DbHistogram {
+public:
+    static const int64_t subBuckets;
+    static const int64_t maxValue; // Larger values count as this
+
+    DbHistogram();
+
+    void record(int64_t value);
+
+    int64_t getCount() const;
+    int64_t getMax() const;
+    double getMean() const;
+    // The largest value of the bucket holding the given share of the values, 0 if none
+    int64_t getPercentile(double percent) const;
+
+private:
+    static size_t bucketFor(int64_t value);
+    static int64_t highestIn(size_t bucket);
+
+private:
+    std::vector<int64_t> buckets; // Grown to the largest bucket used
+    int64_t count;
+    int64_t sum;
+    int64_t max;
+};
+
+// Where the time of each command type goes, from the timing its callback carries, see DbTiming:
+//   queue     queued until started, including a read waiting for earlier writes
+//   busy      waiting for locks other connections hold on the file, up to the busy timeout
+//   execute   started until its callback was ready without the busy wait, the query;
+//             the round trip on a broker
+//   delivery  ready until the GUI thread took the callback
+//   callback  running the callback, mostly updating the views
+//   total     queued until the callback returned
+// Queue depths are gauges with the peak since the last reset. GUI thread only.
+class DbStats {
+public:
+    enum Stage {StageQueue, StageBusy, StageExecute, StageDelivery, StageCallback, StageTotal, numStages};
+
+    static const char *const stageNames[numStages];
+    static const char *const priorityNames[numPriorities];
+
+    DbStats();
+
+    // delivered is when checkCallbacks took the callback, done when it returned
+    void record(const DbTiming &timing, int64_t delivered, int64_t done);
+    void setDepth(QueuePriority priority, size_t depth);
+    void reset();
+
+    std::vector<std::string> getCommands() const;
+    const DbHistogram &getHistogram(const std::string &command, Stage stage) const; // Empty if none
+    size_t getDepth(QueuePriority priority) const;
+    size_t getPeakDepth(QueuePriority priority) const;
+    int64_t getSince() const; // steady_clock us of the last reset
+
+    std::string toJson() const;
+
+private:
+    std::map<std::string, std::vector<DbHistogram> > commands; // numStages each
+    size_t depth[numPriorities];
+    size_t peakDepth[numPriorities];
+    int64_t since;
+};
+
+#endif // DBSTATS_H
@@ -62,7 +62,7 @@ void DescriptionDialog::on_removeWorkstation_clicked() {
 }
 
 void DescriptionDialog::on_accepted() {
-    tdb->queueCommand(new DbSetStationInfoCommand(info(), limits()));
+    tdb->queueCommand(new DbSetStationInfoCommand(info(), limits(), ws->newWriteErrorCallback()));
     ws->refreshAll();
 }
 
@@ -0,0 +1,103 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <QClipboard>
+#include <QGuiApplication>
+#include <QTableWidgetItem>
+
+#include "diagnosticsdialog.h"
+#include "ui_diagnosticsdialog.h"
+
+static const int refreshInterval = 1000; // ms
+
+DiagnosticsDialog::DiagnosticsDialog(WorkstationScheduler *ws, ThreadedDb *tdb) :
+    QDialog(ws),
+    ui(new Ui::DiagnosticsDialog),
+    tdb(tdb) {
+    ui->setupUi(this);
+    setWindowTitle("Diagnostics");
+
+    ui->table->setColumnCount(2 + DbStats::numStages);
+    ui->table->setHorizontalHeaderItem(0, new QTableWidgetItem("Command"));
+    ui->table->setHorizontalHeaderItem(1, new QTableWidgetItem("Count"));
+    for (int stage = 0; stage < DbStats::numStages; stage++) {
+        QString name = QString::fromUtf8(DbStats::stageNames[stage]);
+        ui->table->setHorizontalHeaderItem(2 + stage, new QTableWidgetItem(name.left(1).toUpper() + name.mid(1)));
+    }
+
+    connect(&refreshTimer, &QTimer::timeout, this, &DiagnosticsDialog::showStats);
+    refreshTimer.start(refreshInterval);
+    showStats();
+}
+
+DiagnosticsDialog::~DiagnosticsDialog() {
+    delete ui;
+}
+
+void DiagnosticsDialog::on_copyJson_clicked() {
+    QGuiApplication::clipboard()->setText(QString::fromStdString(tdb->getStats().toJson()));
+}
+
+void DiagnosticsDialog::on_resetStats_clicked() {
+    tdb->getStats().reset();
+    showStats();
+}
+
+void DiagnosticsDialog::showStats() {
+    const DbStats &stats = tdb->getStats();
+    std::vector<std::string> commands = stats.getCommands();
+
+    QString queues = QString::fromUtf8(tdb->hasBroker() ? "Waiting for the broker:" : "Queued:");
+    for (int priority = 0; priority < numPriorities; priority++) {
+        queues += QString::fromUtf8(" %1 %2 (peak %3)").arg(QString::fromUtf8(DbStats::priorityNames[priority]))
+                  .arg(static_cast<long long>(stats.getDepth(static_cast<QueuePriority>(priority))))
+                  .arg(static_cast<long long>(stats.getPeakDepth(static_cast<QueuePriority>(priority))));
+    }
+    ui->queues->setText(queues);
+
+    // Each cell shows the median and the 99th percentile, the tooltip the rest
+    ui->table->setRowCount(static_cast<int>(commands.size()));
+    for (size_t row = 0; row < commands.size(); row++) {
+        const DbHistogram &total = stats.getHistogram(commands[row], DbStats::StageTotal);
+
+        ui->table->setItem(static_cast<int>(row), 0, new QTableWidgetItem(QString::fromStdString(commands[row])));
+        ui->table->setItem(static_cast<int>(row), 1, new QTableWidgetItem(QString::number(static_cast<long long>(total.getCount()))));
+
+        for (int stage = 0; stage < DbStats::numStages; stage++) {
+            const DbHistogram &hist = stats.getHistogram(commands[row], static_cast<DbStats::Stage>(stage));
+            QTableWidgetItem *item = new QTableWidgetItem(formatMs(hist.getPercentile(50)) + " / " + formatMs(hist.getPercentile(99)));
+
+            item->setToolTip(QString::fromUtf8("mean %1 ms\np90 %2 ms\nmax %3 ms")
+                             .arg(hist.getMean() / 1000.0, 0, 'f', 1)
+                             .arg(formatMs(hist.getPercentile(90)))
+                             .arg(formatMs(hist.getMax())));
+            ui->table->setItem(static_cast<int>(row), 2 + stage, item);
+        }
+    }
+
+    double seconds = static_cast<double>(DbTiming::now() - stats.getSince()) / 1e6;
+    ui->status->setText(QString::fromUtf8("Milliseconds, median / 99th percentile, over the last %1 s").arg(seconds, 0, 'f', 0));
+}
+
+QString DiagnosticsDialog::formatMs(int64_t us) {
+    return QString::number(static_cast<double>(us) / 1000.0, 'f', 1);
+}
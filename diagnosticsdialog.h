@@ -0,0 +1,61 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef DIAGNOSTICSDIALOG_H
+#define DIAGNOSTICSDIALOG_H
+
+#include <QDialog>
+#include <QString>
+#include <QTimer>
+
+#include "dbstats.h"
+#include "threadeddb.h"
+#include "workstationscheduler.h"
+
+namespace Ui {
+class DiagnosticsDialog;
+}
+
+// Where the time of database commands goes, by command type and stage, see DbStats. Kept current
+// while open; the JSON copy is what to attach when someone reports that scheduling is slow.
+class DiagnosticsDialog : public QDialog {
+    Q_OBJECT
+
+public:
+    explicit DiagnosticsDialog(WorkstationScheduler *ws, ThreadedDb *tdb);
+    ~DiagnosticsDialog();
+
+private slots:
+    void on_copyJson_clicked();
+    void on_resetStats_clicked();
+    void showStats();
+
+private:
+    static QString formatMs(int64_t us);
+
+private:
+    Ui::DiagnosticsDialog *ui;
+    ThreadedDb *tdb;
+    QTimer refreshTimer;
+};
+
+#endif // DIAGNOSTICSDIALOG_H
@@ -0,0 +1,162 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include <QFontMetrics>
+#include <QHelpEvent>
+#include <QPainter>
+#include <QToolTip>
+
+#include "heatmapview.h"
+
+static const QRgb noDataColor = 0xFFE0E0E0;
+
+// White for free, dark red like the red limit for fully booked
+static QRgb heatColor(double value) {
+    if (value < 0)
+        return noDataColor;
+
+    value = std::min(value, 1.0);
+    int red   = static_cast<int> (255 - value * (255 - 0xC0));
+    int other = static_cast<int> (255 - value * 255);
+
+    return qRgb(red, other, other);
+}
+
+HeatmapView::HeatmapView(QWidget *parent) : QWidget(parent) {
+    setMinimumSize(200, 100);
+}
+
+HeatmapView::~HeatmapView() {
+}
+
+void HeatmapView::setLabels(const QStringList &newRowLabels, const QStringList &newColumnLabels) {
+    rowLabels = newRowLabels;
+    columnLabels = newColumnLabels;
+
+    values.assign(static_cast<size_t> (rowLabels.size()) * static_cast<size_t> (columnLabels.size()), -1);
+    image = QImage(std::max(columnLabels.size(), 1), std::max(rowLabels.size(), 1), QImage::Format_RGB32);
+    image.fill(noDataColor);
+    update();
+}
+
+void HeatmapView::setValue(int row, int col, double value) {
+    if (row < 0 || row >= rowLabels.size() || col < 0 || col >= columnLabels.size())
+        return;
+
+    values[static_cast<size_t> (row) * static_cast<size_t> (columnLabels.size()) + static_cast<size_t> (col)] = static_cast<float> (value);
+    image.setPixel(col, row, heatColor(value));
+}
+
+double HeatmapView::value(int row, int col) const {
+    if (row < 0 || row >= rowLabels.size() || col < 0 || col >= columnLabels.size())
+        return -1;
+
+    return values[static_cast<size_t> (row) * static_cast<size_t> (columnLabels.size()) + static_cast<size_t> (col)];
+}
+
+QString HeatmapView::columnLabel(int col) const {
+    if (col < 0 || col >= columnLabels.size())
+        return QString();
+
+    return columnLabels[col];
+}
+
+bool HeatmapView::event(QEvent *event) {
+    if (event->type() != QEvent::ToolTip)
+        return QWidget::event(event);
+
+    QHelpEvent *help = static_cast<QHelpEvent *> (event);
+    int row;
+    int col;
+
+    if (!cellAt(help->pos(), &row, &col)) {
+        QToolTip::hideText();
+        event->ignore();
+        return true;
+    }
+
+    QString text = rowLabels[row] + QString::fromUtf8("\n") + columnLabels[col] + QString::fromUtf8("\n");
+    double val = value(row, col);
+    if (val < 0)
+        text += QString::fromUtf8("Loading");
+    else
+        text += QString::number(val * 100, 'f', 1) + QString::fromUtf8(" % booked");
+    QToolTip::showText(help->globalPos(), text, this);
+
+    return true;
+}
+
+void HeatmapView::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    QRect grid = gridRect();
+    QFontMetrics metrics(font());
+    int lineHeight = metrics.height();
+
+    painter.fillRect(rect(), palette().window());
+    if (rowLabels.isEmpty() || columnLabels.isEmpty())
+        return;
+
+    painter.drawImage(grid, image);
+
+    // Label every nth row and column so the labels do not overlap
+    int rows = rowLabels.size();
+    int rowStep = std::max(1, (lineHeight * rows + grid.height() - 1) / std::max(grid.height(), 1));
+    for (int row = 0; row < rows; row += rowStep) {
+        int y = grid.top() + static_cast<int> ((row + 0.5) * grid.height() / rows);
+        painter.drawText(QRect(0, y - lineHeight / 2, grid.left() - 4, lineHeight), Qt::AlignRight | Qt::AlignVCenter, rowLabels[row]);
+    }
+
+    int cols = columnLabels.size();
+    int labelWidth = metrics.horizontalAdvance(columnLabels[0]) + 12;
+    int colStep = std::max(1, (labelWidth * cols + grid.width() - 1) / std::max(grid.width(), 1));
+    for (int col = 0; col < cols; col += colStep) {
+        int x = grid.left() + col * grid.width() / cols;
+        painter.drawText(QRect(x, 0, labelWidth, grid.top()), Qt::AlignLeft | Qt::AlignVCenter, columnLabels[col]);
+    }
+}
+
+QRect HeatmapView::gridRect() const {
+    QFontMetrics metrics(font());
+    int labelWidth = 0;
+
+    for (auto &label : rowLabels)
+        labelWidth = std::max(labelWidth, metrics.horizontalAdvance(label));
+
+    int left = labelWidth + 8;
+    int top = metrics.height() + 4;
+
+    return QRect(left, top, std::max(width() - left, 1), std::max(height() - top, 1));
+}
+
+bool HeatmapView::cellAt(const QPoint &pos, int *row, int *col) const {
+    QRect grid = gridRect();
+
+    if (rowLabels.isEmpty() || columnLabels.isEmpty() || !grid.contains(pos))
+        return false;
+
+    *row = std::min((pos.y() - grid.top()) * rowLabels.size() / grid.height(), rowLabels.size() - 1);
+    *col = std::min((pos.x() - grid.left()) * columnLabels.size() / grid.width(), columnLabels.size() - 1);
+
+    return true;
+}
@@ -0,0 +1,63 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef HEATMAPVIEW_H
+#define HEATMAPVIEW_H
+
+#include <vector>
+
+#include <QImage>
+#include <QRect>
+#include <QStringList>
+#include <QWidget>
+
+// Grid of values between 0 and 1, drawn one pixel per cell and scaled to the widget, so
+// thousands of columns cost no more than a few. Hovering a cell shows its labels and value.
+class HeatmapView : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit HeatmapView(QWidget *parent = nullptr);
+    virtual ~HeatmapView();
+
+    // Clears every value
+    void setLabels(const QStringList &rowLabels, const QStringList &columnLabels);
+    void setValue(int row, int col, double value); // Negative for no data, shown after update()
+    double value(int row, int col) const;
+    QString columnLabel(int col) const;
+
+protected:
+    virtual bool event(QEvent *event);
+    virtual void paintEvent(QPaintEvent *event);
+
+private:
+    QRect gridRect() const;
+    bool cellAt(const QPoint &pos, int *row, int *col) const;
+
+private:
+    QStringList rowLabels;
+    QStringList columnLabels;
+    std::vector<float> values;
+    QImage image;
+};
+
+#endif // HEATMAPVIEW_H
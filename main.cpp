@@ -21,10 +21,15 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include "workstationscheduler.h"
+#include "wscommandline.h"
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+    // Imports and exports run without a display
+    if (WsCommandLine::isRequested(argc, argv))
+        return WsCommandLine::run(argc, argv);
+
     QApplication a(argc, argv);
     WorkstationScheduler w;
     w.show();
@@ -0,0 +1,197 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include "namescache.h"
+
+class NamesCacheChanges : public WsdbChangeCallback {
+public:
+    NamesCacheChanges() : lastSeq(-1) {}
+
+    virtual void change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr);
+
+    class Change {
+    public:
+        Change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station) :
+            seq(seq), slotStart(slotStart), slotStop(slotStop), station(station) {}
+
+        int64_t seq;
+        int64_t slotStart;
+        int64_t slotStop;
+        int64_t station;
+    };
+
+    std::vector<Change> changes;
+    int64_t lastSeq;
+};
+
+void NamesCacheChanges::change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *, int64_t) {
+    changes.push_back(Change(seq, slotStart, slotStop, station));
+    lastSeq = std::max(lastSeq, seq);
+}
+
+bool NamesCache::Range::operator==(const Range &other) const {
+    return slotStart == other.slotStart && slotStop == other.slotStop &&
+            stationStart == other.stationStart && stationStop == other.stationStop;
+}
+
+bool NamesCache::Range::overlaps(int64_t slotStartA, int64_t slotStopA, int64_t station) const {
+    return slotStartA <= slotStop && slotStopA >= slotStart && station >= stationStart && station <= stationStop;
+}
+
+NamesCache::NamesCache(size_t capacity) :
+    capacity(capacity), epoch(0), useCount(0), generation(-1), seenSeq(-1) {
+}
+
+bool NamesCache::lookup(const Range &range, std::shared_ptr<const Names> *data, int64_t *changeSeq) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Entry *entry = find(range);
+    if (entry == nullptr)
+        return false;
+
+    entry->lastUse = ++useCount;
+    *data = entry->data;
+    *changeSeq = entry->changeSeq;
+
+    return true;
+}
+
+void NamesCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    entries.clear();
+    epoch++;
+    seenSeq = -1;
+}
+
+int64_t NamesCache::getEpoch() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return epoch;
+}
+
+void NamesCache::sync(Wsdb &wsdb, int64_t gen) {
+    std::lock_guard<std::mutex> syncLock(syncMutex);
+    int64_t since;
+    int64_t syncEpoch;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (gen < generation)
+            return;
+
+        since = gen == generation ? seenSeq : -1;
+        syncEpoch = epoch;
+    }
+
+    int64_t last = wsdb.getLastChange();
+    if (since >= 0 && last == since)
+        return;
+
+    // Read the log before locking, lookups from the GUI thread must not wait on the file
+    NamesCacheChanges log;
+    bool complete = since >= 0 && wsdb.selectChanges(since, log);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Cleared meanwhile, start over on the next sync
+    if (syncEpoch != epoch)
+        return;
+
+    if (!complete) {
+        entries.clear();
+    } else {
+        for (auto &change : log.changes)
+            drop(change.seq, change.slotStart, change.slotStop, change.station);
+    }
+
+    generation = gen;
+    seenSeq = std::max(last, log.lastSeq);
+}
+
+void NamesCache::apply(const std::vector<DbSelectChangesCallback::Change> &changes, bool complete) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!complete) {
+        entries.clear();
+        return;
+    }
+
+    for (auto &change : changes)
+        drop(change.seq, change.slotStart, change.slotStop, change.station);
+}
+
+bool NamesCache::contains(const Range &range, int64_t changeSeq) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Entry *entry = find(range);
+
+    return entry != nullptr && (changeSeq < 0 || entry->changeSeq == changeSeq);
+}
+
+void NamesCache::store(int64_t epochA, const Range &range, int64_t changeSeq, std::shared_ptr<const Names> data) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (epochA != epoch)
+        return;
+
+    // Another connection synced past the select meanwhile. The changes it dropped were never checked
+    // against this result, which would then pass for current until the range changed again.
+    if (changeSeq < seenSeq)
+        return;
+
+    Entry *entry = find(range);
+    if (entry) {
+        entry->changeSeq = changeSeq;
+        entry->data = data;
+        entry->lastUse = ++useCount;
+        return;
+    }
+
+    if (entries.size() >= capacity && !entries.empty()) {
+        auto oldest = std::min_element(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.lastUse < b.lastUse;
+        });
+        entries.erase(oldest);
+    }
+
+    entries.push_back(Entry(range, changeSeq, data, ++useCount));
+}
+
+NamesCache::Entry *NamesCache::find(const Range &range) {
+    for (auto &entry : entries) {
+        if (entry.range == range)
+            return &entry;
+    }
+
+    return nullptr;
+}
+
+void NamesCache::drop(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station) {
+    // Entries selected after the change already contain it
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [=](const Entry &entry) {
+        return seq > entry.changeSeq && entry.range.overlaps(slotStart, slotStop, station);
+    }), entries.end());
+}
@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef NAMESCACHE_H
+#define NAMESCACHE_H
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "dbcommand.h"
+#include "wsdb.h"
+
+// Recent selectNames results, so date navigation can render before the worker answers.
+// clear and getEpoch are for the GUI thread, the rest for ThreadedDb's connections and lookup for both.
+class NamesCache {
+public:
+    typedef DbSelectNamesCallback::Names Names;
+
+    class Range {
+    public:
+        Range(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop) :
+            slotStart(slotStart), slotStop(slotStop), stationStart(stationStart), stationStop(stationStop) {}
+
+        bool operator==(const Range &other) const;
+        bool overlaps(int64_t slotStartA, int64_t slotStopA, int64_t station) const;
+
+        int64_t slotStart;
+        int64_t slotStop;
+        int64_t stationStart;
+        int64_t stationStop;
+    };
+
+    NamesCache(size_t capacity = 32);
+
+    // Returns false on a miss, changeSeq is the change log sequence data is current to
+    bool lookup(const Range &range, std::shared_ptr<const Names> *data, int64_t *changeSeq);
+    // Drops every entry, including results of selects queued before the call
+    void clear();
+    int64_t getEpoch();
+
+    // Drops entries touched by changes logged since the last sync, everything if the log was pruned.
+    // generation is the writer's generation for the file wsdb has open, older connections are ignored.
+    void sync(Wsdb &wsdb, int64_t generation);
+    // The same for changes a broker pushed, instead of reading the log
+    void apply(const std::vector<DbSelectChangesCallback::Change> &changes, bool complete);
+    bool contains(const Range &range, int64_t changeSeq = -1); // Any sequence if changeSeq < 0
+    // Ignored if clear was called after epoch was taken, or if a sync already went past changeSeq
+    void store(int64_t epoch, const Range &range, int64_t changeSeq, std::shared_ptr<const Names> data);
+
+private:
+    class Entry {
+    public:
+        Entry(const Range &range, int64_t changeSeq, std::shared_ptr<const Names> data, int64_t lastUse) :
+            range(range), changeSeq(changeSeq), data(data), lastUse(lastUse) {}
+
+        Range range;
+        int64_t changeSeq;
+        std::shared_ptr<const Names> data;
+        int64_t lastUse;
+    };
+
+    Entry *find(const Range &range);
+    void drop(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station); // Call with mutex held
+
+private:
+    std::mutex mutex;
+    std::mutex syncMutex; // Held while reading the log so syncs from two connections do not interleave
+    std::vector<Entry> entries;
+    size_t capacity;
+    int64_t epoch;
+    int64_t useCount;
+    int64_t generation;
+    int64_t seenSeq;
+};
+
+#endif // NAMESCACHE_H
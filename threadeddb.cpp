@@ -21,36 +21,141 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include <chrono>
+#include <ctime>
+#include <exception>
+#include <memory>
+#include <random>
+#include <vector>
 
 #include "threadeddb.h"
 
-static void startThreadedDb(ThreadedDb *tdb) {
-    tdb->run();
+const size_t ThreadedDb::numReaders = 3; // Info, daily and workstation refreshes each get their own
+const int64_t ThreadedDb::maintenanceIdle = 10000; // The timed refresh leaves gaps of 30 s
+const int64_t ThreadedDb::maintenanceBudget = 200;
+const int64_t ThreadedDb::maintenanceInterval = 6 * 3600;
+const int64_t ThreadedDb::maintenanceLease = 600;
+
+// runningId of a maintenance step on the writer, never a refresh id
+static const size_t maintenanceId = static_cast<size_t>(-1);
+
+static int64_t steadyMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-ThreadedDb::ThreadedDb() : outstandingCommands(0) {
-    thread = new std::thread(startThreadedDb, this);
+static bool isWriteCommand(DbCommand *cmd) {
+    return cmd != nullptr && cmd->isWrite();
+}
+
+ThreadedDb::ThreadedDb(const std::string &brokerAddress) :
+    outstandingCommands(0), writerQueued(0), writerDone(0), fileGeneration(-1), wakePending(false),
+    lastQueued(steadyMs()), maintenanceGeneration(-1) {
+    std::random_device seed;
+    maintenanceOwner = (static_cast<int64_t>(seed()) << 31) ^ static_cast<int64_t>(seed()) ^ static_cast<int64_t>(time(nullptr));
+
+    if (!brokerAddress.empty()) {
+        broker.reset(new BrokerLink(brokerAddress, &namesCache, [this] {wake();}));
+        return;
+    }
+
+    for (size_t count = 0; count < numReaders; count++)
+        readers.emplace_back(new Connection());
+
+    writer.thread = new std::thread([this] {runWriter();});
+    for (auto &reader : readers) {
+        Connection *conn = reader.get();
+        conn->thread = new std::thread([this, conn] {runReader(conn);});
+    }
 }
 
 ThreadedDb::~ThreadedDb() {
-    cmdQueue.add(new DbCloseCommand());
-    cmdQueue.add(nullptr);
+    // Writes are interactive and still run first, refreshes left behind are dropped
+    setWakeup(nullptr);
+    if (broker) {
+        broker.reset();
+        return;
+    }
+
+    writer.cmdQueue.add(new DbCloseCommand(), 0, PriorityInteractive);
+    writer.cmdQueue.add(nullptr, 0, PriorityInteractive);
+    cancelRun(writer, maintenanceId);
+    for (auto &reader : readers)
+        reader->cmdQueue.add(nullptr, 0, PriorityInteractive);
 
-    thread->join();
-    delete thread;
+    writer.thread->join();
+    delete writer.thread;
+
+    for (auto &reader : readers) {
+        reader->thread->join();
+        delete reader->thread;
+    }
 }
 
 void ThreadedDb::queueCommand(DbCommand *cmd, size_t refreshId) {
-    outstandingCommands += cmdQueue.add(cmd, refreshId);
+    queueCommand(cmd, refreshId, cmd->isWrite() ? PriorityInteractive : PriorityVisible);
+}
+
+void ThreadedDb::queueCommand(DbCommand *cmd, size_t refreshId, QueuePriority priority) {
+    bool wasIdle = outstandingCommands == 0;
+    int added;
+
+    cmd->getTiming().queued = DbTiming::now();
+
+    if (broker) {
+        outstandingCommands += broker->queueCommand(cmd, refreshId, priority);
+        stats.setDepth(priority, broker->getQueueDepth(priority));
+        if (wasIdle)
+            wake();
+        return;
+    }
+
+    // The barrier counts commands, not which ones finished. It still covers every interactive
+    // command queued before the read because the writer never runs a later one ahead of those.
+    Connection &conn = cmd->isRead() ? readerFor(refreshId) : writer;
+
+    // Before the add, once queued the new command may already be the run a later cancel would stop
+    if (refreshId != 0)
+        cancelRun(conn, refreshId);
+
+    if (cmd->isRead()) {
+        cmd->setBarrier(writerQueued);
+        added = conn.cmdQueue.add(cmd, refreshId, priority);
+    } else {
+        // Superseding a queued refresh leaves the count alone, the old one never runs
+        added = conn.cmdQueue.add(cmd, refreshId, priority);
+        writerQueued += added;
+    }
+
+    // Upkeep holds the file, it gives way to any command
+    lastQueued.store(steadyMs(), std::memory_order_relaxed);
+    cancelRun(writer, maintenanceId);
+
+    outstandingCommands += added;
+    stats.setDepth(priority, getQueueDepth(priority));
+    if (wasIdle)
+        wake();
 }
 
 void ThreadedDb::checkCallbacks() {
     DbCallback *cb;
 
-    while ((cb = cbQueue.pop(false))) {
-        outstandingCommands--;
-        cb->execute();
-        delete cb;
+    // Cleared first, so callbacks queued while draining schedule another check
+    wakePending.exchange(false);
+
+    if (broker) {
+        while ((cb = broker->popCallback()))
+            runCallback(cb);
+
+        if (broker->takeChanges() && changeHandler)
+            changeHandler();
+        return;
+    }
+
+    while ((cb = writer.cbQueue.pop(false)))
+        runCallback(cb);
+
+    for (auto &reader : readers) {
+        while ((cb = reader->cbQueue.pop(false)))
+            runCallback(cb);
     }
 }
 
@@ -58,14 +163,340 @@ bool ThreadedDb::isProcessing() {
     return outstandingCommands > 0;
 }
 
-void ThreadedDb::run() {
+void ThreadedDb::setWakeup(std::function<void()> wakeup) {
+    std::lock_guard<std::mutex> lock(wakeupMutex);
+
+    this->wakeup = wakeup;
+}
+
+NamesCache *ThreadedDb::getNamesCache() {
+    return &namesCache;
+}
+
+size_t ThreadedDb::getQueueDepth(QueuePriority priority) {
+    if (broker)
+        return broker->getQueueDepth(priority);
+
+    size_t depth = writer.cmdQueue.getDepth(priority);
+
+    for (auto &reader : readers)
+        depth += reader->cmdQueue.getDepth(priority);
+
+    return depth;
+}
+
+DbStats &ThreadedDb::getStats() {
+    for (int priority = 0; priority < numPriorities; priority++)
+        stats.setDepth(static_cast<QueuePriority>(priority), getQueueDepth(static_cast<QueuePriority>(priority)));
+
+    return stats;
+}
+
+bool ThreadedDb::hasBroker() {
+    return broker != nullptr;
+}
+
+void ThreadedDb::setChangeHandler(std::function<void()> handler) {
+    changeHandler = handler;
+}
+
+void ThreadedDb::wake() {
+    // One wakeup covers every callback queued until checkCallbacks runs
+    if (wakePending.exchange(true))
+        return;
+
+    std::lock_guard<std::mutex> lock(wakeupMutex);
+
+    if (wakeup)
+        wakeup();
+    else
+        wakePending.store(false);
+}
+
+void ThreadedDb::runCallback(DbCallback *cb) {
+    int64_t delivered = DbTiming::now();
+
+    outstandingCommands--;
+    cb->execute();
+    stats.record(cb->getTiming(), delivered, DbTiming::now());
+    delete cb;
+}
+
+void ThreadedDb::runWriter() {
     DbCommand *cmd;
+    size_t refreshId;
+    int64_t delay = maintenanceIdle;
+
+    for (;;) {
+        if (!writer.cmdQueue.waitFor(std::chrono::milliseconds(delay))) {
+            delay = runMaintenance();
+            continue;
+        }
+        delay = maintenanceIdle;
 
-    while ((cmd = cmdQueue.pop())) {
-        cmd->execute(wsdb, cbQueue);
-        delete cmd;
+        if ((cmd = writer.cmdQueue.pop(true, &refreshId)) == nullptr)
+            break;
+        // Busy waits of maintenance or of an earlier open are not the command's
+        writer.wsdb.takeBusyWait();
+        cmd->getTiming().started = DbTiming::now();
+
+        size_t count = 1;
+
+        if (cmd->isWrite()) {
+            count = runWrites(cmd);
+        } else if (refreshId != 0) {
+            runRefresh(writer, cmd, refreshId);
+        } else {
+            cmd->execute(writer.wsdb, writer.results);
+            cmd->getTiming().busy = writer.wsdb.takeBusyWait();
+            cmd->finish(writer.results, writer.cbQueue);
+            delete cmd;
+        }
+        finishWriterCommands(count);
+        wake();
 
         // Use this to simulate a slow filesystem
         //std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
 }
+
+int64_t ThreadedDb::runMaintenance() {
+    int64_t queued = lastQueued.load(std::memory_order_relaxed);
+    int64_t idle = steadyMs() - queued;
+    if (idle < maintenanceIdle)
+        return maintenanceIdle - idle;
+
+    // Displays wait for the snapshot, it comes before upkeep. A cancelled one is built again.
+    if (!writer.wsdb.getFilename().empty()) {
+        beginRun(writer, maintenanceId);
+        if (lastQueued.load(std::memory_order_relaxed) == queued)
+            snapshot.update(writer.wsdb);
+        if (endRun(writer) || lastQueued.load(std::memory_order_relaxed) != queued)
+            return 0;
+    }
+
+    // A round started on another file is dropped, its lease runs out
+    int64_t generation = writer.wsdb.getGeneration();
+    if (maintenanceGeneration != generation) {
+        if (writer.wsdb.getFilename().empty() ||
+            !writer.wsdb.beginMaintenance(maintenanceOwner, time(nullptr), maintenanceInterval, maintenanceLease))
+            return maintenanceIdle;
+
+        maintenanceGeneration = generation;
+    }
+
+    // A command queued before beginRun could not cancel the step, it shows in lastQueued instead
+    beginRun(writer, maintenanceId);
+    if (lastQueued.load(std::memory_order_relaxed) != queued) {
+        endRun(writer);
+        return 0;
+    }
+
+    bool more = writer.wsdb.maintenanceStep(maintenanceBudget);
+    endRun(writer);
+
+    if (more)
+        return 0;
+
+    writer.wsdb.endMaintenance(maintenanceOwner, time(nullptr));
+    maintenanceGeneration = -1;
+
+    return maintenanceIdle;
+}
+
+void ThreadedDb::runReader(Connection *reader) {
+    DbCommand *cmd;
+    size_t refreshId;
+
+    while ((cmd = reader->cmdQueue.pop(true, &refreshId))) {
+        // Waiting for the writer counts as time in the queue
+        waitForWriter(cmd->getBarrier());
+        reopenReader(*reader);
+        reader->wsdb.takeBusyWait();
+        cmd->getTiming().started = DbTiming::now();
+
+        if (refreshId != 0) {
+            runRefresh(*reader, cmd, refreshId);
+        } else {
+            cmd->execute(reader->wsdb, reader->results);
+            cmd->getTiming().busy = reader->wsdb.takeBusyWait();
+            cmd->finish(reader->results, reader->cbQueue);
+            delete cmd;
+        }
+        wake();
+    }
+
+    reader->wsdb.close();
+}
+
+size_t ThreadedDb::runWrites(DbCommand *cmd) {
+    std::vector<std::unique_ptr<DbCommand> > batch;
+    CommandQueue<DbCallback> pending;
+    DbCallback *cb;
+    size_t failed = 0;
+
+    // Execute all queued writes in one transaction and hold their callbacks until commit
+    batch.emplace_back(cmd);
+    try {
+        writer.wsdb.begin();
+        for (size_t count = 0; ; count++) {
+            failed = count;
+            batch[count]->execute(writer.wsdb, writer.results);
+            batch[count]->getTiming().busy = writer.wsdb.takeBusyWait();
+            batch[count]->finish(writer.results, pending);
+
+            if ((cmd = writer.cmdQueue.popIf(isWriteCommand)) == nullptr)
+                break;
+            cmd->getTiming().started = DbTiming::now();
+            batch.emplace_back(cmd);
+        }
+
+        failed = 0;
+        writer.wsdb.pruneChanges();
+        writer.wsdb.commit();
+    } catch (std::exception &e) {
+        writer.wsdb.rollback();
+        batch[failed]->getTiming().busy += writer.wsdb.takeBusyWait();
+
+        while ((cb = writer.results.pop(false)))
+            delete cb;
+        while ((cb = pending.pop(false)))
+            delete cb;
+
+        for (size_t count = 0; count < batch.size(); count++) {
+            batch[count]->fail(e.what(), count == failed, writer.results);
+            batch[count]->finish(writer.results, writer.cbQueue);
+        }
+
+        return batch.size();
+    }
+
+    namesCache.sync(writer.wsdb, writer.generation);
+
+    // Each write waited for the commit too, and for any lock it needed
+    int64_t committed = DbTiming::now();
+    int64_t commitBusy = writer.wsdb.takeBusyWait();
+    while ((cb = pending.pop(false))) {
+        cb->getTiming().finished = committed;
+        cb->getTiming().busy += commitBusy;
+        writer.cbQueue.add(cb);
+    }
+
+    return batch.size();
+}
+
+void ThreadedDb::runRefresh(Connection &conn, DbCommand *cmd, size_t refreshId) {
+    std::unique_ptr<DbCommand> cmdPtr(cmd);
+
+    // Picks up changes by other clients before any cached names are trusted
+    namesCache.sync(conn.wsdb, conn.generation);
+
+    std::string key = cmd->queryKey();
+    int64_t generation = conn.wsdb.getGeneration();
+    int64_t version = key.empty() ? -1 : conn.wsdb.getChangeVersion();
+
+    if (conn.stamps.size() < refreshId)
+        conn.stamps.resize(refreshId);
+    RefreshStamp &stamp = conn.stamps[refreshId - 1];
+
+    // A no-op refresh costs only the version check
+    if (version >= 0 && stamp.generation == generation && stamp.version == version && stamp.key == key) {
+        cmd->unchanged(conn.results);
+        cmd->getTiming().busy = conn.wsdb.takeBusyWait();
+        cmd->finish(conn.results, conn.cbQueue);
+        return;
+    }
+
+    beginRun(conn, refreshId);
+    cmd->execute(conn.wsdb, conn.results);
+    bool cancelled = endRun(conn);
+    cmd->getTiming().busy = conn.wsdb.takeBusyWait();
+
+    // The partial result must not be shown, one plain callback still balances the command
+    cmd->finish(conn.results, conn.cbQueue, cancelled);
+
+    if (cancelled)
+        return;
+
+    stamp.generation = generation;
+    stamp.version = version;
+    stamp.key = key;
+}
+
+void ThreadedDb::beginRun(Connection &conn, size_t refreshId) {
+    std::lock_guard<std::mutex> lock(conn.runMutex);
+
+    conn.runningId = refreshId;
+}
+
+bool ThreadedDb::endRun(Connection &conn) {
+    std::lock_guard<std::mutex> lock(conn.runMutex);
+
+    conn.runningId = 0;
+
+    return conn.cancel.exchange(false);
+}
+
+void ThreadedDb::cancelRun(Connection &conn, size_t refreshId) {
+    std::lock_guard<std::mutex> lock(conn.runMutex);
+
+    // The lock ties the flag to this run, it cannot leak into the next command
+    if (conn.runningId == refreshId)
+        conn.cancel.store(true);
+}
+
+void ThreadedDb::finishWriterCommands(size_t count) {
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+
+        writerDone += static_cast<int64_t>(count);
+
+        // An open ran, readers switch over before their next command
+        if (writer.wsdb.getGeneration() != fileGeneration) {
+            fileGeneration = writer.wsdb.getGeneration();
+            fileName = writer.wsdb.getFilename();
+            fileProfile = writer.wsdb.getActiveProfile();
+        }
+    }
+
+    writer.generation = fileGeneration;
+    writerFinished.notify_all();
+}
+
+void ThreadedDb::waitForWriter(int64_t count) {
+    std::unique_lock<std::mutex> lock(writerMutex);
+
+    writerFinished.wait(lock, [this, count] {return writerDone >= count;});
+}
+
+void ThreadedDb::reopenReader(Connection &reader) {
+    std::string name;
+    Wsdb::StorageProfile profile;
+
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+
+        if (reader.generation == fileGeneration)
+            return;
+
+        reader.generation = fileGeneration;
+        name = fileName;
+        profile = fileProfile;
+    }
+
+    if (name.empty()) {
+        reader.wsdb.close();
+        return;
+    }
+
+    try {
+        reader.wsdb.openReader(name.c_str(), profile);
+    } catch (std::exception &) {
+        // Reads come back empty until the next open, the writer already reported problems with the file
+    }
+}
+
+ThreadedDb::Connection &ThreadedDb::readerFor(size_t refreshId) {
+    // A refresh id always maps to the same reader, which keeps its callbacks in order
+    return *readers[refreshId == 0 ? 0 : (refreshId - 1) % readers.size()];
+}
@@ -23,28 +23,141 @@
 #ifndef THREADEDDB_H
 #define THREADEDDB_H
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 #include <wsdb.h>
 
+#include "brokerlink.h"
 #include "dbcommand.h"
+#include "dbstats.h"
+#include "namescache.h"
+#include "wssnapshot.h"
 
+// Runs commands on one writer connection and a few read-only connections, each on its own thread.
+//
+// Ordering:
+//  - Commands that are not reads run on the writer in the order queued, writes are serialized there.
+//  - Reads run on the reader chosen by their refresh id, so one view never has two queries in flight.
+//    A read starts only after every command queued on the writer before it has finished.
+//  - Each connection serves interactive commands first, then visible and background ones, see
+//    CommandQueue. Callbacks of commands with the same refresh id, or of commands that run on the
+//    writer at the same priority, are delivered in the order the commands were queued.
+//    There is no order between the others.
+//  - Queuing a refresh id cancels the query of that id that is already running. Its callback is
+//    replaced by a plain DbCallback, so only the newest query of a view ever reports.
+//
+// Once nothing has been queued for maintenanceIdle, the writer first publishes the snapshot for
+// displays if it is out of date, see WsSnapshotPublisher, then runs database upkeep in short steps,
+// see Wsdb::maintenanceStep. Queuing any command stops the running step.
+//
+// Given a broker address, commands run on that broker instead, see BrokerLink. It serves its own
+// file, an open only reports the profile that took effect there. The order of callbacks is kept
+// for commands with the same refresh id and for writes, the broker does upkeep itself.
+//
+// Every command is timed from queueCommand to the end of its callback, see DbStats.
 class ThreadedDb {
 public:
-    ThreadedDb();
+    static const size_t numReaders;
+    static const int64_t maintenanceIdle;     // ms without commands before upkeep starts
+    static const int64_t maintenanceBudget;   // ms per step
+    static const int64_t maintenanceInterval; // s between rounds over all clients
+    static const int64_t maintenanceLease;    // s a client may hold the round
+
+    explicit ThreadedDb(const std::string &broker = std::string()); // "host:port" of a broker, empty for local files
     ~ThreadedDb();
 
+    // Writes default to PriorityInteractive, everything else to PriorityVisible.
+    // Open the file and write at PriorityInteractive, reads rely on it to see them.
     void queueCommand(DbCommand *cmd, size_t refreshId = 0);
+    void queueCommand(DbCommand *cmd, size_t refreshId, QueuePriority priority);
     void checkCallbacks();
     bool isProcessing();
+    // Called once callbacks are ready or processing starts, possibly from a worker thread.
+    // It should only schedule checkCallbacks on the GUI thread.
+    void setWakeup(std::function<void()> wakeup);
+    // Kept current with our own writes and with changes found in the log before each refresh
+    NamesCache *getNamesCache();
+    // Commands waiting at a priority over all connections, for diagnostics
+    size_t getQueueDepth(QueuePriority priority);
+    // Latencies of the commands whose callbacks ran so far, with the queue depths sampled now
+    DbStats &getStats();
+    bool hasBroker();
+    // Called by checkCallbacks after the broker pushed changes, made by this or any other client
+    void setChangeHandler(std::function<void()> handler);
+
+private:
+    // Last query run for each refresh id
+    class RefreshStamp {
+    public:
+        RefreshStamp() : generation(-1), version(-1) {}
+
+        int64_t generation;
+        int64_t version;
+        std::string key;
+    };
+
+    // A database connection with its own thread and queues
+    class Connection {
+    public:
+        Connection() : thread(nullptr), generation(-1), runningId(0), cancel(false) {
+            wsdb.setCancelFlag(&cancel);
+        }
+
+        Wsdb wsdb;
+        std::thread *thread;
+        CommandQueue<DbCommand> cmdQueue;
+        CommandQueue<DbCallback> cbQueue;
+        CommandQueue<DbCallback> results; // Callbacks of the running command, see DbCommand::finish
+        std::vector<RefreshStamp> stamps;
+        int64_t generation; // Writer generation of the file wsdb has open
+        std::mutex runMutex; // Guards runningId and setting cancel
+        size_t runningId;    // Refresh id being executed, 0 if none
+        std::atomic<bool> cancel;
+    };
 
-    void run();
+    void runWriter();
+    int64_t runMaintenance(); // Returns the ms to wait before the next step
+    void runReader(Connection *reader);
+    size_t runWrites(DbCommand *cmd); // Returns the number of commands run
+    void runRefresh(Connection &conn, DbCommand *cmd, size_t refreshId);
+    void beginRun(Connection &conn, size_t refreshId);
+    bool endRun(Connection &conn); // True if the run was cancelled
+    void cancelRun(Connection &conn, size_t refreshId);
+    void finishWriterCommands(size_t count);
+    void waitForWriter(int64_t count);
+    void reopenReader(Connection &reader);
+    Connection &readerFor(size_t refreshId);
+    void wake();
+    void runCallback(DbCallback *cb); // GUI thread
 
 private:
-    Wsdb wsdb;
-    std::thread *thread;
-    CommandQueue<DbCommand> cmdQueue;
-    CommandQueue<DbCallback> cbQueue;
+    Connection writer;
+    std::vector<std::unique_ptr<Connection> > readers;
+    NamesCache namesCache;
+    std::unique_ptr<BrokerLink> broker; // Set if commands run on a broker, the connections above stay idle
+    std::function<void()> changeHandler;
     int64_t outstandingCommands;
+    int64_t writerQueued;   // Commands queued on the writer so far, GUI thread only
+    std::mutex writerMutex; // Guards the members below
+    std::condition_variable writerFinished;
+    int64_t writerDone;     // Commands the writer has finished
+    std::string fileName;   // What the writer has open, readers follow it
+    Wsdb::StorageProfile fileProfile;
+    int64_t fileGeneration;
+    std::mutex wakeupMutex;
+    std::function<void()> wakeup;
+    std::atomic<bool> wakePending; // A wakeup is scheduled and checkCallbacks has not run yet
+    std::atomic<int64_t> lastQueued; // steady_clock ms of the last queueCommand
+    int64_t maintenanceOwner;        // Identifies this client in the lease, random
+    int64_t maintenanceGeneration;   // File the writer holds the lease on, -1 if none
+    WsSnapshotPublisher snapshot;    // Writer thread only
+    DbStats stats;                   // GUI thread only
 };
 
 #endif // THREADEDDB_H
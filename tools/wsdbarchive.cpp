@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+// Moves reservations older than a horizon into one archive file per year next
+// to the database.  The horizon is stored in the file, later runs without DAYS
+// use it.  Clients keep showing archived days and reload on their next refresh.
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#include "wsdb.h"
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " FILE [DAYS]\n"
+                 "Archives reservations more than DAYS days old, 0 turns archiving off\n";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int64_t days = -1;
+    if (argc == 3) {
+        char *end;
+        days = strtoll(argv[2], &end, 10);
+        if (*argv[2] == '\0' || *end != '\0' || days < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    try {
+        Wsdb wsdb;
+        wsdb.open(argv[1]);
+
+        if (days >= 0)
+            wsdb.setArchiveDays(days);
+
+        days = wsdb.getArchiveDays();
+        if (days == 0) {
+            std::cout << argv[1] << " has no archive horizon, pass DAYS to set one\n";
+            return 0;
+        }
+
+        int64_t moved = wsdb.archiveOld(Wsdb::todaySlot());
+        std::cout << "Archived " << moved << " rows older than " << days << " days from " << argv[1] << "\n";
+    } catch (std::exception &e) {
+        std::cerr << "wsdbarchive: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
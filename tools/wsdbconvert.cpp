@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+// Converts a database between one row per slot and interval storage.  Open
+// clients pick up the change on their next refresh.
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "wsdb.h"
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " FILE slots|intervals\n";
+}
+
+static const char *engineName(int64_t engine) {
+    return engine == Wsdb::EngineIntervals ? "intervals" : "slots";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int64_t engine;
+    if (strcmp(argv[2], "slots") == 0) {
+        engine = Wsdb::EngineSlots;
+    } else if (strcmp(argv[2], "intervals") == 0) {
+        engine = Wsdb::EngineIntervals;
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+
+    try {
+        Wsdb wsdb;
+        wsdb.open(argv[1]);
+
+        int64_t from = wsdb.getStorageEngine();
+        if (from == engine) {
+            std::cout << argv[1] << " already uses " << engineName(engine) << " storage\n";
+            return 0;
+        }
+
+        wsdb.convertStorage(engine);
+        std::cout << "Converted " << argv[1] << " from " << engineName(from) << " to " << engineName(engine) << " storage\n";
+    } catch (std::exception &e) {
+        std::cerr << "wsdbconvert: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+// Publishes the current and next week of a database as a snapshot file next to
+// it, for displays that map it instead of opening the database.  on or off is
+// stored in the file, clients then keep the snapshot current while idle.
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "wsdb.h"
+#include "wssnapshot.h"
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " FILE [on|off]\n"
+                 "Publishes the current and next week of FILE, on or off sets whether clients keep doing so\n";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (argc == 3 && strcmp(argv[2], "on") != 0 && strcmp(argv[2], "off") != 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    try {
+        Wsdb wsdb;
+        wsdb.open(argv[1]);
+
+        if (argc == 3)
+            wsdb.setPublishSnapshot(strcmp(argv[2], "on") == 0);
+
+        std::string filename = WsSnapshot::filenameFor(argv[1]);
+        WsSnapshot::write(filename, WsSnapshot::build(wsdb, WsSnapshot::weekStart(Wsdb::todaySlot())));
+        std::cout << "Published " << filename;
+        if (!wsdb.getPublishSnapshot())
+            std::cout << ", clients do not keep it current, pass on for that";
+        std::cout << "\n";
+    } catch (std::exception &e) {
+        std::cerr << "wsdbsnapshot: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
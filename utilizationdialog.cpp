@@ -0,0 +1,281 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+#include <QFile>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QPointer>
+#include <QTextStream>
+
+#include "ui_utilizationdialog.h"
+#include "utilizationdialog.h"
+
+// Days read per query, small enough that a refresh of the daily table never waits long behind one
+static const int64_t chunkDays = 28;
+static const int hoursPerWeek = 7 * 24;
+
+class WsUsageCallback : public DbSelectUsageCallback {
+public:
+    WsUsageCallback(UtilizationDialog *dlg, int64_t request, int64_t chunkStart, int64_t chunkStop) :
+        dlg(dlg), request(request), chunkStart(chunkStart), chunkStop(chunkStop) {}
+
+    virtual void execute();
+
+private:
+    QPointer<UtilizationDialog> dlg; // Cleared if the dialog was closed meanwhile
+    int64_t request;
+    int64_t chunkStart;
+    int64_t chunkStop;
+};
+
+void WsUsageCallback::execute() {
+    if (dlg)
+        dlg->addUsage(request, chunkStart, chunkStop, usage);
+}
+
+static QString csvField(const QString &text) {
+    if (!text.contains(QChar(',')) && !text.contains(QChar('"')) && !text.contains(QChar('\n')))
+        return text;
+
+    QString quoted = text;
+    quoted.replace(QString::fromUtf8("\""), QString::fromUtf8("\"\""));
+
+    return QString::fromUtf8("\"") + quoted + QString::fromUtf8("\"");
+}
+
+UtilizationDialog::UtilizationDialog(const std::vector<Wsdb::StationInfo> &info, WorkstationScheduler *ws, ThreadedDb *tdb, size_t refreshId) :
+    QDialog(ws),
+    ui(new Ui::UtilizationDialog),
+    info(info),
+    tdb(tdb),
+    refreshId(refreshId),
+    isUpdating(true),
+    request(0),
+    loadedDays(0),
+    origin(0),
+    columns(0) {
+    ui->setupUi(this);
+    setWindowTitle("Utilization Report");
+
+    // The last quarter answers the usual question
+    QDate today = QDate::currentDate();
+    ui->stopDate->setDate(today);
+    ui->startDate->setDate(today.addDays(-90));
+
+    isUpdating = false;
+    reload();
+}
+
+UtilizationDialog::~UtilizationDialog() {
+    delete ui;
+}
+
+void UtilizationDialog::addUsage(int64_t req, int64_t chunkStart, int64_t chunkStop, const std::vector<DbSelectUsageCallback::Usage> &usage) {
+    if (req != request)
+        return;
+
+    const int64_t slotsPerDay = WorkstationScheduler::slotsPerDay;
+    size_t rows = info.size();
+
+    for (auto &use : usage) {
+        if (use.station < 0 || static_cast<size_t> (use.station) >= rows || use.bucket < 0 || use.bucket >= columns)
+            continue;
+
+        booked[static_cast<size_t> (use.station) * static_cast<size_t> (columns) + static_cast<size_t> (use.bucket)] += use.booked;
+    }
+
+    int colStart = 0;
+    int colStop = columns - 1;
+    int64_t firstDayIdx = (chunkStart - origin) / slotsPerDay;
+    int64_t lastDayIdx = (chunkStop - origin) / slotsPerDay;
+
+    for (int64_t day = firstDayIdx; day <= lastDayIdx; day++) {
+        if (isByDay()) {
+            capacity[static_cast<size_t> (day)] += slotsPerDay;
+        } else {
+            int weekday = static_cast<int> (day % 7);
+            for (int hour = 0; hour < 24; hour++)
+                capacity[static_cast<size_t> (weekday * 24 + hour)] += slotsPerDay / 24;
+        }
+    }
+    loadedDays += lastDayIdx - firstDayIdx + 1;
+
+    if (isByDay()) {
+        colStart = static_cast<int> (firstDayIdx);
+        colStop = static_cast<int> (lastDayIdx);
+    }
+
+    showColumns(colStart, colStop);
+    queueChunk();
+    showStatus();
+}
+
+void UtilizationDialog::on_startDate_dateChanged(const QDate &) {
+    if (!isUpdating)
+        reload();
+}
+
+void UtilizationDialog::on_stopDate_dateChanged(const QDate &) {
+    if (!isUpdating)
+        reload();
+}
+
+void UtilizationDialog::on_grouping_currentIndexChanged(int) {
+    if (!isUpdating)
+        reload();
+}
+
+void UtilizationDialog::on_exportCsv_clicked() {
+    QString filename = QFileDialog::getSaveFileName(this, "Export Utilization", QString(), "CSV Files (*.csv)");
+    if (filename.isEmpty())
+        return;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        QMessageBox::critical(this, "Export Failed", "Could not write " + filename + ":\n\n" + file.errorString());
+        return;
+    }
+
+    // Percent booked, empty where nothing could be booked
+    QTextStream out(&file);
+    out << "Workstation";
+    for (int col = 0; col < columns; col++)
+        out << "," << csvField(ui->heatmap->columnLabel(col));
+    out << "\n";
+
+    for (size_t row = 0; row < info.size(); row++) {
+        out << csvField(QString::fromUtf8(info[row].name.c_str()));
+        for (int col = 0; col < columns; col++) {
+            out << ",";
+            double value = ui->heatmap->value(static_cast<int> (row), col);
+            if (value >= 0)
+                out << QString::number(value * 100, 'f', 1);
+        }
+        out << "\n";
+    }
+
+    out.flush();
+    if (file.error() != QFileDevice::NoError)
+        QMessageBox::critical(this, "Export Failed", "Could not write " + filename + ":\n\n" + file.errorString());
+}
+
+void UtilizationDialog::reload() {
+    const int64_t slotsPerDay = WorkstationScheduler::slotsPerDay;
+    QStringList rowLabels;
+    QStringList columnLabels;
+
+    request++;
+    firstDay = ui->startDate->date();
+    lastDay = ui->stopDate->date();
+    nextDay = firstDay;
+    loadedDays = 0;
+
+    for (auto &station : info)
+        rowLabels.append(QString::fromUtf8(station.name.c_str()));
+
+    if (lastDay < firstDay) {
+        columns = 0;
+        ui->heatmap->setLabels(rowLabels, columnLabels);
+        showStatus();
+        return;
+    }
+
+    if (isByDay()) {
+        origin = WorkstationScheduler::epoch.daysTo(firstDay) * slotsPerDay;
+        for (QDate day = firstDay; day <= lastDay; day = day.addDays(1))
+            columnLabels.append(day.toString(QString::fromUtf8("ddd yyyy-MM-dd")));
+    } else {
+        // Weeks start on Sunday, as in the workstation view
+        QDate sunday = firstDay.addDays(-(firstDay.dayOfWeek() % 7));
+        origin = WorkstationScheduler::epoch.daysTo(sunday) * slotsPerDay;
+        for (int col = 0; col < hoursPerWeek; col++)
+            columnLabels.append(sunday.addDays(col / 24).toString(QString::fromUtf8("ddd ")) + QString::fromUtf8("%1:00").arg(col % 24, 2, 10, QChar('0')));
+    }
+
+    columns = columnLabels.size();
+    booked.assign(info.size() * static_cast<size_t> (columns), 0);
+    capacity.assign(static_cast<size_t> (columns), 0);
+    ui->heatmap->setLabels(rowLabels, columnLabels);
+
+    queueChunk();
+    showStatus();
+}
+
+void UtilizationDialog::queueChunk() {
+    const int64_t slotsPerDay = WorkstationScheduler::slotsPerDay;
+
+    if (lastDay < nextDay)
+        return;
+
+    QDate chunkLast = std::min(nextDay.addDays(chunkDays - 1), lastDay);
+    int64_t slotStart = WorkstationScheduler::epoch.daysTo(nextDay) * slotsPerDay;
+    int64_t slotStop = WorkstationScheduler::epoch.daysTo(chunkLast) * slotsPerDay + slotsPerDay - 1;
+    int64_t slotsPerBucket = isByDay() ? slotsPerDay : slotsPerDay / 24;
+    int64_t bucketsPerCycle = isByDay() ? 0 : hoursPerWeek;
+
+    // Queued under one refresh id, so a new range drops the queued piece and stops the running one
+    tdb->queueCommand(new DbSelectUsageCommand(slotStart, slotStop, origin, slotsPerBucket, bucketsPerCycle,
+                                               new WsUsageCallback(this, request, slotStart, slotStop)), refreshId, PriorityBackground);
+    nextDay = chunkLast.addDays(1);
+}
+
+void UtilizationDialog::showColumns(int colStart, int colStop) {
+    for (size_t row = 0; row < info.size(); row++) {
+        for (int col = colStart; col <= colStop; col++) {
+            int64_t cap = capacity[static_cast<size_t> (col)];
+            int64_t num = booked[row * static_cast<size_t> (columns) + static_cast<size_t> (col)];
+
+            ui->heatmap->setValue(static_cast<int> (row), col, cap > 0 ? static_cast<double> (num) / static_cast<double> (cap) : -1);
+        }
+    }
+
+    ui->heatmap->update();
+}
+
+void UtilizationDialog::showStatus() {
+    int64_t days = lastDay < firstDay ? 0 : firstDay.daysTo(lastDay) + 1;
+
+    if (days == 0) {
+        ui->status->setText(QString::fromUtf8("The end date is before the start date."));
+    } else if (loadedDays < days) {
+        ui->status->setText(QString::fromUtf8("Loading %1 of %2 days...").arg(loadedDays).arg(days));
+    } else {
+        int64_t total = 0;
+        int64_t slotCount = 0;
+        for (int col = 0; col < columns; col++)
+            slotCount += capacity[static_cast<size_t> (col)];
+        for (auto num : booked)
+            total += num;
+        slotCount *= static_cast<int64_t> (info.size());
+
+        ui->status->setText(QString::fromUtf8("%1 days, %2 % booked overall").arg(days)
+                            .arg(slotCount > 0 ? 100.0 * static_cast<double> (total) / static_cast<double> (slotCount) : 0.0, 0, 'f', 1));
+    }
+
+    ui->exportCsv->setEnabled(days > 0 && loadedDays >= days);
+}
+
+bool UtilizationDialog::isByDay() {
+    return ui->grouping->currentIndex() == 0;
+}
@@ -0,0 +1,83 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef UTILIZATIONDIALOG_H
+#define UTILIZATIONDIALOG_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <QDate>
+#include <QDialog>
+
+#include "dbcommand.h"
+#include "threadeddb.h"
+#include "workstationscheduler.h"
+#include "wsdb.h"
+
+namespace Ui {
+class UtilizationDialog;
+}
+
+// Share of slots booked per workstation over a date range, by day or by hour of the week.
+// The range is read a few weeks at a time in the background lane, filling the heatmap as it goes.
+class UtilizationDialog : public QDialog {
+    Q_OBJECT
+
+public:
+    explicit UtilizationDialog(const std::vector<Wsdb::StationInfo> &info, WorkstationScheduler *ws, ThreadedDb *tdb, size_t refreshId);
+    ~UtilizationDialog();
+
+    // Answers to an older request are dropped
+    void addUsage(int64_t request, int64_t chunkStart, int64_t chunkStop, const std::vector<DbSelectUsageCallback::Usage> &usage);
+
+private slots:
+    void on_startDate_dateChanged(const QDate &date);
+    void on_stopDate_dateChanged(const QDate &date);
+    void on_grouping_currentIndexChanged(int index);
+    void on_exportCsv_clicked();
+
+private:
+    void reload();
+    void queueChunk();
+    void showColumns(int colStart, int colStop);
+    void showStatus();
+    bool isByDay();
+
+private:
+    Ui::UtilizationDialog *ui;
+    std::vector<Wsdb::StationInfo> info;
+    ThreadedDb *tdb;
+    size_t refreshId;
+    bool isUpdating;
+    int64_t request;
+    QDate firstDay;
+    QDate lastDay;
+    QDate nextDay;        // First day not queued yet
+    int64_t loadedDays;
+    int64_t origin;       // Slot bucket 0 starts at
+    int columns;
+    std::vector<int64_t> booked;   // Booked slots, per station and column
+    std::vector<int64_t> capacity; // Slots loaded so far per column, for one station
+};
+
+#endif // UTILIZATIONDIALOG_H
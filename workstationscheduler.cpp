@@ -20,7 +20,6 @@
 // DEALINGS IN THE SOFTWARE.
 //////////////////////////////////////////////////////////////////////////////
 
-#include <iomanip>
 #include <memory>
 #include <sstream>
 #include <vector>
@@ -28,40 +27,80 @@
 #include <QBrush>
 #include <QColor>
 #include <QColorDialog>
+#include <QDateTime>
 #include <QDialogButtonBox>
+#include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QMessageBox>
 #include <QSettings>
+#include <QStandardPaths>
 #include <QString>
-#include <QTableWidget>
-#include <QTableWidgetItem>
+#include <QItemSelection>
+#include <QTableView>
 
 #include "dbcommand.h"
 #include "descriptiondialog.h"
+#include "diagnosticsdialog.h"
+#include "utilizationdialog.h"
 #include "workstationscheduler.h"
 #include "wsrecentmenuaction.h"
+#include "wsviewcache.h"
 #include "ui_workstationscheduler.h"
 
 static const size_t WsInfoRefresh             = 1;
 static const size_t WsDailyTableRefresh       = 2;
 static const size_t WsWorkstationTableRefresh = 3;
+static const size_t WsChangesRefresh          = 4;
+static const size_t WsDailyPrefetch           = 5;
+static const size_t WsWorkstationPrefetch     = 6;
+static const size_t WsDailyCountsRefresh      = 7;
+static const size_t WsUtilizationRefresh      = 8;
 
 const QDate WorkstationScheduler::epoch = QDate(2000,1,1);
 const int WorkstationScheduler::slotsPerDay = 48;
-const int64_t WorkstationScheduler::refreshInterval = 15 * 60; // seconds
+const int64_t WorkstationScheduler::refreshInterval = 30; // seconds, cheap when nothing changed
+const int64_t WorkstationScheduler::snapshotPollInterval = 5; // seconds, only the file's attributes are read
 
 class WsOpenCallback : public DbOpenCallback {
 public:
-    WsOpenCallback(QWidget *parent) : parent(parent) {}
+    WsOpenCallback(QWidget *parent, QSettings *settings) : parent(parent), settings(settings) {}
     virtual void execute();
 
 private:
     QWidget *parent;
+    QSettings *settings;
 };
 
 void WsOpenCallback::execute() {
-    QMessageBox::critical(parent, "Error opening database", QString::fromUtf8(errorMsg.c_str()));
+    if (!errorMsg.empty()) {
+        QMessageBox::critical(parent, "Error opening database", QString::fromUtf8(errorMsg.c_str()));
+        return;
+    }
+
+    // Record the profile that took effect so it can be checked per client
+    settings->setValue("storage/active/journalMode", profile.journalMode == Wsdb::StorageProfile::JournalWal ? "wal" : "delete");
+    settings->setValue("storage/active/synchronous", static_cast<qlonglong>(profile.synchronous));
+    settings->setValue("storage/active/busyTimeout", static_cast<qlonglong>(profile.busyTimeout));
+    settings->setValue("storage/active/mmapSize", static_cast<qlonglong>(profile.mmapSize));
+    settings->setValue("storage/active/cacheSize", static_cast<qlonglong>(profile.cacheSize));
+}
+
+class WsWriteErrorCallback : public DbErrorCallback {
+public:
+    WsWriteErrorCallback(QWidget *parent) : parent(parent) {}
+    virtual void execute();
+
+private:
+    QWidget *parent;
+};
+
+void WsWriteErrorCallback::execute() {
+    // Only the command that caused the rollback reports it
+    if (!isCause)
+        return;
+
+    QMessageBox::critical(parent, "Error writing database", QString::fromUtf8(errorMsg.c_str()) + "\n\nNo changes were saved.");
 }
 
 class MakeTrue {
@@ -78,16 +117,57 @@ WorkstationScheduler::WorkstationScheduler(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::WorkstationScheduler),
     settings("maurerpe", "WorkstationScheduler"),
+    tdb(std::string(settings.value("database/broker").toString().toUtf8())),
+    dailyModel(slotsPerDay, true),
+    workstationModel(slotsPerDay, false),
     isUpdating(false),
-    lastRefresh(0),
-    ySaveOffset(-30) {
+    isBusy(false),
+    dailySeq(-1),
+    workstationSeq(-1),
+    dailyBaseSlot(0),
+    workstationBaseSlot(0),
+    workstationShown(-1),
+    dailyCountsSlot(INT64_MIN),
+    ySaveOffset(-30),
+    isDailyStale(false),
+    isWorkstationStale(false),
+    snapshotFile(settings.value("database/snapshot").toString()),
+    snapshotStamp(-1) {
     ui->setupUi(this);
+    ui->dailyTable->setModel(&dailyModel);
+    ui->workstationTable->setModel(&workstationModel);
+
+    // The worker thread posts a queued call, so results show up without polling
+    tdb.setWakeup([this]() {QMetaObject::invokeMethod(this, "deliverCallbacks", Qt::QueuedConnection);});
+    // A broker reports bookings by others right away, the timer only catches up with the rest
+    tdb.setChangeHandler([this]() {refreshChanges();});
+
+    refreshTimer.setTimerType(Qt::VeryCoarseTimer);
+    refreshTimer.setInterval(static_cast<int>(refreshInterval * 1000));
+    connect(&refreshTimer, &QTimer::timeout, this, &WorkstationScheduler::autoRefresh);
 
     resize(settings.value("mainwindow/size", QSize(800, 600)).toSize());
     move(settings.value("mainwindow/pos", QPoint(200,200)).toPoint());
 
     QVariant db = settings.value("database/filename");
-    if (db.isNull()) {
+    if (isWallboard()) {
+        // Displays only show what writers published, nothing can be changed from them
+        ui->book->setEnabled(false);
+        ui->release->setEnabled(false);
+        ui->actionOpenDatabase->setEnabled(false);
+        ui->actionRecentDatabases->setEnabled(false);
+        ui->actionWorkstationDescriptions->setEnabled(false);
+        ui->actionUtilizationReport->setEnabled(false);
+        ui->actionImportReservations->setEnabled(false);
+        ui->actionExportReservations->setEnabled(false);
+        refreshTimer.setInterval(static_cast<int>(snapshotPollInterval * 1000));
+        wallboardToday = QDate::currentDate();
+    } else if (tdb.hasBroker()) {
+        // The broker serves its own file, the open only reports the profile in effect there
+        ui->actionOpenDatabase->setEnabled(false);
+        ui->actionRecentDatabases->setEnabled(false);
+        tdb.queueCommand(new DbOpenCommand(std::string(), clientStorageProfile(), new WsOpenCallback(this, &settings)), 0, PriorityInteractive);
+    } else if (db.isNull()) {
         selectDbFile();
     }  else {
         openDbFile(db.toString());
@@ -101,12 +181,15 @@ WorkstationScheduler::WorkstationScheduler(QWidget *parent) :
         setWorkstationToToday();
     }
 
-    startTimer(15); // ms
+    // Something to look at before a slow share answers
+    showSavedViews();
     refreshAll();
 }
 
 WorkstationScheduler::~WorkstationScheduler() {
+    tdb.setWakeup(nullptr);
     saveSettings();
+    saveViews();
 
     delete ui;
 }
@@ -116,7 +199,7 @@ void WorkstationScheduler::refreshAll() {
     refreshDaily();
     refreshWorkstation();
 
-    lastRefresh = QDateTime::currentSecsSinceEpoch();
+    refreshTimer.start();
 }
 
 void WorkstationScheduler::openDbFile(QString filename) {
@@ -137,73 +220,110 @@ void WorkstationScheduler::openDbFile(QString filename) {
     settings.setValue("database/recent", newRecent);
 
     settings.setValue("database/filename", filename);
-    tdb.queueCommand(new DbOpenCommand(std::string(filename.toUtf8()), new WsOpenCallback(this)));
+    dailySeq = -1;
+    workstationSeq = -1;
+    dailyCountsSlot = INT64_MIN;
+    tdb.getNamesCache()->clear();
+    tdb.queueCommand(new DbOpenCommand(std::string(filename.toUtf8()), clientStorageProfile(), new WsOpenCallback(this, &settings)), 0, PriorityInteractive);
     refreshAll();
     buildRecentDatabasesMenu();
 }
 
-void WorkstationScheduler::updateTable(std::list<DbSelectNamesCallback::Datum *> &data, bool isDaily) {
-    QTableWidget *table = isDaily ? ui->dailyTable : ui->workstationTable;
-    int cols = table->columnCount();
+void WorkstationScheduler::updateTable(const DbSelectNamesCallback::Names &data, bool isDaily, int64_t slotStart, int64_t workstation, int64_t changeSeq) {
+    WsTableModel *model = isDaily ? &dailyModel : &workstationModel;
 
-    for (int col = 0; col < cols; col++)
-        for (int row = 0; row < slotsPerDay; row++)
-            delete table->takeItem(row, col);
+    // A cached view may already be shown for the current date, a late answer for the old one must not replace it
+    if (isDaily) {
+        if (slotStart != epoch.daysTo(ui->dailyDate->date()) * slotsPerDay)
+            return;
+    } else {
+        if (slotStart != epoch.daysTo(workstationStartDate()) * slotsPerDay || workstation != ui->workstationName->currentIndex())
+            return;
+    }
 
-    QDate baseDay = isDaily ? ui->dailyDate->date() : workstationStartDate();
-    int64_t baseSlot = epoch.daysTo(baseDay) * slotsPerDay;
-    int64_t station = ui->workstationName->currentIndex();
-    int64_t numBooked[slotsPerDay];
+    model->clearCells();
 
-    for (int count = 0; count < slotsPerDay; count++)
-         numBooked[count] = 0;
+    // Changes are patched relative to what is shown
+    if (isDaily) {
+        dailyBaseSlot = slotStart;
+        dailySeq = changeSeq;
+    } else {
+        workstationBaseSlot = slotStart;
+        workstationShown = workstation;
+        workstationSeq = changeSeq;
+    }
 
-    while (!data.empty()) {
-        std::unique_ptr<DbSelectNamesCallback::Datum> datum(data.front());
-        data.pop_front();
-        int64_t delta = datum->slot - baseSlot;
-        int64_t col;
-        int64_t row;
-        if (isDaily) {
-            size_t stationSize = static_cast<uint64_t>(datum->station) > SIZE_MAX ? SIZE_MAX : static_cast<size_t>(datum->station);
-            if (delta < 0 || delta >= slotsPerDay || datum->station < 0 || stationSize >= dailyColumn.size())
-                continue;
-            col = dailyColumn[stationSize];
-            row = delta;
-        } else {
-            if (datum->station != station)
-                continue;
-            col = delta / slotsPerDay;
-            row = delta % slotsPerDay;
-        }
+    size_t rows = data.size();
+    for (size_t count = 0; count < rows; count++) {
+        int row;
+        int col;
 
-        if (col < 0 || col >= cols)
+        if (!cellFor(isDaily, data.slot[count], data.station[count], &row, &col))
             continue;
 
-        if (row < 0 || row >= slotsPerDay)
-            continue;
+        model->setCell(row, col, data.name(count), data.attr[count]);
+    }
+
+    model->flush();
 
-        QTableWidgetItem *item = WorkstationScheduler::newTableWidgetItem(datum->name.c_str(), datum->attr);
-        table->setItem(static_cast<int> (row), static_cast<int> (col), item);
-        numBooked[row]++;
+    // The first answer replaces the view saved at the last exit
+    bool &isStale = isDaily ? isDailyStale : isWorkstationStale;
+    if (isStale) {
+        isStale = false;
+        if (!isDailyStale && !isWorkstationStale)
+            ui->statusBar->clearMessage();
     }
+}
 
-    if (isDaily) {
-        for (int count = 0; count < slotsPerDay; count++) {
-            std::stringstream ss;
-            ss << numBooked[count];
-
-            int64_t attr = 0xFFFFFF404040; // light gray text on white background
-            if (numBooked[count] >= limits.red)
-                attr = 0xC00000FFFFFF; // white text on dark red background
-            else if (numBooked[count] >= limits.yellow)
-                attr = 0xFFFF80000000; // black text on pale yellow background
-
-            QTableWidgetItem *item = WorkstationScheduler::newTableWidgetItem(ss.str().c_str(), attr);
-            item->setTextAlignment(Qt::AlignHCenter);
-            table->setItem(count, 0, item);
+void WorkstationScheduler::applyChanges(const std::vector<DbSelectChangesCallback::Change> &changes) {
+    if (changes.empty())
+        return;
+
+    for (auto &change : changes) {
+        for (int view = 0; view < 2; view++) {
+            bool isDaily = view == 0;
+            int64_t seq = isDaily ? dailySeq : workstationSeq;
+            WsTableModel *model = isDaily ? &dailyModel : &workstationModel;
+            int row;
+            int col;
+
+            if (seq < 0 || change.seq <= seq)
+                continue;
+
+            for (int64_t slot = change.slotStart; slot <= change.slotStop; slot++) {
+                if (!cellFor(isDaily, slot, change.station, &row, &col))
+                    continue;
+
+                if (change.isRemoval)
+                    model->clearCell(row, col);
+                else
+                    model->setCell(row, col, change.name.c_str(), change.attr);
+            }
         }
     }
+
+    if (dailySeq >= 0 && dailySeq < changes.back().seq)
+        dailySeq = changes.back().seq;
+
+    if (workstationSeq >= 0 && workstationSeq < changes.back().seq)
+        workstationSeq = changes.back().seq;
+
+    dailyModel.flush();
+    workstationModel.flush();
+
+    refreshCounts();
+}
+
+void WorkstationScheduler::updateCounts(const std::vector<int64_t> &counts, int64_t slotStart) {
+    if (slotStart != dailyCountsSlot)
+        return;
+
+    dailyModel.setCounts(counts);
+    dailyModel.flush();
+}
+
+DbErrorCallback *WorkstationScheduler::newWriteErrorCallback() {
+    return new WsWriteErrorCallback(this);
 }
 
 void WorkstationScheduler::on_refresh_clicked() {
@@ -213,7 +333,7 @@ void WorkstationScheduler::on_refresh_clicked() {
 void WorkstationScheduler::on_book_clicked() {
     doBookRelease(true);
 
-    refreshAll();
+    refreshChanges();
 }
 
 void WorkstationScheduler::on_release_clicked() {
@@ -223,7 +343,7 @@ void WorkstationScheduler::on_release_clicked() {
 
     doBookRelease(false);
 
-    refreshAll();
+    refreshChanges();
 }
 
 void WorkstationScheduler::on_dailyDate_dateChanged(const QDate &) {
@@ -268,7 +388,113 @@ void WsDescriptionsCallback::execute() {
 }
 
 void WorkstationScheduler::on_actionWorkstationDescriptions_triggered() {
-    tdb.queueCommand(new DbGetStationInfoCommand(new WsDescriptionsCallback(this, &tdb)));
+    tdb.queueCommand(new DbGetStationInfoCommand(new WsDescriptionsCallback(this, &tdb)), 0, PriorityInteractive);
+}
+
+class WsUtilizationCallback : public DbGetStationInfoCallback {
+public:
+    WsUtilizationCallback(WorkstationScheduler *ws, ThreadedDb *tdb) : ws(ws), tdb(tdb) {}
+
+    virtual void execute();
+
+private:
+    WorkstationScheduler *ws;
+    ThreadedDb *tdb;
+};
+
+void WsUtilizationCallback::execute() {
+    // Not modal, the report keeps loading while bookings are edited
+    UtilizationDialog *dlg = new UtilizationDialog(info, ws, tdb, WsUtilizationRefresh);
+    dlg->setAttribute(Qt::WA_DeleteOnClose);
+    dlg->show();
+}
+
+void WorkstationScheduler::on_actionUtilizationReport_triggered() {
+    tdb.queueCommand(new DbGetStationInfoCommand(new WsUtilizationCallback(this, &tdb)), 0, PriorityInteractive);
+}
+
+static const QString transferFilter = QString::fromUtf8("Reservations (*.csv *.json);;CSV Files (*.csv);;JSON Files (*.json)");
+
+class WsImportCallback : public DbImportCallback {
+public:
+    WsImportCallback(WorkstationScheduler *ws, QString filename) : ws(ws), filename(filename) {}
+
+    virtual void execute();
+
+private:
+    WorkstationScheduler *ws;
+    QString filename;
+};
+
+void WsImportCallback::execute() {
+    // Batches committed before an error stay in
+    ws->refreshAll();
+
+    if (!errorMsg.empty()) {
+        QMessageBox::critical(ws, "Import Failed", "Could not import " + filename + ":\n\n" + QString::fromUtf8(errorMsg.c_str()));
+        return;
+    }
+
+    QString text = QString::fromUtf8("Read %1 reservations from %2 and booked %3 slots.").arg(result.records).arg(filename).arg(result.booked);
+    if (result.conflicts > 0)
+        text += QString::fromUtf8("\n\n%1 reservations overlapped existing bookings, which were kept.").arg(result.conflicts);
+    if (result.rejected > 0)
+        text += QString::fromUtf8("\n\n%1 reservations could not be read and were skipped.").arg(result.rejected);
+
+    if (result.problems.empty()) {
+        QMessageBox::information(ws, "Import Finished", text);
+        return;
+    }
+
+    QString details;
+    for (auto &problem : result.problems)
+        details += QString::fromUtf8("Line %1: %2\n").arg(problem.line).arg(QString::fromUtf8(problem.message.c_str()));
+    if (result.conflicts + result.rejected > static_cast<int64_t> (result.problems.size()))
+        details += QString::fromUtf8("...\n");
+
+    QMessageBox box(QMessageBox::Warning, "Import Finished", text, QMessageBox::Ok, ws);
+    box.setDetailedText(details);
+    box.exec();
+}
+
+void WorkstationScheduler::on_actionImportReservations_triggered() {
+    QString filename = QFileDialog::getOpenFileName(this, "Import Reservations", QString(), transferFilter);
+    if (filename.isEmpty())
+        return;
+
+    tdb.queueCommand(new DbImportCommand(std::string(filename.toUtf8()), new WsImportCallback(this, filename)), 0, PriorityInteractive);
+}
+
+class WsExportCallback : public DbExportCallback {
+public:
+    WsExportCallback(WorkstationScheduler *ws, QString filename) : ws(ws), filename(filename) {}
+
+    virtual void execute();
+
+private:
+    WorkstationScheduler *ws;
+    QString filename;
+};
+
+void WsExportCallback::execute() {
+    if (!errorMsg.empty())
+        QMessageBox::critical(ws, "Export Failed", "Could not export to " + filename + ":\n\n" + QString::fromUtf8(errorMsg.c_str()));
+    else
+        QMessageBox::information(ws, "Export Finished", QString::fromUtf8("Wrote %1 reservations to %2.").arg(records).arg(filename));
+}
+
+void WorkstationScheduler::on_actionExportReservations_triggered() {
+    QString filename = QFileDialog::getSaveFileName(this, "Export Reservations", QString(), transferFilter);
+    if (filename.isEmpty())
+        return;
+
+    tdb.queueCommand(new DbExportCommand(std::string(filename.toUtf8()), new WsExportCallback(this, filename)), 0, PriorityInteractive);
+}
+
+void WorkstationScheduler::on_actionDiagnostics_triggered() {
+    DiagnosticsDialog *dlg = new DiagnosticsDialog(this, &tdb);
+    dlg->setAttribute(Qt::WA_DeleteOnClose);
+    dlg->show();
 }
 
 void WorkstationScheduler::on_actionAbout_triggered() {
@@ -328,34 +554,56 @@ void WorkstationScheduler::on_workstationToday_clicked() {
 
 void WorkstationScheduler::on_takeFromCell_clicked() {
     bool isDaily = ui->mainTab->currentIndex() == 0;
-    QTableWidget *table = isDaily ? ui->dailyTable : ui->workstationTable;
+    QTableView *table = isDaily ? ui->dailyTable : ui->workstationTable;
+    WsTableModel *model = isDaily ? &dailyModel : &workstationModel;
+    QModelIndex index = table->currentIndex();
+    QString name;
+    int64_t attr;
 
-    if (isDaily && table->currentColumn() == 0)
+    if (!index.isValid() || !model->cellAt(index.row(), index.column(), &name, &attr))
         return;
 
-    QTableWidgetItem *item = table->currentItem();
-
-    if (item == nullptr)
-        return;
-
-    QFont font = item->font();
-    ui->bold->setChecked(font.bold());
-    ui->italic->setChecked(font.italic());
-    setColor(ui->foregroundButton, item->foreground().color().rgb());
-    setColor(ui->backgroundButton, item->background().color().rgb());
-    ui->bookAs->setText(item->text());
+    uint64_t uattr = static_cast<uint64_t> (attr);
+    ui->bold->setChecked((uattr >> 48) & 1);
+    ui->italic->setChecked((uattr >> 49) & 1);
+    setColor(ui->foregroundButton, static_cast<QRgb> (uattr & 0xFFFFFF));
+    setColor(ui->backgroundButton, static_cast<QRgb> ((uattr >> 24) & 0xFFFFFF));
+    ui->bookAs->setText(name);
 }
 
-void WorkstationScheduler::timerEvent(QTimerEvent *) {
+void WorkstationScheduler::deliverCallbacks() {
     tdb.checkCallbacks();
 
-    if (tdb.isProcessing())
+    bool busy = tdb.isProcessing();
+    if (busy == isBusy)
+        return;
+
+    if (busy)
         QApplication::setOverrideCursor(Qt::BusyCursor);
     else
         QApplication::restoreOverrideCursor();
+    isBusy = busy;
+}
+
+void WorkstationScheduler::autoRefresh() {
+    if (isWallboard()) {
+        // Displays follow the day, and redraw only when a new snapshot was published
+        if (QDate::currentDate() != wallboardToday) {
+            wallboardToday = QDate::currentDate();
+            MakeTrue mt(&isUpdating);
+            setDailyToToday();
+            setWorkstationToToday();
+        } else if (WsSnapshot::fileStamp(std::string(snapshotFile.toUtf8())) == snapshotStamp) {
+            return;
+        }
+
+        refreshInfo(true);
+        return;
+    }
 
-    if (QDateTime::currentSecsSinceEpoch() - lastRefresh >= refreshInterval)
-        refreshAll();
+    // Timed refreshes yield to anything the user does meanwhile
+    refreshInfo(true, PriorityBackground);
+    refreshChanges(PriorityBackground);
 }
 
 void WorkstationScheduler::saveSettings() {
@@ -465,6 +713,30 @@ QString WorkstationScheduler::defaultBookAs() {
     return name;
 }
 
+Wsdb::StorageProfile WorkstationScheduler::clientStorageProfile() {
+    Wsdb::StorageProfile profile;
+    QVariant value;
+
+    // The journal mode is shared by every client of the file, only the parameters table sets it
+    value = settings.value("storage/synchronous");
+    if (!value.isNull())
+        profile.synchronous = value.toLongLong();
+
+    value = settings.value("storage/busyTimeout");
+    if (!value.isNull())
+        profile.busyTimeout = value.toLongLong();
+
+    value = settings.value("storage/mmapSize");
+    if (!value.isNull())
+        profile.mmapSize = value.toLongLong();
+
+    value = settings.value("storage/cacheSize");
+    if (!value.isNull())
+        profile.cacheSize = value.toLongLong();
+
+    return profile;
+}
+
 QDate WorkstationScheduler::workstationStartDate() {
     QDate wd = ui->workstationDate->date();
     return wd.addDays(-(wd.dayOfWeek() % 7));
@@ -472,42 +744,44 @@ QDate WorkstationScheduler::workstationStartDate() {
 
 class WsUpdateInfo : public DbGetStationInfoCallback {
 public:
-    WsUpdateInfo(QTableWidget *table, QComboBox *combo, std::vector<int> *column, std::vector<int64_t> *station, Wsdb::Limits *lim, bool *isUpdating) :
-        table(table), combo(combo), column(column), station(station), lim(lim), isUpdating(isUpdating) {}
+    WsUpdateInfo(WsTableModel *model, QComboBox *combo, std::vector<int> *column, std::vector<int64_t> *station, bool *isUpdating, WorkstationScheduler *ws, bool reloadTables) :
+        model(model), combo(combo), column(column), station(station), isUpdating(isUpdating), ws(ws), reloadTables(reloadTables) {}
 
     virtual void execute();
 
 protected:
-    QTableWidget *table;
+    WsTableModel *model;
     QComboBox *combo;
     std::vector<int> *column;
     std::vector<int64_t> *station;
-    Wsdb::Limits *lim;
     bool *isUpdating;
+    WorkstationScheduler *ws;
+    bool reloadTables; // Reload the tables when the info changed
 };
 
 void WsUpdateInfo::execute() {
+    if (unchanged)
+        return;
+
+    ws->rememberStationInfo(info, limits);
+
     MakeTrue mt(isUpdating);
     size_t len = static_cast<size_t> (combo->count());
     size_t num = info.size();
+    QStringList labels;
+    QStringList toolTips;
 
-    int columnCount = num + 1 > INT_MAX ? INT_MAX : static_cast<int>(num + 1);
-    table->setColumnCount(columnCount);
     column->resize(num, -1);
     station->clear();
 
-    if (lim)
-        *lim = limits;
-
     if (len > num) {
         for (size_t count = num; count < len; count++)
             combo->removeItem(static_cast<int> (num));
         len = num;
     }
 
-    delete table->takeHorizontalHeaderItem(0);
-    QTableWidgetItem *numItem = new QTableWidgetItem(QString::fromUtf8("Number booked"));
-    table->setHorizontalHeaderItem(0, numItem);
+    labels.append(QString::fromUtf8("Number booked"));
+    toolTips.append(QString());
 
     int curColumn = 1;
     for (size_t count = 0; count < num; count++) {
@@ -523,74 +797,208 @@ void WsUpdateInfo::execute() {
         if (info[count].flags & 1) {
             (*column)[count] = -1;
         } else {
-            QString headerText = QString::fromUtf8(info[count].name.c_str());
-            delete table->takeHorizontalHeaderItem(curColumn);
-            QTableWidgetItem *item = new QTableWidgetItem(headerText);
-            if (info[count].desc.size() > 0)
-                item->setToolTip(QString::fromUtf8(info[count].desc.c_str()));
-            table->setHorizontalHeaderItem(curColumn, item);
+            labels.append(QString::fromUtf8(info[count].name.c_str()));
+            toolTips.append(QString::fromUtf8(info[count].desc.c_str()));
             (*column)[count] = curColumn++;
             (*station).push_back(static_cast<int64_t>(count));
         }
     }
 
-    table->setColumnCount(curColumn);
+    model->setLimits(limits);
+    model->setColumns(labels, toolTips);
+    model->flush();
+
+    // The columns may have moved, patching changes into the old layout is not possible.
+    // The daily table may also have arrived first from its own reader, redraw it with the columns now known.
+    if (reloadTables) {
+        ws->refreshDaily();
+        ws->refreshWorkstation();
+    } else if (ws->isDailyShown()) {
+        ws->refreshDaily();
+    }
 }
 
-void WorkstationScheduler::refreshInfo() {
-    tdb.queueCommand(new DbGetStationInfoCommand(new WsUpdateInfo(ui->dailyTable, ui->workstationName, &dailyColumn, &dailyStation, &limits, &isUpdating)), WsInfoRefresh);
+void WorkstationScheduler::refreshInfo(bool reloadTables, QueuePriority priority) {
+    if (isWallboard()) {
+        WsSnapshot snapshot;
+        if (!openSnapshot(&snapshot))
+            return;
+
+        WsUpdateInfo update(&dailyModel, ui->workstationName, &dailyColumn, &dailyStation, &isUpdating, this, reloadTables);
+        snapshot.getStationInfo(update.prepare(snapshot.getLimits()));
+        update.execute();
+        return;
+    }
+
+    tdb.queueCommand(new DbGetStationInfoCommand(new WsUpdateInfo(&dailyModel, ui->workstationName, &dailyColumn, &dailyStation, &isUpdating, this, reloadTables)), WsInfoRefresh, priority);
 }
 
 class WsUpdateTable : public DbSelectNamesCallback {
 public:
-    WsUpdateTable(WorkstationScheduler *ws, bool isDaily) : ws(ws), isDaily(isDaily) {}
+    WsUpdateTable(WorkstationScheduler *ws, bool isDaily, int64_t slotStart, int64_t workstation) :
+        ws(ws), isDaily(isDaily), slotStart(slotStart), workstation(workstation) {}
 
     virtual void execute();
 
 private:
     WorkstationScheduler *ws;
     bool isDaily;
+    int64_t slotStart;
+    int64_t workstation;
 };
 
 void WsUpdateTable::execute()  {
-    ws->updateTable(data, isDaily);
+    if (unchanged)
+        return;
+
+    ws->updateTable(data, isDaily, slotStart, workstation, changeSeq);
 }
 
-void WorkstationScheduler::refreshDaily() {
-    setupRows(ui->dailyTable);
+int64_t WorkstationScheduler::showCached(bool isDaily, const NamesCache::Range &range, int64_t workstation) {
+    std::shared_ptr<const DbSelectNamesCallback::Names> data;
+    int64_t changeSeq;
+
+    if (!tdb.getNamesCache()->lookup(range, &data, &changeSeq))
+        return -1;
 
+    updateTable(*data, isDaily, range.slotStart, workstation, changeSeq);
+
+    return changeSeq;
+}
+
+bool WorkstationScheduler::isDailyShown() {
+    return dailySeq >= 0;
+}
+
+void WorkstationScheduler::refreshDaily() {
     int64_t startSlot = epoch.daysTo(ui->dailyDate->date()) * slotsPerDay;
-    tdb.queueCommand(new DbSelectNamesCommand(startSlot, startSlot + 47, 0, 0x7FFFFFFF, new WsUpdateTable(this, true)), WsDailyTableRefresh);
+    NamesCache::Range range(startSlot, startSlot + slotsPerDay - 1, 0, 0x7FFFFFFF);
+
+    // The counts of another day would be wrong next to the cells, show none until they arrive
+    if (startSlot != dailyCountsSlot) {
+        dailyCountsSlot = startSlot;
+        dailyModel.clearCounts();
+        dailyModel.flush();
+    }
+    refreshCounts();
+
+    if (isWallboard()) {
+        showSnapshot(true, range, -1);
+        return;
+    }
+
+    // Show the cached day at once, the select only answers if it turns out stale
+    int64_t knownSeq = showCached(true, range, -1);
+    tdb.queueCommand(new DbSelectNamesCommand(range.slotStart, range.slotStop, range.stationStart, range.stationStop,
+                                              new WsUpdateTable(this, true, startSlot, -1), tdb.getNamesCache(), knownSeq), WsDailyTableRefresh);
+    tdb.queueCommand(new DbPrefetchNamesCommand(range.slotStart, range.slotStop, range.stationStart, range.stationStop,
+                                                slotsPerDay, tdb.getNamesCache()), WsDailyPrefetch, PriorityBackground);
 }
 
+class WsUpdateCounts : public DbSelectSlotCountsCallback {
+public:
+    WsUpdateCounts(WorkstationScheduler *ws, int64_t slotStart) : ws(ws), slotStart(slotStart) {}
 
-void WorkstationScheduler::refreshWorkstation() {
-    setupRows(ui->workstationTable);
-    QDate start = workstationStartDate();
+    virtual void execute();
 
-    ui->workstationTable->setColumnCount(7);
+private:
+    WorkstationScheduler *ws;
+    int64_t slotStart;
+};
+
+void WsUpdateCounts::execute() {
+    if (unchanged)
+        return;
+
+    ws->updateCounts(counts, slotStart);
+}
+
+void WorkstationScheduler::refreshCounts() {
+    if (dailyCountsSlot == INT64_MIN)
+        return;
+
+    if (isWallboard()) {
+        WsSnapshot snapshot;
+        std::vector<int64_t> counts;
 
-    for (int count = 0; count < 7; count++) {
-        delete ui->workstationTable->takeHorizontalHeaderItem(count);
-        QTableWidgetItem *item = new QTableWidgetItem(start.addDays(count).toString(QString::fromUtf8("ddd yyyy-MM-dd")));
-        ui->workstationTable->setHorizontalHeaderItem(count, item);
+        if (openSnapshot(&snapshot))
+            snapshot.getSlotCounts(dailyCountsSlot, dailyCountsSlot + slotsPerDay - 1, &counts);
+        updateCounts(counts, dailyCountsSlot);
+        return;
     }
 
+    tdb.queueCommand(new DbSelectSlotCountsCommand(dailyCountsSlot, dailyCountsSlot + slotsPerDay - 1, new WsUpdateCounts(this, dailyCountsSlot)), WsDailyCountsRefresh);
+}
+
+void WorkstationScheduler::setWeekLabels() {
+    QDate start = workstationStartDate();
+    QStringList labels;
+
+    for (int count = 0; count < 7; count++)
+        labels.append(start.addDays(count).toString(QString::fromUtf8("ddd yyyy-MM-dd")));
+    workstationModel.setColumns(labels);
+}
+
+void WorkstationScheduler::refreshWorkstation() {
+    QDate start = workstationStartDate();
+    setWeekLabels();
+
     int64_t workstation = ui->workstationName->currentIndex();
     int64_t startSlot = epoch.daysTo(start) * slotsPerDay;
-    tdb.queueCommand(new DbSelectNamesCommand(startSlot, startSlot + slotsPerDay * 7 - 1, workstation, workstation, new WsUpdateTable(this, false)), WsWorkstationTableRefresh);
+    NamesCache::Range range(startSlot, startSlot + slotsPerDay * 7 - 1, workstation, workstation);
+
+    if (isWallboard()) {
+        showSnapshot(false, range, workstation);
+        return;
+    }
+
+    int64_t knownSeq = showCached(false, range, workstation);
+    tdb.queueCommand(new DbSelectNamesCommand(range.slotStart, range.slotStop, range.stationStart, range.stationStop,
+                                              new WsUpdateTable(this, false, startSlot, workstation), tdb.getNamesCache(), knownSeq), WsWorkstationTableRefresh);
+    tdb.queueCommand(new DbPrefetchNamesCommand(range.slotStart, range.slotStop, range.stationStart, range.stationStop,
+                                                slotsPerDay * 7, tdb.getNamesCache()), WsWorkstationPrefetch, PriorityBackground);
 }
 
-class WsBookCallback : public DbInsertNameCallback {
+class WsApplyChanges : public DbSelectChangesCallback {
 public:
-    WsBookCallback(int64_t *bookCountA) : DbInsertNameCallback(bookCountA) {}
+    WsApplyChanges(WorkstationScheduler *ws) : ws(ws) {}
 
     virtual void execute();
+
+private:
+    WorkstationScheduler *ws;
 };
 
-void WsBookCallback::execute() {
+void WsApplyChanges::execute() {
+    if (truncated) {
+        ws->refreshDaily();
+        ws->refreshWorkstation();
+        return;
+    }
+
+    ws->applyChanges(changes);
+}
+
+void WorkstationScheduler::refreshChanges(QueuePriority priority) {
+    if (isWallboard())
+        return;
+
+    int64_t since = dailySeq;
+    if (since < 0 || (workstationSeq >= 0 && workstationSeq < since))
+        since = workstationSeq;
+
+    // Nothing loaded yet, the pending full refreshes will pick everything up
+    if (since < 0)
+        return;
+
+    tdb.queueCommand(new DbSelectChangesCommand(since, new WsApplyChanges(this)), WsChangesRefresh, priority);
 }
 
+class WsBookCallback : public DbInsertNameCallback {
+public:
+    WsBookCallback(int64_t *bookCountA) : DbInsertNameCallback(bookCountA) {}
+};
+
 class WsBookFinalCallback : public DbCallback {
 public:
     WsBookFinalCallback(int64_t *bookCount, QStatusBar *status) :
@@ -613,7 +1021,7 @@ void WsBookFinalCallback::execute() {
 }
 
 void WorkstationScheduler::doBookRelease(bool isBooking) {
-    QTableWidget *table;
+    QTableView *table;
     QDate date = QDate::currentDate();
     QDate wsd = workstationStartDate();
     int64_t workstation = 0;
@@ -641,12 +1049,12 @@ void WorkstationScheduler::doBookRelease(bool isBooking) {
         *bookCount = 0;
     }
 
-    QList<QTableWidgetSelectionRange> ranges = table->selectedRanges();
+    QItemSelection ranges = table->selectionModel()->selection();
     for (auto &range : ranges) {
-        int rowStart = range.topRow();
-        int rowStop  = range.bottomRow();
-        int colStart = range.leftColumn();
-        int colStop  = range.rightColumn();
+        int rowStart = range.top();
+        int rowStop  = range.bottom();
+        int colStart = range.left();
+        int colStop  = range.right();
 
         for (int col = colStart; col <= colStop; col++) {
             if (isDaily) {
@@ -666,46 +1074,192 @@ void WorkstationScheduler::doBookRelease(bool isBooking) {
     }
 
     if (isBooking)
-        tdb.queueCommand(new DbNopCommand(new WsBookFinalCallback(bookCount, ui->statusBar)));
+        tdb.queueCommand(new DbNopCommand(new WsBookFinalCallback(bookCount, ui->statusBar)), 0, PriorityInteractive);
 }
 
 void WorkstationScheduler::book(int64_t workstation, QDate &date, int slotStart, int slotStop, QString &name, int64_t attr, DbInsertNameCallback *cb) {
     int64_t baseSlot = epoch.daysTo(date) * slotsPerDay;
 
-    tdb.queueCommand(new DbInsertNameCommand(baseSlot + slotStart, baseSlot + slotStop, workstation, std::string(name.toUtf8()), attr, cb));
+    tdb.queueCommand(new DbInsertNameCommand(baseSlot + slotStart, baseSlot + slotStop, workstation, std::string(name.toUtf8()), attr, cb, newWriteErrorCallback()));
 }
 
 void WorkstationScheduler::release(int64_t workstation, QDate &date, int slotStart, int slotStop) {
     int64_t baseSlot = epoch.daysTo(date) * slotsPerDay;
 
-    tdb.queueCommand(new DbRemoveNamesCommand(baseSlot + slotStart, baseSlot + slotStop, workstation));
+    tdb.queueCommand(new DbRemoveNamesCommand(baseSlot + slotStart, baseSlot + slotStop, workstation, newWriteErrorCallback()));
 }
 
-void WorkstationScheduler::setupRows(QTableWidget *table) {
-    table->setRowCount(slotsPerDay);
+bool WorkstationScheduler::cellFor(bool isDaily, int64_t slot, int64_t station, int *row, int *col) {
+    WsTableModel *model = isDaily ? &dailyModel : &workstationModel;
+    int64_t delta = slot - (isDaily ? dailyBaseSlot : workstationBaseSlot);
+    int64_t c;
+    int64_t r;
+
+    if (isDaily) {
+        size_t stationSize = static_cast<uint64_t>(station) > SIZE_MAX ? SIZE_MAX : static_cast<size_t>(station);
+        if (delta < 0 || delta >= slotsPerDay || station < 0 || stationSize >= dailyColumn.size())
+            return false;
+        c = dailyColumn[stationSize];
+        r = delta;
+    } else {
+        if (station != workstationShown)
+            return false;
+        c = delta / slotsPerDay;
+        r = delta % slotsPerDay;
+    }
+
+    if (c < 0 || c >= model->columnCount())
+        return false;
 
-    for (int count = 0; count < slotsPerDay; count++) {
-        delete table->takeVerticalHeaderItem(count);
+    if (r < 0 || r >= slotsPerDay)
+        return false;
 
-        std::stringstream str;
-        str << std::setfill('0') << std::setw(2) << (count >> 1);
-        str << ((count & 1) ? ":30" : ":00");
+    *row = static_cast<int> (r);
+    *col = static_cast<int> (c);
+
+    return true;
+}
 
-        QTableWidgetItem *item = new QTableWidgetItem(QString::fromUtf8(str.str().c_str()));
-        table->setVerticalHeaderItem(count, item);
+bool WorkstationScheduler::isWallboard() {
+    return !snapshotFile.isEmpty();
+}
+
+bool WorkstationScheduler::openSnapshot(WsSnapshot *snapshot) {
+    if (!snapshot->open(std::string(snapshotFile.toUtf8()))) {
+        snapshotStamp = -1;
+        ui->statusBar->showMessage(QString::fromUtf8("Nothing has been published to ") + snapshotFile);
+        return false;
+    }
+
+    if (snapshot->getStamp() != snapshotStamp) {
+        snapshotStamp = snapshot->getStamp();
+        ui->statusBar->showMessage(QString::fromUtf8("Read only, published ") +
+                                   QDateTime::fromSecsSinceEpoch(snapshot->getPublishedAt()).toString(QString::fromUtf8("ddd yyyy-MM-dd hh:mm")));
     }
+
+    return true;
 }
 
-QTableWidgetItem *WorkstationScheduler::newTableWidgetItem(const char *name, int64_t attr) {
-    uint64_t uattr = static_cast<uint64_t> (attr);
-    QTableWidgetItem *item = new QTableWidgetItem(QString::fromUtf8(name));
-    item->setForeground(QBrush(static_cast<QRgb> ((uattr & 0xFFFFFF) | 0xFF000000)));
-    item->setBackground(QBrush(static_cast<QRgb> ((uattr >> 24) & 0xFFFFFF) | 0xFF000000));
-    QFont font = item->font();
-    font.setBold((uattr >> 48) & 1);
-    font.setItalic((uattr >> 49) & 1);
-    item->setFont(font);
+class WsSnapshotNames : public WsdbCallback {
+public:
+    virtual void callback(int64_t slot, int64_t station, const char *name, int64_t attr);
+
+    DbSelectNamesCallback::Names data;
+};
+
+void WsSnapshotNames::callback(int64_t slot, int64_t station, const char *name, int64_t attr) {
+    data.append(slot, station, name, attr);
+}
+
+void WorkstationScheduler::showSnapshot(bool isDaily, const NamesCache::Range &range, int64_t workstation) {
+    // Mapped only while reading, a publisher can replace the file any time
+    WsSnapshot snapshot;
+    WsSnapshotNames names;
+    int64_t version = -1;
+
+    if (openSnapshot(&snapshot)) {
+        snapshot.selectNames(range.slotStart, range.slotStop, range.stationStart, range.stationStop, names);
+        version = snapshot.getChangeVersion();
+    }
+
+    updateTable(names.data, isDaily, range.slotStart, workstation, version);
+}
 
-    return item;
+void WorkstationScheduler::rememberStationInfo(const std::vector<Wsdb::StationInfo> &info, const Wsdb::Limits &limits) {
+    stationInfo = info;
+    stationLimits = limits;
 }
 
+QString WorkstationScheduler::viewCacheFile() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QString::fromUtf8("/views.cache");
+}
+
+QString WorkstationScheduler::viewSource() {
+    if (tdb.hasBroker())
+        return QString::fromUtf8("broker ") + settings.value("database/broker").toString();
+
+    return settings.value("database/filename").toString();
+}
+
+void WorkstationScheduler::showSavedViews() {
+    WsViewCache cache;
+
+    if (isWallboard() || !cache.load(viewCacheFile()) || cache.source != std::string(viewSource().toUtf8()) || cache.info.empty())
+        return;
+
+    WsUpdateInfo update(&dailyModel, ui->workstationName, &dailyColumn, &dailyStation, &isUpdating, this, false);
+    *update.prepare(cache.limits) = cache.info;
+    update.execute();
+
+    {
+        MakeTrue mt(&isUpdating);
+        if (cache.workstation >= 0 && cache.workstation < ui->workstationName->count())
+            ui->workstationName->setCurrentIndex(static_cast<int> (cache.workstation));
+    }
+
+    // Only views of the days selected now are shown. Their changeSeq is unknown, so nothing is patched into them.
+    int64_t dailySlot = epoch.daysTo(ui->dailyDate->date()) * slotsPerDay;
+    if (cache.dailySlot == dailySlot) {
+        updateTable(cache.daily, true, dailySlot, -1, -1);
+        if (!cache.counts.empty()) {
+            dailyCountsSlot = dailySlot;
+            updateCounts(cache.counts, dailySlot);
+        }
+        isDailyStale = true;
+    }
+
+    int64_t weekSlot = epoch.daysTo(workstationStartDate()) * slotsPerDay;
+    if (cache.weekSlot == weekSlot && cache.workstation == ui->workstationName->currentIndex()) {
+        setWeekLabels();
+        updateTable(cache.week, false, weekSlot, cache.workstation, -1);
+        isWorkstationStale = true;
+    }
+
+    if (isDailyStale || isWorkstationStale)
+        ui->statusBar->showMessage(QString::fromUtf8("Showing the schedule as of ") +
+                                   QDateTime::fromSecsSinceEpoch(cache.savedAt).toString(QString::fromUtf8("ddd yyyy-MM-dd hh:mm")) +
+                                   QString::fromUtf8(", waiting for the database"));
+}
+
+void WorkstationScheduler::saveViews() {
+    // A start that never reached the database keeps the file of the last one that did
+    if (isWallboard() || stationInfo.empty() || (dailySeq < 0 && workstationSeq < 0))
+        return;
+
+    WsViewCache cache;
+    QString name;
+    int64_t attr;
+
+    cache.source = std::string(viewSource().toUtf8());
+    cache.info = stationInfo;
+    cache.limits = stationLimits;
+    cache.workstation = ui->workstationName->currentIndex();
+
+    if (dailySeq >= 0) {
+        cache.dailySlot = dailyBaseSlot;
+        for (int col = 1; col < dailyModel.columnCount() && static_cast<size_t> (col - 1) < dailyStation.size(); col++) {
+            for (int row = 0; row < slotsPerDay; row++) {
+                if (dailyModel.cellAt(row, col, &name, &attr))
+                    cache.daily.append(dailyBaseSlot + row, dailyStation[static_cast<size_t> (col - 1)], name.toUtf8().constData(), attr);
+            }
+        }
+
+        if (dailyCountsSlot == dailyBaseSlot)
+            cache.counts = dailyModel.getCounts();
+    }
+
+    if (workstationSeq >= 0) {
+        cache.weekSlot = workstationBaseSlot;
+        cache.workstation = workstationShown;
+        for (int col = 0; col < workstationModel.columnCount(); col++) {
+            for (int row = 0; row < slotsPerDay; row++) {
+                if (workstationModel.cellAt(row, col, &name, &attr))
+                    cache.week.append(workstationBaseSlot + col * slotsPerDay + row, workstationShown, name.toUtf8().constData(), attr);
+            }
+        }
+    }
+
+    QString filename = viewCacheFile();
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    cache.save(filename);
+}
@@ -23,7 +23,7 @@
 #ifndef WORKSTATIONSCHEDULER_H
 #define WORKSTATIONSCHEDULER_H
 
-#include <list>
+#include <vector>
 
 #include <QAction>
 #include <QDate>
@@ -31,10 +31,13 @@
 #include <QPushButton>
 #include <QString>
 #include <QSettings>
-#include <QTableWidget>
+#include <QTableView>
+#include <QTimer>
 
 #include "threadeddb.h"
 #include "wsdb.h"
+#include "wssnapshot.h"
+#include "wstablemodel.h"
 
 namespace Ui {
 class WorkstationScheduler;
@@ -47,13 +50,23 @@ public:
     static const QDate epoch;
     static const int slotsPerDay;
     static const int64_t refreshInterval;
+    static const int64_t snapshotPollInterval;
 
     explicit WorkstationScheduler(QWidget *parent = nullptr);
     ~WorkstationScheduler();
 
     void refreshAll();
     void openDbFile(QString filename);
-    void updateTable(std::list<DbSelectNamesCallback::Datum *> &data, bool isDaily);
+    // Results for a day or workstation that is no longer selected are ignored
+    void updateTable(const DbSelectNamesCallback::Names &data, bool isDaily, int64_t slotStart, int64_t workstation, int64_t changeSeq);
+    void applyChanges(const std::vector<DbSelectChangesCallback::Change> &changes);
+    void updateCounts(const std::vector<int64_t> &counts, int64_t slotStart); // Ignored if the day is no longer shown
+    void refreshDaily();
+    bool isDailyShown();
+    void refreshWorkstation();
+    void refreshChanges(QueuePriority priority = PriorityVisible);
+    void rememberStationInfo(const std::vector<Wsdb::StationInfo> &info, const Wsdb::Limits &limits); // For the view cache
+    DbErrorCallback *newWriteErrorCallback();
 
 private slots:
     void on_refresh_clicked();
@@ -65,6 +78,10 @@ private slots:
     void on_foregroundButton_clicked();
     void on_backgroundButton_clicked();
     void on_actionWorkstationDescriptions_triggered();
+    void on_actionUtilizationReport_triggered();
+    void on_actionImportReservations_triggered();
+    void on_actionExportReservations_triggered();
+    void on_actionDiagnostics_triggered();
     void on_actionAbout_triggered();
     void on_actionQuit_triggered();
     void on_actionOpenDatabase_triggered();
@@ -75,9 +92,10 @@ private slots:
     void on_dailyToday_clicked();
     void on_workstationToday_clicked();
     void on_takeFromCell_clicked();
+    void deliverCallbacks();
+    void autoRefresh();
 
 private:
-    void timerEvent(QTimerEvent *event);
     void saveSettings();
     void selectDbFile();
     void buildRecentDatabasesMenu();
@@ -88,27 +106,49 @@ private:
     QRgb getColor(QPushButton *button);
     void chooseColor(QPushButton *button, const QString &title);
     QString defaultBookAs();
+    Wsdb::StorageProfile clientStorageProfile();
     QDate workstationStartDate();
-    void refreshInfo();
-    void refreshDaily();
-    void refreshWorkstation();
+    void setWeekLabels();
+    void refreshInfo(bool reloadTables = false, QueuePriority priority = PriorityVisible);
+    void refreshCounts();
     void doBookRelease(bool isBooking);
     void book(int64_t workstation, QDate &date, int slotStart, int slotStop, QString &name, int64_t attr, DbInsertNameCallback *cb);
     void release(int64_t workstation, QDate &date, int slotStart, int slotStop);
-
-    static void setupRows(QTableWidget *table);
-    static QTableWidgetItem *newTableWidgetItem(const char *name, int64_t attr);
+    bool cellFor(bool isDaily, int64_t slot, int64_t station, int *row, int *col);
+    QString viewCacheFile();
+    QString viewSource();
+    void showSavedViews();
+    void saveViews();
+    bool isWallboard();
+    bool openSnapshot(WsSnapshot *snapshot); // false if there is none, shown in the status bar
+    void showSnapshot(bool isDaily, const NamesCache::Range &range, int64_t workstation);
+    int64_t showCached(bool isDaily, const NamesCache::Range &range, int64_t workstation); // changeSeq shown, -1 on a miss
 
 private:
     Ui::WorkstationScheduler *ui;
     QSettings settings;
     ThreadedDb tdb;
+    WsTableModel dailyModel;
+    WsTableModel workstationModel;
     bool isUpdating;
-    int64_t lastRefresh;
+    bool isBusy;
+    QTimer refreshTimer;
+    int64_t dailySeq;       // Change log sequence the tables are current to, -1 if not loaded
+    int64_t workstationSeq;
+    int64_t dailyBaseSlot;  // First slot of what the tables show
+    int64_t workstationBaseSlot;
+    int64_t workstationShown;
+    int64_t dailyCountsSlot; // First slot of the counts shown, or requested if they are still unknown
     std::vector<int> dailyColumn;
     std::vector<int64_t> dailyStation;
-    Wsdb::Limits limits;
     int ySaveOffset;
+    std::vector<Wsdb::StationInfo> stationInfo; // As last shown
+    Wsdb::Limits stationLimits;
+    bool isDailyStale;      // Shows the view saved at the last exit until the database answers
+    bool isWorkstationStale;
+    QString snapshotFile;   // Set for read-only displays, which show the published weeks and never open the database
+    int64_t snapshotStamp;  // WsSnapshot::fileStamp of what is shown
+    QDate wallboardToday;
 };
 
 #endif // WORKSTATIONSCHEDULER_H
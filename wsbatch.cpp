@@ -0,0 +1,385 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+#include "wsbatch.h"
+#include "wsdbtransfer.h"
+
+static const int64_t slotsPerDay = 48; // As in WorkstationScheduler
+
+const char *const WsBatch::usage =
+    "book STATIONS FROM TO NAME [ATTR]   Book the free slots, slots already booked are kept\n"
+    "release STATIONS FROM TO            Release every booking in the range\n"
+    "list [STATIONS [FROM [TO]]]         Print the bookings as CSV, all stations today by default\n"
+    "export FILE [STATIONS [FROM [TO]]]  Write the bookings to CSV, or JSON for .json, all by default\n"
+    "import FILE                         Book the reservations in a CSV or JSON file\n"
+    "\n"
+    "STATIONS is a list like 1-10,12,\"Lab PC\" or all, numbers count from 1.  FROM and TO are\n"
+    "yyyy-mm-dd for whole days, or \"yyyy-mm-dd hh:mm\" on the half hour with TO exclusive.\n"
+    "FILE - is stdin or stdout.\n";
+
+static std::string trim(const std::string &text) {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return std::string();
+
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+static bool parseNumber(const std::string &text, int64_t *value) {
+    if (text.empty() || !isdigit(static_cast<unsigned char> (text[0])))
+        return false;
+
+    char *end;
+    errno = 0;
+    *value = strtoll(text.c_str(), &end, 10);
+
+    return errno == 0 && *end == '\0';
+}
+
+static int64_t parseFrom(const std::string &text) {
+    int64_t slot;
+
+    if (!WsdbTransfer::parseTime(trim(text), &slot))
+        throw std::runtime_error("Bad time \"" + text + "\", use yyyy-mm-dd or \"yyyy-mm-dd hh:mm\" on the half hour");
+
+    return slot;
+}
+
+// The last slot, a day alone includes all of it
+static int64_t parseTo(const std::string &text) {
+    int64_t slot = parseFrom(text);
+
+    if (text.find(':') == std::string::npos)
+        slot += slotsPerDay;
+
+    return slot - 1;
+}
+
+WsBatch::WsBatch(Wsdb &wsdb, std::istream *in, std::ostream &out, std::ostream &err) :
+    wsdb(wsdb),
+    in(in),
+    out(out),
+    err(err),
+    inTransaction(false),
+    conflicts(false) {
+}
+
+WsBatch::~WsBatch() {
+    rollback();
+}
+
+void WsBatch::execute(const std::vector<std::string> &words) {
+    if (words.empty())
+        return;
+
+    try {
+        const std::string &command = words[0];
+
+        if (command == "book")
+            book(words);
+        else if (command == "release")
+            release(words);
+        else if (command == "list")
+            list(words);
+        else if (command == "export")
+            exportFile(words);
+        else if (command == "import")
+            importFile(words);
+        else
+            throw std::runtime_error("Unknown command \"" + command + "\"");
+    } catch (std::runtime_error &e) {
+        throw std::runtime_error(prefix() + e.what());
+    }
+}
+
+void WsBatch::executeLine(const std::string &line) {
+    std::vector<std::string> words;
+
+    try {
+        words = split(line);
+    } catch (std::runtime_error &e) {
+        throw std::runtime_error(prefix() + e.what());
+    }
+
+    execute(words);
+}
+
+void WsBatch::commit() {
+    if (!inTransaction)
+        return;
+
+    wsdb.pruneChanges();
+    wsdb.commit();
+    inTransaction = false;
+}
+
+void WsBatch::rollback() {
+    if (!inTransaction)
+        return;
+
+    wsdb.rollback();
+    inTransaction = false;
+}
+
+std::vector<std::string> WsBatch::split(const std::string &line) {
+    std::vector<std::string> words;
+    std::string word;
+    bool inWord = false;
+    bool quoted = false;
+
+    for (size_t pos = 0; pos < line.size(); pos++) {
+        char c = line[pos];
+
+        if (quoted) {
+            if (c != '"')
+                word.push_back(c);
+            else if (pos + 1 < line.size() && line[pos + 1] == '"')
+                word.push_back(line[++pos]);
+            else
+                quoted = false;
+            continue;
+        }
+
+        if (c == '"') {
+            quoted = true;
+            inWord = true;
+        } else if (c == '#' && !inWord) {
+            break;
+        } else if (isspace(static_cast<unsigned char> (c))) {
+            if (inWord)
+                words.push_back(word);
+            word.clear();
+            inWord = false;
+        } else {
+            word.push_back(c);
+            inWord = true;
+        }
+    }
+
+    if (quoted)
+        throw std::runtime_error("Quote does not end");
+    if (inWord)
+        words.push_back(word);
+
+    return words;
+}
+
+void WsBatch::write() {
+    if (inTransaction)
+        return;
+
+    wsdb.begin();
+    inTransaction = true;
+}
+
+void WsBatch::book(const std::vector<std::string> &words) {
+    if (words.size() != 5 && words.size() != 6)
+        throw std::runtime_error("Use book STATIONS FROM TO NAME [ATTR]");
+
+    std::vector<int64_t> stations = parseStations(words[1]);
+    int64_t slotStart = parseFrom(words[2]);
+    int64_t slotStop = parseTo(words[3]);
+    int64_t attr;
+
+    if (slotStop < slotStart)
+        throw std::runtime_error("TO is not after FROM");
+    if (words[4].empty())
+        throw std::runtime_error("No name");
+    if (!WsdbTransfer::parseAttr(words.size() > 5 ? trim(words[5]) : std::string(), &attr))
+        throw std::runtime_error("Bad attr \"" + words[5] + "\"");
+
+    write();
+    int64_t length = slotStop - slotStart + 1;
+    int64_t archived = checkArchived(slotStart, slotStop);
+    for (auto station : stations) {
+        int64_t booked = wsdb.insertNames(slotStart, slotStop, station, words[4].c_str(), attr);
+        if (booked + archived < length) {
+            conflicts = true;
+            err << prefix() << info[static_cast<size_t> (station)].name << ": " << length - archived - booked << " of " << length << " slots were already booked\n";
+        }
+    }
+}
+
+void WsBatch::release(const std::vector<std::string> &words) {
+    if (words.size() != 4)
+        throw std::runtime_error("Use release STATIONS FROM TO");
+
+    std::vector<int64_t> stations = parseStations(words[1]);
+    int64_t slotStart = parseFrom(words[2]);
+    int64_t slotStop = parseTo(words[3]);
+
+    if (slotStop < slotStart)
+        throw std::runtime_error("TO is not after FROM");
+
+    write();
+    checkArchived(slotStart, slotStop);
+    for (auto station : stations)
+        wsdb.removeNames(slotStart, slotStop, station);
+}
+
+int64_t WsBatch::checkArchived(int64_t slotStart, int64_t slotStop) {
+    int64_t archivedBefore = wsdb.getArchivedBefore();
+    if (slotStart >= archivedBefore)
+        return 0;
+
+    // Archived days are read only, Wsdb skips them
+    int64_t archived = std::min(archivedBefore, slotStop + 1) - slotStart;
+    conflicts = true;
+    err << prefix() << archived << " of " << slotStop - slotStart + 1 << " slots are archived and were left as they were\n";
+
+    return archived;
+}
+
+void WsBatch::list(const std::vector<std::string> &words) {
+    if (words.size() > 4)
+        throw std::runtime_error("Use list [STATIONS [FROM [TO]]]");
+
+    std::vector<int64_t> stations = parseStations(words.size() > 1 ? words[1] : "all");
+    int64_t slotStart = words.size() > 2 ? parseFrom(words[2]) : Wsdb::todaySlot();
+    int64_t slotStop = words.size() > 3 ? parseTo(words[3]) : words.size() > 2 ? parseTo(words[2]) : slotStart + slotsPerDay - 1;
+    if (slotStop < slotStart)
+        throw std::runtime_error("TO is not after FROM");
+
+    WsdbTransfer::exportReservations(out, WsdbTransfer::FormatCsv, wsdb, slotStart, slotStop, stations);
+}
+
+void WsBatch::exportFile(const std::vector<std::string> &words) {
+    if (words.size() < 2 || words.size() > 5)
+        throw std::runtime_error("Use export FILE [STATIONS [FROM [TO]]]");
+
+    std::vector<int64_t> stations = parseStations(words.size() > 2 ? words[2] : "all");
+    int64_t slotStart = 0;
+    int64_t slotStop = -1;
+    if (words.size() > 3) {
+        slotStart = parseFrom(words[3]);
+        slotStop = parseTo(words.size() > 4 ? words[4] : words[3]);
+        if (slotStop < slotStart)
+            throw std::runtime_error("TO is not after FROM");
+    } else {
+        wsdb.getSlotRange(&slotStart, &slotStop);
+    }
+
+    const std::string &filename = words[1];
+    if (filename == "-") {
+        WsdbTransfer::exportReservations(out, WsdbTransfer::FormatCsv, wsdb, slotStart, slotStop, stations);
+        return;
+    }
+
+    std::ofstream file(filename.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Could not create " + filename);
+
+    int64_t records = WsdbTransfer::exportReservations(file, WsdbTransfer::formatOf(filename), wsdb, slotStart, slotStop, stations);
+    err << prefix() << "Exported " << records << " reservations to " << filename << "\n";
+}
+
+void WsBatch::importFile(const std::vector<std::string> &words) {
+    if (words.size() != 2)
+        throw std::runtime_error("Use import FILE");
+
+    const std::string &filename = words[1];
+    std::ifstream file;
+    std::istream *source = in;
+    if (filename != "-") {
+        file.open(filename.c_str(), std::ios::in | std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Could not open " + filename);
+        source = &file;
+    } else if (source == nullptr) {
+        throw std::runtime_error("stdin holds the commands, import from a file");
+    }
+
+    // The import batches its own transactions
+    commit();
+    std::string name = filename == "-" ? "stdin" : filename;
+    WsdbTransfer::ImportResult result = WsdbTransfer::importReservations(*source, WsdbTransfer::formatOf(filename), wsdb);
+
+    for (auto &problem : result.problems)
+        err << name << ":" << problem.line << ": " << problem.message << "\n";
+    if (result.conflicts + result.rejected > static_cast<int64_t> (result.problems.size()))
+        err << name << ": further problems not shown\n";
+    if (result.conflicts > 0)
+        conflicts = true;
+
+    err << prefix() << "Imported " << result.records << " reservations from " << name << ", booked " << result.booked << " slots, "
+        << result.conflicts << " overlapped existing bookings or archived days, " << result.rejected << " skipped\n";
+}
+
+std::vector<int64_t> WsBatch::parseStations(const std::string &text) {
+    if (info.empty())
+        wsdb.getStationInfo(&info);
+
+    int64_t num = static_cast<int64_t> (info.size());
+    std::vector<int64_t> stations;
+    std::vector<bool> seen(info.size(), false);
+    auto add = [&](int64_t station) {
+        if (!seen[static_cast<size_t> (station)])
+            stations.push_back(station);
+        seen[static_cast<size_t> (station)] = true;
+    };
+
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos)
+            comma = text.size();
+        std::string item = trim(text.substr(start, comma - start));
+        start = comma + 1;
+
+        size_t dash = item.find('-', 1);
+        int64_t first, last;
+        if (item == "all") {
+            for (int64_t station = 0; station < num; station++)
+                add(station);
+        } else if (dash != std::string::npos && parseNumber(trim(item.substr(0, dash)), &first) && parseNumber(trim(item.substr(dash + 1)), &last)) {
+            if (first < 1 || last > num || last < first)
+                throw std::runtime_error("No workstations " + item + ", there are " + std::to_string(num));
+            for (int64_t station = first - 1; station < last; station++)
+                add(station);
+        } else if (parseNumber(item, &first)) {
+            if (first < 1 || first > num)
+                throw std::runtime_error("No workstation " + item + ", there are " + std::to_string(num));
+            add(first - 1);
+        } else {
+            int64_t found = -1;
+            for (int64_t station = 0; station < num && found < 0; station++)
+                if (info[static_cast<size_t> (station)].name == item)
+                    found = station;
+            if (found < 0)
+                throw std::runtime_error("No workstation \"" + item + "\"");
+            add(found);
+        }
+    }
+
+    return stations;
+}
+
+std::string WsBatch::prefix() {
+    return context.empty() ? std::string() : context + ": ";
+}
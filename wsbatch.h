@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef WSBATCH_H
+#define WSBATCH_H
+
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "wsdb.h"
+
+// Book, release, list, export and import commands for scripts, run straight on a Wsdb.
+// Writes share one transaction until commit(), an import commits what came before and then its own batches.
+class WsBatch {
+public:
+    // in serves import -, nullptr if stdin holds the commands
+    WsBatch(Wsdb &wsdb, std::istream *in, std::ostream &out, std::ostream &err);
+    ~WsBatch();
+
+    static const char *const usage; // The commands and their arguments
+
+    // Throw std::runtime_error if the command is wrong or the database fails, roll back then
+    void execute(const std::vector<std::string> &words);
+    void executeLine(const std::string &line); // Words split as by a shell, "" quote, # starts a comment
+    void commit();
+    void rollback();
+    bool hasConflicts() {return conflicts;} // Some slots to book were already taken
+
+    void setContext(const std::string &where) {context = where;} // Prefix for messages, like "line 3"
+
+private:
+    static std::vector<std::string> split(const std::string &line);
+    void write();
+    void book(const std::vector<std::string> &words);
+    void release(const std::vector<std::string> &words);
+    int64_t checkArchived(int64_t slotStart, int64_t slotStop); // Reports and returns the slots before the archive horizon
+    void list(const std::vector<std::string> &words);
+    void exportFile(const std::vector<std::string> &words);
+    void importFile(const std::vector<std::string> &words);
+    std::vector<int64_t> parseStations(const std::string &text);
+    std::string prefix();
+
+    Wsdb &wsdb;
+    std::istream *in;
+    std::ostream &out;
+    std::ostream &err;
+    std::string context;
+    bool inTransaction;
+    bool conflicts;
+    std::vector<Wsdb::StationInfo> info; // Loaded with the first station set
+};
+
+#endif // WSBATCH_H
@@ -0,0 +1,133 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QSettings>
+
+#include "wsbatch.h"
+#include "wscommandline.h"
+#include "wsdb.h"
+
+static const char *const commandWords[] = {"book", "release", "list", "export", "import", "batch"};
+static const char *const commandOptions[] = {"--import", "--export", "--database", "--help"};
+
+bool WsCommandLine::isRequested(int argc, char *argv[]) {
+    for (int arg = 1; arg < argc; arg++) {
+        for (auto option : commandOptions)
+            if (strncmp(argv[arg], option, strlen(option)) == 0)
+                return true;
+
+        for (auto word : commandWords)
+            if (strcmp(argv[arg], word) == 0)
+                return true;
+    }
+
+    return false;
+}
+
+int WsCommandLine::run(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QString::fromUtf8("WorkstationScheduler"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QString::fromUtf8("Books and lists workstation reservations without opening the window.\n\n") +
+                                     QString::fromUtf8(WsBatch::usage) +
+                                     QString::fromUtf8("\nbatch reads these commands from stdin, one per line, and commits them together.  "
+                                                       "Nothing is kept if a command fails, except what imports committed.  "
+                                                       "The exit code is 0 on success, 1 on errors and 3 if some slots were already booked."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QString::fromUtf8("command"), QString::fromUtf8("One of the commands above."), QString::fromUtf8("[command [args...]]"));
+
+    QCommandLineOption databaseOption(QString::fromUtf8("database"), QString::fromUtf8("Database to use, the one last opened by default."), QString::fromUtf8("file"));
+    QCommandLineOption importOption(QString::fromUtf8("import"), QString::fromUtf8("Same as the import command, before it."), QString::fromUtf8("file"));
+    QCommandLineOption exportOption(QString::fromUtf8("export"), QString::fromUtf8("Same as the export command of everything, before it."), QString::fromUtf8("file"));
+    parser.addOption(databaseOption);
+    parser.addOption(importOption);
+    parser.addOption(exportOption);
+    parser.process(app);
+
+    std::vector<std::string> words;
+    for (auto &arg : parser.positionalArguments())
+        words.push_back(std::string(arg.toUtf8()));
+
+    if (words.empty() && !parser.isSet(importOption) && !parser.isSet(exportOption))
+        parser.showHelp(2);
+
+    QString database = parser.value(databaseOption);
+    if (database.isEmpty())
+        database = QSettings(QString::fromUtf8("maurerpe"), QString::fromUtf8("WorkstationScheduler")).value(QString::fromUtf8("database/filename")).toString();
+    if (database.isEmpty()) {
+        std::cerr << "No database given and none opened before, use --database\n";
+        return 2;
+    }
+
+    // A script with a typo in the path should not start a new database
+    if (!QFileInfo::exists(database)) {
+        std::cerr << "Database " << std::string(database.toUtf8()) << " does not exist\n";
+        return 1;
+    }
+
+    bool isBatch = !words.empty() && words[0] == "batch";
+    if (isBatch && words.size() > 1) {
+        std::cerr << "batch takes its commands from stdin\n";
+        return 2;
+    }
+
+    Wsdb wsdb;
+    WsBatch batch(wsdb, isBatch ? nullptr : &std::cin, std::cout, std::cerr);
+    try {
+        wsdb.open(database.toUtf8().constData());
+
+        for (auto &filename : parser.values(importOption))
+            batch.execute({"import", std::string(filename.toUtf8())});
+
+        for (auto &filename : parser.values(exportOption))
+            batch.execute({"export", std::string(filename.toUtf8())});
+
+        if (isBatch) {
+            std::string line;
+            int64_t lineNum = 0;
+
+            while (std::getline(std::cin, line)) {
+                batch.setContext("line " + std::to_string(++lineNum));
+                batch.executeLine(line);
+            }
+        } else {
+            batch.execute(words);
+        }
+
+        batch.commit();
+    } catch (std::exception &e) {
+        batch.rollback();
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    return batch.hasConflicts() ? 3 : 0;
+}
@@ -20,14 +20,40 @@
 // DEALINGS IN THE SOFTWARE.
 //////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <stdexcept>
+#include <stdlib.h>
 #include <sstream>
+#include <time.h>
 
 #include "wsdb.h"
 
 #define DEFAULT_STATIONS "10"
 #define DEFAULT_LIMIT 0x7FFFFFFF
 
+#define DEFAULT_JOURNAL_MODE "0"   // delete, WAL only works on shares that support shared memory
+#define DEFAULT_SYNCHRONOUS  "2"   // full
+#define DEFAULT_BUSY_TIMEOUT "5000"
+#define DEFAULT_MMAP_SIZE    "0"
+#define DEFAULT_CACHE_SIZE   "-8192"
+
+#define DEFAULT_CHANGE_LOG_SIZE 50000
+
+// Index entries sampled per index by ANALYZE during maintenance, enough for the query planner
+#define ANALYSIS_LIMIT "1000"
+// Free pages given back per incremental vacuum step
+#define VACUUM_PAGES "64"
+// Longest the VACUUM may hold the file that switches an older one to incremental auto vacuum,
+// well below the default busy timeout other clients wait for the lock
+#define VACUUM_CONVERSION_MS 2000
+
+// Intervals never span a block boundary, so an overlap lookup only has to look this far back
+#define INTERVAL_BLOCK 48
+
+// Slots are half hours from 2000-01-01, as the client counts them. Days are blocks, so
+// archiving up to a day boundary never splits a run.
+#define SLOTS_PER_DAY 48
+
 class ResetOnExit {
 private:
     sqlite3_stmt *stmt;
@@ -37,11 +63,110 @@ public:
     ~ResetOnExit() {sqlite3_reset(stmt);}
 };
 
+class FinalizeOnExit {
+private:
+    sqlite3_stmt *stmt;
+
+public:
+    FinalizeOnExit(sqlite3_stmt *stmt) : stmt(stmt) {}
+    ~FinalizeOnExit() {sqlite3_finalize(stmt);}
+};
+
 void WsdbCallback::callback(int64_t, int64_t, const char *, int64_t) {
 }
 
+void WsdbChangeCallback::change(int64_t, int64_t, int64_t, int64_t, const char *, int64_t) {
+}
+
+void WsdbUsageCallback::usage(int64_t, int64_t, int64_t) {
+}
+
+enum MaintenanceTask {MaintainArchive, MaintainStatistics, MaintainCheckpoint, MaintainConvertVacuum, MaintainVacuum, numMaintenanceTasks};
+
+static int64_t blockOf(int64_t slot) {
+    if (slot >= 0)
+        return slot / INTERVAL_BLOCK;
+
+    return -((-slot + INTERVAL_BLOCK - 1) / INTERVAL_BLOCK);
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t daysFromCivil(int64_t year, int64_t month, int64_t day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t yoe = year - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+// Inverse of daysFromCivil
+static void civilFromDays(int64_t days, int64_t *year, int64_t *month, int64_t *day) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t doe = days - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+static int64_t yearStartSlot(int64_t year) {
+    return Wsdb::slotOfDate(year, 1, 1);
+}
+
+static int64_t yearOfSlot(int64_t slot) {
+    int64_t year = 2000 + slot / (SLOTS_PER_DAY * 365);
+
+    while (yearStartSlot(year) > slot)
+        year--;
+
+    while (yearStartSlot(year + 1) <= slot)
+        year++;
+
+    return year;
+}
+
+// Reads that run against the main file and an attached archive alike
+static std::string selectSql(const char *schema) {
+    return std::string("select slot, station, nameId, attr from ") + schema + ".reservations where slot between ? and ? and station between ? and ?;";
+}
+
+static std::string selectRunsSql(const char *schema) {
+    return std::string("select slotStart, slotStop, station, nameId, attr from ") + schema + ".intervals "
+           "where slotStart between ? and ? and station between ? and ? and slotStop >= ?;";
+}
+
+static std::string usedSql(const char *schema) {
+    return std::string("select station, ((slot - ?1) / ?2) % ?3 as bucket, count(*) from ") + schema + ".reservations "
+           "where slot between ?4 and ?5 group by station, bucket;";
+}
+
+// Runs are expanded to slots with slot_offsets, they never cross a block so it has enough rows
+static std::string runsUsedSql(const char *schema) {
+    return std::string("select i.station, ((i.slotStart + o.n - ?1) / ?2) % ?3 as bucket, count(*) from ") + schema + ".intervals i, main.slot_offsets o "
+           "where i.slotStart between ?6 and ?5 and o.n <= i.slotStop - i.slotStart and i.slotStart + o.n between ?4 and ?5 "
+           "group by i.station, bucket;";
+}
+
+static std::string sumRunsUsedSql(const char *schema) {
+    return std::string("select station, ((max(slotStart, ?4) - ?1) / ?2) % ?3 as bucket, sum(min(slotStop, ?5) - max(slotStart, ?4) + 1) from ") + schema + ".intervals "
+           "where slotStart between ?6 and ?5 and slotStop >= ?4 group by station, bucket;";
+}
+
 Wsdb::Wsdb() :
+    cancelFlag(nullptr),
+    hasDeadline(false),
+    busyTimeout(0),
+    busyWait(0),
+    maintenanceTask(0),
     db(nullptr),
+    dataVersion(nullptr),
+    getVersion(nullptr),
     getParam(nullptr),
     setParam(nullptr),
     getInfo(nullptr),
@@ -49,26 +174,102 @@ Wsdb::Wsdb() :
     cleanInfo(nullptr),
     insert(nullptr),
     select(nullptr),
-    remove(nullptr) {
+    remove(nullptr),
+    insertNameId(nullptr),
+    getNameId(nullptr),
+    loadNames(nullptr),
+    lastChange(nullptr),
+    firstChange(nullptr),
+    selectChange(nullptr),
+    pruneChange(nullptr),
+    selectRuns(nullptr),
+    selectBlock(nullptr),
+    insertRun(nullptr),
+    removeRun(nullptr),
+    selectCounts(nullptr),
+    selectUsed(nullptr),
+    selectRunsUsed(nullptr),
+    sumRunsUsed(nullptr),
+    archiveAttached(INT64_MIN),
+    archiveSelect(nullptr),
+    archiveSelectRuns(nullptr),
+    archiveUsed(nullptr),
+    archiveRunsUsed(nullptr),
+    archiveSumRunsUsed(nullptr),
+    generation(0),
+    lastDataVersion(-1),
+    lastTotalChanges(-1),
+    version(-1),
+    namesLoaded(0),
+    isBulkLoad(false) {
 }
 
 Wsdb::~Wsdb() {
     close();
 }
 
-void Wsdb::open(const char *filename) {
+const int64_t Wsdb::StorageProfile::unset = INT64_MIN;
+
+Wsdb::StorageProfile::StorageProfile() :
+    journalMode(unset),
+    synchronous(unset),
+    busyTimeout(unset),
+    mmapSize(unset),
+    cacheSize(unset) {
+}
+
+void Wsdb::StorageProfile::merge(const StorageProfile &other) {
+    if (other.journalMode != unset)
+        journalMode = other.journalMode;
+
+    if (other.synchronous != unset)
+        synchronous = other.synchronous;
+
+    if (other.busyTimeout != unset)
+        busyTimeout = other.busyTimeout;
+
+    if (other.mmapSize != unset)
+        mmapSize = other.mmapSize;
+
+    if (other.cacheSize != unset)
+        cacheSize = other.cacheSize;
+}
+
+void Wsdb::open(const char *filename, const StorageProfile &clientProfile) {
     close();
+    generation++;
 
     if (sqlite3_open(filename, &db) != SQLITE_OK)
         throw std::runtime_error("Could not open database: " + std::string(sqlite3_errmsg(db)));
 
+    installCancelHandler();
+
+    // Only takes effect for a new file, older ones switch with the VACUUM of a maintenance round
+    sqlite3_exec(db, "pragma auto_vacuum = incremental;", nullptr, nullptr, nullptr);
+
+    // Wait for other clients while creating the tables, the profile may change this below
+    setBusyTimeout(clientProfile.busyTimeout != StorageProfile::unset ? clientProfile.busyTimeout : atoi(DEFAULT_BUSY_TIMEOUT));
+
     char *errStr;
-    if (sqlite3_exec(db, "create table if not exists reservations (slot int not null, station int not null, name text, attr int, primary key (slot, station)) without rowid;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+    if (sqlite3_exec(db, "create table if not exists reservations (slot int not null, station int not null, nameId int, attr int, primary key (slot, station)) without rowid;", nullptr, nullptr, &errStr) != SQLITE_OK) {
         std::string err(errStr);
         close();
         throw std::runtime_error("Could not create table reservations: " + err);
     }
 
+    if (sqlite3_exec(db, "create table if not exists intervals (slotStart int not null, station int not null, slotStop int not null, nameId int, attr int, primary key (slotStart, station)) without rowid;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        close();
+        throw std::runtime_error("Could not create table intervals: " + err);
+    }
+
+    // Names are never deleted so ids stay valid in every client's cache
+    if (sqlite3_exec(db, "create table if not exists names (id integer primary key, name text unique not null);", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        close();
+        throw std::runtime_error("Could not create table names: " + err);
+    }
+
     if (sqlite3_exec(db, "create table if not exists descriptions (station int primary key not null, name text, desc text, flags int) without rowid;", nullptr, nullptr, &errStr) != SQLITE_OK) {
         std::string err(errStr);
         close();
@@ -81,61 +282,103 @@ void Wsdb::open(const char *filename) {
         throw std::runtime_error("Could not create table parameters: " + err);
     }
 
-    if (sqlite3_exec(db, "insert or ignore into parameters (name, value) values (\"numStations\", " DEFAULT_STATIONS ");", nullptr, nullptr, &errStr) != SQLITE_OK) {
+    if (sqlite3_exec(db, "create table if not exists version (id int primary key not null, value int) without rowid;"
+                     "insert or ignore into version (id, value) values (0, 0);", nullptr, nullptr, &errStr) != SQLITE_OK) {
         std::string err(errStr);
         close();
-        throw std::runtime_error("Could not set default number of stations: " + err);
+        throw std::runtime_error("Could not create table version: " + err);
     }
 
-    if (sqlite3_prepare_v2(db, "select value from parameters where name = ?;", -1, &getParam, nullptr) != SQLITE_OK) {
+    try {
+        migrateNames();
+    } catch (std::exception &) {
         close();
-        throw std::runtime_error("Could not prepare getParam statement: " + std::string(sqlite3_errmsg(db)));
+        throw;
     }
 
-    if (sqlite3_prepare_v2(db, "insert or replace into parameters (name, value) values (?, ?);", -1, &setParam, nullptr) != SQLITE_OK) {
-        std::string err(sqlite3_errmsg(db));
+    // Append-only log of reservation changes so clients can sync deltas, name is null for removals
+    if (sqlite3_exec(db, "create table if not exists reservation_changes (seq integer primary key autoincrement, slot int not null, station int not null, name text, attr int, slotStop int);", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
         close();
-        throw std::runtime_error("Could not prepare setParam statement: " + err);
+        throw std::runtime_error("Could not create table reservation_changes: " + err);
     }
 
-    if (sqlite3_prepare_v2(db, "select station, name, desc, flags from descriptions;", -1, &getInfo, nullptr) != SQLITE_OK) {
-        std::string err(sqlite3_errmsg(db));
+    try {
+        migrateChangeLog();
+        migrateSlotCounts();
+        createTriggers();
+    } catch (std::exception &) {
         close();
-        throw std::runtime_error("Could not prepare getInfo statement: " + std::string(sqlite3_errmsg(db)));
+        throw;
     }
 
-    if (sqlite3_prepare_v2(db, "insert or replace into descriptions (station, name, desc, flags) values (?, ?, ?, ?);", -1, &setInfo, nullptr) != SQLITE_OK) {
-        std::string err(sqlite3_errmsg(db));
+    if (sqlite3_exec(db, "insert or ignore into parameters (name, value) values (\"numStations\", " DEFAULT_STATIONS ");", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
         close();
-        throw std::runtime_error("Could not prepare setInfo statement: " + err);
+        throw std::runtime_error("Could not set default number of stations: " + err);
     }
 
-    if (sqlite3_prepare_v2(db, "delete from descriptions where station >= ? or (name is null and desc is null and flags = 0);", -1, &cleanInfo, nullptr) != SQLITE_OK) {
-        std::string err(sqlite3_errmsg(db));
+    if (sqlite3_exec(db, "insert or ignore into parameters (name, value) values "
+                     "(\"journalMode\", " DEFAULT_JOURNAL_MODE "), "
+                     "(\"synchronous\", " DEFAULT_SYNCHRONOUS "), "
+                     "(\"busyTimeout\", " DEFAULT_BUSY_TIMEOUT "), "
+                     "(\"mmapSize\", " DEFAULT_MMAP_SIZE "), "
+                     "(\"cacheSize\", " DEFAULT_CACHE_SIZE ");", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
         close();
-        throw std::runtime_error("Could not prepare cleanInfo statement: " + err);
+        throw std::runtime_error("Could not set default storage profile: " + err);
     }
 
-    if (sqlite3_prepare_v2(db, "select slot, station, name, attr from reservations where slot between ? and ? and station between ? and ?;", -1, &select, nullptr) != SQLITE_OK) {
-        std::string err(sqlite3_errmsg(db));
+    try {
+        prepareStatements();
+        applyProfile(storedProfile(clientProfile), true);
+    } catch (std::exception &) {
         close();
-        throw std::runtime_error("Could not prepare select statement: " + err);
+        throw;
     }
+}
 
-    if (sqlite3_prepare_v2(db, "insert or fail into reservations (slot, station, name, attr) values (?, ?, ?, ?);", -1, &insert, nullptr) != SQLITE_OK) {
+void Wsdb::openReader(const char *filename, const StorageProfile &clientProfile) {
+    close();
+    generation++;
+
+    if (sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
         std::string err(sqlite3_errmsg(db));
         close();
-        throw std::runtime_error("Could not prepare insert statement: " + err);
+        throw std::runtime_error("Could not open database: " + err);
     }
 
-    if (sqlite3_prepare_v2(db, "delete from reservations where slot between ? and ? and station = ?;", -1, &remove, nullptr) != SQLITE_OK) {
-        std::string err(sqlite3_errmsg(db));
+    installCancelHandler();
+    setBusyTimeout(clientProfile.busyTimeout != StorageProfile::unset ? clientProfile.busyTimeout : atoi(DEFAULT_BUSY_TIMEOUT));
+
+    // The tables exist already, open() on the writer connection created them
+    try {
+        prepareStatements();
+        applyProfile(storedProfile(clientProfile), false);
+    } catch (std::exception &) {
         close();
-        throw std::runtime_error("Could not prepare remove statement: " + err);
+        throw;
     }
 }
 
+std::string Wsdb::getFilename() {
+    if (db == nullptr)
+        return std::string();
+
+    const char *name = sqlite3_db_filename(db, "main");
+
+    return name ? std::string(name) : std::string();
+}
+
 void Wsdb::close() {
+    detachArchive();
+
+    if (dataVersion)
+        sqlite3_finalize(dataVersion);
+
+    if (getVersion)
+        sqlite3_finalize(getVersion);
+
     if (getParam)
         sqlite3_finalize(getParam);
 
@@ -160,9 +403,56 @@ void Wsdb::close() {
     if (remove)
         sqlite3_finalize(remove);
 
+    if (insertNameId)
+        sqlite3_finalize(insertNameId);
+
+    if (getNameId)
+        sqlite3_finalize(getNameId);
+
+    if (loadNames)
+        sqlite3_finalize(loadNames);
+
+    if (lastChange)
+        sqlite3_finalize(lastChange);
+
+    if (firstChange)
+        sqlite3_finalize(firstChange);
+
+    if (selectChange)
+        sqlite3_finalize(selectChange);
+
+    if (pruneChange)
+        sqlite3_finalize(pruneChange);
+
+    if (selectRuns)
+        sqlite3_finalize(selectRuns);
+
+    if (selectBlock)
+        sqlite3_finalize(selectBlock);
+
+    if (insertRun)
+        sqlite3_finalize(insertRun);
+
+    if (removeRun)
+        sqlite3_finalize(removeRun);
+
+    if (selectCounts)
+        sqlite3_finalize(selectCounts);
+
+    if (selectUsed)
+        sqlite3_finalize(selectUsed);
+
+    if (selectRunsUsed)
+        sqlite3_finalize(selectRunsUsed);
+
+    if (sumRunsUsed)
+        sqlite3_finalize(sumRunsUsed);
+
     if (db)
         sqlite3_close(db);
 
+    dataVersion = nullptr;
+    getVersion  = nullptr;
     getParam  = nullptr;
     setParam  = nullptr;
     getInfo   = nullptr;
@@ -171,7 +461,140 @@ void Wsdb::close() {
     insert    = nullptr;
     select    = nullptr;
     remove    = nullptr;
+    insertNameId = nullptr;
+    getNameId    = nullptr;
+    loadNames    = nullptr;
+    lastChange   = nullptr;
+    firstChange  = nullptr;
+    selectChange = nullptr;
+    pruneChange  = nullptr;
+    selectRuns   = nullptr;
+    selectBlock  = nullptr;
+    insertRun    = nullptr;
+    removeRun    = nullptr;
+    selectCounts = nullptr;
+    selectUsed   = nullptr;
+    selectRunsUsed = nullptr;
+    sumRunsUsed    = nullptr;
     db        = nullptr;
+    active    = StorageProfile();
+    lastDataVersion  = -1;
+    lastTotalChanges = -1;
+    version = -1;
+    hasDeadline = false;
+    maintenanceTask = 0;
+    nameById.clear();
+    idByName.clear();
+    namesLoaded = 0;
+}
+
+Wsdb::StorageProfile Wsdb::getActiveProfile() {
+    return active;
+}
+
+void Wsdb::begin() {
+    if (db == nullptr)
+        return;
+
+    char *errStr;
+    if (sqlite3_exec(db, "begin immediate;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not begin transaction: " + err);
+    }
+}
+
+void Wsdb::beginRead() {
+    if (db == nullptr)
+        return;
+
+    char *errStr;
+    if (sqlite3_exec(db, "begin deferred;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not begin transaction: " + err);
+    }
+}
+
+void Wsdb::commit() {
+    if (db == nullptr)
+        return;
+
+    char *errStr;
+    if (sqlite3_exec(db, "commit;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not commit transaction: " + err);
+    }
+}
+
+void Wsdb::rollback() {
+    if (db == nullptr || sqlite3_get_autocommit(db))
+        return;
+
+    sqlite3_exec(db, "rollback;", nullptr, nullptr, nullptr);
+
+    // The rollback brought the triggers back
+    isBulkLoad = false;
+    bulkCounts.clear();
+
+    // Ids handed out in the transaction are gone and may be reused by another client
+    nameById.clear();
+    idByName.clear();
+    namesLoaded = 0;
+}
+
+void Wsdb::setCancelFlag(const std::atomic<bool> *flag) {
+    cancelFlag = flag;
+    installCancelHandler();
+}
+
+int64_t Wsdb::takeBusyWait() {
+    int64_t waited = busyWait;
+
+    busyWait = 0;
+
+    return waited;
+}
+
+bool Wsdb::isCancelled() {
+    if (cancelFlag != nullptr && cancelFlag->load(std::memory_order_relaxed))
+        return true;
+
+    return hasDeadline && std::chrono::steady_clock::now() >= deadline;
+}
+
+int64_t Wsdb::getGeneration() {
+    return generation;
+}
+
+int64_t Wsdb::getChangeVersion() {
+    if (dataVersion == nullptr || getVersion == nullptr)
+        return -1;
+
+    // data_version only changes for commits by other connections, total_changes covers our own
+    int64_t dv = -1;
+    {
+        ResetOnExit roe(dataVersion);
+
+        if (sqlite3_step(dataVersion) == SQLITE_ROW)
+            dv = sqlite3_column_int64(dataVersion, 0);
+    }
+
+    int64_t tc = sqlite3_total_changes(db);
+    if (dv >= 0 && dv == lastDataVersion && tc == lastTotalChanges)
+        return version;
+
+    ResetOnExit roe(getVersion);
+
+    if (sqlite3_step(getVersion) != SQLITE_ROW)
+        return -1;
+
+    version = sqlite3_column_int64(getVersion, 0);
+    lastDataVersion = dv;
+    lastTotalChanges = tc;
+
+    return version;
 }
 
 Wsdb::Limits::Limits() {
@@ -184,6 +607,10 @@ int64_t Wsdb::getNumStations() {
 }
 
 void Wsdb::setNumStations(int64_t num) {
+    // Every change recounts slot_counts, saving the descriptions usually keeps the number
+    if (num == getNumStations())
+        return;
+
     setParameter("numStations", num);
 }
 
@@ -255,7 +682,7 @@ void Wsdb::setStationInfo(int64_t station, const StationInfo &info) {
 
     sqlite3_bind_int64(setInfo, 4, info.flags);
 
-    sqlite3_step(setInfo);
+    stepWrite(setInfo);
 }
 
 void Wsdb::setStationInfo(const std::vector<StationInfo> &info) {
@@ -276,57 +703,170 @@ void Wsdb::setStationInfo(const std::vector<StationInfo> &info) {
     if (sqlite3_bind_int64(cleanInfo, 1, num) != SQLITE_OK)
         return;
 
-    sqlite3_step(cleanInfo);
+    stepWrite(cleanInfo);
+}
+
+int64_t Wsdb::getStorageEngine() {
+    return getParameter("storageEngine", EngineSlots);
+}
+
+void Wsdb::convertStorage(int64_t engine) {
+    if (db == nullptr)
+        return;
+
+    if (engine != EngineSlots && engine != EngineIntervals)
+        throw std::runtime_error("Unknown storage engine");
+
+    begin();
+    try {
+        if (getStorageEngine() != engine) {
+            // Moving the rows through the triggers would log and version every reservation twice
+            dropTriggers();
+            if (engine == EngineIntervals)
+                convertToIntervals();
+            else
+                convertToSlots();
+            createTriggers();
+
+            resetChangeLog();
+            setParameter("storageEngine", engine);
+        }
+        commit();
+    } catch (std::exception &) {
+        rollback();
+        throw;
+    }
 }
 
 int Wsdb::insertName(int64_t slot, int64_t station, const char *name, int64_t attr) {
-    if (insert == nullptr)
+    if (slot < getArchivedBefore())
         return 0;
 
-    ResetOnExit roe(insert);
+    if (getStorageEngine() == EngineIntervals)
+        return insertNames(slot, slot, station, name, attr) > 0 ? 1 : 0;
 
-    if (sqlite3_bind_int64(insert, 1, slot) != SQLITE_OK)
+    int64_t id = nameId(name);
+    if (id < 0)
         return 0;
 
-    if (sqlite3_bind_int64(insert, 2, station) != SQLITE_OK)
-        return 0;
+    return insertSlot(slot, station, id, attr);
+}
 
-    if (sqlite3_bind_text(insert, 3, name, -1, SQLITE_STATIC) != SQLITE_OK)
+int64_t Wsdb::insertNames(int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr) {
+    slotStart = std::max(slotStart, getArchivedBefore());
+    if (slotStart > slotStop)
         return 0;
 
-    if (sqlite3_bind_int64(insert, 4, attr) != SQLITE_OK)
+    int64_t id = nameId(name);
+    if (id < 0)
         return 0;
 
-    return sqlite3_step(insert) == SQLITE_DONE;
+    if (getStorageEngine() == EngineIntervals)
+        return updateIntervals(slotStart, slotStop, station, id, attr);
+
+    int64_t booked = 0;
+    for (int64_t slot = slotStart; slot <= slotStop; slot++) {
+        if (insertSlot(slot, station, id, attr) == 0)
+            continue;
+
+        booked++;
+        bulkCount(slot, station);
+    }
+
+    return booked;
 }
 
 void Wsdb::selectNames(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback) {
-    if (select == nullptr)
+    int64_t archivedBefore = getArchivedBefore();
+
+    if (slotStart < archivedBefore) {
+        int64_t lastYear = yearOfSlot(std::min(slotStop, archivedBefore - 1));
+
+        // Archived rows keep the layout they were stored in, either table may hold them
+        for (int64_t year = yearOfSlot(std::max(slotStart, getArchivedFrom())); year <= lastYear && !isCancelled(); year++) {
+            if (!attachArchive(year, false))
+                continue;
+
+            selectSlots(archiveSelect, slotStart, slotStop, stationStart, stationStop, callback);
+            selectRunSlots(archiveSelectRuns, slotStart, slotStop, stationStart, stationStop, callback);
+        }
+    }
+
+    if (getStorageEngine() == EngineIntervals)
+        selectRunSlots(selectRuns, slotStart, slotStop, stationStart, stationStop, callback);
+    else
+        selectSlots(select, slotStart, slotStop, stationStart, stationStop, callback);
+}
+
+void Wsdb::selectSlots(sqlite3_stmt *stmt, int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback) {
+    if (stmt == nullptr)
+        return;
+
+    ResetOnExit row(stmt);
+
+    if (sqlite3_bind_int64(stmt, 1, slotStart) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(stmt, 2, slotStop) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(stmt, 3, stationStart) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(stmt, 4, stationStop) != SQLITE_OK)
+        return;
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        callback.callback(sqlite3_column_int64(stmt, 0),
+                          sqlite3_column_int64(stmt, 1),
+                          nameForId(sqlite3_column_int64(stmt, 2)),
+                          sqlite3_column_int64(stmt, 3));
+    }
+}
+
+void Wsdb::selectRunSlots(sqlite3_stmt *stmt, int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback) {
+    if (stmt == nullptr)
         return;
 
-    ResetOnExit row(select);
+    ResetOnExit roe(stmt);
 
-    if (sqlite3_bind_int64(select, 1, slotStart) != SQLITE_OK)
+    if (sqlite3_bind_int64(stmt, 1, slotStart - (INTERVAL_BLOCK - 1)) != SQLITE_OK)
         return;
 
-    if (sqlite3_bind_int64(select, 2, slotStop) != SQLITE_OK)
+    if (sqlite3_bind_int64(stmt, 2, slotStop) != SQLITE_OK)
         return;
 
-    if (sqlite3_bind_int64(select, 3, stationStart) != SQLITE_OK)
+    if (sqlite3_bind_int64(stmt, 3, stationStart) != SQLITE_OK)
         return;
 
-    if (sqlite3_bind_int64(select, 4, stationStop) != SQLITE_OK)
+    if (sqlite3_bind_int64(stmt, 4, stationStop) != SQLITE_OK)
         return;
 
-    while (sqlite3_step(select) == SQLITE_ROW) {
-        callback.callback(sqlite3_column_int64(select, 0),
-                          sqlite3_column_int64(select, 1),
-                          (const char *) sqlite3_column_text(select, 2),
-                          sqlite3_column_int64(select, 3));
+    if (sqlite3_bind_int64(stmt, 5, slotStart) != SQLITE_OK)
+        return;
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int64_t start = std::max<int64_t>(sqlite3_column_int64(stmt, 0), slotStart);
+        int64_t stop = std::min<int64_t>(sqlite3_column_int64(stmt, 1), slotStop);
+        int64_t station = sqlite3_column_int64(stmt, 2);
+        const char *name = nameForId(sqlite3_column_int64(stmt, 3));
+        int64_t attr = sqlite3_column_int64(stmt, 4);
+
+        for (int64_t slot = start; slot <= stop; slot++)
+            callback.callback(slot, station, name, attr);
     }
 }
 
 void Wsdb::removeNames(int64_t slotStart, int64_t slotStop, int64_t station) {
+    slotStart = std::max(slotStart, getArchivedBefore());
+    if (slotStart > slotStop)
+        return;
+
+    if (getStorageEngine() == EngineIntervals) {
+        updateIntervals(slotStart, slotStop, station, -1, 0);
+        return;
+    }
+
     if (remove == nullptr)
         return;
 
@@ -341,46 +881,1467 @@ void Wsdb::removeNames(int64_t slotStart, int64_t slotStop, int64_t station) {
     if (sqlite3_bind_int64(remove, 3, station) != SQLITE_OK)
         return;
 
-    sqlite3_step(remove);
+    stepWrite(remove);
 }
 
-std::string Wsdb::defaultWorkstationName(int64_t station) {
-    std::stringstream str;
+void Wsdb::beginBulkLoad() {
+    if (db == nullptr || isBulkLoad)
+        return;
 
-    str << "Workstation " << (station + 1);
+    std::vector<StationInfo> info;
+    getStationInfo(&info);
 
-    return str.str();
+    bulkCounted.clear();
+    for (auto &station : info)
+        bulkCounted.push_back((station.flags & 1) == 0);
+
+    dropTriggers();
+    bulkCounts.clear();
+    isBulkLoad = true;
 }
 
-int64_t Wsdb::getParameter(const char *name, int64_t default_val) {
-    if (getParam == nullptr)
-        return default_val;
+void Wsdb::endBulkLoad() {
+    if (db == nullptr || !isBulkLoad)
+        return;
 
-    ResetOnExit roe(getParam);
+    sqlite3_stmt *addSlot;
+    sqlite3_stmt *addCount;
+    if (sqlite3_prepare_v2(db, "insert or ignore into slot_counts (slot, count) values (?, 0);", -1, &addSlot, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not update slot_counts: " + std::string(sqlite3_errmsg(db)));
+
+    FinalizeOnExit slotFoe(addSlot);
+    if (sqlite3_prepare_v2(db, "update slot_counts set count = count + ? where slot = ?;", -1, &addCount, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not update slot_counts: " + std::string(sqlite3_errmsg(db)));
+
+    FinalizeOnExit countFoe(addCount);
+    for (auto &count : bulkCounts) {
+        {
+            ResetOnExit roe(addSlot);
+            sqlite3_bind_int64(addSlot, 1, count.first);
+            stepWrite(addSlot);
+        }
 
-    if (sqlite3_bind_text(getParam, 1, name, -1, SQLITE_STATIC) != SQLITE_OK)
-        return default_val;
+        ResetOnExit roe(addCount);
+        sqlite3_bind_int64(addCount, 1, count.second);
+        sqlite3_bind_int64(addCount, 2, count.first);
+        stepWrite(addCount);
+    }
 
-    if (sqlite3_step(getParam) != SQLITE_ROW)
-        return default_val;
+    isBulkLoad = false;
+    bulkCounts.clear();
+    createTriggers();
+    resetChangeLog();
 
-    if (sqlite3_column_type(getParam, 0) != SQLITE_INTEGER)
-        return default_val;
+    // The version triggers were gone too
+    char *errStr;
+    if (sqlite3_exec(db, "update version set value = value + 1 where id = 0;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not update version: " + err);
+    }
+}
 
-    return sqlite3_column_int64(getParam, 0);
+bool Wsdb::getSlotRange(int64_t *first, int64_t *last) {
+    if (db == nullptr)
+        return false;
+
+    sqlite3_stmt *stmt;
+    std::string sql = "select min(slot), max(slot) from reservations union all "
+        "select min(slotStart), max(slotStart) + " + std::to_string(INTERVAL_BLOCK - 1) + " from intervals;";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+
+    FinalizeOnExit foe(stmt);
+    *first = INT64_MAX;
+    *last = INT64_MIN;
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+            continue;
+
+        *first = std::min<int64_t>(*first, sqlite3_column_int64(stmt, 0));
+        *last = std::max<int64_t>(*last, sqlite3_column_int64(stmt, 1));
+    }
+
+    if (getArchivedFrom() < getArchivedBefore()) {
+        *first = std::min(*first, getArchivedFrom());
+        *last = std::max(*last, getArchivedBefore() - 1);
+    }
+
+    return *first <= *last;
 }
 
-void Wsdb::setParameter(const char *name, int64_t value) {
-    if (setParam == nullptr)
+void Wsdb::getSlotCounts(int64_t slotStart, int64_t slotStop, std::vector<int64_t> *countsOut) {
+    if (countsOut == nullptr)
         return;
+    countsOut->clear();
 
-    ResetOnExit roe(setParam);
+    if (slotStart > slotStop)
+        return;
+    countsOut->resize(static_cast<size_t>(slotStop - slotStart + 1), 0);
 
-    if (sqlite3_bind_text(setParam, 1, name, -1, SQLITE_STATIC) != SQLITE_OK)
+    if (selectCounts == nullptr)
         return;
 
-    if (sqlite3_bind_int64(setParam, 2, value) != SQLITE_OK)
+    ResetOnExit roe(selectCounts);
+
+    if (sqlite3_bind_int64(selectCounts, 1, slotStart) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(selectCounts, 2, slotStop) != SQLITE_OK)
+        return;
+
+    while (sqlite3_step(selectCounts) == SQLITE_ROW)
+        (*countsOut)[static_cast<size_t>(sqlite3_column_int64(selectCounts, 0) - slotStart)] = sqlite3_column_int64(selectCounts, 1);
+}
+
+void Wsdb::selectUsage(int64_t slotStart, int64_t slotStop, int64_t origin, int64_t slotsPerBucket, int64_t bucketsPerCycle, WsdbUsageCallback &callback) {
+    if (slotsPerBucket <= 0 || origin > slotStart)
         return;
 
-    sqlite3_step(setParam);
+    // Runs stay within one block, so with buckets made of whole blocks each run lies in one bucket
+    bool wholeBlocks = slotsPerBucket % INTERVAL_BLOCK == 0 && blockOf(origin) * INTERVAL_BLOCK == origin;
+    int64_t archivedBefore = getArchivedBefore();
+
+    if (slotStart < archivedBefore) {
+        int64_t lastYear = yearOfSlot(std::min(slotStop, archivedBefore - 1));
+
+        for (int64_t year = yearOfSlot(std::max(slotStart, getArchivedFrom())); year <= lastYear && !isCancelled(); year++) {
+            if (!attachArchive(year, false))
+                continue;
+
+            selectUsageFrom(archiveUsed, false, slotStart, slotStop, origin, slotsPerBucket, bucketsPerCycle, callback);
+            selectUsageFrom(wholeBlocks ? archiveSumRunsUsed : archiveRunsUsed, true, slotStart, slotStop, origin, slotsPerBucket, bucketsPerCycle, callback);
+        }
+    }
+
+    if (getStorageEngine() == EngineIntervals)
+        selectUsageFrom(wholeBlocks ? sumRunsUsed : selectRunsUsed, true, slotStart, slotStop, origin, slotsPerBucket, bucketsPerCycle, callback);
+    else
+        selectUsageFrom(selectUsed, false, slotStart, slotStop, origin, slotsPerBucket, bucketsPerCycle, callback);
+}
+
+void Wsdb::selectUsageFrom(sqlite3_stmt *stmt, bool isRuns, int64_t slotStart, int64_t slotStop, int64_t origin, int64_t slotsPerBucket, int64_t bucketsPerCycle, WsdbUsageCallback &callback) {
+    if (stmt == nullptr)
+        return;
+
+    ResetOnExit roe(stmt);
+
+    if (sqlite3_bind_int64(stmt, 1, origin) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(stmt, 2, slotsPerBucket) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(stmt, 3, bucketsPerCycle > 0 ? bucketsPerCycle : INT64_MAX) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(stmt, 4, slotStart) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(stmt, 5, slotStop) != SQLITE_OK)
+        return;
+
+    if (isRuns && sqlite3_bind_int64(stmt, 6, slotStart - (INTERVAL_BLOCK - 1)) != SQLITE_OK)
+        return;
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        callback.usage(sqlite3_column_int64(stmt, 0),
+                       sqlite3_column_int64(stmt, 1),
+                       sqlite3_column_int64(stmt, 2));
+    }
+}
+
+int64_t Wsdb::getArchiveDays() {
+    return getParameter("archiveDays", 0);
+}
+
+void Wsdb::setArchiveDays(int64_t days) {
+    if (days != getArchiveDays())
+        setParameter("archiveDays", days);
+}
+
+int64_t Wsdb::getArchivedBefore() {
+    return getParameter("archivedBefore", INT64_MIN);
+}
+
+int64_t Wsdb::getArchivedFrom() {
+    return getParameter("archivedFrom", INT64_MAX);
+}
+
+std::string Wsdb::archiveFilename(int64_t year) {
+    std::string filename = getFilename();
+    if (filename.empty())
+        return filename;
+
+    // schedule.db becomes schedule.2019.db
+    std::stringstream str;
+    size_t dir = filename.find_last_of("/\\");
+    size_t base = dir == std::string::npos ? 0 : dir + 1;
+    size_t ext = filename.rfind('.');
+    if (ext == std::string::npos || ext <= base)
+        str << filename << "." << year;
+    else
+        str << filename.substr(0, ext) << "." << year << filename.substr(ext);
+
+    return str.str();
+}
+
+int64_t Wsdb::archive(int64_t beforeSlot) {
+    if (db == nullptr)
+        return 0;
+
+    releaseArchivedStrays();
+
+    // Years without reservations get no archive file
+    int64_t cutoff = blockOf(beforeSlot) * INTERVAL_BLOCK;
+    int64_t moved = 0;
+    int64_t first;
+    while ((first = oldestSlot()) < cutoff) {
+        int64_t year = yearOfSlot(first);
+        int64_t count = archiveYear(year, first, std::min(cutoff, yearStartSlot(year + 1)) - 1);
+        if (count == 0)
+            break;
+
+        moved += count;
+    }
+
+    return moved;
+}
+
+int64_t Wsdb::archiveOld(int64_t nowSlot) {
+    int64_t days = getArchiveDays();
+    if (days <= 0)
+        return 0;
+
+    return archive(nowSlot - days * SLOTS_PER_DAY);
+}
+
+bool Wsdb::getPublishSnapshot() {
+    return getParameter("publishSnapshot", 0) != 0;
+}
+
+void Wsdb::setPublishSnapshot(bool publish) {
+    if (publish != getPublishSnapshot())
+        setParameter("publishSnapshot", publish ? 1 : 0);
+}
+
+bool Wsdb::beginMaintenance(int64_t owner, int64_t now, int64_t interval, int64_t leaseTime) {
+    if (db == nullptr)
+        return false;
+
+    // Most checks find the round not due and need no write lock
+    if (getParameter("lastMaintenance", 0) + interval > now)
+        return false;
+
+    try {
+        begin();
+
+        bool due = getParameter("lastMaintenance", 0) + interval <= now;
+        bool leased = getParameter("maintenanceOwner", 0) != owner && getParameter("maintenanceLease", 0) > now;
+        if (!due || leased) {
+            rollback();
+            return false;
+        }
+
+        setParameter("maintenanceOwner", owner);
+        setParameter("maintenanceLease", now + leaseTime);
+        commit();
+    } catch (std::exception &) {
+        rollback();
+        return false;
+    }
+
+    maintenanceTask = MaintainArchive;
+    return true;
+}
+
+bool Wsdb::maintenanceStep(int64_t budgetMs) {
+    if (db == nullptr)
+        return false;
+
+    hasDeadline = true;
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budgetMs);
+    installCancelHandler();
+
+    bool repeat = false;
+    switch (maintenanceTask) {
+    case MaintainArchive:
+        // Usually moves the one day that passed the horizon since the last round
+        try {
+            archiveOld(todaySlot());
+        } catch (std::exception &) {
+        }
+        break;
+
+    case MaintainStatistics:
+        // Sampling bounds the time on any file size
+        sqlite3_exec(db, "pragma analysis_limit = " ANALYSIS_LIMIT "; analyze;", nullptr, nullptr, nullptr);
+        break;
+
+    case MaintainCheckpoint:
+        // Passive, it never waits for readers
+        if (active.journalMode == StorageProfile::JournalWal)
+            sqlite3_exec(db, "pragma wal_checkpoint(passive);", nullptr, nullptr, nullptr);
+        break;
+
+    case MaintainConvertVacuum:
+        // Once per file. One too large to rewrite in the time is marked and left to a manual VACUUM.
+        if (getPragma("auto_vacuum") == 0 && getParameter("vacuumConversionFailed", 0) == 0) {
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max<int64_t>(budgetMs, VACUUM_CONVERSION_MS));
+            int rc = sqlite3_exec(db, "pragma auto_vacuum = incremental; vacuum;", nullptr, nullptr, nullptr);
+            bool timedOut = rc != SQLITE_OK && std::chrono::steady_clock::now() >= deadline;
+            if (timedOut && !(cancelFlag != nullptr && cancelFlag->load(std::memory_order_relaxed))) {
+                hasDeadline = false;
+                try {
+                    begin();
+                    setParameter("vacuumConversionFailed", 1);
+                    commit();
+                } catch (std::exception &) {
+                    rollback();
+                }
+            }
+        }
+        break;
+
+    case MaintainVacuum:
+        if (getPragma("auto_vacuum") == 2 && getPragma("freelist_count") > 0)
+            repeat = sqlite3_exec(db, "pragma incremental_vacuum(" VACUUM_PAGES ");", nullptr, nullptr, nullptr) == SQLITE_OK;
+        break;
+    }
+
+    // Stopped for a command, try the same step again once idle
+    bool stopped = cancelFlag != nullptr && cancelFlag->load(std::memory_order_relaxed);
+    hasDeadline = false;
+    installCancelHandler();
+
+    if (stopped || repeat)
+        return true;
+
+    if (++maintenanceTask < numMaintenanceTasks)
+        return true;
+
+    maintenanceTask = MaintainArchive;
+    return false;
+}
+
+void Wsdb::endMaintenance(int64_t owner, int64_t now) {
+    if (db == nullptr)
+        return;
+
+    try {
+        begin();
+
+        if (getParameter("maintenanceOwner", 0) == owner) {
+            setParameter("lastMaintenance", now);
+            setParameter("maintenanceLease", 0);
+        }
+        commit();
+    } catch (std::exception &) {
+        rollback();
+    }
+}
+
+int64_t Wsdb::getLastChange() {
+    if (lastChange == nullptr)
+        return 0;
+
+    ResetOnExit roe(lastChange);
+
+    if (sqlite3_step(lastChange) != SQLITE_ROW)
+        return 0;
+
+    return sqlite3_column_int64(lastChange, 0);
+}
+
+bool Wsdb::selectChanges(int64_t sinceSeq, WsdbChangeCallback &callback) {
+    if (selectChange == nullptr || firstChange == nullptr)
+        return false;
+
+    {
+        ResetOnExit roe(selectChange);
+
+        if (sqlite3_bind_int64(selectChange, 1, sinceSeq) != SQLITE_OK)
+            return false;
+
+        while (sqlite3_step(selectChange) == SQLITE_ROW) {
+            callback.change(sqlite3_column_int64(selectChange, 0),
+                            sqlite3_column_int64(selectChange, 1),
+                            sqlite3_column_int64(selectChange, 2),
+                            sqlite3_column_int64(selectChange, 3),
+                            (const char *) sqlite3_column_text(selectChange, 4),
+                            sqlite3_column_int64(selectChange, 5));
+        }
+    }
+
+    // Checked afterwards so a prune while streaming is caught too
+    ResetOnExit roe(firstChange);
+
+    if (sqlite3_step(firstChange) != SQLITE_ROW)
+        return false;
+
+    int64_t first;
+    if (sqlite3_column_type(firstChange, 0) == SQLITE_NULL)
+        first = getLastChange() + 1;
+    else
+        first = sqlite3_column_int64(firstChange, 0);
+
+    return sinceSeq + 1 >= first;
+}
+
+void Wsdb::pruneChanges() {
+    if (pruneChange == nullptr)
+        return;
+
+    int64_t keep = getParameter("changeLogSize", DEFAULT_CHANGE_LOG_SIZE);
+    int64_t last = getLastChange();
+    if (keep < 0 || last <= keep)
+        return;
+
+    ResetOnExit roe(pruneChange);
+
+    if (sqlite3_bind_int64(pruneChange, 1, last - keep) != SQLITE_OK)
+        return;
+
+    stepWrite(pruneChange);
+}
+
+std::string Wsdb::defaultWorkstationName(int64_t station) {
+    std::stringstream str;
+
+    str << "Workstation " << (station + 1);
+
+    return str.str();
+}
+
+int64_t Wsdb::slotOfDate(int64_t year, int64_t month, int64_t day) {
+    return (daysFromCivil(year, month, day) - daysFromCivil(2000, 1, 1)) * SLOTS_PER_DAY;
+}
+
+void Wsdb::dateOfSlot(int64_t slot, int64_t *year, int64_t *month, int64_t *day, int64_t *minute) {
+    int64_t days = slot / SLOTS_PER_DAY;
+    int64_t rest = slot % SLOTS_PER_DAY;
+    if (rest < 0) {
+        days--;
+        rest += SLOTS_PER_DAY;
+    }
+
+    civilFromDays(days + daysFromCivil(2000, 1, 1), year, month, day);
+    *minute = rest * (24 * 60 / SLOTS_PER_DAY);
+}
+
+int64_t Wsdb::todaySlot() {
+    time_t now = time(nullptr);
+    struct tm local;
+
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+
+    return slotOfDate(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+}
+
+int64_t Wsdb::getParameter(const char *name, int64_t default_val) {
+    if (getParam == nullptr)
+        return default_val;
+
+    ResetOnExit roe(getParam);
+
+    if (sqlite3_bind_text(getParam, 1, name, -1, SQLITE_STATIC) != SQLITE_OK)
+        return default_val;
+
+    if (sqlite3_step(getParam) != SQLITE_ROW)
+        return default_val;
+
+    if (sqlite3_column_type(getParam, 0) != SQLITE_INTEGER)
+        return default_val;
+
+    return sqlite3_column_int64(getParam, 0);
+}
+
+void Wsdb::setParameter(const char *name, int64_t value) {
+    if (setParam == nullptr)
+        return;
+
+    ResetOnExit roe(setParam);
+
+    if (sqlite3_bind_text(setParam, 1, name, -1, SQLITE_STATIC) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(setParam, 2, value) != SQLITE_OK)
+        return;
+
+    stepWrite(setParam);
+}
+
+void Wsdb::prepareStatements() {
+    if (sqlite3_prepare_v2(db, "pragma data_version;", -1, &dataVersion, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare dataVersion statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select value from version where id = 0;", -1, &getVersion, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare getVersion statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select value from parameters where name = ?;", -1, &getParam, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare getParam statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "insert or replace into parameters (name, value) values (?, ?);", -1, &setParam, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare setParam statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select station, name, desc, flags from descriptions;", -1, &getInfo, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare getInfo statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "insert or replace into descriptions (station, name, desc, flags) values (?, ?, ?, ?);", -1, &setInfo, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare setInfo statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "delete from descriptions where station >= ? or (name is null and desc is null and flags = 0);", -1, &cleanInfo, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare cleanInfo statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, selectSql("main").c_str(), -1, &select, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare select statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "insert or fail into reservations (slot, station, nameId, attr) values (?, ?, ?, ?);", -1, &insert, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare insert statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "delete from reservations where slot between ? and ? and station = ?;", -1, &remove, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare remove statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "insert or ignore into names (name) values (?);", -1, &insertNameId, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare insertNameId statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select id from names where name = ?;", -1, &getNameId, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare getNameId statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select id, name from names where id > ?;", -1, &loadNames, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare loadNames statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select coalesce((select seq from sqlite_sequence where name = 'reservation_changes'), 0);", -1, &lastChange, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare lastChange statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select min(seq) from reservation_changes;", -1, &firstChange, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare firstChange statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select seq, slot, coalesce(slotStop, slot), station, name, attr from reservation_changes where seq > ? order by seq;", -1, &selectChange, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare selectChange statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "delete from reservation_changes where seq <= ?;", -1, &pruneChange, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare pruneChange statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, selectRunsSql("main").c_str(), -1, &selectRuns, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare selectRuns statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select slotStart, slotStop, nameId, attr from intervals where slotStart between ? and ? and station = ?;", -1, &selectBlock, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare selectBlock statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "insert or fail into intervals (slotStart, slotStop, station, nameId, attr) values (?, ?, ?, ?, ?);", -1, &insertRun, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare insertRun statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "delete from intervals where slotStart = ? and station = ?;", -1, &removeRun, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare removeRun statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, "select slot, count from slot_counts where slot between ? and ?;", -1, &selectCounts, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare selectCounts statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, usedSql("main").c_str(), -1, &selectUsed, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare selectUsed statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, runsUsedSql("main").c_str(), -1, &selectRunsUsed, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare selectRunsUsed statement: " + std::string(sqlite3_errmsg(db)));
+
+    if (sqlite3_prepare_v2(db, sumRunsUsedSql("main").c_str(), -1, &sumRunsUsed, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not prepare sumRunsUsed statement: " + std::string(sqlite3_errmsg(db)));
+}
+
+Wsdb::StorageProfile Wsdb::storedProfile(const StorageProfile &clientProfile) {
+    StorageProfile profile;
+    profile.journalMode = getParameter("journalMode", atoi(DEFAULT_JOURNAL_MODE));
+    profile.synchronous = getParameter("synchronous", atoi(DEFAULT_SYNCHRONOUS));
+    profile.busyTimeout = getParameter("busyTimeout", atoi(DEFAULT_BUSY_TIMEOUT));
+    profile.mmapSize    = getParameter("mmapSize", atoi(DEFAULT_MMAP_SIZE));
+    profile.cacheSize   = getParameter("cacheSize", atoi(DEFAULT_CACHE_SIZE));
+
+    // One client switching the journal mode would switch it for all, a client only tunes its own connection
+    StorageProfile connectionProfile(clientProfile);
+    connectionProfile.journalMode = StorageProfile::unset;
+    profile.merge(connectionProfile);
+
+    return profile;
+}
+
+void Wsdb::applyProfile(const StorageProfile &profile, bool setJournalMode) {
+    std::stringstream sql;
+
+    sql << "pragma synchronous = " << profile.synchronous << ";";
+    sql << "pragma cache_size = " << profile.cacheSize << ";";
+    sql << "pragma mmap_size = " << profile.mmapSize << ";";
+
+    char *errStr;
+    if (sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not apply storage profile: " + err);
+    }
+
+    setBusyTimeout(profile.busyTimeout);
+
+    // Shares without shared memory support cannot use WAL, fall back to a rollback journal.
+    // Read-only connections take whatever mode the writer left the file in.
+    const char *mode = setJournalMode ? "pragma journal_mode = delete;" : nullptr;
+    if (setJournalMode && profile.journalMode == StorageProfile::JournalWal) {
+        if (sqlite3_exec(db, "pragma journal_mode = wal;", nullptr, nullptr, nullptr) == SQLITE_OK && canReadWal())
+            mode = nullptr;
+        else
+            mode = "pragma locking_mode = exclusive; pragma journal_mode = delete; pragma locking_mode = normal;";
+    }
+
+    // Switching modes fails while other clients have the file open, keep whatever mode it is in
+    if (mode != nullptr)
+        sqlite3_exec(db, mode, nullptr, nullptr, nullptr);
+
+    // Record what actually took effect
+    sqlite3_stmt *stmt;
+    active.journalMode = StorageProfile::JournalDelete;
+    if (sqlite3_prepare_v2(db, "pragma journal_mode;", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_strnicmp((const char *) sqlite3_column_text(stmt, 0), "wal", 4) == 0)
+            active.journalMode = StorageProfile::JournalWal;
+        sqlite3_finalize(stmt);
+    }
+
+    active.synchronous = getPragma("synchronous");
+    active.busyTimeout = profile.busyTimeout;
+    active.mmapSize    = getPragma("mmap_size");
+    active.cacheSize   = getPragma("cache_size");
+}
+
+int Wsdb::progressHandler(void *wsdb) {
+    return static_cast<Wsdb *>(wsdb)->isCancelled() ? 1 : 0;
+}
+
+// Waits the way sqlite3_busy_timeout does, but adds up the time so it can be told apart from the query
+int Wsdb::busyHandler(void *wsdb, int count) {
+    static const int delays[] = {1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100}; // ms
+    static const int numDelays = sizeof(delays) / sizeof(delays[0]);
+    Wsdb *self = static_cast<Wsdb *>(wsdb);
+    auto now = std::chrono::steady_clock::now();
+
+    if (count == 0)
+        self->busySince = now;
+
+    int64_t waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - self->busySince).count();
+    if (waited >= self->busyTimeout)
+        return 0;
+
+    int64_t delay = std::min<int64_t>(delays[std::min(count, numDelays - 1)], self->busyTimeout - waited);
+    sqlite3_sleep(static_cast<int>(delay));
+    self->busyWait += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
+
+    return 1;
+}
+
+void Wsdb::setBusyTimeout(int64_t ms) {
+    busyTimeout = ms;
+
+    // As with sqlite3_busy_timeout, no timeout fails at once with SQLITE_BUSY
+    sqlite3_busy_handler(db, ms > 0 ? busyHandler : nullptr, this);
+}
+
+void Wsdb::installCancelHandler() {
+    if (db == nullptr)
+        return;
+
+    // Checked every 1000 virtual machine instructions, a step then fails with SQLITE_INTERRUPT
+    if (cancelFlag || hasDeadline)
+        sqlite3_progress_handler(db, 1000, progressHandler, this);
+    else
+        sqlite3_progress_handler(db, 0, nullptr, nullptr);
+}
+
+bool Wsdb::canReadWal() {
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, "select count(*) from sqlite_master;", -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+
+    bool ok = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+
+    return ok;
+}
+
+int64_t Wsdb::getPragma(const char *name) {
+    std::string sql = std::string("pragma ") + name + ";";
+    sqlite3_stmt *stmt;
+    int64_t value = StorageProfile::unset;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return value;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        value = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    return value;
+}
+
+bool Wsdb::hasColumn(const char *table, const char *column) {
+    std::string sql = std::string("pragma table_info(") + table + ");";
+    sqlite3_stmt *stmt;
+    bool found = false;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error(std::string("Could not read ") + table + " schema: " + sqlite3_errmsg(db));
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        if (sqlite3_stricmp((const char *) sqlite3_column_text(stmt, 1), column) == 0)
+            found = true;
+    sqlite3_finalize(stmt);
+
+    return found;
+}
+
+void Wsdb::migrateNames() {
+    if (!hasColumn("reservations", "name"))
+        return;
+
+    // Dropping the old table drops its triggers too, open recreates them afterwards
+    char *errStr;
+    if (sqlite3_exec(db, "begin immediate;"
+                     "insert or ignore into names (name) select distinct name from reservations where name is not null;"
+                     "create table reservations_new (slot int not null, station int not null, nameId int, attr int, primary key (slot, station)) without rowid;"
+                     "insert into reservations_new (slot, station, nameId, attr) "
+                     "select r.slot, r.station, n.id, r.attr from reservations r left join names n on n.name = r.name;"
+                     "drop table reservations;"
+                     "alter table reservations_new rename to reservations;"
+                     "update version set value = value + 1 where id = 0;"
+                     "commit;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        sqlite3_exec(db, "rollback;", nullptr, nullptr, nullptr);
+        throw std::runtime_error("Could not migrate reservations to the names table: " + err);
+    }
+}
+
+void Wsdb::migrateChangeLog() {
+    if (hasColumn("reservation_changes", "slotStop"))
+        return;
+
+    // Older logs only hold single slots, a null slotStop reads as slot
+    char *errStr;
+    if (sqlite3_exec(db, "alter table reservation_changes add column slotStop int;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+
+        // Another client may have added it first
+        if (hasColumn("reservation_changes", "slotStop"))
+            return;
+
+        throw std::runtime_error("Could not add slotStop to reservation_changes: " + err);
+    }
+}
+
+// Stations past numStations or flagged as excluded are not shown, so they are not counted either
+static std::string countedSql(const std::string &station) {
+    return "(" + station + " < coalesce((select value from parameters where name = 'numStations'), " DEFAULT_STATIONS ") and "
+           "not exists (select 1 from descriptions d where d.station = " + station + " and d.flags & 1))";
+}
+
+// Every booked slot as (slot, station), from either engine
+static const char *allSlotsSql =
+    "select slot, station from reservations union all "
+    "select i.slotStart + o.n, i.station from intervals i, slot_offsets o where o.n <= i.slotStop - i.slotStart";
+
+// The conflict clause of the statement firing a trigger overrides the ones inside it, so these
+// statements only insert slots that are missing and never rely on "or ignore"
+static std::string addCountsSql(const std::string &slotStart, const std::string &slotStop, const std::string &counted) {
+    return "insert into slot_counts (slot, count) select " + slotStart + " + o.n, 0 from slot_offsets o "
+           "where o.n <= " + slotStop + " - " + slotStart + " and " + counted + " and "
+           "not exists (select 1 from slot_counts c where c.slot = " + slotStart + " + o.n);"
+           "update slot_counts set count = count + 1 where slot between " + slotStart + " and " + slotStop + " and " + counted + ";";
+}
+
+static std::string subCountsSql(const std::string &slotStart, const std::string &slotStop, const std::string &counted) {
+    return "update slot_counts set count = count - 1 where slot between " + slotStart + " and " + slotStop + " and " + counted + ";"
+           "delete from slot_counts where slot between " + slotStart + " and " + slotStop + " and count <= 0;";
+}
+
+// Adds (delta 1) or removes (delta -1) all bookings of one station, when it stops or starts being excluded
+static std::string stationCountsSql(const std::string &station, int delta, const std::string &when) {
+    std::string slots = "select slot from reservations where station = " + station + " union all "
+                        "select i.slotStart + o.n from intervals i, slot_offsets o where i.station = " + station + " and o.n <= i.slotStop - i.slotStart";
+
+    if (delta > 0)
+        return "insert into slot_counts (slot, count) select s.slot, 0 from (" + slots + ") s "
+               "where " + when + " and not exists (select 1 from slot_counts c where c.slot = s.slot);"
+               "update slot_counts set count = count + 1 where slot in (" + slots + ") and " + when + ";";
+
+    return "update slot_counts set count = count - 1 where slot in (" + slots + ") and " + when + ";"
+           "delete from slot_counts where count <= 0 and " + when + ";";
+}
+
+// Archived slots are no longer in these tables, their counts stay as they were when archived
+static std::string rebuildCountsSql() {
+    std::string archivedBefore = "coalesce((select value from parameters where name = 'archivedBefore'), -9223372036854775808)";
+
+    return "delete from slot_counts where slot >= " + archivedBefore + ";"
+           "insert into slot_counts (slot, count) select a.slot, count(*) from (" + allSlotsSql + ") a "
+           "where a.slot >= " + archivedBefore + " and " + countedSql("a.station") + " group by a.slot;";
+}
+
+void Wsdb::migrateSlotCounts() {
+    if (hasColumn("slot_counts", "count"))
+        return;
+
+    // Filled in the same transaction as the triggers that keep it current, so no booking is missed
+    std::stringstream sql;
+    sql << "begin immediate;"
+           "create table if not exists slot_offsets (n int primary key not null) without rowid;"
+           "create table if not exists slot_counts (slot int primary key not null, count int not null) without rowid;";
+    for (int count = 0; count < INTERVAL_BLOCK; count++)
+        sql << "insert or ignore into slot_offsets (n) values (" << count << ");";
+
+    char *errStr;
+    if (sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        sqlite3_exec(db, "rollback;", nullptr, nullptr, nullptr);
+        throw std::runtime_error("Could not create table slot_counts: " + err);
+    }
+
+    try {
+        createTriggers();
+    } catch (std::exception &) {
+        sqlite3_exec(db, "rollback;", nullptr, nullptr, nullptr);
+        throw;
+    }
+
+    if (sqlite3_exec(db, (rebuildCountsSql() + "commit;").c_str(), nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        sqlite3_exec(db, "rollback;", nullptr, nullptr, nullptr);
+        throw std::runtime_error("Could not fill slot_counts: " + err);
+    }
+}
+
+void Wsdb::createTriggers() {
+    const char *tables[] = {"reservations", "intervals", "descriptions", "parameters"};
+    const char *ops[] = {"insert", "update", "delete"};
+    std::stringstream sql;
+
+    // Any change to the tables that are shown bumps the version
+    for (auto table : tables)
+        for (auto op : ops)
+            sql << "create trigger if not exists " << table << "_" << op << "_version after " << op << " on " << table
+                << " begin update version set value = value + 1 where id = 0; end;";
+
+    sql << "create trigger if not exists reservations_insert_log after insert on reservations begin "
+           "insert into reservation_changes (slot, station, name, attr) values (new.slot, new.station, (select name from names where id = new.nameId), new.attr); end;"
+           "create trigger if not exists reservations_update_log after update on reservations begin "
+           "insert into reservation_changes (slot, station, name, attr) values (old.slot, old.station, null, null);"
+           "insert into reservation_changes (slot, station, name, attr) values (new.slot, new.station, (select name from names where id = new.nameId), new.attr); end;"
+           "create trigger if not exists reservations_delete_log after delete on reservations begin "
+           "insert into reservation_changes (slot, station, name, attr) values (old.slot, old.station, null, null); end;";
+
+    sql << "create trigger if not exists intervals_insert_log after insert on intervals begin "
+           "insert into reservation_changes (slot, slotStop, station, name, attr) values (new.slotStart, new.slotStop, new.station, (select name from names where id = new.nameId), new.attr); end;"
+           "create trigger if not exists intervals_update_log after update on intervals begin "
+           "insert into reservation_changes (slot, slotStop, station, name, attr) values (old.slotStart, old.slotStop, old.station, null, null);"
+           "insert into reservation_changes (slot, slotStop, station, name, attr) values (new.slotStart, new.slotStop, new.station, (select name from names where id = new.nameId), new.attr); end;"
+           "create trigger if not exists intervals_delete_log after delete on intervals begin "
+           "insert into reservation_changes (slot, slotStop, station, name, attr) values (old.slotStart, old.slotStop, old.station, null, null); end;";
+
+    // slot_counts follows the bookings of the stations that are shown
+    // Updates are not used by this client, they are only kept correct
+    for (auto table : {"reservations", "intervals"}) {
+        std::string start = std::string(table) == "reservations" ? "slot" : "slotStart";
+        std::string stop = std::string(table) == "reservations" ? "slot" : "slotStop";
+
+        sql << "create trigger if not exists " << table << "_insert_counts after insert on " << table << " when " << countedSql("new.station") << " begin "
+            << addCountsSql("new." + start, "new." + stop, "1") << " end;"
+               "create trigger if not exists " << table << "_update_counts after update on " << table << " begin "
+            << subCountsSql("old." + start, "old." + stop, countedSql("old.station"))
+            << addCountsSql("new." + start, "new." + stop, countedSql("new.station")) << " end;"
+               "create trigger if not exists " << table << "_delete_counts after delete on " << table << " when " << countedSql("old.station") << " begin "
+            << subCountsSql("old." + start, "old." + stop, "1") << " end;";
+    }
+
+    // Descriptions are written with insert or replace, whose implicit delete fires no trigger.
+    // The before trigger compares against the row about to be replaced instead.
+    std::string shown = " < coalesce((select value from parameters where name = 'numStations'), " DEFAULT_STATIONS ")";
+    std::string wasExcluded = "coalesce((select flags & 1 from descriptions where station = new.station), 0)";
+    sql << "create trigger if not exists descriptions_insert_counts before insert on descriptions "
+           "when (new.flags & 1) != " << wasExcluded << " and new.station" << shown << " begin "
+        << stationCountsSql("new.station", -1, "new.flags & 1")
+        << stationCountsSql("new.station", 1, "not (new.flags & 1)") << " end;"
+           "create trigger if not exists descriptions_update_counts after update on descriptions begin "
+        << stationCountsSql("old.station", 1, "old.flags & 1 and old.station" + shown)
+        << stationCountsSql("new.station", -1, "new.flags & 1 and new.station" + shown) << " end;"
+           "create trigger if not exists descriptions_delete_counts after delete on descriptions begin "
+        << stationCountsSql("old.station", 1, "old.flags & 1 and old.station" + shown) << " end;";
+
+    // Changing the number of stations is rare, recount everything
+    for (auto op : {"insert", "update"})
+        sql << "create trigger if not exists parameters_" << op << "_counts after " << op << " on parameters "
+               "when new.name = 'numStations' begin " << rebuildCountsSql() << " end;";
+
+    char *errStr;
+    if (sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not create triggers: " + err);
+    }
+}
+
+void Wsdb::dropTriggers() {
+    const char *tables[] = {"reservations", "intervals"};
+    const char *ops[] = {"insert", "update", "delete"};
+    std::stringstream sql;
+
+    for (auto table : tables) {
+        for (auto op : ops) {
+            sql << "drop trigger if exists " << table << "_" << op << "_version;";
+            sql << "drop trigger if exists " << table << "_" << op << "_log;";
+            sql << "drop trigger if exists " << table << "_" << op << "_counts;";
+        }
+    }
+
+    // Recreated with the current recount, which older versions did not limit to unarchived slots
+    for (auto op : {"insert", "update"})
+        sql << "drop trigger if exists parameters_" << op << "_counts;";
+
+    char *errStr;
+    if (sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not drop triggers: " + err);
+    }
+}
+
+void Wsdb::convertToIntervals() {
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, "select slot, station, nameId, attr from reservations order by slot, station;", -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not read reservations: " + std::string(sqlite3_errmsg(db)));
+
+    {
+        FinalizeOnExit foe(stmt);
+
+        // Rows arrive in slot order, so each station has at most one run still growing
+        std::unordered_map<int64_t, Interval> runs;
+        int rc;
+
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            int64_t slot = sqlite3_column_int64(stmt, 0);
+            int64_t station = sqlite3_column_int64(stmt, 1);
+            int64_t id = sqlite3_column_int64(stmt, 2);
+            int64_t attr = sqlite3_column_int64(stmt, 3);
+
+            auto it = runs.find(station);
+            if (it != runs.end()) {
+                Interval &run = it->second;
+
+                if (run.slotStop + 1 == slot && blockOf(run.slotStart) == blockOf(slot) && run.nameId == id && run.attr == attr) {
+                    run.slotStop = slot;
+                    continue;
+                }
+
+                insertInterval(station, run);
+                runs.erase(it);
+            }
+
+            runs.insert(std::make_pair(station, Interval(slot, slot, id, attr)));
+        }
+
+        if (rc != SQLITE_DONE)
+            throw std::runtime_error("Could not read reservations: " + std::string(sqlite3_errmsg(db)));
+
+        for (auto &run : runs)
+            insertInterval(run.first, run.second);
+    }
+
+    char *errStr;
+    if (sqlite3_exec(db, "delete from reservations;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not clear reservations: " + err);
+    }
+}
+
+void Wsdb::convertToSlots() {
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, "select slotStart, slotStop, station, nameId, attr from intervals;", -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not read intervals: " + std::string(sqlite3_errmsg(db)));
+
+    {
+        FinalizeOnExit foe(stmt);
+        int rc;
+
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            int64_t stop = sqlite3_column_int64(stmt, 1);
+            int64_t station = sqlite3_column_int64(stmt, 2);
+            int64_t id = sqlite3_column_int64(stmt, 3);
+            int64_t attr = sqlite3_column_int64(stmt, 4);
+
+            for (int64_t slot = sqlite3_column_int64(stmt, 0); slot <= stop; slot++)
+                if (insertSlot(slot, station, id, attr) == 0)
+                    throw std::runtime_error("Overlapping intervals, could not convert");
+        }
+
+        if (rc != SQLITE_DONE)
+            throw std::runtime_error("Could not read intervals: " + std::string(sqlite3_errmsg(db)));
+    }
+
+    char *errStr;
+    if (sqlite3_exec(db, "delete from intervals;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not clear intervals: " + err);
+    }
+}
+
+int64_t Wsdb::oldestSlot() {
+    sqlite3_stmt *stmt;
+    int64_t first = INT64_MAX;
+
+    if (sqlite3_prepare_v2(db, "select min(slot) from reservations union all select min(slotStart) from intervals;", -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error("Could not read oldest reservation: " + std::string(sqlite3_errmsg(db)));
+
+    FinalizeOnExit foe(stmt);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        if (sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+            first = std::min<int64_t>(first, sqlite3_column_int64(stmt, 0));
+
+    return first;
+}
+
+// Leaves the log empty past a new sequence number, so every client sees it as pruned and reloads
+void Wsdb::resetChangeLog() {
+    char *errStr;
+    if (sqlite3_exec(db, "insert into reservation_changes (slot, station) values (0, 0);"
+                     "delete from reservation_changes;", nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        throw std::runtime_error("Could not reset reservation_changes: " + err);
+    }
+}
+
+bool Wsdb::attachArchive(int64_t year, bool create) {
+    if (db == nullptr)
+        return false;
+
+    if (archiveAttached == year)
+        return true;
+    detachArchive();
+
+    std::string filename = archiveFilename(year);
+    if (filename.empty())
+        return false;
+
+    // Attaching a missing file would create it, probe for it first
+    if (!create) {
+        sqlite3 *probe;
+        int rc = sqlite3_open_v2(filename.c_str(), &probe, SQLITE_OPEN_READONLY, nullptr);
+        sqlite3_close(probe);
+
+        if (rc != SQLITE_OK)
+            return false;
+    }
+
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "attach database ? as archive;", -1, &stmt, nullptr) != SQLITE_OK) {
+        if (create)
+            throw std::runtime_error("Could not attach " + filename + ": " + sqlite3_errmsg(db));
+        return false;
+    }
+
+    {
+        FinalizeOnExit foe(stmt);
+
+        if (sqlite3_bind_text(stmt, 1, filename.c_str(), -1, SQLITE_TRANSIENT) != SQLITE_OK || sqlite3_step(stmt) != SQLITE_DONE) {
+            if (create)
+                throw std::runtime_error("Could not attach " + filename + ": " + sqlite3_errmsg(db));
+            return false;
+        }
+    }
+    archiveAttached = year;
+
+    // Archives hold ids of the names table in the main file, they are only read through it
+    char *errStr;
+    if (create && sqlite3_exec(db, "create table if not exists archive.reservations (slot int not null, station int not null, nameId int, attr int, primary key (slot, station)) without rowid;"
+                               "create table if not exists archive.intervals (slotStart int not null, station int not null, slotStop int not null, nameId int, attr int, primary key (slotStart, station)) without rowid;",
+                               nullptr, nullptr, &errStr) != SQLITE_OK) {
+        std::string err(errStr);
+        sqlite3_free(errStr);
+        detachArchive();
+        throw std::runtime_error("Could not create archive tables in " + filename + ": " + err);
+    }
+
+    if (sqlite3_prepare_v2(db, selectSql("archive").c_str(), -1, &archiveSelect, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, selectRunsSql("archive").c_str(), -1, &archiveSelectRuns, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, usedSql("archive").c_str(), -1, &archiveUsed, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, runsUsedSql("archive").c_str(), -1, &archiveRunsUsed, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, sumRunsUsedSql("archive").c_str(), -1, &archiveSumRunsUsed, nullptr) != SQLITE_OK) {
+        std::string err(sqlite3_errmsg(db));
+        detachArchive();
+        if (create)
+            throw std::runtime_error("Could not prepare archive statements for " + filename + ": " + err);
+        return false;
+    }
+
+    return true;
+}
+
+void Wsdb::detachArchive() {
+    if (archiveSelect)
+        sqlite3_finalize(archiveSelect);
+
+    if (archiveSelectRuns)
+        sqlite3_finalize(archiveSelectRuns);
+
+    if (archiveUsed)
+        sqlite3_finalize(archiveUsed);
+
+    if (archiveRunsUsed)
+        sqlite3_finalize(archiveRunsUsed);
+
+    if (archiveSumRunsUsed)
+        sqlite3_finalize(archiveSumRunsUsed);
+
+    if (db && archiveAttached != INT64_MIN)
+        sqlite3_exec(db, "detach database archive;", nullptr, nullptr, nullptr);
+
+    archiveSelect      = nullptr;
+    archiveSelectRuns  = nullptr;
+    archiveUsed        = nullptr;
+    archiveRunsUsed    = nullptr;
+    archiveSumRunsUsed = nullptr;
+    archiveAttached    = INT64_MIN;
+}
+
+int64_t Wsdb::archiveYear(int64_t year, int64_t slotStart, int64_t slotStop) {
+    // Attaching is not possible inside a transaction
+    attachArchive(year, true);
+
+    std::stringstream range;
+    range << " between " << slotStart << " and " << slotStop << ";";
+    std::string moveSlots = "insert or ignore into archive.reservations (slot, station, nameId, attr) "
+                            "select slot, station, nameId, attr from main.reservations where slot" + range.str() +
+                            "delete from main.reservations where slot" + range.str();
+    std::string moveRuns = "insert or ignore into archive.intervals (slotStart, station, slotStop, nameId, attr) "
+                           "select slotStart, station, slotStop, nameId, attr from main.intervals where slotStart" + range.str() +
+                           "delete from main.intervals where slotStart" + range.str();
+
+    begin();
+    try {
+        // Rows leave the main file without being logged or uncounted, slot_counts keeps their counts
+        dropTriggers();
+
+        int64_t moved = 0;
+        for (auto &sql : {moveSlots, moveRuns}) {
+            char *errStr;
+            if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errStr) != SQLITE_OK) {
+                std::string err(errStr);
+                sqlite3_free(errStr);
+                throw std::runtime_error("Could not archive " + std::to_string(year) + ": " + err);
+            }
+            moved += sqlite3_changes(db);
+        }
+
+        createTriggers();
+        resetChangeLog();
+
+        // In the same transaction, so readers never miss the moved rows
+        setParameter("archivedBefore", std::max(getArchivedBefore(), slotStop + 1));
+        setParameter("archivedFrom", std::min(getArchivedFrom(), slotStart));
+        commit();
+
+        return moved;
+    } catch (std::exception &) {
+        rollback();
+        throw;
+    }
+}
+
+void Wsdb::releaseArchivedStrays() {
+    int64_t archivedBefore = getArchivedBefore();
+    if (archivedBefore == INT64_MIN)
+        return;
+
+    // Older versions still booked archived days in the main file, where they showed and counted twice.
+    // The triggers uncount and log them like any release.
+    std::string before = std::to_string(archivedBefore);
+    std::string sql = "delete from main.reservations where slot < " + before + ";"
+                      "delete from main.intervals where slotStart < " + before + ";";
+
+    begin();
+    try {
+        char *errStr;
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errStr) != SQLITE_OK) {
+            std::string err(errStr);
+            sqlite3_free(errStr);
+            throw std::runtime_error("Could not release archived slots: " + err);
+        }
+        commit();
+    } catch (std::exception &) {
+        rollback();
+        throw;
+    }
+}
+
+int64_t Wsdb::updateIntervals(int64_t slotStart, int64_t slotStop, int64_t station, int64_t id, int64_t attr) {
+    if (db == nullptr || slotStart > slotStop)
+        return 0;
+
+    // Blocks are read and rewritten, which has to happen in one transaction
+    bool ownTransaction = sqlite3_get_autocommit(db) != 0;
+    if (ownTransaction)
+        begin();
+
+    int64_t changed = 0;
+    try {
+        for (int64_t block = blockOf(slotStart); block <= blockOf(slotStop); block++) {
+            int64_t base = block * INTERVAL_BLOCK;
+            changed += updateBlock(block, std::max(slotStart, base), std::min(slotStop, base + INTERVAL_BLOCK - 1), station, id, attr);
+        }
+
+        if (ownTransaction)
+            commit();
+    } catch (std::exception &) {
+        if (ownTransaction)
+            rollback();
+        throw;
+    }
+
+    return changed;
+}
+
+int64_t Wsdb::updateBlock(int64_t block, int64_t slotStart, int64_t slotStop, int64_t station, int64_t id, int64_t attr) {
+    if (selectBlock == nullptr)
+        return 0;
+
+    int64_t base = block * INTERVAL_BLOCK;
+    bool used[INTERVAL_BLOCK];
+    int64_t ids[INTERVAL_BLOCK];
+    int64_t attrs[INTERVAL_BLOCK];
+    std::vector<Interval> before;
+
+    for (int count = 0; count < INTERVAL_BLOCK; count++)
+        used[count] = false;
+
+    {
+        ResetOnExit roe(selectBlock);
+
+        if (sqlite3_bind_int64(selectBlock, 1, base) != SQLITE_OK)
+            return 0;
+
+        if (sqlite3_bind_int64(selectBlock, 2, base + INTERVAL_BLOCK - 1) != SQLITE_OK)
+            return 0;
+
+        if (sqlite3_bind_int64(selectBlock, 3, station) != SQLITE_OK)
+            return 0;
+
+        while (sqlite3_step(selectBlock) == SQLITE_ROW) {
+            Interval run(sqlite3_column_int64(selectBlock, 0),
+                         sqlite3_column_int64(selectBlock, 1),
+                         sqlite3_column_int64(selectBlock, 2),
+                         sqlite3_column_int64(selectBlock, 3));
+
+            for (int64_t slot = run.slotStart; slot <= std::min(run.slotStop, base + INTERVAL_BLOCK - 1); slot++) {
+                used[slot - base] = true;
+                ids[slot - base] = run.nameId;
+                attrs[slot - base] = run.attr;
+            }
+            before.push_back(run);
+        }
+    }
+
+    // Only free slots are booked and only booked slots released, like the per slot engine
+    int64_t changed = 0;
+    for (int64_t slot = slotStart; slot <= slotStop; slot++) {
+        int64_t idx = slot - base;
+
+        if (id >= 0 && !used[idx]) {
+            used[idx] = true;
+            ids[idx] = id;
+            attrs[idx] = attr;
+            changed++;
+            bulkCount(slot, station);
+        } else if (id < 0 && used[idx]) {
+            used[idx] = false;
+            changed++;
+        }
+    }
+
+    if (changed == 0)
+        return 0;
+
+    // Rebuild the block as maximal runs, which splits and merges as needed
+    std::vector<Interval> after;
+    for (int64_t idx = 0; idx < INTERVAL_BLOCK; idx++) {
+        if (!used[idx])
+            continue;
+
+        if (!after.empty() && after.back().slotStop == base + idx - 1 && after.back().nameId == ids[idx] && after.back().attr == attrs[idx])
+            after.back().slotStop++;
+        else
+            after.push_back(Interval(base + idx, base + idx, ids[idx], attrs[idx]));
+    }
+
+    // Only touch runs that differ, so the change log stays small
+    for (auto &run : before)
+        if (std::find(after.begin(), after.end(), run) == after.end())
+            removeInterval(station, run.slotStart);
+
+    for (auto &run : after)
+        if (std::find(before.begin(), before.end(), run) == before.end())
+            insertInterval(station, run);
+
+    return changed;
+}
+
+void Wsdb::insertInterval(int64_t station, const Interval &interval) {
+    if (insertRun == nullptr)
+        return;
+
+    ResetOnExit roe(insertRun);
+
+    if (sqlite3_bind_int64(insertRun, 1, interval.slotStart) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(insertRun, 2, interval.slotStop) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(insertRun, 3, station) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(insertRun, 4, interval.nameId) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(insertRun, 5, interval.attr) != SQLITE_OK)
+        return;
+
+    if (stepWrite(insertRun) == 0)
+        throw std::runtime_error("Overlapping interval");
+}
+
+void Wsdb::removeInterval(int64_t station, int64_t slotStart) {
+    if (removeRun == nullptr)
+        return;
+
+    ResetOnExit roe(removeRun);
+
+    if (sqlite3_bind_int64(removeRun, 1, slotStart) != SQLITE_OK)
+        return;
+
+    if (sqlite3_bind_int64(removeRun, 2, station) != SQLITE_OK)
+        return;
+
+    stepWrite(removeRun);
+}
+
+void Wsdb::bulkCount(int64_t slot, int64_t station) {
+    if (isBulkLoad && station >= 0 && static_cast<size_t> (station) < bulkCounted.size() && bulkCounted[static_cast<size_t> (station)])
+        bulkCounts[slot]++;
+}
+
+int Wsdb::insertSlot(int64_t slot, int64_t station, int64_t id, int64_t attr) {
+    if (insert == nullptr)
+        return 0;
+
+    ResetOnExit roe(insert);
+
+    if (sqlite3_bind_int64(insert, 1, slot) != SQLITE_OK)
+        return 0;
+
+    if (sqlite3_bind_int64(insert, 2, station) != SQLITE_OK)
+        return 0;
+
+    if (sqlite3_bind_int64(insert, 3, id) != SQLITE_OK)
+        return 0;
+
+    if (sqlite3_bind_int64(insert, 4, attr) != SQLITE_OK)
+        return 0;
+
+    return stepWrite(insert);
+}
+
+bool Wsdb::Interval::operator==(const Interval &other) const {
+    return slotStart == other.slotStart && slotStop == other.slotStop && nameId == other.nameId && attr == other.attr;
+}
+
+int64_t Wsdb::nameId(const char *name) {
+    if (name == nullptr)
+        name = "";
+
+    auto it = idByName.find(name);
+    if (it != idByName.end())
+        return it->second;
+
+    if (insertNameId == nullptr || getNameId == nullptr)
+        return -1;
+
+    {
+        ResetOnExit roe(insertNameId);
+
+        if (sqlite3_bind_text(insertNameId, 1, name, -1, SQLITE_STATIC) != SQLITE_OK)
+            return -1;
+
+        stepWrite(insertNameId);
+    }
+
+    ResetOnExit roe(getNameId);
+
+    if (sqlite3_bind_text(getNameId, 1, name, -1, SQLITE_STATIC) != SQLITE_OK)
+        return -1;
+
+    if (sqlite3_step(getNameId) != SQLITE_ROW)
+        return -1;
+
+    int64_t id = sqlite3_column_int64(getNameId, 0);
+    idByName[name] = id;
+
+    return id;
+}
+
+const char *Wsdb::nameForId(int64_t id) {
+    if (id <= 0)
+        return "";
+
+    // The dictionary only grows, so a miss just means new names to load
+    if (id > namesLoaded && loadNames != nullptr) {
+        ResetOnExit roe(loadNames);
+
+        if (sqlite3_bind_int64(loadNames, 1, namesLoaded) != SQLITE_OK)
+            return "";
+
+        while (sqlite3_step(loadNames) == SQLITE_ROW) {
+            int64_t newId = sqlite3_column_int64(loadNames, 0);
+            const char *newName = (const char *) sqlite3_column_text(loadNames, 1);
+
+            if (static_cast<size_t>(newId) >= nameById.size())
+                nameById.resize(static_cast<size_t>(newId) + 1);
+            nameById[static_cast<size_t>(newId)] = newName;
+            idByName[newName] = newId;
+            namesLoaded = std::max(namesLoaded, newId);
+        }
+    }
+
+    if (static_cast<size_t>(id) >= nameById.size())
+        return "";
+
+    return nameById[static_cast<size_t>(id)].c_str();
+}
+
+int Wsdb::stepWrite(sqlite3_stmt *stmt) {
+    int rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_DONE)
+        return 1;
+
+    if (rc == SQLITE_CONSTRAINT)
+        return 0;
+
+    throw std::runtime_error(std::string(sqlite3_errmsg(db)));
 }
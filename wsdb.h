@@ -23,9 +23,12 @@
 #ifndef WSDB_H
 #define WSDB_H
 
+#include <atomic>
+#include <chrono>
 #include <sqlite3.h>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class WsdbCallback {
@@ -35,13 +38,65 @@ public:
     virtual void callback(int64_t slot, int64_t station, const char *name, int64_t attr);
 };
 
+class WsdbChangeCallback {
+public:
+    virtual ~WsdbChangeCallback() {}
+
+    // name is null when the slots were released
+    virtual void change(int64_t seq, int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr);
+};
+
+class WsdbUsageCallback {
+public:
+    virtual ~WsdbUsageCallback() {}
+
+    virtual void usage(int64_t station, int64_t bucket, int64_t booked);
+};
+
 class Wsdb{
 public:
     Wsdb();
     ~Wsdb();
 
-    void open(const char *filename);
+    class StorageProfile {
+    public:
+        StorageProfile();
+
+        static const int64_t unset;
+        enum JournalMode {JournalDelete = 0, JournalWal = 1};
+
+        void merge(const StorageProfile &other); // Take every field that is set in other
+
+        int64_t journalMode; // Of the file, a client profile cannot change it
+        int64_t synchronous; // 0 = off, 1 = normal, 2 = full, 3 = extra
+        int64_t busyTimeout; // ms
+        int64_t mmapSize;    // bytes
+        int64_t cacheSize;   // pages, or KiB if negative
+    };
+
+    // Fields set in clientProfile override the profile stored in the parameters table, except the journal mode
+    void open(const char *filename, const StorageProfile &clientProfile = StorageProfile());
+    // Read-only connection to a file that open() has already set up, for reading in parallel to a writer
+    void openReader(const char *filename, const StorageProfile &clientProfile = StorageProfile());
     void close();
+    StorageProfile getActiveProfile();
+    std::string getFilename(); // Empty if not open
+
+    void begin();
+    void beginRead(); // Several reads see one state of the file, ended by commit
+    void commit();
+    void rollback();
+
+    // Statements stop early while *flag is true, the flag outlives every open. Null to run to completion.
+    void setCancelFlag(const std::atomic<bool> *flag);
+    bool isCancelled(); // The flag is set or a time limit passed, results read since may be incomplete
+    // Time spent waiting for locks other connections hold since the last call, in us
+    int64_t takeBusyWait();
+
+    // Incremented on every open so results from a previous file are never reused
+    int64_t getGeneration();
+    // Bumped by triggers on every change to reservations, descriptions or parameters, -1 if unknown
+    int64_t getChangeVersion();
 
     class Limits {
     public:
@@ -71,18 +126,134 @@ public:
     void setStationInfo(int64_t station, const StationInfo &info);
     void setStationInfo(const std::vector<StationInfo> &info);
 
-    int insertName(int64_t slot, int64_t station, const char *name, int64_t attr); // 1 on sucess, 0 on error
+    // Reservations are kept either one row per slot or as runs of slots, chosen per file
+    enum StorageEngine {EngineSlots = 0, EngineIntervals = 1};
+    int64_t getStorageEngine();
+    // Moves every reservation to the given engine in one transaction, throws std::runtime_error
+    void convertStorage(int64_t engine);
+
+    // For imports inside a transaction: insertNames skips the per row triggers until endBulkLoad, which adds
+    // the booked slots to slot_counts at once and resets the change log so every client reloads.
+    // Rolling back ends it too. Throw std::runtime_error.
+    void beginBulkLoad();
+    void endBulkLoad();
+
+    // Write methods throw std::runtime_error on database errors. Archived slots, before getArchivedBefore,
+    // are read only: they are neither booked nor released.
+    int insertName(int64_t slot, int64_t station, const char *name, int64_t attr); // 1 on sucess, 0 if slot already taken
+    int64_t insertNames(int64_t slotStart, int64_t slotStop, int64_t station, const char *name, int64_t attr); // Number of slots booked, taken slots are skipped
     void selectNames(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback);
     void removeNames(int64_t slotStart, int64_t slotStop, int64_t station);
+    // Bounds of every reservation including archived ones, false if there are none. last may be a few slots past the newest.
+    bool getSlotRange(int64_t *first, int64_t *last);
+
+    // Booked slots per slot over the shown stations, kept by triggers. countsOut[0] is slotStart.
+    void getSlotCounts(int64_t slotStart, int64_t slotStop, std::vector<int64_t> *countsOut);
+
+    // Booked slots per station and bucket, grouped in SQL. A slot falls in bucket (slot - origin) / slotsPerBucket,
+    // taken modulo bucketsPerCycle if that is positive. origin must not be after slotStart.
+    // A bucket may be reported more than once when it spans archived and current reservations, add them up.
+    void selectUsage(int64_t slotStart, int64_t slotStop, int64_t origin, int64_t slotsPerBucket, int64_t bucketsPerCycle, WsdbUsageCallback &callback);
+
+    // Reservations older than the archive horizon live in one file per year next to the main file,
+    // selectNames and selectUsage attach them when a query reaches back that far. Archived bookings are never
+    // replaced; rows older versions let into the main file before the horizon are released when archiving.
+    int64_t getArchiveDays(); // 0 never archives
+    void setArchiveDays(int64_t days);
+    int64_t getArchivedBefore(); // Slot the last archive ran up to, INT64_MIN if never
+    int64_t getArchivedFrom();   // Oldest slot ever archived, INT64_MAX if none
+    std::string archiveFilename(int64_t year);
+    // Moves reservations before the day of beforeSlot into the yearly archives, one transaction per year.
+    // Returns the rows moved, throws std::runtime_error.
+    int64_t archive(int64_t beforeSlot);
+    int64_t archiveOld(int64_t nowSlot); // Archives what is more than archiveDays before nowSlot
+
+    // Idle writers keep a copy of the current and next week next to the file for displays, see WsSnapshot
+    bool getPublishSnapshot();
+    void setPublishSnapshot(bool publish);
+
+    // Idle-time upkeep, one client at a time. The lease and the time of the last round are kept in the
+    // parameters table, times are seconds since the Unix epoch. A round runs at most once per interval.
+    bool beginMaintenance(int64_t owner, int64_t now, int64_t interval, int64_t leaseTime); // false if not due or leased
+    // Runs the next step of the round within budgetMs, false once the round is done. A cancelled
+    // step is repeated by the next call, one that fails or runs out of time is skipped.
+    bool maintenanceStep(int64_t budgetMs);
+    void endMaintenance(int64_t owner, int64_t now);
+
+    int64_t getLastChange();
+    // Returns false if changes after sinceSeq have been pruned, a full selectNames is needed then
+    bool selectChanges(int64_t sinceSeq, WsdbChangeCallback &callback);
+    void pruneChanges(); // Keeps the last changeLogSize entries
 
     static std::string defaultWorkstationName(int64_t station);
+    static int64_t slotOfDate(int64_t year, int64_t month, int64_t day); // First slot of the day
+    static int64_t todaySlot(); // First slot of the local day
+    static void dateOfSlot(int64_t slot, int64_t *year, int64_t *month, int64_t *day, int64_t *minute); // minute of the day
 
 private:
+    class Interval {
+    public:
+        Interval(int64_t slotStart, int64_t slotStop, int64_t nameId, int64_t attr) :
+            slotStart(slotStart), slotStop(slotStop), nameId(nameId), attr(attr) {}
+
+        bool operator==(const Interval &other) const;
+
+        int64_t slotStart;
+        int64_t slotStop;
+        int64_t nameId;
+        int64_t attr;
+    };
+
     int64_t getParameter(const char *name, int64_t default_val);
     void setParameter(const char *name, int64_t value);
+    int stepWrite(sqlite3_stmt *stmt);
+    bool hasColumn(const char *table, const char *column);
+    void migrateNames();
+    void migrateChangeLog();
+    void migrateSlotCounts();
+    void createTriggers();
+    void dropTriggers();
+    void convertToIntervals();
+    void convertToSlots();
+    void resetChangeLog();
+    int64_t oldestSlot(); // INT64_MAX without reservations
+    int64_t updateIntervals(int64_t slotStart, int64_t slotStop, int64_t station, int64_t id, int64_t attr); // id < 0 releases, returns slots changed
+    int64_t updateBlock(int64_t block, int64_t slotStart, int64_t slotStop, int64_t station, int64_t id, int64_t attr);
+    void insertInterval(int64_t station, const Interval &interval);
+    void removeInterval(int64_t station, int64_t slotStart);
+    int insertSlot(int64_t slot, int64_t station, int64_t id, int64_t attr);
+    void bulkCount(int64_t slot, int64_t station);
+    void selectSlots(sqlite3_stmt *stmt, int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback);
+    void selectRunSlots(sqlite3_stmt *stmt, int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback);
+    void selectUsageFrom(sqlite3_stmt *stmt, bool isRuns, int64_t slotStart, int64_t slotStop, int64_t origin, int64_t slotsPerBucket, int64_t bucketsPerCycle, WsdbUsageCallback &callback);
+    bool attachArchive(int64_t year, bool create); // false if there is no archive for the year
+    void detachArchive();
+    int64_t archiveYear(int64_t year, int64_t slotStart, int64_t slotStop);
+    void releaseArchivedStrays();
+    int64_t nameId(const char *name); // -1 on error
+    const char *nameForId(int64_t id);
+    void prepareStatements();
+    StorageProfile storedProfile(const StorageProfile &clientProfile);
+    void applyProfile(const StorageProfile &profile, bool setJournalMode);
+    bool canReadWal();
+    int64_t getPragma(const char *name);
+    void installCancelHandler();
+    static int progressHandler(void *wsdb);
+    void setBusyTimeout(int64_t ms);
+    static int busyHandler(void *wsdb, int count);
 
 private:
+    StorageProfile active;
+    const std::atomic<bool> *cancelFlag;
+    bool hasDeadline;
+    std::chrono::steady_clock::time_point deadline;
+    int64_t busyTimeout; // ms
+    int64_t busyWait; // us since takeBusyWait
+    std::chrono::steady_clock::time_point busySince; // Start of the current busy wait
+    int64_t maintenanceTask; // Next step of the maintenance round
     sqlite3 *db;
+    sqlite3_stmt *dataVersion;
+    sqlite3_stmt *getVersion;
     sqlite3_stmt *getParam;
     sqlite3_stmt *setParam;
     sqlite3_stmt *getInfo;
@@ -91,6 +262,37 @@ private:
     sqlite3_stmt *insert;
     sqlite3_stmt *select;
     sqlite3_stmt *remove;
+    sqlite3_stmt *insertNameId;
+    sqlite3_stmt *getNameId;
+    sqlite3_stmt *loadNames;
+    sqlite3_stmt *lastChange;
+    sqlite3_stmt *firstChange;
+    sqlite3_stmt *selectChange;
+    sqlite3_stmt *pruneChange;
+    sqlite3_stmt *selectRuns;
+    sqlite3_stmt *selectBlock;
+    sqlite3_stmt *insertRun;
+    sqlite3_stmt *removeRun;
+    sqlite3_stmt *selectCounts;
+    sqlite3_stmt *selectUsed;
+    sqlite3_stmt *selectRunsUsed;
+    sqlite3_stmt *sumRunsUsed;
+    int64_t archiveAttached; // Year of the attached archive, INT64_MIN if none
+    sqlite3_stmt *archiveSelect;
+    sqlite3_stmt *archiveSelectRuns;
+    sqlite3_stmt *archiveUsed;
+    sqlite3_stmt *archiveRunsUsed;
+    sqlite3_stmt *archiveSumRunsUsed;
+    int64_t generation;
+    int64_t lastDataVersion;
+    int64_t lastTotalChanges;
+    int64_t version;
+    std::vector<std::string> nameById; // Cache of the names table, indexed by id
+    std::unordered_map<std::string, int64_t> idByName;
+    int64_t namesLoaded; // Highest id in nameById
+    bool isBulkLoad;
+    std::vector<bool> bulkCounted; // Stations that count in slot_counts
+    std::unordered_map<int64_t, int64_t> bulkCounts; // Slots booked per slot since beginBulkLoad
 };
 
 #endif // WSDB_H
@@ -0,0 +1,827 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "wsdbtransfer.h"
+
+const size_t WsdbTransfer::maxProblems = 100;
+const int64_t WsdbTransfer::batchSlots = 50000;
+const int64_t WsdbTransfer::defaultAttr = static_cast<int64_t> (0xFFFFFF) << 24;
+
+// Longer fields are cut, so a file without line breaks cannot grow memory without bound
+static const size_t maxFieldLength = 4096;
+
+// Fields of one record as read, converted by the importer
+class TransferRecord {
+public:
+    TransferRecord() : line(0) {}
+
+    void clear() {
+        workstation.clear();
+        start.clear();
+        stop.clear();
+        name.clear();
+        attr.clear();
+        error.clear();
+    }
+
+    int64_t line;
+    std::string workstation;
+    std::string start;
+    std::string stop;
+    std::string name;
+    std::string attr;
+    std::string error; // Set if the record could be delimited but not read
+};
+
+class TransferReader {
+public:
+    TransferReader(std::istream &in) : buf(in.rdbuf()), line(1) {
+        if (buf == nullptr)
+            throw std::runtime_error("Cannot read the input");
+    }
+    virtual ~TransferReader() {}
+
+    virtual bool next(TransferRecord *rec) = 0; // false at the end of the input
+
+protected:
+    int peek() {return buf->sgetc();}
+    int get() {
+        int c = buf->sbumpc();
+        if (c == '\n')
+            line++;
+        return c;
+    }
+
+    [[noreturn]] void fail(const std::string &msg) {
+        throw std::runtime_error("Line " + std::to_string(line) + ": " + msg);
+    }
+
+    std::streambuf *buf;
+    int64_t line;
+};
+
+static std::string trim(const std::string &text) {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return std::string();
+
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+static std::string lower(std::string text) {
+    for (auto &c : text)
+        c = static_cast<char> (tolower(static_cast<unsigned char> (c)));
+
+    return text;
+}
+
+// CsvReader ////
+
+class CsvReader : public TransferReader {
+public:
+    CsvReader(std::istream &in);
+
+    virtual bool next(TransferRecord *rec);
+
+private:
+    bool readFields();
+
+    std::vector<std::string> fields;
+    std::vector<std::string TransferRecord::*> columns;
+    int64_t fieldsLine; // Where the last fields started
+};
+
+CsvReader::CsvReader(std::istream &in) : TransferReader(in), fieldsLine(0) {
+    static const std::map<std::string, std::string TransferRecord::*> known = {
+        {"workstation", &TransferRecord::workstation},
+        {"start", &TransferRecord::start},
+        {"stop", &TransferRecord::stop},
+        {"name", &TransferRecord::name},
+        {"attr", &TransferRecord::attr}};
+
+    if (!readFields())
+        return;
+
+    // Columns may come in any order, unknown ones are skipped
+    for (auto &field : fields) {
+        auto it = known.find(lower(trim(field)));
+        columns.push_back(it == known.end() ? nullptr : it->second);
+    }
+
+    for (auto required : {&TransferRecord::workstation, &TransferRecord::start, &TransferRecord::stop, &TransferRecord::name})
+        if (std::find(columns.begin(), columns.end(), required) == columns.end())
+            fail("The header needs workstation, start, stop and name columns");
+}
+
+bool CsvReader::next(TransferRecord *rec) {
+    rec->clear();
+
+    if (!readFields())
+        return false;
+
+    rec->line = fieldsLine;
+    for (size_t col = 0; col < fields.size() && col < columns.size(); col++)
+        if (columns[col] != nullptr)
+            rec->*columns[col] = fields[col];
+
+    if (fields.size() > columns.size())
+        rec->error = "More fields than header columns";
+
+    return true;
+}
+
+// Reads one line of fields, blank lines are skipped
+bool CsvReader::readFields() {
+    fields.clear();
+
+    int c = peek();
+    while (c == '\r' || c == '\n') {
+        get();
+        c = peek();
+    }
+
+    if (c == EOF)
+        return false;
+
+    fieldsLine = line;
+    std::string field;
+    for (;;) {
+        field.clear();
+        c = get();
+
+        if (c == '"') {
+            int64_t quoteLine = line;
+            for (;;) {
+                c = get();
+                if (c == EOF)
+                    fail("Quoted field from line " + std::to_string(quoteLine) + " does not end");
+
+                if (c == '"') {
+                    if (peek() != '"') {
+                        c = get();
+                        break;
+                    }
+                    get();
+                }
+
+                if (field.size() < maxFieldLength)
+                    field.push_back(static_cast<char> (c));
+            }
+
+            // Text between the closing quote and the separator is dropped
+            while (c != ',' && c != '\n' && c != '\r' && c != EOF)
+                c = get();
+        } else {
+            while (c != ',' && c != '\n' && c != '\r' && c != EOF) {
+                if (field.size() < maxFieldLength)
+                    field.push_back(static_cast<char> (c));
+                c = get();
+            }
+        }
+
+        fields.push_back(field);
+        if (c != ',')
+            break;
+    }
+
+    if (c == '\r' && peek() == '\n')
+        get();
+    else if (c == '\r')
+        line++;
+
+    return true;
+}
+
+// JsonReader ////
+
+class JsonReader : public TransferReader {
+public:
+    JsonReader(std::istream &in);
+
+    virtual bool next(TransferRecord *rec);
+
+private:
+    void skipSpace();
+    void expect(int expected);
+    std::string readString();
+    std::string readLiteral();
+    void appendUtf8(std::string *text, uint32_t code);
+    uint32_t readHex();
+
+    bool inArray;
+};
+
+JsonReader::JsonReader(std::istream &in) : TransferReader(in), inArray(false) {
+    // An array of objects, or objects one after the other as in JSON Lines
+    skipSpace();
+    if (peek() == '[') {
+        get();
+        inArray = true;
+    }
+}
+
+bool JsonReader::next(TransferRecord *rec) {
+    rec->clear();
+
+    skipSpace();
+    if (inArray && peek() == ',') {
+        get();
+        skipSpace();
+    }
+
+    if (inArray && peek() == ']') {
+        get();
+        inArray = false;
+        skipSpace();
+    }
+
+    if (peek() == EOF) {
+        if (inArray)
+            fail("The array does not end");
+        return false;
+    }
+
+    if (peek() != '{')
+        fail("Expected an object");
+
+    rec->line = line;
+    get();
+    skipSpace();
+    if (peek() == '}') {
+        get();
+        return true;
+    }
+
+    for (;;) {
+        skipSpace();
+        std::string key = readString();
+        skipSpace();
+        expect(':');
+        skipSpace();
+
+        std::string value;
+        int c = peek();
+        if (c == '"')
+            value = readString();
+        else if (c == '{' || c == '[')
+            fail("Nested values are not supported");
+        else
+            value = readLiteral();
+
+        if (value == "null" && c != '"')
+            value.clear();
+
+        if (key == "workstation")
+            rec->workstation = value;
+        else if (key == "start")
+            rec->start = value;
+        else if (key == "stop")
+            rec->stop = value;
+        else if (key == "name")
+            rec->name = value;
+        else if (key == "attr")
+            rec->attr = value;
+
+        skipSpace();
+        c = get();
+        if (c == '}')
+            break;
+        if (c != ',')
+            fail("Expected , or }");
+    }
+
+    return true;
+}
+
+void JsonReader::skipSpace() {
+    int c = peek();
+    while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        get();
+        c = peek();
+    }
+}
+
+void JsonReader::expect(int expected) {
+    if (get() != expected)
+        fail(std::string("Expected ") + static_cast<char> (expected));
+}
+
+std::string JsonReader::readString() {
+    std::string text;
+
+    expect('"');
+    for (;;) {
+        int c = get();
+        if (c == EOF || c == '\n')
+            fail("String does not end");
+        if (c == '"')
+            break;
+
+        if (c == '\\') {
+            c = get();
+            switch (c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case '"': case '\\': case '/': break;
+            case 'u': {
+                uint32_t code = readHex();
+                if (code >= 0xD800 && code < 0xDC00) {
+                    expect('\\');
+                    expect('u');
+                    uint32_t low = readHex();
+                    if (low < 0xDC00 || low >= 0xE000)
+                        fail("Bad surrogate pair");
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (text.size() < maxFieldLength)
+                    appendUtf8(&text, code);
+                continue;
+            }
+            default:
+                fail("Bad escape");
+            }
+        }
+
+        if (text.size() < maxFieldLength)
+            text.push_back(static_cast<char> (c));
+    }
+
+    return text;
+}
+
+// Numbers, true, false and null, kept as their text
+std::string JsonReader::readLiteral() {
+    std::string text;
+
+    int c = peek();
+    while (c != EOF && (isalnum(c) || c == '-' || c == '+' || c == '.')) {
+        if (text.size() < maxFieldLength)
+            text.push_back(static_cast<char> (c));
+        get();
+        c = peek();
+    }
+
+    if (text.empty())
+        fail("Expected a value");
+
+    return text;
+}
+
+uint32_t JsonReader::readHex() {
+    uint32_t code = 0;
+
+    for (int digit = 0; digit < 4; digit++) {
+        int c = get();
+        if (!isxdigit(c))
+            fail("Bad \\u escape");
+        code = code * 16 + static_cast<uint32_t> (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+    }
+
+    return code;
+}
+
+void JsonReader::appendUtf8(std::string *text, uint32_t code) {
+    if (code < 0x80) {
+        text->push_back(static_cast<char> (code));
+    } else if (code < 0x800) {
+        text->push_back(static_cast<char> (0xC0 | (code >> 6)));
+        text->push_back(static_cast<char> (0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        text->push_back(static_cast<char> (0xE0 | (code >> 12)));
+        text->push_back(static_cast<char> (0x80 | ((code >> 6) & 0x3F)));
+        text->push_back(static_cast<char> (0x80 | (code & 0x3F)));
+    } else {
+        text->push_back(static_cast<char> (0xF0 | (code >> 18)));
+        text->push_back(static_cast<char> (0x80 | ((code >> 12) & 0x3F)));
+        text->push_back(static_cast<char> (0x80 | ((code >> 6) & 0x3F)));
+        text->push_back(static_cast<char> (0x80 | (code & 0x3F)));
+    }
+}
+
+// Import ////
+
+static bool parseInt(const std::string &text, int64_t *value) {
+    if (text.empty())
+        return false;
+
+    char *end;
+    bool isHex = text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+    errno = 0;
+    *value = isHex ? static_cast<int64_t> (strtoull(text.c_str() + 2, &end, 16)) : strtoll(text.c_str(), &end, 10);
+
+    return errno == 0 && *end == '\0';
+}
+
+// "yyyy-mm-dd hh:mm", a T may stand for the space
+bool WsdbTransfer::parseTime(const std::string &text, int64_t *slot) {
+    int year, month, day, hour = 0, minute = 0;
+    char sep;
+    int used = 0;
+
+    if (sscanf(text.c_str(), "%4d-%2d-%2d%n", &year, &month, &day, &used) != 3)
+        return false;
+
+    if (text[static_cast<size_t> (used)] != '\0') {
+        int more = 0;
+        if (sscanf(text.c_str() + used, "%c%2d:%2d%n", &sep, &hour, &minute, &more) != 3 || (sep != ' ' && sep != 'T'))
+            return false;
+        if (text[static_cast<size_t> (used + more)] != '\0')
+            return false;
+    }
+
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 24 || minute < 0 || minute > 59)
+        return false;
+
+    // The check catches days past the end of the month and times off the half hour
+    int64_t minutes = hour * 60 + minute;
+    int64_t dayStart = Wsdb::slotOfDate(year, month, day);
+    int64_t checkYear, checkMonth, checkDay, checkMinute;
+    Wsdb::dateOfSlot(dayStart, &checkYear, &checkMonth, &checkDay, &checkMinute);
+    if (checkMonth != month || checkDay != day || minutes % 30 != 0 || minutes > 24 * 60)
+        return false;
+
+    *slot = dayStart + minutes / 30;
+    return true;
+}
+
+bool WsdbTransfer::parseAttr(const std::string &text, int64_t *attr) {
+    if (text.empty()) {
+        *attr = defaultAttr;
+        return true;
+    }
+
+    return parseInt(text, attr);
+}
+
+class Importer {
+public:
+    Importer(Wsdb &wsdb);
+
+    void import(TransferReader &reader);
+
+    WsdbTransfer::ImportResult result;
+
+private:
+    void problem(int64_t line, const std::string &message);
+    bool convert(const TransferRecord &rec, int64_t *slotStart, int64_t *slotStop, int64_t *station, int64_t *attr);
+
+    Wsdb &wsdb;
+    int64_t numStations;
+    std::unordered_map<std::string, int64_t> stationByName;
+};
+
+Importer::Importer(Wsdb &wsdb) : wsdb(wsdb) {
+    std::vector<Wsdb::StationInfo> info;
+
+    wsdb.getStationInfo(&info);
+    numStations = static_cast<int64_t> (info.size());
+    for (size_t station = 0; station < info.size(); station++)
+        stationByName.insert(std::make_pair(info[station].name, static_cast<int64_t> (station)));
+}
+
+void Importer::import(TransferReader &reader) {
+    TransferRecord rec;
+    int64_t pending = 0;
+
+    wsdb.begin();
+    wsdb.beginBulkLoad();
+    try {
+        // Archived days are read only, the horizon only moves under the write lock we hold
+        int64_t archivedBefore = wsdb.getArchivedBefore();
+
+        while (reader.next(&rec)) {
+            int64_t slotStart, slotStop, station, attr;
+
+            result.records++;
+            if (!convert(rec, &slotStart, &slotStop, &station, &attr)) {
+                result.rejected++;
+                continue;
+            }
+
+            int64_t length = slotStop - slotStart + 1;
+            int64_t archived = slotStart < archivedBefore ? std::min(archivedBefore, slotStop + 1) - slotStart : 0;
+            int64_t booked = wsdb.insertNames(slotStart, slotStop, station, rec.name.c_str(), attr);
+            result.booked += booked;
+            if (archived > 0) {
+                result.conflicts++;
+                problem(rec.line, std::to_string(archived) + " of " + std::to_string(length) + " slots are archived" +
+                        (booked + archived < length ? ", " + std::to_string(length - archived - booked) + " were already booked" : ""));
+            } else if (booked < length) {
+                result.conflicts++;
+                problem(rec.line, std::to_string(length - booked) + " of " + std::to_string(length) + " slots were already booked");
+            }
+
+            // Commits in batches so other clients get the writer between them
+            pending += length;
+            if (pending >= WsdbTransfer::batchSlots) {
+                wsdb.endBulkLoad();
+                wsdb.commit();
+                wsdb.begin();
+                wsdb.beginBulkLoad();
+                archivedBefore = wsdb.getArchivedBefore();
+                pending = 0;
+            }
+        }
+
+        wsdb.endBulkLoad();
+        wsdb.commit();
+    } catch (...) {
+        wsdb.rollback();
+        throw;
+    }
+}
+
+void Importer::problem(int64_t line, const std::string &message) {
+    if (result.problems.size() < WsdbTransfer::maxProblems)
+        result.problems.push_back(WsdbTransfer::Problem(line, message));
+}
+
+bool Importer::convert(const TransferRecord &rec, int64_t *slotStart, int64_t *slotStop, int64_t *station, int64_t *attr) {
+    if (!rec.error.empty()) {
+        problem(rec.line, rec.error);
+        return false;
+    }
+
+    // A number picks the workstation by position, anything else by name
+    std::string ws = trim(rec.workstation);
+    int64_t number;
+    if (parseInt(ws, &number) && number >= 1 && number <= numStations) {
+        *station = number - 1;
+    } else {
+        auto it = stationByName.find(ws);
+        if (it == stationByName.end()) {
+            problem(rec.line, "No workstation \"" + ws + "\"");
+            return false;
+        }
+        *station = it->second;
+    }
+
+    int64_t slotEnd;
+    if (!WsdbTransfer::parseTime(trim(rec.start), slotStart) || !WsdbTransfer::parseTime(trim(rec.stop), &slotEnd)) {
+        problem(rec.line, "Start and stop must be yyyy-mm-dd hh:mm on the half hour");
+        return false;
+    }
+
+    if (slotEnd <= *slotStart) {
+        problem(rec.line, "Stop is not after start");
+        return false;
+    }
+    *slotStop = slotEnd - 1;
+
+    if (rec.name.empty()) {
+        problem(rec.line, "No name");
+        return false;
+    }
+
+    std::string attrText = trim(rec.attr);
+    if (!WsdbTransfer::parseAttr(attrText, attr)) {
+        problem(rec.line, "Bad attr \"" + attrText + "\"");
+        return false;
+    }
+
+    return true;
+}
+
+// Export ////
+
+static void writeTime(std::ostream &out, int64_t slot) {
+    int64_t year, month, day, minute;
+    char text[64]; // Room for five full ints, so the compiler sees it cannot truncate
+
+    Wsdb::dateOfSlot(slot, &year, &month, &day, &minute);
+    snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d", static_cast<int> (year), static_cast<int> (month),
+             static_cast<int> (day), static_cast<int> (minute / 60), static_cast<int> (minute % 60));
+    out << text;
+}
+
+static void writeCsvField(std::ostream &out, const std::string &text) {
+    if (text.find_first_of(",\"\r\n") == std::string::npos && trim(text) == text) {
+        out << text;
+        return;
+    }
+
+    out << '"';
+    for (auto c : text) {
+        if (c == '"')
+            out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+static void writeJsonString(std::ostream &out, const std::string &text) {
+    out << '"';
+    for (auto c : text) {
+        unsigned char uc = static_cast<unsigned char> (c);
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (uc < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", uc);
+            out << esc;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// Joins the slots selectNames returns into runs, one open run per workstation
+class Exporter : public WsdbCallback {
+public:
+    Exporter(std::ostream &out, WsdbTransfer::Format format, const std::vector<int64_t> &stations) :
+        out(out), format(format), records(0), stations(stations.begin(), stations.end()) {}
+
+    virtual void callback(int64_t slot, int64_t station, const char *name, int64_t attr);
+    void begin();
+    void end();
+
+    int64_t getRecords() {return records;}
+
+private:
+    class Run {
+    public:
+        Run(int64_t slotStart, const char *name, int64_t attr) :
+            slotStart(slotStart), slotStop(slotStart), name(name), attr(attr) {}
+
+        int64_t slotStart;
+        int64_t slotStop;
+        std::string name;
+        int64_t attr;
+    };
+
+    void write(int64_t station, const Run &run);
+
+    std::ostream &out;
+    WsdbTransfer::Format format;
+    int64_t records;
+    std::unordered_set<int64_t> stations; // All if empty
+    std::unordered_map<int64_t, Run> runs;
+};
+
+void Exporter::callback(int64_t slot, int64_t station, const char *name, int64_t attr) {
+    if (!stations.empty() && stations.count(station) == 0)
+        return;
+
+    auto it = runs.find(station);
+    if (it == runs.end()) {
+        runs.insert(std::make_pair(station, Run(slot, name, attr)));
+        return;
+    }
+
+    Run &run = it->second;
+    if (run.slotStop + 1 == slot && run.attr == attr && run.name == name) {
+        run.slotStop = slot;
+        return;
+    }
+
+    write(station, run);
+    run = Run(slot, name, attr);
+}
+
+void Exporter::begin() {
+    if (format == WsdbTransfer::FormatCsv)
+        out << "workstation,start,stop,name,attr\n";
+    else
+        out << "[";
+}
+
+void Exporter::end() {
+    // The runs still open, oldest first
+    std::vector<std::pair<int64_t, Run>> rest(runs.begin(), runs.end());
+    std::sort(rest.begin(), rest.end(), [](const std::pair<int64_t, Run> &a, const std::pair<int64_t, Run> &b) {
+        return a.second.slotStart != b.second.slotStart ? a.second.slotStart < b.second.slotStart : a.first < b.first;
+    });
+
+    for (auto &run : rest)
+        write(run.first, run.second);
+    runs.clear();
+
+    if (format == WsdbTransfer::FormatJson)
+        out << (records > 0 ? "\n]\n" : "]\n");
+}
+
+void Exporter::write(int64_t station, const Run &run) {
+    if (format == WsdbTransfer::FormatCsv) {
+        out << station + 1 << ',';
+        writeTime(out, run.slotStart);
+        out << ',';
+        writeTime(out, run.slotStop + 1);
+        out << ',';
+        writeCsvField(out, run.name);
+        out << ',' << run.attr << '\n';
+    } else {
+        out << (records > 0 ? ",\n" : "\n") << "{\"workstation\": " << station + 1 << ", \"start\": \"";
+        writeTime(out, run.slotStart);
+        out << "\", \"stop\": \"";
+        writeTime(out, run.slotStop + 1);
+        out << "\", \"name\": ";
+        writeJsonString(out, run.name);
+        out << ", \"attr\": " << run.attr << "}";
+    }
+
+    records++;
+}
+
+// WsdbTransfer ////
+
+WsdbTransfer::ImportResult::ImportResult() :
+    records(0),
+    booked(0),
+    conflicts(0),
+    rejected(0) {
+}
+
+WsdbTransfer::Format WsdbTransfer::formatOf(const std::string &filename) {
+    size_t dot = filename.rfind('.');
+    if (dot != std::string::npos && lower(filename.substr(dot)) == ".json")
+        return FormatJson;
+
+    return FormatCsv;
+}
+
+WsdbTransfer::ImportResult WsdbTransfer::importReservations(std::istream &in, Format format, Wsdb &wsdb) {
+    if (wsdb.getFilename().empty())
+        throw std::runtime_error("No database is open");
+
+    Importer importer(wsdb);
+
+    if (format == FormatJson) {
+        JsonReader reader(in);
+        importer.import(reader);
+    } else {
+        CsvReader reader(in);
+        importer.import(reader);
+    }
+
+    return importer.result;
+}
+
+int64_t WsdbTransfer::exportReservations(std::ostream &out, Format format, Wsdb &wsdb) {
+    int64_t first, last;
+
+    if (!wsdb.getSlotRange(&first, &last)) {
+        first = 0;
+        last = -1;
+    }
+
+    return exportReservations(out, format, wsdb, first, last, std::vector<int64_t>());
+}
+
+int64_t WsdbTransfer::exportReservations(std::ostream &out, Format format, Wsdb &wsdb, int64_t slotStart, int64_t slotStop, const std::vector<int64_t> &stations) {
+    Exporter exporter(out, format, stations);
+
+    if (wsdb.getFilename().empty())
+        throw std::runtime_error("No database is open");
+
+    int64_t stationStart = 0;
+    int64_t stationStop = INT64_MAX;
+    if (!stations.empty()) {
+        stationStart = *std::min_element(stations.begin(), stations.end());
+        stationStop = *std::max_element(stations.begin(), stations.end());
+    }
+
+    exporter.begin();
+    if (slotStart <= slotStop)
+        wsdb.selectNames(slotStart, slotStop, stationStart, stationStop, exporter);
+    exporter.end();
+
+    out.flush();
+    if (!out)
+        throw std::runtime_error("Could not write the export");
+
+    return exporter.getRecords();
+}
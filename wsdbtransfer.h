@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef WSDBTRANSFER_H
+#define WSDBTRANSFER_H
+
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "wsdb.h"
+
+// Streams reservations between a database and CSV or JSON files without holding the file in memory.
+// A record is one run of slots: workstation (number from 1, or name), start and stop as local time
+// "yyyy-mm-dd hh:mm" on the half hour with stop exclusive, name and an optional attr.
+// CSV has a header row naming the columns, JSON is an array of flat objects.
+class WsdbTransfer {
+public:
+    enum Format {FormatCsv, FormatJson};
+    static Format formatOf(const std::string &filename); // JSON for .json, CSV otherwise
+
+    class Problem {
+    public:
+        Problem(int64_t line, const std::string &message) :
+            line(line), message(message) {}
+
+        int64_t line;
+        std::string message;
+    };
+
+    class ImportResult {
+    public:
+        ImportResult();
+
+        int64_t records;   // Records read
+        int64_t booked;    // Slots booked
+        int64_t conflicts; // Records that hit slots already booked or archived, those slots are left as they were
+        int64_t rejected;  // Records that could not be read, nothing booked
+        std::vector<Problem> problems; // The first maxProblems conflicts and rejections
+    };
+
+    static const size_t maxProblems;
+    static const int64_t batchSlots;  // Slots booked per transaction
+    static const int64_t defaultAttr; // Black on white
+
+    // The field formats of the records, false if the text does not fit
+    static bool parseTime(const std::string &text, int64_t *slot); // A date alone is midnight
+    static bool parseAttr(const std::string &text, int64_t *attr); // Decimal or 0x hex, empty for defaultAttr
+
+    // Throws std::runtime_error on database and syntax errors, batches committed before then stay
+    static ImportResult importReservations(std::istream &in, Format format, Wsdb &wsdb);
+    // Returns the number of records written, throws std::runtime_error if the stream fails
+    static int64_t exportReservations(std::ostream &out, Format format, Wsdb &wsdb);
+    // Only the given stations within slotStart..slotStop, runs are cut at the ends
+    static int64_t exportReservations(std::ostream &out, Format format, Wsdb &wsdb, int64_t slotStart, int64_t slotStop, const std::vector<int64_t> &stations);
+};
+
+#endif // WSDBTRANSFER_H
@@ -0,0 +1,589 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "wssnapshot.h"
+
+const int64_t WsSnapshot::format = 1;
+const int64_t WsSnapshot::days = 14; // The current and next week
+
+static const int64_t slotsPerDay = 48;
+static const char magic[8] = {'W', 'S', 'S', 'N', 'A', 'P', 0, 0};
+
+// Header fields, in int64 units
+enum {HeaderMagic, HeaderFormat, HeaderVersion, HeaderSlotStart, HeaderSlots, HeaderStations, HeaderYellow,
+      HeaderRed, HeaderEntries, HeaderStringsSize, HeaderPublishedAt, HeaderFileSize, HeaderFields};
+
+static const size_t headerSize = HeaderFields * sizeof(int64_t);
+static const size_t stationSize = 16;
+static const size_t entrySize = 16;
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+// Every replacement gets a new inode or write time, the size catches the rest
+static int64_t mixStamp(uint64_t id, uint64_t size, uint64_t time) {
+    uint64_t stamp = time * 0x9E3779B97F4A7C15ull ^ id * 0xC2B2AE3D27D4EB4Full ^ size;
+
+    return static_cast<int64_t>(stamp & INT64_MAX);
+}
+
+#ifdef _WIN32
+static std::wstring widen(const std::string &text) {
+    int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, nullptr, 0);
+    if (len <= 0)
+        return std::wstring();
+
+    std::vector<wchar_t> wide(static_cast<size_t>(len));
+    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, wide.data(), len);
+
+    return std::wstring(wide.data());
+}
+
+static uint64_t fileTime(const FILETIME &time) {
+    return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+}
+#else
+static int64_t statStamp(const struct stat &st) {
+    uint64_t time = static_cast<uint64_t>(st.st_mtime) * 1000000000ull;
+#ifdef __linux__
+    time += static_cast<uint64_t>(st.st_mtim.tv_nsec);
+#endif
+
+    return mixStamp(static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_size), time);
+}
+#endif
+
+// Collects what selectNames reports into cells, naming each distinct name and attribute once
+class SnapshotCells : public WsdbCallback {
+public:
+    SnapshotCells(int64_t slotStart, int64_t slots) :
+        slotStart(slotStart), slots(slots), stations(0) {}
+
+    void setStations(int64_t num);
+    virtual void callback(int64_t slot, int64_t station, const char *name, int64_t attr);
+    uint32_t intern(const char *text);
+
+    int64_t slotStart;
+    int64_t slots;
+    int64_t stations;
+    std::vector<uint32_t> cells;
+    std::vector<std::pair<int64_t, uint32_t> > entries; // attr and name offset
+    std::string strings;
+
+private:
+    std::unordered_map<std::string, uint32_t> stringOffsets;
+    std::map<std::pair<int64_t, uint32_t>, uint32_t> entryIndex;
+};
+
+void SnapshotCells::setStations(int64_t num) {
+    stations = num;
+    cells.assign(static_cast<size_t>(slots * stations), 0);
+}
+
+void SnapshotCells::callback(int64_t slot, int64_t station, const char *name, int64_t attr) {
+    if (slot < slotStart || slot >= slotStart + slots || station < 0 || station >= stations)
+        return;
+
+    std::pair<int64_t, uint32_t> entry(attr, intern(name));
+    auto found = entryIndex.find(entry);
+    uint32_t index;
+
+    if (found == entryIndex.end()) {
+        entries.push_back(entry);
+        index = static_cast<uint32_t>(entries.size());
+        entryIndex[entry] = index;
+    } else {
+        index = found->second;
+    }
+
+    cells[static_cast<size_t>((slot - slotStart) * stations + station)] = index;
+}
+
+uint32_t SnapshotCells::intern(const char *text) {
+    std::string key(text);
+    auto found = stringOffsets.find(key);
+    if (found != stringOffsets.end())
+        return found->second;
+
+    if (strings.size() + key.size() + 1 > UINT32_MAX)
+        throw std::runtime_error("Too many names for a snapshot");
+
+    uint32_t offset = static_cast<uint32_t>(strings.size());
+    strings.append(key.c_str(), key.size() + 1);
+    stringOffsets[key] = offset;
+
+    return offset;
+}
+
+static void putBytes(std::string *image, size_t offset, const void *bytes, size_t len) {
+    memcpy(&(*image)[offset], bytes, len);
+}
+
+static void putInt64(std::string *image, size_t offset, int64_t value) {
+    putBytes(image, offset, &value, sizeof(value));
+}
+
+static void putUint32(std::string *image, size_t offset, uint32_t value) {
+    putBytes(image, offset, &value, sizeof(value));
+}
+
+WsSnapshot::WsSnapshot() :
+    data(nullptr), size(0), mapping(0), stamp(-1), stationsOffset(0), countsOffset(0), entriesOffset(0), cellsOffset(0), stringsOffset(0) {
+}
+
+WsSnapshot::~WsSnapshot() {
+    close();
+}
+
+std::string WsSnapshot::filenameFor(const std::string &dbFilename) {
+    // schedule.db becomes schedule.snapshot
+    size_t dir = dbFilename.find_last_of("/\\");
+    size_t base = dir == std::string::npos ? 0 : dir + 1;
+    size_t ext = dbFilename.rfind('.');
+    if (ext == std::string::npos || ext <= base)
+        return dbFilename + ".snapshot";
+
+    return dbFilename.substr(0, ext) + ".snapshot";
+}
+
+int64_t WsSnapshot::weekStart(int64_t slot) {
+    // Slot 0 is Saturday 2000-01-01
+    int64_t day = slot >= 0 ? slot / slotsPerDay : -((-slot + slotsPerDay - 1) / slotsPerDay);
+    int64_t weekday = ((day + 6) % 7 + 7) % 7;
+
+    return (day - weekday) * slotsPerDay;
+}
+
+std::string WsSnapshot::build(Wsdb &wsdb, int64_t slotStart) {
+    int64_t slots = days * slotsPerDay;
+    int64_t version;
+    Wsdb::Limits limits;
+    std::vector<Wsdb::StationInfo> info;
+    std::vector<int64_t> counts;
+    SnapshotCells cells(slotStart, slots);
+
+    // One read transaction, so the version matches the cells
+    wsdb.beginRead();
+    try {
+        version = wsdb.getChangeVersion();
+        limits = wsdb.getLimits();
+        wsdb.getStationInfo(&info);
+        wsdb.getSlotCounts(slotStart, slotStart + slots - 1, &counts);
+        cells.setStations(static_cast<int64_t>(info.size()));
+        if (!info.empty())
+            wsdb.selectNames(slotStart, slotStart + slots - 1, 0, cells.stations - 1, cells);
+        wsdb.commit();
+    } catch (std::exception &) {
+        wsdb.rollback();
+        throw;
+    }
+
+    if (wsdb.isCancelled())
+        return std::string();
+
+    std::vector<std::pair<uint32_t, uint32_t> > stationStrings;
+    for (auto &station : info)
+        stationStrings.push_back(std::make_pair(cells.intern(station.name.c_str()), cells.intern(station.desc.c_str())));
+
+    size_t stationsAt = headerSize;
+    size_t countsAt = static_cast<size_t>(align8(stationsAt + info.size() * stationSize));
+    size_t entriesAt = static_cast<size_t>(align8(countsAt + static_cast<size_t>(slots) * sizeof(int32_t)));
+    size_t cellsAt = static_cast<size_t>(align8(entriesAt + cells.entries.size() * entrySize));
+    size_t stringsAt = static_cast<size_t>(align8(cellsAt + cells.cells.size() * sizeof(uint32_t)));
+    size_t fileSize = stringsAt + cells.strings.size();
+    std::string image(fileSize, '\0');
+
+    putBytes(&image, 0, magic, sizeof(magic));
+    putInt64(&image, HeaderFormat * sizeof(int64_t), format);
+    putInt64(&image, HeaderVersion * sizeof(int64_t), version);
+    putInt64(&image, HeaderSlotStart * sizeof(int64_t), slotStart);
+    putInt64(&image, HeaderSlots * sizeof(int64_t), slots);
+    putInt64(&image, HeaderStations * sizeof(int64_t), cells.stations);
+    putInt64(&image, HeaderYellow * sizeof(int64_t), limits.yellow);
+    putInt64(&image, HeaderRed * sizeof(int64_t), limits.red);
+    putInt64(&image, HeaderEntries * sizeof(int64_t), static_cast<int64_t>(cells.entries.size()));
+    putInt64(&image, HeaderStringsSize * sizeof(int64_t), static_cast<int64_t>(cells.strings.size()));
+    putInt64(&image, HeaderPublishedAt * sizeof(int64_t), static_cast<int64_t>(time(nullptr)));
+    putInt64(&image, HeaderFileSize * sizeof(int64_t), static_cast<int64_t>(fileSize));
+
+    for (size_t station = 0; station < info.size(); station++) {
+        putInt64(&image, stationsAt + station * stationSize, info[station].flags);
+        putUint32(&image, stationsAt + station * stationSize + 8, stationStrings[station].first);
+        putUint32(&image, stationsAt + station * stationSize + 12, stationStrings[station].second);
+    }
+
+    for (size_t slot = 0; slot < static_cast<size_t>(slots); slot++) {
+        int32_t count = slot < counts.size() ? static_cast<int32_t>(counts[slot]) : 0;
+        putBytes(&image, countsAt + slot * sizeof(int32_t), &count, sizeof(count));
+    }
+
+    for (size_t entry = 0; entry < cells.entries.size(); entry++) {
+        putInt64(&image, entriesAt + entry * entrySize, cells.entries[entry].first);
+        putUint32(&image, entriesAt + entry * entrySize + 8, cells.entries[entry].second);
+    }
+
+    if (!cells.cells.empty())
+        putBytes(&image, cellsAt, cells.cells.data(), cells.cells.size() * sizeof(uint32_t));
+    if (!cells.strings.empty())
+        putBytes(&image, stringsAt, cells.strings.data(), cells.strings.size());
+
+    return image;
+}
+
+void WsSnapshot::write(const std::string &filename, const std::string &image) {
+    // Clients may publish at the same time, each writes its own file and the last rename wins
+    std::random_device seed;
+    std::string temp = filename + "." + std::to_string(seed()) + ".tmp";
+
+#ifdef _WIN32
+    FILE *file = _wfopen(widen(temp).c_str(), L"wb");
+#else
+    FILE *file = fopen(temp.c_str(), "wb");
+#endif
+    if (file == nullptr)
+        throw std::runtime_error("Could not write " + temp + ": " + strerror(errno));
+
+    bool isWritten = fwrite(image.data(), 1, image.size(), file) == image.size();
+    isWritten = fclose(file) == 0 && isWritten;
+
+#ifdef _WIN32
+    if (isWritten && MoveFileExW(widen(temp).c_str(), widen(filename).c_str(), MOVEFILE_REPLACE_EXISTING))
+        return;
+    _wremove(widen(temp).c_str());
+#else
+    if (isWritten && rename(temp.c_str(), filename.c_str()) == 0)
+        return;
+    remove(temp.c_str());
+#endif
+
+    throw std::runtime_error("Could not write " + filename);
+}
+
+int64_t WsSnapshot::fileStamp(const std::string &filename) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(widen(filename).c_str(), GetFileExInfoStandard, &attr))
+        return -1;
+
+    return mixStamp(0, (static_cast<uint64_t>(attr.nFileSizeHigh) << 32) | attr.nFileSizeLow, fileTime(attr.ftLastWriteTime));
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return -1;
+
+    return statStamp(st);
+#endif
+}
+
+bool WsSnapshot::open(const std::string &filename) {
+    close();
+
+#ifdef _WIN32
+    // Shared for deleting, so publishers can still replace the file
+    HANDLE file = CreateFileW(widen(filename).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    BY_HANDLE_FILE_INFORMATION fileInfo;
+    if (!GetFileInformationByHandle(file, &fileInfo)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    uint64_t fileSize = (static_cast<uint64_t>(fileInfo.nFileSizeHigh) << 32) | fileInfo.nFileSizeLow;
+    stamp = mixStamp(0, fileSize, fileTime(fileInfo.ftLastWriteTime));
+
+    HANDLE map = fileSize >= headerSize ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    CloseHandle(file);
+    if (map == nullptr)
+        return false;
+
+    data = static_cast<const char *>(MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr) {
+        CloseHandle(map);
+        return false;
+    }
+    mapping = reinterpret_cast<intptr_t>(map);
+    size = static_cast<size_t>(fileSize);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(headerSize)) {
+        ::close(fd);
+        return false;
+    }
+    stamp = statStamp(st);
+
+    void *map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    data = static_cast<const char *>(map);
+    size = static_cast<size_t>(st.st_size);
+#endif
+
+    // Check every bound once, the getters trust them afterwards
+    int64_t slots = header(HeaderSlots);
+    int64_t stations = header(HeaderStations);
+    int64_t entries = header(HeaderEntries);
+    int64_t stringsSize = header(HeaderStringsSize);
+    const int64_t maxCount = INT64_C(1) << 24;
+
+    if (memcmp(data, magic, sizeof(magic)) != 0 || header(HeaderFormat) != format || header(HeaderFileSize) != static_cast<int64_t>(size) ||
+        slots < 0 || slots > maxCount || stations < 0 || stations > maxCount || entries < 0 || entries > slots * stations ||
+        stringsSize < 0 || stringsSize > static_cast<int64_t>(size)) {
+        close();
+        return false;
+    }
+
+    uint64_t counts = align8(headerSize + static_cast<uint64_t>(stations) * stationSize);
+    uint64_t entryTable = align8(counts + static_cast<uint64_t>(slots) * sizeof(int32_t));
+    uint64_t cells = align8(entryTable + static_cast<uint64_t>(entries) * entrySize);
+    uint64_t strings = align8(cells + static_cast<uint64_t>(slots * stations) * sizeof(uint32_t));
+
+    if (strings + static_cast<uint64_t>(stringsSize) != size || (stringsSize > 0 && data[size - 1] != '\0')) {
+        close();
+        return false;
+    }
+
+    stationsOffset = headerSize;
+    countsOffset = static_cast<size_t>(counts);
+    entriesOffset = static_cast<size_t>(entryTable);
+    cellsOffset = static_cast<size_t>(cells);
+    stringsOffset = static_cast<size_t>(strings);
+
+    return true;
+}
+
+void WsSnapshot::close() {
+    if (data == nullptr)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(reinterpret_cast<HANDLE>(mapping));
+    mapping = 0;
+#else
+    munmap(const_cast<char *>(data), size);
+#endif
+
+    data = nullptr;
+    size = 0;
+    stamp = -1;
+}
+
+bool WsSnapshot::isOpen() {
+    return data != nullptr;
+}
+
+int64_t WsSnapshot::getChangeVersion() {
+    return isOpen() ? header(HeaderVersion) : -1;
+}
+
+int64_t WsSnapshot::getSlotStart() {
+    return isOpen() ? header(HeaderSlotStart) : 0;
+}
+
+int64_t WsSnapshot::getSlotStop() {
+    return isOpen() ? header(HeaderSlotStart) + header(HeaderSlots) - 1 : -1;
+}
+
+int64_t WsSnapshot::getPublishedAt() {
+    return isOpen() ? header(HeaderPublishedAt) : 0;
+}
+
+int64_t WsSnapshot::getStamp() {
+    return stamp;
+}
+
+Wsdb::Limits WsSnapshot::getLimits() {
+    if (!isOpen())
+        return Wsdb::Limits();
+
+    return Wsdb::Limits(header(HeaderYellow), header(HeaderRed));
+}
+
+void WsSnapshot::getStationInfo(std::vector<Wsdb::StationInfo> *infoOut) {
+    infoOut->clear();
+    if (!isOpen())
+        return;
+
+    size_t stations = static_cast<size_t>(header(HeaderStations));
+    for (size_t station = 0; station < stations; station++) {
+        const char *at = data + stationsOffset + station * stationSize;
+        int64_t flags;
+        uint32_t name;
+        uint32_t desc;
+
+        memcpy(&flags, at, sizeof(flags));
+        memcpy(&name, at + 8, sizeof(name));
+        memcpy(&desc, at + 12, sizeof(desc));
+        infoOut->push_back(Wsdb::StationInfo(text(name), text(desc), flags));
+    }
+}
+
+void WsSnapshot::getSlotCounts(int64_t slotStart, int64_t slotStop, std::vector<int64_t> *countsOut) {
+    countsOut->clear();
+    if (slotStop < slotStart)
+        return;
+
+    countsOut->resize(static_cast<size_t>(slotStop - slotStart + 1), 0);
+    if (!isOpen())
+        return;
+
+    int64_t first = std::max(slotStart, getSlotStart());
+    int64_t last = std::min(slotStop, getSlotStop());
+    for (int64_t slot = first; slot <= last; slot++) {
+        int32_t count;
+
+        memcpy(&count, data + countsOffset + static_cast<size_t>(slot - getSlotStart()) * sizeof(int32_t), sizeof(count));
+        (*countsOut)[static_cast<size_t>(slot - slotStart)] = count;
+    }
+}
+
+void WsSnapshot::selectNames(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback) {
+    if (!isOpen())
+        return;
+
+    int64_t stations = header(HeaderStations);
+    size_t entries = static_cast<size_t>(header(HeaderEntries));
+    int64_t first = std::max(slotStart, getSlotStart());
+    int64_t last = std::min(slotStop, getSlotStop());
+    stationStart = std::max(stationStart, INT64_C(0));
+    stationStop = std::min(stationStop, stations - 1);
+
+    for (int64_t slot = first; slot <= last; slot++) {
+        const char *row = data + cellsOffset + static_cast<size_t>((slot - getSlotStart()) * stations) * sizeof(uint32_t);
+
+        for (int64_t station = stationStart; station <= stationStop; station++) {
+            uint32_t index;
+
+            memcpy(&index, row + static_cast<size_t>(station) * sizeof(uint32_t), sizeof(index));
+            if (index == 0 || index > entries)
+                continue;
+
+            const char *entry = data + entriesOffset + (index - 1) * entrySize;
+            int64_t attr;
+            uint32_t name;
+
+            memcpy(&attr, entry, sizeof(attr));
+            memcpy(&name, entry + 8, sizeof(name));
+            callback.callback(slot, station, text(name), attr);
+        }
+    }
+}
+
+int64_t WsSnapshot::header(size_t field) {
+    int64_t value;
+
+    memcpy(&value, data + field * sizeof(int64_t), sizeof(value));
+    return value;
+}
+
+const char *WsSnapshot::text(uint32_t offset) {
+    // The strings end with a null, checked by open
+    if (offset >= size - stringsOffset)
+        return "";
+
+    return data + stringsOffset + offset;
+}
+
+// WsSnapshotPublisher ///////////////////////////////////////////////////////
+
+WsSnapshotPublisher::WsSnapshotPublisher() :
+    generation(-1), version(-1), slotStart(0) {
+}
+
+bool WsSnapshotPublisher::update(Wsdb &wsdb) {
+    std::string dbFilename = wsdb.getFilename();
+    int64_t currentGeneration = wsdb.getGeneration();
+    int64_t currentVersion = wsdb.getChangeVersion();
+    int64_t currentStart = WsSnapshot::weekStart(Wsdb::todaySlot());
+
+    if (dbFilename.empty() || currentVersion < 0)
+        return false;
+    if (currentGeneration == generation && currentVersion == version && currentStart == slotStart)
+        return false;
+
+    // Turning publishing on bumps the version as well, so this is read once per change
+    if (!wsdb.getPublishSnapshot()) {
+        generation = currentGeneration;
+        version = currentVersion;
+        slotStart = currentStart;
+        return false;
+    }
+
+    std::string filename = WsSnapshot::filenameFor(dbFilename);
+    try {
+        {
+            WsSnapshot current;
+
+            if (current.open(filename) && current.getChangeVersion() == currentVersion && current.getSlotStart() == currentStart) {
+                generation = currentGeneration;
+                version = currentVersion;
+                slotStart = currentStart;
+                return false;
+            }
+        }
+
+        std::string image = WsSnapshot::build(wsdb, currentStart);
+        if (image.empty())
+            return false;
+
+        WsSnapshot::write(filename, image);
+    } catch (std::exception &) {
+        // Retried on the next call, the displays keep the previous file meanwhile
+        return false;
+    }
+
+    generation = currentGeneration;
+    version = currentVersion;
+    slotStart = currentStart;
+
+    return true;
+}
@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef WSSNAPSHOT_H
+#define WSSNAPSHOT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "wsdb.h"
+
+// The current and next week of a database as one read-only file for displays, which map it
+// instead of opening the database. schedule.db publishes schedule.snapshot next to it.
+//
+// Layout in host byte order, every section starts 8 byte aligned:
+//   Header    "WSSNAP\0\0", then int64 format, changeVersion, slotStart, slots, stations, yellow,
+//             red, entries, stringsSize, publishedAt (s since the Unix epoch) and fileSize
+//   Stations  per station int64 flags, uint32 name and desc offsets into the strings
+//   Counts    int32 booked stations per slot, as in slot_counts
+//   Entries   per distinct name and attribute int64 attr, uint32 name offset, uint32 unused
+//   Cells     uint32 per slot and station, slot major, 0 if free or else the entry index + 1
+//   Strings   UTF-8, each terminated by a null
+//
+// Publishers write a new file and rename it over the old one, a reader keeps the file it opened.
+class WsSnapshot {
+public:
+    static const int64_t format;
+    static const int64_t days;
+
+    WsSnapshot();
+    ~WsSnapshot();
+
+    static std::string filenameFor(const std::string &dbFilename);
+    static int64_t weekStart(int64_t slot); // First slot of the Sunday on or before slot
+    // The file for the days from slotStart, in one read transaction. Throws std::runtime_error,
+    // returns an empty string if wsdb was cancelled meanwhile.
+    static std::string build(Wsdb &wsdb, int64_t slotStart);
+    static void write(const std::string &filename, const std::string &image); // Throws std::runtime_error
+    // Without opening the file, changes whenever it is replaced. -1 if it does not exist.
+    static int64_t fileStamp(const std::string &filename);
+
+    // false if the file is missing or not a snapshot, the previous one is closed either way
+    bool open(const std::string &filename);
+    void close();
+    bool isOpen();
+
+    int64_t getChangeVersion();
+    int64_t getSlotStart();
+    int64_t getSlotStop();
+    int64_t getPublishedAt();
+    int64_t getStamp(); // fileStamp when it was opened
+    Wsdb::Limits getLimits();
+    void getStationInfo(std::vector<Wsdb::StationInfo> *infoOut);
+    // The parts outside the published weeks are left out, as if free
+    void getSlotCounts(int64_t slotStart, int64_t slotStop, std::vector<int64_t> *countsOut);
+    void selectNames(int64_t slotStart, int64_t slotStop, int64_t stationStart, int64_t stationStop, WsdbCallback &callback);
+
+private:
+    WsSnapshot(const WsSnapshot &) = delete;
+    WsSnapshot &operator=(const WsSnapshot &) = delete;
+
+    int64_t header(size_t field);
+    const char *text(uint32_t offset);
+
+    const char *data;
+    size_t size;
+    intptr_t mapping; // Windows only
+    int64_t stamp;
+    size_t stationsOffset;
+    size_t countsOffset;
+    size_t entriesOffset;
+    size_t cellsOffset;
+    size_t stringsOffset;
+};
+
+// Keeps the snapshot of one database current, for the connection that writes it.
+// Publishing is on once the publishSnapshot parameter is set, see Wsdb::setPublishSnapshot.
+class WsSnapshotPublisher {
+public:
+    WsSnapshotPublisher();
+
+    // Publishes if the database or the week changed since the file was written, true if it did.
+    // Every client may publish, the first one to notice a change does. Errors are retried on the next call.
+    bool update(Wsdb &wsdb);
+
+private:
+    int64_t generation; // What the file is known to hold
+    int64_t version;
+    int64_t slotStart;
+};
+
+#endif // WSSNAPSHOT_H
@@ -0,0 +1,261 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef int socklen_t;
+#define closeHandle closesocket
+#define SHUT_RDWR SD_BOTH
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define closeHandle close
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#include "wssocket.h"
+#include "wswire.h"
+
+static const intptr_t invalidHandle = -1;
+
+static std::string socketError(const std::string &what) {
+#ifdef _WIN32
+    return what + ": error " + std::to_string(WSAGetLastError());
+#else
+    return what + ": " + strerror(errno);
+#endif
+}
+
+static void startup() {
+#ifdef _WIN32
+    static std::once_flag once;
+    std::call_once(once, [] {
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data);
+    });
+#endif
+}
+
+static struct addrinfo *resolve(const std::string &host, int port, bool isPassive) {
+    struct addrinfo hints;
+    struct addrinfo *result = nullptr;
+
+    startup();
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = isPassive ? AI_PASSIVE : 0;
+
+    int err = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result);
+    if (err != 0 || result == nullptr)
+        throw std::runtime_error("Could not resolve " + host + ": " + gai_strerror(err));
+
+    return result;
+}
+
+WsSocket::WsSocket(intptr_t handle) : handle(handle) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(static_cast<int>(handle), SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+WsSocket::~WsSocket() {
+    if (handle != invalidHandle)
+        closeHandle(handle);
+}
+
+void WsSocket::parseAddress(const std::string &address, std::string *host, int *port) {
+    size_t colon = address.rfind(':');
+    std::string portText = colon == std::string::npos ? address : address.substr(colon + 1);
+
+    *host = colon == std::string::npos ? std::string() : address.substr(0, colon);
+    if (host->empty() && colon == std::string::npos && portText.find_first_not_of("0123456789") != std::string::npos) {
+        *host = address;
+        portText.clear();
+    }
+    if (host->empty())
+        *host = "127.0.0.1";
+
+    *port = WsWire::defaultPort;
+    if (portText.empty())
+        return;
+
+    if (portText.size() > 5 || portText.find_first_not_of("0123456789") != std::string::npos || std::stoi(portText) < 1 || std::stoi(portText) > 65535)
+        throw std::runtime_error("Bad broker port in " + address);
+    *port = std::stoi(portText);
+}
+
+std::unique_ptr<WsSocket> WsSocket::connectTo(const std::string &host, int port) {
+    struct addrinfo *addrs = resolve(host, port, false);
+    std::string error = "Could not connect to " + host + ":" + std::to_string(port);
+
+    for (struct addrinfo *addr = addrs; addr; addr = addr->ai_next) {
+        intptr_t fd = static_cast<intptr_t>(socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol));
+        if (fd == invalidHandle)
+            continue;
+
+        if (connect(fd, addr->ai_addr, static_cast<socklen_t>(addr->ai_addrlen)) == 0) {
+            freeaddrinfo(addrs);
+
+            // Requests are small and answered one by one, do not hold them back
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&on), sizeof(on));
+
+            return std::unique_ptr<WsSocket>(new WsSocket(fd));
+        }
+
+        error = socketError(error);
+        closeHandle(fd);
+    }
+
+    freeaddrinfo(addrs);
+    throw std::runtime_error(error);
+}
+
+std::unique_ptr<WsSocket> WsSocket::listenOn(const std::string &host, int port) {
+    struct addrinfo *addrs = resolve(host, port, true);
+    std::string error = "Could not listen on " + host + ":" + std::to_string(port);
+
+    for (struct addrinfo *addr = addrs; addr; addr = addr->ai_next) {
+        intptr_t fd = static_cast<intptr_t>(socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol));
+        if (fd == invalidHandle)
+            continue;
+
+#ifndef _WIN32
+        // A restarted broker must not wait for connections of the last one to time out
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#endif
+
+        if (bind(fd, addr->ai_addr, static_cast<socklen_t>(addr->ai_addrlen)) == 0 && listen(fd, 16) == 0) {
+            freeaddrinfo(addrs);
+            return std::unique_ptr<WsSocket>(new WsSocket(fd));
+        }
+
+        error = socketError(error);
+        closeHandle(fd);
+    }
+
+    freeaddrinfo(addrs);
+    throw std::runtime_error(error);
+}
+
+std::unique_ptr<WsSocket> WsSocket::accept() {
+    for (;;) {
+        intptr_t fd = static_cast<intptr_t>(::accept(handle, nullptr, nullptr));
+        if (fd != invalidHandle) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&on), sizeof(on));
+
+            return std::unique_ptr<WsSocket>(new WsSocket(fd));
+        }
+
+#ifndef _WIN32
+        if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+#endif
+        return nullptr;
+    }
+}
+
+void WsSocket::sendFrame(const std::string &payload) {
+    if (payload.size() > WsWire::maxFrame)
+        throw std::runtime_error("Broker message too large");
+
+    // One buffer, so the header never goes out in a packet of its own
+    std::string frame(4, '\0');
+    for (int byte = 0; byte < 4; byte++)
+        frame[byte] = static_cast<char>((payload.size() >> (8 * byte)) & 0xFF);
+    frame.append(payload);
+
+    size_t sent = 0;
+    while (sent < frame.size()) {
+        int len = static_cast<int>(std::min<size_t>(frame.size() - sent, 1 << 20));
+        int num = static_cast<int>(send(handle, frame.data() + sent, len, MSG_NOSIGNAL));
+        if (num <= 0) {
+#ifndef _WIN32
+            if (num < 0 && errno == EINTR)
+                continue;
+#endif
+            throw std::runtime_error(socketError("Broker connection lost"));
+        }
+        sent += static_cast<size_t>(num);
+    }
+}
+
+static bool recvAll(intptr_t handle, char *data, size_t size, bool isStart) {
+    size_t got = 0;
+
+    while (got < size) {
+        int len = static_cast<int>(std::min<size_t>(size - got, 1 << 20));
+        int num = static_cast<int>(recv(handle, data + got, len, 0));
+        if (num == 0 && got == 0 && isStart)
+            return false;
+        if (num <= 0) {
+#ifndef _WIN32
+            if (num < 0 && errno == EINTR)
+                continue;
+#endif
+            throw std::runtime_error(num == 0 ? std::string("Broker connection closed") : socketError("Broker connection lost"));
+        }
+        got += static_cast<size_t>(num);
+    }
+
+    return true;
+}
+
+bool WsSocket::recvFrame(std::string *payload) {
+    unsigned char header[4];
+
+    if (!recvAll(handle, reinterpret_cast<char *>(header), sizeof(header), true))
+        return false;
+
+    size_t size = 0;
+    for (int byte = 0; byte < 4; byte++)
+        size |= static_cast<size_t>(header[byte]) << (8 * byte);
+    if (size > WsWire::maxFrame)
+        throw std::runtime_error("Broker message too large");
+
+    payload->resize(size);
+    if (size > 0)
+        recvAll(handle, &(*payload)[0], size, false);
+
+    return true;
+}
+
+void WsSocket::shutdown() {
+    ::shutdown(handle, SHUT_RDWR);
+}
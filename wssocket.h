@@ -0,0 +1,53 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef WSSOCKET_H
+#define WSSOCKET_H
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+// Blocking TCP connection carrying WsWire frames. One thread may send while another receives.
+// Errors throw std::runtime_error.
+class WsSocket {
+public:
+    ~WsSocket();
+
+    // "host:port", "host" or "port", the host defaults to the loopback address
+    static void parseAddress(const std::string &address, std::string *host, int *port);
+    static std::unique_ptr<WsSocket> connectTo(const std::string &host, int port);
+    static std::unique_ptr<WsSocket> listenOn(const std::string &host, int port);
+
+    std::unique_ptr<WsSocket> accept(); // nullptr once shut down
+    void sendFrame(const std::string &payload);
+    bool recvFrame(std::string *payload); // false when the peer closed the connection
+    // Makes blocked and later calls on either side fail, safe from any thread
+    void shutdown();
+
+private:
+    WsSocket(intptr_t handle);
+
+    intptr_t handle;
+};
+
+#endif // WSSOCKET_H
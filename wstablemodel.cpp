@@ -0,0 +1,306 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "wstablemodel.h"
+
+static const int64_t countAttrs[3] = {
+    0xFFFFFF404040, // light gray text on white background
+    0xFFFF80000000, // black text on pale yellow background
+    0xC00000FFFFFF  // white text on dark red background
+};
+
+WsTableModel::Style::Style(int64_t attr) : attr(attr) {
+    uint64_t uattr = static_cast<uint64_t> (attr);
+
+    foreground = QBrush(static_cast<QRgb> ((uattr & 0xFFFFFF) | 0xFF000000));
+    background = QBrush(static_cast<QRgb> (((uattr >> 24) & 0xFFFFFF) | 0xFF000000));
+    font.setBold((uattr >> 48) & 1);
+    font.setItalic((uattr >> 49) & 1);
+}
+
+WsTableModel::WsTableModel(int rows, bool hasCountColumn, QObject *parent) :
+    QAbstractTableModel(parent),
+    rows(rows),
+    cols(0),
+    hasCountColumn(hasCountColumn),
+    dirtyTop(-1),
+    dirtyBottom(-1),
+    dirtyLeft(-1),
+    dirtyRight(-1) {
+    // Row labels never change, build them once
+    for (int count = 0; count < rows; count++) {
+        std::stringstream str;
+        str << std::setfill('0') << std::setw(2) << (count >> 1);
+        str << ((count & 1) ? ":30" : ":00");
+
+        rowLabels.append(QString::fromUtf8(str.str().c_str()));
+    }
+
+    booked.assign(static_cast<size_t> (rows), -1);
+    clearCells();
+}
+
+WsTableModel::~WsTableModel() {
+}
+
+int WsTableModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : rows;
+}
+
+int WsTableModel::columnCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : cols;
+}
+
+QVariant WsTableModel::data(const QModelIndex &index, int role) const {
+    int row = index.row();
+    int col = index.column();
+
+    if (!index.isValid() || row < 0 || row >= rows || col < 0 || col >= cols)
+        return QVariant();
+
+    if (hasCountColumn && col == 0) {
+        const Style &style = styles[static_cast<size_t> (countStyle(row))];
+
+        switch (role) {
+        case Qt::DisplayRole:
+            if (booked[static_cast<size_t> (row)] < 0)
+                return QVariant();
+            return QVariant(static_cast<qlonglong> (booked[static_cast<size_t> (row)]));
+        case Qt::TextAlignmentRole:
+            return QVariant(static_cast<int> (Qt::AlignHCenter));
+        case Qt::FontRole:
+            return QVariant(style.font);
+        case Qt::ForegroundRole:
+            return QVariant(style.foreground);
+        case Qt::BackgroundRole:
+            return QVariant(style.background);
+        default:
+            return QVariant();
+        }
+    }
+
+    const Cell &cell = cells[static_cast<size_t> (row) * static_cast<size_t> (cols) + static_cast<size_t> (col)];
+    if (cell.name < 0)
+        return QVariant();
+
+    const Style &style = styles[static_cast<size_t> (cell.style)];
+
+    switch (role) {
+    case Qt::DisplayRole:
+        return QVariant(names[static_cast<size_t> (cell.name)]);
+    case Qt::FontRole:
+        return QVariant(style.font);
+    case Qt::ForegroundRole:
+        return QVariant(style.foreground);
+    case Qt::BackgroundRole:
+        return QVariant(style.background);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant WsTableModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (orientation == Qt::Vertical) {
+        if (role == Qt::DisplayRole && section >= 0 && section < rowLabels.size())
+            return QVariant(rowLabels[section]);
+
+        return QVariant();
+    }
+
+    if (role == Qt::DisplayRole && section >= 0 && section < labels.size())
+        return QVariant(labels[section]);
+
+    if (role == Qt::ToolTipRole && section >= 0 && section < toolTips.size() && !toolTips[section].isEmpty())
+        return QVariant(toolTips[section]);
+
+    return QVariant();
+}
+
+void WsTableModel::setColumns(const QStringList &newLabels, const QStringList &newToolTips) {
+    labels = newLabels;
+    toolTips = newToolTips;
+
+    if (labels.size() == cols) {
+        if (cols > 0)
+            emit headerDataChanged(Qt::Horizontal, 0, cols - 1);
+        return;
+    }
+
+    beginResetModel();
+    cols = labels.size();
+    clearCells();
+    dirtyTop = -1;
+    endResetModel();
+}
+
+void WsTableModel::setLimits(const Wsdb::Limits &newLimits) {
+    limits = newLimits;
+
+    if (hasCountColumn && rows > 0 && cols > 0) {
+        markDirty(0, 0);
+        markDirty(rows - 1, 0);
+    }
+}
+
+void WsTableModel::setCounts(const std::vector<int64_t> &counts) {
+    for (size_t count = 0; count < booked.size(); count++)
+        booked[count] = count < counts.size() ? counts[count] : 0;
+
+    if (hasCountColumn && rows > 0 && cols > 0) {
+        markDirty(0, 0);
+        markDirty(rows - 1, 0);
+    }
+}
+
+void WsTableModel::clearCounts() {
+    booked.assign(static_cast<size_t> (rows), -1);
+
+    if (hasCountColumn && rows > 0 && cols > 0) {
+        markDirty(0, 0);
+        markDirty(rows - 1, 0);
+    }
+}
+
+void WsTableModel::clearCells() {
+    cells.assign(static_cast<size_t> (rows) * static_cast<size_t> (cols), Cell());
+
+    // Start the dictionaries over so a long running session does not accumulate stale names
+    names.clear();
+    nameByText.clear();
+    styles.clear();
+    styleByAttr.clear();
+    for (int count = 0; count < 3; count++)
+        countStyles[count] = styleIndex(countAttrs[count]);
+
+    if (rows > 0 && cols > 0) {
+        markDirty(0, 0);
+        markDirty(rows - 1, cols - 1);
+    }
+}
+
+void WsTableModel::setCell(int row, int col, const char *name, int64_t attr) {
+    if (row < 0 || row >= rows || col < 0 || col >= cols || (hasCountColumn && col == 0))
+        return;
+
+    Cell &cell = cells[static_cast<size_t> (row) * static_cast<size_t> (cols) + static_cast<size_t> (col)];
+    cell.name = nameIndex(name);
+    cell.style = styleIndex(attr);
+    markDirty(row, col);
+}
+
+void WsTableModel::clearCell(int row, int col) {
+    if (row < 0 || row >= rows || col < 0 || col >= cols)
+        return;
+
+    Cell &cell = cells[static_cast<size_t> (row) * static_cast<size_t> (cols) + static_cast<size_t> (col)];
+    if (cell.name < 0)
+        return;
+
+    cell = Cell();
+    markDirty(row, col);
+}
+
+void WsTableModel::flush() {
+    if (dirtyTop < 0)
+        return;
+
+    emit dataChanged(index(dirtyTop, dirtyLeft), index(dirtyBottom, dirtyRight));
+    dirtyTop = -1;
+}
+
+bool WsTableModel::cellAt(int row, int col, QString *name, int64_t *attr) const {
+    if (row < 0 || row >= rows || col < 0 || col >= cols || (hasCountColumn && col == 0))
+        return false;
+
+    const Cell &cell = cells[static_cast<size_t> (row) * static_cast<size_t> (cols) + static_cast<size_t> (col)];
+    if (cell.name < 0)
+        return false;
+
+    *name = names[static_cast<size_t> (cell.name)];
+    *attr = styles[static_cast<size_t> (cell.style)].attr;
+
+    return true;
+}
+
+std::vector<int64_t> WsTableModel::getCounts() const {
+    if (booked.empty() || booked[0] < 0)
+        return std::vector<int64_t>();
+
+    return booked;
+}
+
+int32_t WsTableModel::nameIndex(const char *name) {
+    auto it = nameByText.find(name);
+    if (it != nameByText.end())
+        return it->second;
+
+    int32_t idx = static_cast<int32_t> (names.size());
+    names.push_back(QString::fromUtf8(name));
+    nameByText[name] = idx;
+
+    return idx;
+}
+
+int32_t WsTableModel::styleIndex(int64_t attr) {
+    auto it = styleByAttr.find(attr);
+    if (it != styleByAttr.end())
+        return it->second;
+
+    int32_t idx = static_cast<int32_t> (styles.size());
+    styles.push_back(Style(attr));
+    styleByAttr[attr] = idx;
+
+    return idx;
+}
+
+int32_t WsTableModel::countStyle(int row) const {
+    int64_t num = booked[static_cast<size_t> (row)];
+
+    if (num < 0)
+        return countStyles[0];
+
+    if (num >= limits.red)
+        return countStyles[2];
+
+    if (num >= limits.yellow)
+        return countStyles[1];
+
+    return countStyles[0];
+}
+
+void WsTableModel::markDirty(int row, int col) {
+    if (dirtyTop < 0) {
+        dirtyTop = dirtyBottom = row;
+        dirtyLeft = col;
+        dirtyRight = col;
+        return;
+    }
+
+    dirtyTop    = std::min(dirtyTop, row);
+    dirtyBottom = std::max(dirtyBottom, row);
+    dirtyLeft   = std::min(dirtyLeft, col);
+    dirtyRight  = std::max(dirtyRight, col);
+}
@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef WSTABLEMODEL_H
+#define WSTABLEMODEL_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QAbstractTableModel>
+#include <QBrush>
+#include <QFont>
+#include <QString>
+#include <QStringList>
+
+#include "wsdb.h"
+
+// Reservation grid with one slot per row.  Cells are stored as indexes into
+// per model name and style tables, so a booked cell costs 8 bytes and every
+// distinct attr shares one font and pair of brushes.
+class WsTableModel : public QAbstractTableModel {
+    Q_OBJECT
+
+public:
+    // With a count column, column 0 shows the booked count of each row, as given to setCounts
+    WsTableModel(int rows, bool hasCountColumn, QObject *parent = nullptr);
+    virtual ~WsTableModel();
+
+    virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    virtual int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    virtual QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+
+    // Keeps the cells if the number of columns is unchanged
+    void setColumns(const QStringList &labels, const QStringList &toolTips = QStringList());
+    void setLimits(const Wsdb::Limits &limits);
+    void setCounts(const std::vector<int64_t> &counts); // One per row, missing rows count 0
+    void clearCounts(); // Shows the counts as unknown
+
+    // Cell changes are collected until flush, which emits one dataChanged
+    void clearCells();
+    void setCell(int row, int col, const char *name, int64_t attr);
+    void clearCell(int row, int col);
+    void flush();
+
+    bool cellAt(int row, int col, QString *name, int64_t *attr) const;
+    std::vector<int64_t> getCounts() const; // Empty while they are unknown
+
+private:
+    class Cell {
+    public:
+        Cell() : name(-1), style(-1) {}
+
+        int32_t name; // -1 if not booked
+        int32_t style;
+    };
+
+    class Style {
+    public:
+        Style(int64_t attr);
+
+        int64_t attr;
+        QFont font;
+        QBrush foreground;
+        QBrush background;
+    };
+
+    int32_t nameIndex(const char *name);
+    int32_t styleIndex(int64_t attr);
+    int32_t countStyle(int row) const;
+    void markDirty(int row, int col);
+
+private:
+    int rows;
+    int cols;
+    bool hasCountColumn;
+    std::vector<Cell> cells;
+    std::vector<int64_t> booked; // Per row, -1 if unknown
+    QStringList labels;
+    QStringList toolTips;
+    QStringList rowLabels;
+    Wsdb::Limits limits;
+
+    std::vector<QString> names;
+    std::unordered_map<std::string, int32_t> nameByText;
+    std::vector<Style> styles;
+    std::unordered_map<int64_t, int32_t> styleByAttr;
+    int32_t countStyles[3];
+
+    int dirtyTop;
+    int dirtyBottom;
+    int dirtyLeft;
+    int dirtyRight;
+};
+
+#endif // WSTABLEMODEL_H
@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <ctime>
+#include <stdexcept>
+
+#include <QFile>
+#include <QSaveFile>
+
+#include "wsviewcache.h"
+#include "wswire.h"
+
+const int64_t WsViewCache::format = 1;
+
+WsViewCache::WsViewCache() :
+    savedAt(0), dailySlot(INT64_MIN), weekSlot(INT64_MIN), workstation(-1) {
+}
+
+bool WsViewCache::load(const QString &filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray bytes = file.readAll();
+    std::string payload(bytes.constData(), static_cast<size_t>(bytes.size()));
+
+    try {
+        WireReader in(payload);
+
+        if (in.getInt() != format)
+            return false;
+
+        source = in.getString();
+        savedAt = in.getInt();
+
+        info.clear();
+        size_t stations = in.getCount();
+        for (size_t count = 0; count < stations; count++) {
+            std::string name = in.getString();
+            std::string desc = in.getString();
+            info.push_back(Wsdb::StationInfo(name, desc, in.getInt()));
+        }
+        limits.yellow = in.getInt();
+        limits.red = in.getInt();
+
+        dailySlot = in.getInt();
+        DbSelectNamesCallback::decodeNames(in, &daily);
+        counts.clear();
+        size_t rows = in.getCount();
+        for (size_t count = 0; count < rows; count++)
+            counts.push_back(in.getInt());
+
+        weekSlot = in.getInt();
+        workstation = in.getInt();
+        DbSelectNamesCallback::decodeNames(in, &week);
+    } catch (std::runtime_error &) {
+        return false;
+    }
+
+    return true;
+}
+
+bool WsViewCache::save(const QString &filename) {
+    WireWriter out;
+
+    out.putInt(format);
+    out.putString(source);
+    out.putInt(static_cast<int64_t>(time(nullptr)));
+
+    out.putInt(static_cast<int64_t>(info.size()));
+    for (auto &station : info) {
+        out.putString(station.name);
+        out.putString(station.desc);
+        out.putInt(station.flags);
+    }
+    out.putInt(limits.yellow);
+    out.putInt(limits.red);
+
+    out.putInt(dailySlot);
+    DbSelectNamesCallback::encodeNames(daily, out);
+    out.putInt(static_cast<int64_t>(counts.size()));
+    for (auto count : counts)
+        out.putInt(count);
+
+    out.putInt(weekSlot);
+    out.putInt(workstation);
+    DbSelectNamesCallback::encodeNames(week, out);
+
+    // A start reading it meanwhile sees the old file or the new one, never a mix
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    const std::string &payload = out.data();
+    if (file.write(payload.data(), static_cast<qint64>(payload.size())) != static_cast<qint64>(payload.size())) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
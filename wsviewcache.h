@@ -0,0 +1,58 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef WSVIEWCACHE_H
+#define WSVIEWCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <QString>
+
+#include "dbcommand.h"
+#include "wsdb.h"
+
+// The views shown at the last exit, kept in a local file so the next start can show them before
+// the database answers. Encoded like the broker's messages, see WireWriter.
+class WsViewCache {
+public:
+    static const int64_t format;
+
+    WsViewCache();
+
+    bool load(const QString &filename); // false if missing, damaged or of another format
+    bool save(const QString &filename); // Replaces the file at once, false if it could not
+
+    std::string source;   // Database file or broker the views came from
+    int64_t savedAt;      // s since the Unix epoch
+    std::vector<Wsdb::StationInfo> info;
+    Wsdb::Limits limits;
+    int64_t dailySlot;    // First slot of the daily view, INT64_MIN if none was saved
+    DbSelectNamesCallback::Names daily;
+    std::vector<int64_t> counts; // Empty if they were not known
+    int64_t weekSlot;     // First slot of the workstation view, INT64_MIN if none was saved
+    int64_t workstation;
+    DbSelectNamesCallback::Names week;
+};
+
+#endif // WSVIEWCACHE_H
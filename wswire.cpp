@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdexcept>
+
+#include "wswire.h"
+
+const int64_t WsWire::version = 2;
+const int WsWire::defaultPort = 47311;
+const size_t WsWire::maxFrame = 256 << 20; // A year of a busy week view is far below
+
+void WireWriter::putInt(int64_t value) {
+    uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+
+    while (zigzag >= 0x80) {
+        buffer.push_back(static_cast<char>((zigzag & 0x7F) | 0x80));
+        zigzag >>= 7;
+    }
+    buffer.push_back(static_cast<char>(zigzag));
+}
+
+void WireWriter::putBool(bool value) {
+    buffer.push_back(value ? 1 : 0);
+}
+
+void WireWriter::putString(const std::string &value) {
+    putString(value.c_str(), value.size());
+}
+
+void WireWriter::putString(const char *value, size_t len) {
+    putInt(static_cast<int64_t>(len));
+    buffer.append(value, len);
+}
+
+WireReader::WireReader(const std::string &data) :
+    data(data), pos(0) {
+}
+
+int64_t WireReader::getInt() {
+    uint64_t zigzag = 0;
+
+    for (unsigned shift = 0; ; shift += 7) {
+        if (pos >= data.size() || shift > 63)
+            throw std::runtime_error("Malformed broker message");
+
+        uint64_t byte = static_cast<unsigned char>(data[pos++]);
+        zigzag |= (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            break;
+    }
+
+    return static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+}
+
+bool WireReader::getBool() {
+    if (pos >= data.size())
+        throw std::runtime_error("Malformed broker message");
+
+    return data[pos++] != 0;
+}
+
+std::string WireReader::getString() {
+    size_t len = getCount();
+    std::string value(data, pos, len);
+    pos += len;
+
+    return value;
+}
+
+size_t WireReader::getCount() {
+    int64_t count = getInt();
+    if (count < 0 || static_cast<uint64_t>(count) > data.size() - pos)
+        throw std::runtime_error("Malformed broker message");
+
+    return static_cast<size_t>(count);
+}
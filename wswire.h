@@ -0,0 +1,100 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2020 Paul Maurer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef WSWIRE_H
+#define WSWIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Messages between ThreadedDb's broker link and the broker, see broker/wsbroker.cpp.
+//
+// Each message is one frame: a 4 byte little-endian payload length, then the payload. A payload
+// starts with its Message type. Integers are zigzag varints, so small values of either sign take
+// one byte, strings are a varint length followed by the bytes.
+//
+//  - MsgHello, client first: version. The broker answers with version and the file it serves.
+//  - MsgCommand: request id, refresh id, then the command as written by DbCommand::encode.
+//  - MsgReply: request id, then the callback as written by DbCallback::encode.
+//  - MsgChanges: complete, count, then seq, slotStart, slotStop and station of each change.
+//    Pushed to every client after changes were committed, complete is false if the log was
+//    pruned past what the clients have seen.
+class WsWire {
+public:
+    static const int64_t version;
+    static const int defaultPort;
+    static const size_t maxFrame; // bytes
+
+    enum Message {MsgHello = 1, MsgCommand = 2, MsgReply = 3, MsgChanges = 4};
+
+    // What a reply carries: nothing, an error for DbCommand::fail, or the command's own callback
+    enum Reply {ReplyPlain = 0, ReplyError = 1, ReplyResult = 2};
+
+    enum Command {
+        CmdNop = 1,
+        CmdOpen,
+        CmdClose,
+        CmdGetStationInfo,
+        CmdSetStationInfo,
+        CmdInsertName,
+        CmdSelectNames,
+        CmdPrefetchNames,
+        CmdSelectSlotCounts,
+        CmdSelectUsage,
+        CmdRemoveNames,
+        CmdSelectChanges,
+        CmdImport,
+        CmdExport
+    };
+};
+
+class WireWriter {
+public:
+    void putInt(int64_t value);
+    void putBool(bool value);
+    void putString(const std::string &value);
+    void putString(const char *value, size_t len);
+
+    const std::string &data() const {return buffer;}
+
+private:
+    std::string buffer;
+};
+
+// Throws std::runtime_error on a truncated or malformed payload
+class WireReader {
+public:
+    WireReader(const std::string &data);
+
+    int64_t getInt();
+    bool getBool();
+    std::string getString();
+    // Number of elements that follow, each at least one byte, so a bad count cannot exhaust memory
+    size_t getCount();
+
+private:
+    const std::string &data;
+    size_t pos;
+};
+
+#endif // WSWIRE_H